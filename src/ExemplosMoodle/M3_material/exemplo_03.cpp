@@ -5,183 +5,1511 @@
 #include <fstream>
 #include <sstream>
 #include <math.h>
+#include <vector>
+#include <atomic>
+#include "ppm_io.h"
+#include "ppm_stream.h"
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+#include "ppm_chain.h"
+#include "ppm_batch.h"
+#include "ppm_pam.h"
+#include "ppm_planar.h"
+#include "ppm_resample.h"
+#include "ppm_png.h"
+#include "ppm_cutout.h"
+#include "ppm_composite.h"
+#include "ppm_compare.h"
+
+/* Command line build:
+  g++ -std=c++17 -O2 -pthread -o exemplo_03 exemplo_03.cpp
+ */
 
 using namespace std;
 
-unsigned char *open(string file, int &width, int &height) {
-    ifstream arq(file);
-    char BUFFER[1024];
-    arq.getline(BUFFER, 1024);
-    char type = BUFFER[1];
-    cout << BUFFER << endl;
-    do {
-        arq.getline(BUFFER, 1024);
-        cout << "." << BUFFER << "." << endl;
-    } while (BUFFER[0] == '#');
-    stringstream sstr(BUFFER);
-    int w;
-    int h;
-    sstr >> w;
-    sstr >> h;
-    width = w;
-    height = h;
-    int maxValue;
-    arq >> maxValue;
-    cout << w << " X " << h << " mv: " << maxValue << endl; 
-    unsigned char *data = new unsigned char [w * h * 3];
-    if (type == '3') {
-        // modo texto
-        int j=0;
-        while (!arq.eof()) {
-            int g;
-            arq >> g;
-            data[j++] = (unsigned char)g;
-        }
-    } else { 
-        // modo binário
-        arq.read(reinterpret_cast<char*> (&data), sizeof(data));
-    }
-    arq.close();
-    return data;
-}
-
-void save(string file, unsigned char *data, int &w, int &h) {
-    ofstream arq(file);
-    arq << "P3" << endl;
-    arq << "#Gerado por chroma-key." << endl;
-    arq << w << " " << h << endl << "255" << endl;
-    int length = w * h * 3;
-    for (int i = 0; i < length; i++) {
-        arq << (int)data[i] << endl;
-    }    
-    arq.close();
-}
-
-double dist(int &r1, int &g1, int &b1, int &r2, int &g2, int &b2) {
-    double r = r1 - r2;
-    double g = g1 - g2;
-    double b = b1 - b2;
-    return sqrt(r*r + g*g + b*b);
-}
-
-void chromaKey(unsigned char *data, int w, int h) {
-    int r, g, b;
-    cout << "Cor-chave: " << endl;
+// Parâmetros de um filtro: lidos uma vez do usuário e depois aplicados
+// a quantas faixas de pixels forem necessárias.
+struct FilterParams {
+    int opt;        // 1-chroma-key, 2-gray-scale, 3-colorize, 4-negative,
+                    // 5-blur, 6-gaussian, 7-sharpen, 8-sobel,
+                    // 9-auto-levels, 10-contrast stretch, 11-equalize,
+                    // 12-median cut, 13-octree, 14-cutout,
+                    // 15-erode, 16-dilate, 17-open, 18-close, 19-median
+    int r, g, b;    // cor-chave (chroma-key) ou cor de base (colorize)
+    double t;       // tolerância do chroma-key/cutout (0..1), intensidade do sharpen
+                    // ou % ignorada nas pontas do histograma
+    bool simple;    // gray-scale por média aritmética ou paleta com pontilhado
+    double size;    // raio do blur e dos filtros de ordem, desvio do gaussian/sharpen, cores da paleta
+                    // ou área mínima do cutout
+};
+
+void askColor(int &r, int &g, int &b) {
     cout << "\tR: ";
     cin >> r;
     cout << "\tG: ";
     cin >> g;
     cout << "\tB: ";
     cin >> b;
+}
+
+FilterParams askFilter(int opt) {
+    FilterParams p = {};
+    p.opt = opt;
+    if (opt == 1 || opt == 14) {
+        cout << "Cor-chave: " << endl;
+        askColor(p.r, p.g, p.b);
+        cout << "% Tolerência (0..1): ";
+        cin >> p.t;
+        if (opt == 14) {
+            cout << "Área mínima de um componente (pixels): ";
+            cin >> p.size;
+        }
+    } else if (opt == 2) {
+        cout << "Média aritmética (S) ou ponderada? ";
+        char op;
+        cin >> op;
+        p.simple = (op == 'S') || (op == 's');
+    } else if (opt == 3) {
+        cout << "Cor de base: " << endl;
+        askColor(p.r, p.g, p.b);
+    } else if (opt == 5 || opt >= 15) {
+        cout << "Raio: ";
+        cin >> p.size;
+    } else if (opt == 6 || opt == 7) {
+        cout << "Desvio padrão (pixels): ";
+        cin >> p.size;
+        if (opt == 7) {
+            cout << "Intensidade (1 = normal): ";
+            cin >> p.t;
+        }
+    } else if (opt == 9 || opt == 10) {
+        cout << "% ignorada em cada ponta do histograma: ";
+        cin >> p.t;
+    } else if (opt == 12 || opt == 13) {
+        cout << "Número de cores (2..256): ";
+        cin >> p.size;
+        if (p.size < 2) p.size = 2;
+        if (p.size > 256) p.size = 256;
+        cout << "Pontilhado Floyd-Steinberg (S/N)? ";
+        char op;
+        cin >> op;
+        p.simple = (op == 'S') || (op == 's');
+    }
+    return p;
+}
+
+// O mesmo filtro como passo de uma cadeia (ppm_chain.h)
+PixelOp toPixelOp(const FilterParams &p) {
+    PixelOp op = {};
+    op.type = PIXEL_NEGATIVE;
+    switch(p.opt) {
+        case 1:
+            op.type = PIXEL_CHROMA_KEY;
+            op.r = clampColor(p.r);
+            op.g = clampColor(p.g);
+            op.b = clampColor(p.b);
+            op.thr = chromaKeyThreshold(p.t);
+            break;
+        case 2:  op.type = p.simple ? PIXEL_GRAY_MEAN : PIXEL_GRAY; break;
+        case 3:
+            op.type = PIXEL_COLORIZE;
+            op.r = p.r;
+            op.g = p.g;
+            op.b = p.b;
+            break;
+    }
+    return op;
+}
+
+NeighborhoodOp toNeighborhoodOp(const FilterParams &p) {
+    NeighborhoodOp op = { NEIGHBOR_SOBEL, (int)p.size, p.size, p.t };
+    switch(p.opt) {
+        case 5:  op.type = NEIGHBOR_BLUR; break;
+        case 6:  op.type = NEIGHBOR_GAUSSIAN; break;
+        case 7:  op.type = NEIGHBOR_SHARPEN; break;
+        case 15: op.type = NEIGHBOR_ERODE; break;
+        case 16: op.type = NEIGHBOR_DILATE; break;
+        case 17: op.type = NEIGHBOR_OPEN; break;
+        case 18: op.type = NEIGHBOR_CLOSE; break;
+        case 19: op.type = NEIGHBOR_MEDIAN; break;
+    }
+    return op;
+}
+
+HistogramOp toHistogramOp(const FilterParams &p) {
+    HistogramOp op = { HIST_EQUALIZE, p.t / 100.0 };
+    switch(p.opt) {
+        case 9:  op.type = HIST_LEVELS; break;
+        case 10: op.type = HIST_STRETCH; break;
+    }
+    return op;
+}
 
-    cout << "% Tolerência (0..1): ";
-    double t;
-    cin >> t;
-    
+PaletteOp toPaletteOp(const FilterParams &p) {
+    PaletteOp op = { p.opt == 13 ? PALETTE_OCTREE : PALETTE_MEDIAN_CUT, (int)p.size, p.simple };
+    return op;
+}
+
+CutoutOp toCutoutOp(const FilterParams &p) {
+    CutoutOp op = { clampColor(p.r), clampColor(p.g), clampColor(p.b), chromaKeyThreshold(p.t), (int)p.size };
+    return op;
+}
 
-    double dmax = 441.6729559301;
+// Modo interativo: um filtro só, escolhido por menu
+bool askChain(FilterChain &chain) {
+    int opt;
+    cout << "Qual opção de filtro você quer aplicar (1-chroma-key, 2-gray-scale, 3-colorize, 4-negative, "
+         << "5-blur, 6-gaussian, 7-sharpen, 8-sobel, 9-auto-levels, 10-contrast stretch, 11-equalize, "
+         << "12-median cut, 13-octree, 14-cutout, 15-erode, 16-dilate, 17-open, 18-close, 19-median)? ";
+    cin >> opt;
+    if ((opt < 1) || (opt > 19)) {
+        cout << "Opção inválida!!";
+        return false;
+    }
+    FilterParams p = askFilter(opt);
+    if (opt >= 15) {
+        chain.addNeighborhood(toNeighborhoodOp(p));
+    } else if (opt == 14) {
+        chain.addCutout(toCutoutOp(p));
+    } else if (opt >= 12) {
+        chain.addPalette(toPaletteOp(p));
+    } else if (opt >= 9) {
+        chain.addHistogram(toHistogramOp(p));
+    } else if (opt >= 5) {
+        chain.addNeighborhood(toNeighborhoodOp(p));
+    } else {
+        chain.ops.push_back(toPixelOp(p));
+    }
+    return true;
+}
+
+// Uma tabela de casos. Cada caso tem o caminho otimizado ('run') e uma
+// referência: uma implementação direta e independente ou, se não houver,
+// o próprio 'run'. A referência roda no nível escalar com 1 thread; 'run'
+// roda em cada nível SIMD até 'top', com as threads pedidas, e a saída tem
+// que sair igual byte a byte. A vazão é em MB/s da imagem de entrada.
+typedef void (*CheckFn)(const Image &img, vector<unsigned char> &out);
+
+struct SelfCheck {
+    const char *name;
+    CheckFn run;
+    CheckFn reference;
+    SimdLevel top;          // último nível com kernels próprios
+};
+
+// Filtros pontuais do menu (1 a 4)
+FilterParams pointwiseParams(int f) {
+    FilterParams p = {};
+    switch(f) {
+        case 0: p.opt = 1; p.g = 255; p.t = 0.4; break;
+        case 1: p.opt = 2; break;
+        case 2: p.opt = 2; p.simple = true; break;
+        case 3: p.opt = 3; p.r = 30; p.g = 40; p.b = 50; break;
+        case 4: p.opt = 4; break;
+    }
+    return p;
+}
+const int POINTWISE_FILTERS = 5;
+const char *pointwiseNames[POINTWISE_FILTERS] = { "chroma-key", "gray-scale (ponderada)", "gray-scale (média)", "colorize", "negative" };
+
+const int CHECK_RADIUS = 2;
+const char *CHECK_CHAIN = "gray:weighted,colorize:30,40,50,negative";
+const char *CHECK_FILE = "exemplo_03_self_check.qoic";
+
+template <int F>
+void checkPointwise(const Image &img, vector<unsigned char> &out) {
+    FilterChain chain;
+    chain.ops.push_back(toPixelOp(pointwiseParams(F)));
+    out.assign(img.data, img.data + img.bytes());
+    runChain(chain, out.data(), img.width, img.height);
+}
 
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
-        double d = dist(r, g, b, ri, gi, bi);
-        if (d/dmax < t) {
-            data[i] = 0;
-            data[i+1] = 0;
-            data[i+2] = 0;
+// Modos de rodar a mesma cadeia: compilada (tabelas), uma passada com
+// todos os passos como foram pedidos e uma passada por filtro.
+enum ChainMode { CHAIN_COMPILED, CHAIN_FUSED, CHAIN_PASSES };
+
+void runChainAs(ChainMode mode, const FilterChain &chain, unsigned char *data, int w, int h) {
+    if (mode != CHAIN_PASSES) {
+        runChain(chain, data, w, h);
+        return;
+    }
+    for (size_t i = 0; i < chain.ops.size(); i++) {
+        FilterChain single;
+        single.ops.push_back(chain.ops[i]);
+        runChain(single, data, w, h);
+    }
+}
+
+template <ChainMode MODE>
+void checkChain(const Image &img, vector<unsigned char> &out) {
+    FilterChain chain;
+    parseFilterChain(CHECK_CHAIN, chain);
+    if (MODE == CHAIN_COMPILED) compileChain(chain);
+    out.assign(img.data, img.data + img.bytes());
+    runChainAs(MODE, chain, out.data(), img.width, img.height);
+}
+
+// Blur direto, somando as 2R+1 amostras de cada pixel em cada direção:
+// referência para o box, com o mesmo arredondamento e as mesmas bordas.
+void directBlur(unsigned char *data, int w, int h, int radius) {
+    size_t rowBytes = (size_t)w * 3;
+    WindowDivisor div(2 * radius + 1);
+    vector<unsigned char> tmp(rowBytes * h);
+    parallelRows(w, h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *src = data + y * rowBytes;
+            unsigned char *dst = tmp.data() + y * rowBytes;
+            for (int x = 0; x < w; x++) {
+                for (int c = 0; c < 3; c++) {
+                    int sum = 0;
+                    for (int k = -radius; k <= radius; k++) sum += src[clampIndex(x + k, w) * 3 + c];
+                    dst[x * 3 + c] = div(sum);
+                }
+            }
         }
+    });
+    parallelRows(w, h, [&](int y0, int y1) {
+        vector<int> sum(rowBytes);
+        for (int y = y0; y < y1; y++) {
+            fill(sum.begin(), sum.end(), 0);
+            for (int k = -radius; k <= radius; k++) {
+                const unsigned char *src = tmp.data() + clampIndex(y + k, h) * rowBytes;
+                for (size_t i = 0; i < rowBytes; i++) sum[i] += src[i];
+            }
+            unsigned char *dst = data + y * rowBytes;
+            for (size_t i = 0; i < rowBytes; i++) dst[i] = div(sum[i]);
+        }
+    });
+}
+
+template <bool DIRECT>
+void checkBoxBlur(const Image &img, vector<unsigned char> &out) {
+    out.assign(img.data, img.data + img.bytes());
+    if (DIRECT) directBlur(out.data(), img.width, img.height, CHECK_RADIUS);
+    else boxBlur(out.data(), img.width, img.height, CHECK_RADIUS);
+}
+
+void checkGaussian(const Image &img, vector<unsigned char> &out) {
+    out.assign(img.data, img.data + img.bytes());
+    gaussianBlur(out.data(), img.width, img.height, CHECK_RADIUS);
+}
+
+void checkSharpen(const Image &img, vector<unsigned char> &out) {
+    out.assign(img.data, img.data + img.bytes());
+    sharpen(out.data(), img.width, img.height, CHECK_RADIUS, 1.0);
+}
+
+void checkSobel(const Image &img, vector<unsigned char> &out) {
+    out.assign(img.data, img.data + img.bytes());
+    sobel(out.data(), img.width, img.height);
+}
+
+// Mínimo, máximo ou mediana direto, ordenando as (2R+1)² amostras de cada
+// pixel: referência para os filtros de ordem, com as mesmas bordas.
+void directRank(unsigned char *data, int w, int h, int radius, NeighborhoodType type) {
+    size_t rowBytes = (size_t)w * 3;
+    vector<unsigned char> src(data, data + rowBytes * h);
+    parallelRows(w, h, [&](int y0, int y1) {
+        vector<unsigned char> window;
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < w; x++) {
+                for (int c = 0; c < 3; c++) {
+                    window.clear();
+                    for (int dy = -radius; dy <= radius; dy++) {
+                        const unsigned char *row = src.data() + clampIndex(y + dy, h) * rowBytes;
+                        for (int dx = -radius; dx <= radius; dx++) window.push_back(row[clampIndex(x + dx, w) * 3 + c]);
+                    }
+                    sort(window.begin(), window.end());
+                    size_t at = type == NEIGHBOR_ERODE ? 0 : (type == NEIGHBOR_DILATE ? window.size() - 1 : window.size() / 2);
+                    data[y * rowBytes + x * 3 + c] = window[at];
+                }
+            }
+        }
+    });
+}
+
+template <NeighborhoodType T, bool DIRECT>
+void checkRank(const Image &img, vector<unsigned char> &out) {
+    NeighborhoodOp op = { T, CHECK_RADIUS, 0.0, 0.0 };
+    out.assign(img.data, img.data + img.bytes());
+    if (DIRECT) directRank(out.data(), img.width, img.height, CHECK_RADIUS, T);
+    else applyNeighborhood(op, out.data(), img.width, img.height);
+}
+
+// Contagem por thread contra um laço simples
+template <bool DIRECT>
+void checkHistogram(const Image &img, vector<unsigned char> &out) {
+    uint32_t counts[3][256] = {};
+    if (DIRECT) {
+        for (size_t i = 0; i < img.bytes(); i += 3) {
+            for (int c = 0; c < 3; c++) counts[c][img.data[i + c]]++;
+        }
+    } else {
+        Histogram hist = computeHistogram(img.data, img.width, img.height);
+        memcpy(counts, hist.counts, sizeof(counts));
+    }
+    out.assign((unsigned char *)counts, (unsigned char *)counts + sizeof(counts));
+}
+
+// auto-levels, contrast stretch ou equalize como único passo da cadeia
+void runHistogramFilter(HistogramType type, unsigned char *data, int w, int h) {
+    FilterChain chain;
+    HistogramOp op = { type, 0.005 };
+    chain.addHistogram(op);
+    compileChain(chain);
+    runChain(chain, data, w, h);
+}
+
+// Os três filtros por histograma, um depois do outro na saída
+void checkHistogramFilters(const Image &img, vector<unsigned char> &out) {
+    size_t bytes = img.bytes();
+    out.resize(bytes * 3);
+    for (int f = 0; f < 3; f++) {
+        memcpy(out.data() + bytes * f, img.data, bytes);
+        runHistogramFilter((HistogramType)f, out.data() + bytes * f, img.width, img.height);
+    }
+}
+
+// median cut e octree, com e sem pontilhado: o pontilhado em frente
+// diagonal tem que dar o mesmo resultado com qualquer número de threads
+void checkPalette(const Image &img, vector<unsigned char> &out) {
+    size_t bytes = img.bytes();
+    out.resize(bytes * 4);
+    for (int f = 0; f < 4; f++) {
+        PaletteOp op = { f < 2 ? PALETTE_MEDIAN_CUT : PALETTE_OCTREE, 256, f % 2 == 1 };
+        memcpy(out.data() + bytes * f, img.data, bytes);
+        applyPalette(op, out.data() + bytes * f, img.width, img.height);
     }
 }
 
-void grayScale(unsigned char *data, int w, int h) {
-    cout << "Média aritmética (S) ou ponderada? ";
-    char op;
-    cin >> op;
-    double rw, gw, bw;
-    if ((op == 'S') || (op == 's')) {
-        rw = gw = bw = 1.0/3.0;
+// máscara, limpeza e RGBA
+void checkCutout(const Image &img, vector<unsigned char> &out) {
+    CutoutOp op = { 0, 255, 0, chromaKeyThreshold(0.4), CUTOUT_MIN_AREA };
+    size_t n = (size_t)img.width * img.height;
+    vector<unsigned char> mask(n);
+    out.resize(n * 4);
+    keyMask(img.data, img.width, img.height, op, mask.data());
+    cleanMask(mask.data(), img.width, img.height, op.minArea);
+    cutoutRGBA(img.data, img.width, img.height, mask.data(), out.data());
+}
+
+// a*b/255 em ponto fixo contra a divisão, para todos os pares
+template <bool DIRECT>
+void checkMul255(const Image &, vector<unsigned char> &out) {
+    out.resize(256 * 256);
+    for (unsigned a = 0; a < 256; a++) {
+        for (unsigned b = 0; b < 256; b++) out[a * 256 + b] = (unsigned char)(DIRECT ? (a * b * 2 + 255) / 510 : mul255(a, b));
+    }
+}
+
+// A imagem opaca em RGBA, como fundo da composição
+vector<unsigned char> opaqueCanvas(const Image &img) {
+    size_t n = (size_t)img.width * img.height;
+    vector<unsigned char> canvas(n * 4);
+    for (size_t i = 0; i < n; i++) {
+        memcpy(&canvas[i * 4], img.data + i * 3, 3);
+        canvas[i * 4 + 3] = 255;
+    }
+    return canvas;
+}
+
+// Camada de meia tela no centro: a imagem com alfa crescendo para a
+// direita e para baixo
+Layer gradientSprite(const Image &img) {
+    Layer sprite;
+    sprite.width = max(img.width / 2, 1);
+    sprite.height = max(img.height / 2, 1);
+    sprite.x = img.width / 4;
+    sprite.y = img.height / 4;
+    sprite.rgba.resize((size_t)sprite.width * sprite.height * 4);
+    for (int y = 0; y < sprite.height; y++) {
+        for (int x = 0; x < sprite.width; x++) {
+            unsigned char *p = &sprite.rgba[((size_t)y * sprite.width + x) * 4];
+            memcpy(p, img.data + ((size_t)y * img.width + x) * 3, 3);
+            p[3] = (unsigned char)((x + y) * 255 / (sprite.width + sprite.height));
+        }
+    }
+    premultiply(sprite.rgba.data(), (size_t)sprite.width * sprite.height);
+    return sprite;
+}
+
+// 4 camadas de tela cheia, deslocadas, com alfa variado e modos diferentes
+vector<Layer> layerStack(const Image &img) {
+    size_t n = (size_t)img.width * img.height;
+    vector<Layer> stack(4);
+    const CompositeMode modes[4] = { COMP_SRC_OVER, COMP_SRC_ATOP, COMP_DST_OVER, COMP_XOR };
+    for (int i = 0; i < 4; i++) {
+        stack[i].width = img.width;
+        stack[i].height = img.height;
+        stack[i].mode = modes[i];
+        stack[i].rgba.resize(n * 4);
+        for (size_t p = 0; p < n; p++) {
+            memcpy(&stack[i].rgba[p * 4], img.data + ((p + n / 4 * i) % n) * 3, 3);
+            stack[i].rgba[p * 4 + 3] = (unsigned char)(p * 7 + i * 64);
+        }
+        premultiply(stack[i].rgba.data(), n);
+    }
+    return stack;
+}
+
+// Cada operador de Porter-Duff com gradientSprite() sobre a imagem opaca
+void checkPorterDuff(const Image &img, vector<unsigned char> &out) {
+    Layer sprite = gradientSprite(img);
+    vector<unsigned char> canvas = opaqueCanvas(img);
+    out.clear();
+    for (int m = 0; m < COMP_MODES; m++) {
+        vector<unsigned char> work = canvas;
+        sprite.mode = (CompositeMode)m;
+        compositeLayer(work.data(), img.width, img.height, sprite);
+        out.insert(out.end(), work.begin(), work.end());
+    }
+}
+
+// layerStack() em blocos contra uma camada por vez
+template <bool ONE_BY_ONE>
+void checkLayers(const Image &img, vector<unsigned char> &out) {
+    vector<Layer> stack = layerStack(img);
+    out = opaqueCanvas(img);
+    if (ONE_BY_ONE) {
+        for (size_t i = 0; i < stack.size(); i++) compositeLayer(out.data(), img.width, img.height, stack[i]);
     } else {
-        rw = 0.2125; 
-        gw = 0.7154;
-        bw = 0.0721;
+        compositeLayers(out.data(), img.width, img.height, stack);
     }
+}
 
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
+// Cada filtro reduzindo à metade e ampliando ao dobro
+void checkResize(const Image &img, vector<unsigned char> &out) {
+    const double factors[] = { 0.5, 2.0 };
+    out.clear();
+    for (int f = RESAMPLE_BOX; f <= RESAMPLE_LANCZOS3; f++) {
+        for (int i = 0; i < 2; i++) {
+            int outW = max((int)(img.width * factors[i]), 1), outH = max((int)(img.height * factors[i]), 1);
+            Image work(outW, outH);
+            resampleImage(img.data, img.width, img.height, work.data, outW, outH, (ResampleFilter)f);
+            out.insert(out.end(), work.data, work.data + work.bytes());
+        }
+    }
+}
 
-        data[i] = data[i+1] = data[i+2] = (int)(ri * rw + gi * gw + bi * bw);
+// A imagem de 8 bits em planos de 16 bits com maxValue 255
+PlanarImage planarFromImage(const Image &img) {
+    PlanarImage x;
+    x.allocate(img.width, img.height);
+    x.depth = 3;
+    x.maxValue = 255;
+    size_t n = x.pixels();
+    for (size_t i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++) x.planes[c][i] = img.data[i * 3 + c];
+        x.planes[3][i] = 255;
     }
+    return x;
 }
 
-void colorize(unsigned char *data, int w, int h) {
-    int r, g, b;
-    cout << "Cor de base: " << endl;
-    cout << "\tR: ";
-    cin >> r;
-    cout << "\tG: ";
-    cin >> g;
-    cout << "\tB: ";
-    cin >> b;
-    
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
+// Cópia de 'x' com um ruído fixo de -4..4 em cada amostra de cor
+PlanarImage slightlyAltered(const PlanarImage &x) {
+    PlanarImage y = x;
+    for (size_t i = 0; i < x.pixels(); i++) {
+        for (int c = 0; c < 3; c++) {
+            int v = x.planes[c][i] + (int)((i * 7919 + c * 31) % 9) - 4;
+            y.planes[c][i] = (uint16_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+    return y;
+}
+
+// A imagem contra slightlyAltered(): somas das diferenças e SSIM
+// (arredondado a 1e-6) iguais às do escalar com 1 thread
+void checkCompare(const Image &img, vector<unsigned char> &out) {
+    PlanarImage x = planarFromImage(img), y = slightlyAltered(x);
+    CompareResult res = compareImages(x, y);
+    int64_t values[3][4];
+    for (int c = 0; c < 3; c++) {
+        values[c][0] = (int64_t)res.diff[c].sumSq;
+        values[c][1] = (int64_t)res.diff[c].sumAbs;
+        values[c][2] = (int64_t)res.diff[c].maxAbs;
+        values[c][3] = llround(res.ssim[c] * 1e6);
+    }
+    out.assign((unsigned char *)values, (unsigned char *)values + sizeof(values));
+}
 
-        data[i]   = ri | r;
-        data[i+1] = gi | g;
-        data[i+2] = bi | b;
+// Cada filtro pontual sobre os planos; a saída são os quatro planos
+void checkPlanar(const Image &img, vector<unsigned char> &out) {
+    PlanarImage src = planarFromImage(img);
+    out.clear();
+    for (int f = 0; f < POINTWISE_FILTERS; f++) {
+        vector<PixelOp> ops(1, toPixelOp(pointwiseParams(f)));
+        PlanarImage work = src;
+        runPlanarOps(ops, work);
+        for (int c = 0; c < 4; c++) {
+            const unsigned char *p = (const unsigned char *)work.planes[c].data();
+            out.insert(out.end(), p, p + work.planes[c].size() * sizeof(uint16_t));
+        }
     }
 }
 
-void negative(unsigned char *data, int w, int h) {
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
+// Cadeias com vizinhança e histograma: com maxValue 255 os planos têm que
+// dar os mesmos bytes que o caminho de 8 bits.
+const char *PLANAR_CHAINS[] = {
+    "levels,gray:weighted,colorize:30,40,50,blur:2,gauss:1.5,sharpen:1,equalize,negative",
+    "stretch,sobel,negative",
+    "gauss:1,cutout:0,255,0,0.4,negative",
+    "open:2,dilate:3,close:1,erode:1,negative",
+};
 
-        data[i]   = ri ^ 255;
-        data[i+1] = gi ^ 255;
-        data[i+2] = bi ^ 255;
+template <int C, bool PLANAR>
+void checkPlanarChain(const Image &img, vector<unsigned char> &out) {
+    FilterChain chain;
+    parseFilterChain(PLANAR_CHAINS[C], chain);
+    out.assign(img.data, img.data + img.bytes());
+    if (!PLANAR) {
+        compileChain(chain);
+        runChain(chain, out.data(), img.width, img.height);
+        return;
+    }
+    PlanarImage work = planarFromImage(img);
+    runPlanarChain(chain, work);
+    for (size_t i = 0; i < work.pixels(); i++) {
+        for (int c = 0; c < 3; c++) out[i * 3 + c] = (unsigned char)work.planes[c][i];
     }
 }
 
-int main() {
-    string file;
-    
-    // AQUI PRA LER DO USUÁRIO O NOME DO ARQUIVO
-    // cout << "Digite caminho para o arquivo da imagem de entrada: ";
-    // getline(cin, file);
-    file = "../src/ExemplosMoodle/M3_material/M3_exemplo1.ppm";
+// QOIC gravado e lido de volta tem que ser a própria imagem
+template <bool DIRECT>
+void checkQOIC(const Image &img, vector<unsigned char> &out) {
+    out.clear();
+    Image back;
+    if (DIRECT) {
+        out.assign(img.data, img.data + img.bytes());
+    } else if (writeQOIC(CHECK_FILE, img.data, img.width, img.height, 3, threadPool()) && openPPM(CHECK_FILE, back)) {
+        out.assign(back.data, back.data + back.bytes());
+    }
+    remove(CHECK_FILE);
+}
 
-    int w, h;
-    unsigned char *data = open(file, w, h);
-    // cout << ((int)data[0]) << "..." << ((int)data[w * h * 3 - 1]) << endl;
+const SelfCheck SELF_CHECKS[] = {
+    { "chroma-key",                 checkPointwise<0>, NULL, SIMD_AVX512VBMI },
+    { "gray-scale (ponderada)",     checkPointwise<1>, NULL, SIMD_AVX512VBMI },
+    { "gray-scale (média)",         checkPointwise<2>, NULL, SIMD_AVX512VBMI },
+    { "colorize",                   checkPointwise<3>, NULL, SIMD_AVX512VBMI },
+    { "negative",                   checkPointwise<4>, NULL, SIMD_AVX512VBMI },
+    { "cadeia em uma passada",      checkChain<CHAIN_FUSED>, checkChain<CHAIN_PASSES>, SIMD_AVX512VBMI },
+    { "cadeia compilada",           checkChain<CHAIN_COMPILED>, checkChain<CHAIN_PASSES>, SIMD_AVX512VBMI },
+    { "box blur",                   checkBoxBlur<false>, checkBoxBlur<true>, SIMD_SSSE3 },
+    { "gaussiano",                  checkGaussian, NULL, SIMD_SSSE3 },
+    { "sharpen",                    checkSharpen, NULL, SIMD_SSSE3 },
+    { "sobel",                      checkSobel, NULL, SIMD_SSSE3 },
+    { "erode",                      checkRank<NEIGHBOR_ERODE, false>, checkRank<NEIGHBOR_ERODE, true>, SIMD_SSSE3 },
+    { "dilate",                     checkRank<NEIGHBOR_DILATE, false>, checkRank<NEIGHBOR_DILATE, true>, SIMD_SSSE3 },
+    { "median",                     checkRank<NEIGHBOR_MEDIAN, false>, checkRank<NEIGHBOR_MEDIAN, true>, SIMD_SSSE3 },
+    { "contagem do histograma",     checkHistogram<false>, checkHistogram<true>, SIMD_SCALAR },
+    { "levels, stretch, equalize",  checkHistogramFilters, NULL, SIMD_AVX512VBMI },
+    { "paletas (256 cores)",        checkPalette, NULL, SIMD_SCALAR },
+    { "recorte",                    checkCutout, NULL, SIMD_AVX2 },
+    { "a*b/255 em ponto fixo",      checkMul255<false>, checkMul255<true>, SIMD_SCALAR },
+    { "Porter-Duff",                checkPorterDuff, NULL, SIMD_AVX2 },
+    { "4 camadas em blocos",        checkLayers<false>, checkLayers<true>, SIMD_AVX2 },
+    { "comparação (PSNR/SSIM)",     checkCompare, NULL, SIMD_AVX2 },
+    { "redimensionamento",          checkResize, NULL, SIMD_AVX2 },
+    { "planos de 16 bits",          checkPlanar, NULL, SIMD_AVX2 },
+    { "QOIC gravado e lido",        checkQOIC<false>, checkQOIC<true>, SIMD_SCALAR },
+    { "cadeia planar",              checkPlanarChain<0, true>, checkPlanarChain<0, false>, SIMD_AVX2 },
+    { "cadeia planar com sobel",    checkPlanarChain<1, true>, checkPlanarChain<1, false>, SIMD_AVX2 },
+    { "cadeia planar com recorte",  checkPlanarChain<2, true>, checkPlanarChain<2, false>, SIMD_AVX2 },
+    { "cadeia planar com abertura", checkPlanarChain<3, true>, checkPlanarChain<3, false>, SIMD_SSSE3 },
+};
 
+// Roda a tabela inteira; falso se algum caso saiu diferente da referência.
+// Os níveis SIMD vão até o atual (ver --simd).
+bool selfCheck(const Image &img, int threads, int rounds) {
+    SimdLevel chosen = simdLevel();
+    double mb = img.bytes() * rounds / (1024.0 * 1024.0);
+    vector<unsigned char> expected, out;
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(SELF_CHECKS) / sizeof(SELF_CHECKS[0]); i++) {
+        const SelfCheck &check = SELF_CHECKS[i];
+        simdLevel() = SIMD_SCALAR;
+        setThreads(1);
+        (check.reference ? check.reference : check.run)(img, expected);
+        setThreads(threads);
+        int top = check.top < chosen ? check.top : chosen;
+        for (int level = SIMD_SCALAR; level <= top; level++) {
+            simdLevel() = (SimdLevel)level;
+            double seconds = 0;
+            for (int k = 0; k < rounds; k++) {
+                Stopwatch t;
+                check.run(img, out);
+                seconds += t.seconds();
+            }
+            bool same = out == expected;
+            if (!same) failures++;
+            printf("%-28s %-10s %8.1f MB/s %s\n", check.name, simdLevelName((SimdLevel)level), mb / seconds,
+                   same ? "" : "DIFERENTE DA REFERÊNCIA");
+        }
+    }
+    simdLevel() = chosen;
+    if (failures > 0) fprintf(stderr, "%d verificação(ões) com resultado diferente\n", failures);
+    return failures == 0;
+}
 
-    int opt;
-    cout << "Qual opção de filtro você quer aplicar (1-chroma-key, 2-gray-scale, 3-colorize, 4-negative)? ";
-    cin >> opt;
+// Medições que não cabem no --self-check: como a vazão muda com um
+// parâmetro (threads, raio, ...). Cada uma imprime a própria tabela.
+struct BenchOptions {
+    int threads;            // máximo de threads (--threads)
+    const FilterChain *chain;   // --chain ou CHECK_CHAIN
+    string outFile;         // base dos arquivos temporários de "save"
+};
+
+typedef void (*BenchFn)(const Image &img, const BenchOptions &opt);
+
+struct Benchmark {
+    const char *name;
+    BenchFn run;
+};
 
-    switch(opt) {
-        case 1:  chromaKey(data, w, h); break;
-        case 2:  grayScale(data, w, h); break;
-        case 3:  colorize(data, w, h);  break;
-        case 4:  negative(data, w, h);  break;
-        default: cout << "Opção inválida!!";
+// Escalabilidade: cada filtro com 1..N threads, em MB/s e em aceleração
+// sobre 1 thread. Use uma imagem grande (bem maior que a L3) para medir o
+// limite de banda de memória.
+void benchThreads(const Image &img, const BenchOptions &opt) {
+    const int rounds = 20;
+    size_t bytes = img.bytes();
+    vector<unsigned char> work(img.data, img.data + bytes);
+    double base[POINTWISE_FILTERS];
+
+    printf("%-8s", "threads");
+    for (int f = 0; f < POINTWISE_FILTERS; f++) printf(" %24s", pointwiseNames[f]);
+    printf("\n");
+    for (int t = 1; t <= opt.threads; t++) {
+        setThreads(t);
+        printf("%-8d", t);
+        for (int f = 0; f < POINTWISE_FILTERS; f++) {
+            // os kernels não têm desvios que dependam dos pixels, então
+            // reaplicar sobre o resultado custa o mesmo e não é preciso
+            // recopiar a imagem a cada rodada
+            FilterChain chain;
+            chain.ops.push_back(toPixelOp(pointwiseParams(f)));
+            runChain(chain, work.data(), img.width, img.height);
+            Stopwatch sw;
+            for (int k = 0; k < rounds; k++) {
+                runChain(chain, work.data(), img.width, img.height);
+            }
+            double rate = bytes * rounds / (1024.0 * 1024.0) / sw.seconds();
+            if (t == 1) base[f] = rate;
+            printf(" %10.1f MB/s (%5.2fx)", rate, rate / base[f]);
+        }
+        printf("\n");
     }
+    setThreads(opt.threads);
+}
 
-    if ((opt > 0) && (opt < 5)){
-        save("../src/ExemplosMoodle/M3_material/output.ppm", data, w, h);
+// Cadeia (--chain ou a padrão) compilada, em uma passada sem compilar e
+// com uma passada por filtro, com uma cópia simples da imagem como teto de
+// banda. A conferência dos resultados fica no --self-check.
+void benchChain(const Image &img, const BenchOptions &opt) {
+    if (!opt.chain->isPointwise()) {
+        fprintf(stderr, "--bench chain compara só cadeias de filtros pontuais\n");
+        return;
+    }
+    const int rounds = 20;
+    size_t bytes = img.bytes();
+    vector<unsigned char> work(bytes);
+    double mb = bytes * rounds / (1024.0 * 1024.0);
+    FilterChain compiled = *opt.chain;
+    compileChain(compiled);
+    int n = (int)opt.chain->ops.size();
+
+    Stopwatch t;
+    for (int k = 0; k < rounds; k++) memcpy(work.data(), img.data, bytes);
+    printf("memcpy:                       %8.1f MB/s\n", mb / t.seconds());
+
+    const char *names[3] = { "compilada", "uma passada", "uma por filtro" };
+    for (int mode = CHAIN_COMPILED; mode <= CHAIN_PASSES; mode++) {
+        const FilterChain &chain = mode == CHAIN_COMPILED ? compiled : *opt.chain;
+        double seconds = 0;
+        for (int k = 0; k < rounds; k++) {
+            memcpy(work.data(), img.data, bytes);
+            Stopwatch sw;
+            runChainAs((ChainMode)mode, chain, work.data(), img.width, img.height);
+            seconds += sw.seconds();
+        }
+        printf("%d filtros, %-16s %8.1f MB/s\n", n, names[mode], mb / seconds);
+    }
+    printf("%d passo(s) depois de compilar\n", (int)compiled.compiled.size());
+}
+
+// Vazão por raio: o box e o gaussiano (três boxes) devem ficar quase
+// constantes; o direto cai na proporção do raio, então roda menos vezes
+// nos raios grandes.
+void benchBlur(const Image &img, const BenchOptions &) {
+    const int rounds = 10;
+    size_t bytes = img.bytes();
+    vector<unsigned char> work(bytes);
+    double mb = bytes * rounds / (1024.0 * 1024.0);
+    const int radii[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+    printf("%-6s %16s %16s %16s\n", "raio", "box", "gaussiano (3x)", "direto");
+    for (size_t i = 0; i < sizeof(radii) / sizeof(radii[0]); i++) {
+        int radius = radii[i];
+        double seconds[3] = { 0, 0, 0 };
+        for (int k = 0; k < rounds; k++) {
+            memcpy(work.data(), img.data, bytes);
+            Stopwatch t;
+            boxBlur(work.data(), img.width, img.height, radius);
+            seconds[0] += t.seconds();
+        }
+        for (int k = 0; k < rounds; k++) {
+            memcpy(work.data(), img.data, bytes);
+            Stopwatch t;
+            gaussianBlur(work.data(), img.width, img.height, radius);
+            seconds[1] += t.seconds();
+        }
+        printf("%-6d %11.1f MB/s %11.1f MB/s", radius, mb / seconds[0], mb / seconds[1]);
+        int directRounds = rounds / radius > 0 ? rounds / radius : 1;
+        for (int k = 0; k < directRounds; k++) {
+            memcpy(work.data(), img.data, bytes);
+            Stopwatch t;
+            directBlur(work.data(), img.width, img.height, radius);
+            seconds[2] += t.seconds();
+        }
+        printf(" %11.1f MB/s\n", bytes * directRounds / (1024.0 * 1024.0) / seconds[2]);
+    }
+}
+
+// Erosão, dilatação e mediana com raios crescentes: a vazão não deve cair
+// com o raio. O direto, que ordena a janela, só roda até o raio 4; a
+// conferência dos resultados fica no --self-check.
+void benchMorphology(const Image &img, const BenchOptions &) {
+    const int rounds = 5;
+    size_t bytes = img.bytes();
+    vector<unsigned char> work(bytes);
+    double mb = bytes * rounds / (1024.0 * 1024.0);
+    const int radii[] = { 1, 2, 4, 8, 16, 32, 64, 127 };
+    const NeighborhoodType types[3] = { NEIGHBOR_ERODE, NEIGHBOR_DILATE, NEIGHBOR_MEDIAN };
+
+    printf("%-6s %16s %16s %16s %16s\n", "raio", "erode", "dilate", "median", "median direta");
+    for (size_t i = 0; i < sizeof(radii) / sizeof(radii[0]); i++) {
+        int radius = radii[i];
+        printf("%-6d", radius);
+        for (int t = 0; t < 3; t++) {
+            NeighborhoodOp op = { types[t], radius, 0.0, 0.0 };
+            double seconds = 0;
+            for (int k = 0; k < rounds; k++) {
+                memcpy(work.data(), img.data, bytes);
+                Stopwatch sw;
+                applyNeighborhood(op, work.data(), img.width, img.height);
+                seconds += sw.seconds();
+            }
+            printf(" %11.1f MB/s", mb / seconds);
+        }
+        if (radius <= 4) {
+            memcpy(work.data(), img.data, bytes);
+            Stopwatch sw;
+            directRank(work.data(), img.width, img.height, radius, NEIGHBOR_MEDIAN);
+            printf(" %11.1f MB/s", bytes / (1024.0 * 1024.0) / sw.seconds());
+        }
+        printf("\n");
     }
-    
-    delete [] data;
+}
+
+// Contagem com um histograma só, compartilhado por todas as threads com
+// incrementos atômicos: a referência que os histogramas por thread evitam.
+void sharedHistogram(const unsigned char *data, int w, int h, vector<atomic<uint32_t>> &counts) {
+    parallelRows(w, h, [&](int y0, int y1) {
+        const unsigned char *p = data + (size_t)y0 * w * 3;
+        size_t n = (size_t)(y1 - y0) * w;
+        for (size_t i = 0; i < n; i++, p += 3) {
+            counts[p[0]].fetch_add(1, memory_order_relaxed);
+            counts[256 + p[1]].fetch_add(1, memory_order_relaxed);
+            counts[512 + p[2]].fetch_add(1, memory_order_relaxed);
+        }
+    });
+}
+
+// Contagem por thread contra a compartilhada, de 1 a N threads, e cada
+// filtro por histograma completo (contagem + tabela), em ms por quadro.
+void benchHistogram(const Image &img, const BenchOptions &opt) {
+    const int rounds = 20;
+    double mb = img.bytes() / (1024.0 * 1024.0);
+    vector<atomic<uint32_t>> shared(768);
+
+    printf("%-8s %26s %26s\n", "threads", "por thread", "atômica");
+    for (int t = 1; t <= opt.threads; t++) {
+        setThreads(t);
+        Stopwatch tp;
+        for (int k = 0; k < rounds; k++) computeHistogram(img.data, img.width, img.height);
+        double ms = tp.seconds() * 1000.0 / rounds;
+        double sharedMs = 0;
+        for (int k = 0; k < rounds; k++) {
+            for (size_t i = 0; i < shared.size(); i++) shared[i] = 0;
+            Stopwatch ts;
+            sharedHistogram(img.data, img.width, img.height, shared);
+            sharedMs += ts.seconds() * 1000.0;
+        }
+        sharedMs /= rounds;
+        printf("%-8d %8.2f ms %10.1f MB/s %8.2f ms %10.1f MB/s\n", t, ms, mb / ms * 1000.0,
+               sharedMs, mb / sharedMs * 1000.0);
+    }
+    setThreads(opt.threads);
+
+    vector<unsigned char> work(img.bytes());
+    const char *names[3] = { "auto-levels", "contrast stretch", "equalize" };
+    for (int f = 0; f < 3; f++) {
+        double seconds = 0;
+        for (int k = 0; k < rounds; k++) {
+            memcpy(work.data(), img.data, img.bytes());
+            Stopwatch tf;
+            runHistogramFilter((HistogramType)f, work.data(), img.width, img.height);
+            seconds += tf.seconds();
+        }
+        printf("%-20s %8.2f ms %10.1f MB/s\n", names[f], seconds * 1000.0 / rounds, mb * rounds / seconds);
+    }
+}
+
+// Reduz à metade e amplia ao dobro com cada filtro; a vazão é em pixels
+// de saída.
+void benchResize(const Image &img, const BenchOptions &) {
+    const int rounds = 10;
+    const double factors[] = { 0.5, 2.0 };
+    for (int f = RESAMPLE_BOX; f <= RESAMPLE_LANCZOS3; f++) {
+        for (int i = 0; i < 2; i++) {
+            int outW = max((int)(img.width * factors[i]), 1), outH = max((int)(img.height * factors[i]), 1);
+            Image work(outW, outH);
+            double seconds = 0;
+            for (int k = 0; k < rounds; k++) {
+                Stopwatch t;
+                resampleImage(img.data, img.width, img.height, work.data, outW, outH, (ResampleFilter)f);
+                seconds += t.seconds();
+            }
+            printf("%-9s %5dx%-5d %8.2f ms %8.1f Mpixels/s\n", resampleFilterName((ResampleFilter)f), outW, outH,
+                   seconds * 1000.0 / rounds, (double)outW * outH * rounds / seconds / 1e6);
+        }
+    }
+}
+
+// Grava a imagem em P3, P6, PNG e QOIC ao lado de 'outFile' e compara
+// tempo e tamanho; o QOIC também é lido de volta (a igualdade é conferida
+// no --self-check). Os arquivos são apagados no fim.
+void benchSave(const Image &img, const BenchOptions &opt) {
+    const int rounds = 5;
+    const char *names[4] = { "P3", "P6", "PNG", "QOIC" };
+    const char *suffixes[4] = { ".p3.ppm", ".p6.ppm", ".png", ".qoic" };
+    double mb = img.bytes() * rounds / (1024.0 * 1024.0);
+    for (int k = 0; k < 4; k++) {
+        string file = opt.outFile + suffixes[k];
+        double seconds = 0;
+        bool ok = true;
+        for (int r = 0; r < rounds && ok; r++) {
+            Stopwatch t;
+            ok = saveImage(file, img, k == 0);
+            seconds += t.seconds();
+        }
+        FILE *f = fopen(file.c_str(), "rb");
+        long size = 0;
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            size = ftell(f);
+            fclose(f);
+        }
+        if (ok) {
+            printf("%-4s %10ld bytes (%5.1f%% do P6) %8.2f ms %8.1f MB/s\n", names[k], size,
+                   100.0 * size / (img.bytes() + 15), seconds * 1000.0 / rounds, mb / seconds);
+        }
+        if (ok && k == 3) {
+            double readSeconds = 0;
+            for (int r = 0; r < rounds && ok; r++) {
+                Image back;
+                Stopwatch t;
+                ok = openPPM(file, back);
+                readSeconds += t.seconds();
+            }
+            if (ok) {
+                printf("%-4s leitura %24s %8.2f ms %8.1f MB/s\n", names[k], "", readSeconds * 1000.0 / rounds,
+                       mb / readSeconds);
+            }
+        }
+        remove(file.c_str());
+    }
+}
+
+// Paleta por median cut e por octree, mapeada direto e com pontilhado,
+// com 1..N threads. O pontilhado avança em frente diagonal, então a
+// aceleração depende da altura; o resultado é conferido no --self-check.
+void benchPalette(const Image &img, const BenchOptions &opt) {
+    const int rounds = 5;
+    size_t bytes = img.bytes();
+    double mb = bytes * rounds / (1024.0 * 1024.0);
+    Image work(img.width, img.height);
+    const char *names[4] = { "median cut", "median cut + FS", "octree", "octree + FS" };
+    for (int f = 0; f < 4; f++) {
+        PaletteOp op = { f < 2 ? PALETTE_MEDIAN_CUT : PALETTE_OCTREE, 256, f % 2 == 1 };
+        double base = 0;
+        for (int t = 1; t <= opt.threads; t++) {
+            setThreads(t);
+            double seconds = 0;
+            for (int k = 0; k < rounds; k++) {
+                memcpy(work.data, img.data, bytes);
+                Stopwatch sw;
+                applyPalette(op, work.data, img.width, img.height);
+                seconds += sw.seconds();
+            }
+            double rate = mb / seconds;
+            if (t == 1) base = rate;
+            printf("%-16s %2d thread(s) %8.2f ms %8.1f MB/s (%5.2fx)\n", names[f], t, seconds * 1000.0 / rounds,
+                   rate, rate / base);
+        }
+    }
+    setThreads(opt.threads);
+}
+
+// Recorte em cada etapa (máscara, limpeza, RGBA) com 1..N threads, em
+// quadros por segundo; a igualdade com 1 thread fica no --self-check.
+void benchCutout(const Image &img, const BenchOptions &opt) {
+    const int rounds = 20;
+    CutoutOp op = { 0, 255, 0, chromaKeyThreshold(0.4), CUTOUT_MIN_AREA };
+    size_t n = (size_t)img.width * img.height;
+    vector<unsigned char> mask(n), raw(n);
+    vector<unsigned char> rgba(n * 4);
+    double base = 0;
+    printf("%-8s %10s %10s %10s %10s\n", "threads", "máscara", "limpeza", "RGBA", "quadros/s");
+    for (int t = 1; t <= opt.threads; t++) {
+        setThreads(t);
+        double seconds[3] = { 0, 0, 0 };
+        for (int k = 0; k < rounds; k++) {
+            Stopwatch sm;
+            keyMask(img.data, img.width, img.height, op, mask.data());
+            seconds[0] += sm.seconds();
+            Stopwatch sc;
+            cleanMask(mask.data(), img.width, img.height, op.minArea);
+            seconds[1] += sc.seconds();
+            Stopwatch sr;
+            cutoutRGBA(img.data, img.width, img.height, mask.data(), rgba.data());
+            seconds[2] += sr.seconds();
+        }
+        double fps = rounds / (seconds[0] + seconds[1] + seconds[2]);
+        if (t == 1) base = fps;
+        printf("%-8d %7.2f ms %7.2f ms %7.2f ms %10.1f (%5.2fx)\n", t, seconds[0] * 1000.0 / rounds,
+               seconds[1] * 1000.0 / rounds, seconds[2] * 1000.0 / rounds, fps, fps / base);
+    }
+    setThreads(opt.threads);
+    size_t removed = 0, keyed = 0;
+    keyMask(img.data, img.width, img.height, op, raw.data());
+    for (size_t i = 0; i < n; i++) {
+        keyed += raw[i] == 0;
+        removed += raw[i] != mask[i];
+    }
+    printf("%zu pixels de fundo na chave, %zu trocados na limpeza\n", keyed, removed);
+}
+
+// Cada operador de Porter-Duff com gradientSprite(), em MB/s da camada;
+// depois layerStack() uma camada por vez e em blocos, com 1..N threads.
+void benchComposite(const Image &img, const BenchOptions &opt) {
+    const int rounds = 10;
+    int w = img.width, h = img.height;
+    vector<unsigned char> canvas = opaqueCanvas(img);
+    vector<unsigned char> work(canvas.size());
+    Layer sprite = gradientSprite(img);
+    double mb = (double)sprite.width * sprite.height * 4 * rounds / (1024.0 * 1024.0);
+    for (int m = 0; m < COMP_MODES; m++) {
+        sprite.mode = (CompositeMode)m;
+        double seconds = 0;
+        for (int k = 0; k < rounds; k++) {
+            work = canvas;
+            Stopwatch t;
+            compositeLayer(work.data(), w, h, sprite);
+            seconds += t.seconds();
+        }
+        printf("%-9s %8.1f MB/s\n", compositeModeName(sprite.mode), mb / seconds);
+    }
+
+    vector<Layer> stack = layerStack(img);
+    double base = 0;
+    printf("%-8s %12s %12s\n", "threads", "uma a uma", "em blocos");
+    for (int t = 1; t <= opt.threads; t++) {
+        setThreads(t);
+        double seconds[2] = { 0, 0 };
+        for (int k = 0; k < rounds; k++) {
+            work = canvas;
+            Stopwatch sw;
+            for (size_t i = 0; i < stack.size(); i++) compositeLayer(work.data(), w, h, stack[i]);
+            seconds[0] += sw.seconds();
+            work = canvas;
+            Stopwatch sb;
+            compositeLayers(work.data(), w, h, stack);
+            seconds[1] += sb.seconds();
+        }
+        if (t == 1) base = seconds[1];
+        printf("%-8d %9.2f ms %9.2f ms (%5.2fx)\n", t, seconds[0] * 1000.0 / rounds, seconds[1] * 1000.0 / rounds,
+               base / seconds[1]);
+    }
+    setThreads(opt.threads);
+}
+
+// Métricas da imagem contra slightlyAltered() com 1..N threads; a vazão é
+// dos planos de cor das duas imagens.
+void benchCompare(const Image &img, const BenchOptions &opt) {
+    const int rounds = 5;
+    PlanarImage x = planarFromImage(img), y = slightlyAltered(x);
+    double mb = (double)x.pixels() * 3 * 2 * rounds / (1024.0 * 1024.0);
+    double base = 0;
+    CompareResult res;
+    for (int t = 1; t <= opt.threads; t++) {
+        setThreads(t);
+        Stopwatch sw;
+        for (int k = 0; k < rounds; k++) res = compareImages(x, y);
+        double seconds = sw.seconds();
+        if (t == 1) base = seconds;
+        printf("%2d thread(s) %8.2f ms %8.1f MB/s (%5.2fx)\n", t, seconds * 1000.0 / rounds, mb / seconds,
+               base / seconds);
+    }
+    setThreads(opt.threads);
+    printf("PSNR %.3f dB, SSIM %.6f\n", res.psnrRGB(), res.ssimRGB());
+}
+
+const Benchmark BENCHMARKS[] = {
+    { "threads",    benchThreads },
+    { "chain",      benchChain },
+    { "blur",       benchBlur },
+    { "morphology", benchMorphology },
+    { "histogram",  benchHistogram },
+    { "resize",     benchResize },
+    { "save",       benchSave },
+    { "palette",    benchPalette },
+    { "cutout",     benchCutout },
+    { "composite",  benchComposite },
+    { "compare",    benchCompare },
+};
+
+// Roda a medição 'name' ou, com o nome vazio, todas; falso se o nome não existe.
+bool runBenchmarks(const Image &img, const BenchOptions &opt, const string &name) {
+    bool found = false;
+    for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+        if (!name.empty() && name != BENCHMARKS[i].name) continue;
+        printf("== %s\n", BENCHMARKS[i].name);
+        BENCHMARKS[i].run(img, opt);
+        found = true;
+    }
+    if (!found) {
+        fprintf(stderr, "Medição desconhecida: %s (", name.c_str());
+        for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+            fprintf(stderr, "%s%s", i ? ", " : "", BENCHMARKS[i].name);
+        }
+        fprintf(stderr, ")\n");
+    }
+    return found;
+}
+
+// "ARQUIVO[@X,Y][:MODO]": camada na posição (X, Y), src-over por padrão
+bool parseLayerSpec(const string &spec, Layer &layer) {
+    string file = spec;
+    size_t colon = file.rfind(':');
+    if (colon != string::npos && parseCompositeMode(file.substr(colon + 1), layer.mode)) {
+        file.resize(colon);
+    }
+    size_t at = file.rfind('@');
+    if (at != string::npos) {
+        char end;
+        if (sscanf(file.c_str() + at + 1, "%d,%d%c", &layer.x, &layer.y, &end) != 2) {
+            fprintf(stderr, "Posição inválida em %s (use ARQUIVO@X,Y)\n", spec.c_str());
+            return false;
+        }
+        file.resize(at);
+    }
+    return loadLayer(file, layer);
+}
+
+// Compõe as camadas sobre a imagem de entrada e grava RGBA (PNG ou P7)
+bool compositeFile(const string &file, const vector<string> &layerSpecs, const string &outFile) {
+    Layer canvas;
+    Stopwatch readTime;
+    if (!loadLayer(file, canvas)) return false;
+    vector<Layer> layers(layerSpecs.size());
+    for (size_t i = 0; i < layerSpecs.size(); i++) {
+        if (!parseLayerSpec(layerSpecs[i], layers[i])) return false;
+    }
+    size_t bytes = canvas.rgba.size();
+    reportThroughput("leitura", bytes, readTime.seconds());
+    cout << canvas.width << " X " << canvas.height << ", " << layers.size() << " camada(s)" << endl;
+    cout << "SIMD: " << simdLevelName(simdLevel()) << ", threads: " << threadPool().size() << endl;
+
+    Stopwatch compositeTime;
+    compositeLayers(canvas.rgba.data(), canvas.width, canvas.height, layers);
+    reportThroughput("composição", bytes * layers.size(), compositeTime.seconds());
+
+    Stopwatch writeTime;
+    parallelRows(canvas.width, canvas.height, [&](int y0, int y1) {
+        unpremultiply(canvas.rgba.data() + (size_t)y0 * canvas.width * 4, (size_t)(y1 - y0) * canvas.width);
+    });
+    if (!saveRGBA(outFile, canvas.rgba.data(), canvas.width, canvas.height)) return false;
+    reportThroughput(isPNGFile(outFile) ? "escrita PNG RGBA" : "escrita P7", bytes, writeTime.seconds());
+    return true;
+}
+
+// Compara a entrada com 'refFile'; falha se os tamanhos não batem ou se o
+// PSNR das cores fica abaixo de 'minPsnr'
+bool compareFiles(const string &file, const string &refFile, double minPsnr) {
+    PlanarImage x, y;
+    Stopwatch readTime;
+    if (!openPlanar(file, x) || !openPlanar(refFile, y)) return false;
+    reportThroughput("leitura", x.fileBytes() + y.fileBytes(), readTime.seconds());
+    if (x.width != y.width || x.height != y.height || x.maxValue != y.maxValue) {
+        fprintf(stderr, "Imagens diferentes: %dx%d (máx %d) e %dx%d (máx %d)\n", x.width, x.height, x.maxValue,
+                y.width, y.height, y.maxValue);
+        return false;
+    }
+    cout << x.width << " X " << x.height << endl;
+    cout << "SIMD: " << simdLevelName(simdLevel()) << ", threads: " << threadPool().size() << endl;
+    Stopwatch compareTime;
+    CompareResult res = compareImages(x, y);
+    reportThroughput("comparação", x.pixels() * res.channels * x.sampleBytes() * 2, compareTime.seconds());
+    printCompare(res);
+    if (res.psnrRGB() < minPsnr) {
+        fprintf(stderr, "PSNR %.2f dB abaixo do mínimo %.2f dB\n", res.psnrRGB(), minPsnr);
+        return false;
+    }
+    return true;
+}
+
+// P5, P7 e P6 fora de 8 bits: planos de 16 bits (ppm_pam.h), a cadeia
+// inteira com runPlanarChain()
+bool filterPlanar(const string &file, const string &outFile, FilterChain &chain) {
+    PlanarImage img;
+    Stopwatch readTime;
+    if (!openPlanar(file, img)) {
+        return false;
+    }
+    reportThroughput("leitura (planar)", img.fileBytes(), readTime.seconds());
+    cout << img.width << " X " << img.height << ", " << img.depth << " canal(is), maxValue " << img.maxValue << endl;
+    cout << "SIMD: " << simdLevelName(simdLevel()) << ", threads: " << threadPool().size() << endl;
+
+    if (chain.empty() && !askChain(chain)) {
+        return true;
+    }
+
+    Stopwatch filterTime;
+    if (!runPlanarChain(chain, img)) {
+        fprintf(stderr, "Paletas e mediana não têm versão de 16 bits: use uma imagem P6 de 8 bits\n");
+        return false;
+    }
+    reportThroughput("filtro (planar)", img.pixels() * 8, filterTime.seconds());
+
+    Stopwatch writeTime;
+    if (!savePlanar(outFile, img)) {
+        return false;
+    }
+    reportThroughput("escrita", img.fileBytes(), writeTime.seconds());
+    return true;
+}
+
+// "LARGURAxALTURA[:filtro]"; um dos lados pode ser 0 para manter a
+// proporção. Filtros: box, bilinear, bicubic e lanczos3 (padrão).
+bool parseResize(const string &spec, int &w, int &h, ResampleFilter &filter) {
+    size_t colon = spec.find(':');
+    string size = spec.substr(0, colon);
+    filter = RESAMPLE_LANCZOS3;
+    if (colon != string::npos) {
+        string name = spec.substr(colon + 1);
+        int f = RESAMPLE_BOX;
+        while (f <= RESAMPLE_LANCZOS3 && name != resampleFilterName((ResampleFilter)f)) f++;
+        if (f > RESAMPLE_LANCZOS3) {
+            fprintf(stderr, "Filtro de redimensionamento desconhecido: %s\n", name.c_str());
+            return false;
+        }
+        filter = (ResampleFilter)f;
+    }
+    if (sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w < 0 || h < 0 || (w == 0 && h == 0)) {
+        fprintf(stderr, "Tamanho inválido: %s (use LARGURAxALTURA)\n", size.c_str());
+        return false;
+    }
+    return true;
+}
+
+// "R,G,B,T[,A]": cor-chave, tolerância (0..1) e área mínima (64)
+bool parseCutoutSpec(const string &spec, CutoutOp &op) {
+    vector<string> args;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        if (comma == string::npos) comma = spec.size();
+        args.push_back(spec.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return parseCutout(args, op);
+}
+
+// Imagem de teste quando não há arquivo: degradês com ruído e quadrados
+// verdes para o chroma-key.
+void makeTestImage(Image &img, int w, int h) {
+    img.allocate(w, h);
+    uint32_t seed = 12345;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned char *p = img.data + ((size_t)y * w + x) * 3;
+            seed = seed * 1664525u + 1013904223u;
+            if ((x / 48 + y / 48) % 4 == 0) {
+                p[0] = (unsigned char)(seed >> 28);
+                p[1] = (unsigned char)(240 + (seed >> 28));
+                p[2] = (unsigned char)(seed >> 29);
+            } else {
+                p[0] = (unsigned char)(x * 255 / w + (seed >> 29));
+                p[1] = (unsigned char)(y * 255 / h);
+                p[2] = (unsigned char)((x + y) + (seed >> 24));
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    string file = "../src/ExemplosMoodle/M3_material/M3_exemplo1.ppm";
+    string outFile = "../src/ExemplosMoodle/M3_material/output.ppm";
+    bool ascii = false;
+    int stripRows = 0;
+    bool checking = false;
+    bool benchmarking = false;
+    string benchName;
+    int threads = defaultThreads();
+    string chainSpec;
+    string batchInput, batchOutDir;
+    string resizeSpec;
+    bool png = false;
+    bool qoic = false;
+    string cutoutSpec;
+    vector<string> layerSpecs;
+    string compareFile;
+    double minPsnr = 0;
+
+    // uso: exemplo_03 [entrada.ppm|pgm|pam [saida]] [--p3] [--stream LINHAS]
+    //                 [--simd escalar|ssse3|avx2|avx512] [--threads N]
+    //                 [--chain gray:weighted,colorize:30,40,50,negative]
+    //                 [--batch DIRETORIO|"dir/*.ppm" SAIDA] [--resize 640x0:lanczos3]
+    //                 [--png] [--qoic] [--cutout R,G,B,T[,A]] [--layer ARQUIVO[@X,Y][:MODO]]...
+    //                 [--compare REFERENCIA [--min-psnr DB]] [--self-check] [--bench [NOME]]
+    // saída terminada em .png (ou --png no modo lote) grava PNG, em .qoic (ou
+    // --qoic) o cache QOIC sem perdas, que também é aceito na entrada; com
+    // --cutout ou --layer a saída é RGBA (PNG, QOIC ou P7);
+    // --self-check confere todos os caminhos otimizados com as referências
+    // (na imagem dada ou, sem entrada, numa imagem de teste) e mostra MB/s;
+    // --bench roda as medições de escalabilidade (todas ou só NOME)
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--p3") {
+            ascii = true;
+        } else if (arg == "--stream" && i + 1 < argc) {
+            stripRows = atoi(argv[++i]);
+        } else if (arg == "--simd" && i + 1 < argc) {
+            string name = argv[++i];
+            for (int level = SIMD_SCALAR; level <= detectSimdLevel(); level++) {
+                if (name == simdLevelName((SimdLevel)level)) simdLevel() = (SimdLevel)level;
+            }
+        } else if (arg == "--self-check") {
+            checking = true;
+        } else if (arg == "--bench") {
+            benchmarking = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-' && strchr(argv[i + 1], '.') == NULL) {
+                benchName = argv[++i];
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--chain" && i + 1 < argc) {
+            chainSpec = argv[++i];
+        } else if (arg == "--resize" && i + 1 < argc) {
+            resizeSpec = argv[++i];
+        } else if (arg == "--cutout" && i + 1 < argc) {
+            cutoutSpec = argv[++i];
+        } else if (arg == "--layer" && i + 1 < argc) {
+            layerSpecs.push_back(argv[++i]);
+        } else if (arg == "--compare" && i + 1 < argc) {
+            compareFile = argv[++i];
+        } else if (arg == "--min-psnr" && i + 1 < argc) {
+            minPsnr = atof(argv[++i]);
+        } else if (arg == "--png") {
+            png = true;
+        } else if (arg == "--qoic") {
+            qoic = true;
+        } else if (arg == "--batch" && i + 2 < argc) {
+            batchInput = argv[++i];
+            batchOutDir = argv[++i];
+        } else if (positional == 0) {
+            file = arg;
+            positional++;
+        } else {
+            outFile = arg;
+            positional++;
+        }
+    }
+
+    setThreads(threads);
+
+    // com --chain roda sem perguntas; senão pergunta um filtro, como antes
+    FilterChain chain;
+    if (!chainSpec.empty() && !parseFilterChain(chainSpec, chain)) {
+        return EXIT_FAILURE;
+    }
+    int resizeW = 0, resizeH = 0;
+    ResampleFilter resizeFilter = RESAMPLE_LANCZOS3;
+    if (!resizeSpec.empty()) {
+        if (!parseResize(resizeSpec, resizeW, resizeH, resizeFilter)) {
+            return EXIT_FAILURE;
+        }
+        if (!batchInput.empty() || stripRows > 0 || needsPlanar(file)) {
+            fprintf(stderr, "--resize só funciona com uma imagem P6/P3 de 8 bits inteira na memória\n");
+            return EXIT_FAILURE;
+        }
+    }
+    CutoutOp cutoutOp = { 0, 255, 0, chromaKeyThreshold(0.4), CUTOUT_MIN_AREA };
+    if (!cutoutSpec.empty()) {
+        if (!parseCutoutSpec(cutoutSpec, cutoutOp)) {
+            return EXIT_FAILURE;
+        }
+        if (!batchInput.empty() || stripRows > 0 || needsPlanar(file)) {
+            fprintf(stderr, "--cutout só funciona com uma imagem P6/P3 de 8 bits inteira na memória; "
+                            "no lote ou em 16 bits, use o filtro cutout na cadeia\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (checking || benchmarking) {
+        Image img;
+        if (positional == 0) {
+            makeTestImage(img, 1024, 768);
+        } else if (needsPlanar(file)) {
+            fprintf(stderr, "--self-check e --bench usam uma imagem P6/P3 de 8 bits inteira na memória\n");
+            return EXIT_FAILURE;
+        } else if (!openPPM(file, img)) {
+            return EXIT_FAILURE;
+        }
+        cout << img.width << " X " << img.height << endl;
+        cout << "SIMD: " << simdLevelName(simdLevel()) << ", threads: " << threadPool().size() << endl;
+        if (checking && !selfCheck(img, threads, 5)) {
+            return EXIT_FAILURE;
+        }
+        BenchOptions opt = {};
+        opt.threads = threadPool().size();
+        FilterChain defaultChain;
+        parseFilterChain(CHECK_CHAIN, defaultChain);
+        opt.chain = chain.empty() ? &defaultChain : &chain;
+        opt.outFile = outFile;
+        if (benchmarking && !runBenchmarks(img, opt, benchName)) {
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (!compareFile.empty()) {
+        // só compara: nenhum filtro, nenhuma saída
+        return compareFiles(file, compareFile, minPsnr) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!layerSpecs.empty()) {
+        // composição: a entrada é o fundo, em qualquer formato de openPlanar
+        if (!batchInput.empty() || stripRows > 0 || !chainSpec.empty() || !resizeSpec.empty() || !cutoutSpec.empty()) {
+            fprintf(stderr, "--layer não se combina com --batch, --stream, --chain, --resize nem --cutout\n");
+            return EXIT_FAILURE;
+        }
+        return compositeFile(file, layerSpecs, outFile) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!batchInput.empty()) {
+        // modo lote: mesma cadeia em todos os quadros, perguntada uma vez
+        vector<string> files;
+        if (!listBatchInputs(batchInput, files)) {
+            return EXIT_FAILURE;
+        }
+        if (files.empty()) {
+            fprintf(stderr, "Nenhum arquivo em %s\n", batchInput.c_str());
+            return EXIT_FAILURE;
+        }
+        if (chain.empty() && !askChain(chain)) {
+            return EXIT_SUCCESS;
+        }
+        compileChain(chain);
+        bool ok = batchPPM(files, batchOutDir, png ? ".png" : (qoic ? ".qoic" : ".ppm"), ascii, [&chain](unsigned char *data, int w, int h) {
+            runChain(chain, data, w, h);
+        });
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (stripRows > 0) {
+        // modo em faixas: a imagem nunca fica inteira na memória
+        if (chain.empty() && !askChain(chain)) {
+            return EXIT_SUCCESS;
+        }
+        if (!chain.isPointwise()) {
+            fprintf(stderr, "Modo em faixas aceita apenas filtros pontuais (sem vizinhança nem histograma)\n");
+            return EXIT_FAILURE;
+        }
+        if (isPNGFile(outFile) || isQOICFile(outFile)) {
+            fprintf(stderr, "Modo em faixas grava apenas PPM\n");
+            return EXIT_FAILURE;
+        }
+        compileChain(chain);
+        bool ok = streamPPM(file, outFile, stripRows, ascii, [&chain](unsigned char *data, int w, int h) {
+            runChain(chain, data, w, h);
+        });
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (needsPlanar(file)) {
+        if (ascii) fprintf(stderr, "--p3 ignorado: a saída segue o formato de entrada (P5/P6/P7)\n");
+        return filterPlanar(file, outFile, chain) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    Image img;
+    Stopwatch readTime;
+    if (!openPPM(file, img)) {
+        return EXIT_FAILURE;
+    }
+    reportThroughput(img.isMapped() ? "leitura (mapeada)" : "leitura", img.bytes(), readTime.seconds());
+    cout << img.width << " X " << img.height << endl;
+    cout << "SIMD: " << simdLevelName(simdLevel()) << ", threads: " << threadPool().size() << endl;
+
+    if (resizeW > 0 || resizeH > 0) {
+        // redimensiona antes dos filtros, que então trabalham no tamanho final
+        if (resizeW == 0) resizeW = (int)((double)img.width * resizeH / img.height + 0.5);
+        if (resizeH == 0) resizeH = (int)((double)img.height * resizeW / img.width + 0.5);
+        if (resizeW < 1) resizeW = 1;
+        if (resizeH < 1) resizeH = 1;
+        Image resized(resizeW, resizeH);
+        Stopwatch resizeTime;
+        resampleImage(img.data, img.width, img.height, resized.data, resizeW, resizeH, resizeFilter);
+        string what = string("redimensionamento (") + resampleFilterName(resizeFilter) + ")";
+        reportThroughput(what.c_str(), resized.bytes(), resizeTime.seconds());
+        img = std::move(resized);
+        cout << "redimensionada para " << img.width << " X " << img.height << endl;
+    }
+
+    // com --resize ou --cutout e sem --chain não pergunta filtro
+    bool noFilter = (!resizeSpec.empty() || !cutoutSpec.empty()) && chain.empty();
+    if (!noFilter) {
+        if (chain.empty() && !askChain(chain)) {
+            return EXIT_SUCCESS;
+        }
+        compileChain(chain);
+
+        Stopwatch filterTime;
+        runChain(chain, img.data, img.width, img.height);
+        reportThroughput("filtro", img.bytes(), filterTime.seconds());
+    }
+
+    if (!cutoutSpec.empty()) {
+        // recorte depois dos filtros: máscara limpa no alfa
+        Stopwatch cutTime;
+        vector<unsigned char> mask = cutoutMask(img.data, img.width, img.height, cutoutOp);
+        vector<unsigned char> rgba((size_t)img.width * img.height * 4);
+        cutoutRGBA(img.data, img.width, img.height, mask.data(), rgba.data());
+        reportThroughput("recorte", img.bytes(), cutTime.seconds());
+        Stopwatch writeTime;
+        if (!saveRGBA(outFile, rgba.data(), img.width, img.height)) {
+            return EXIT_FAILURE;
+        }
+        reportThroughput(isPNGFile(outFile) ? "escrita PNG RGBA" : "escrita P7", rgba.size(), writeTime.seconds());
+        return EXIT_SUCCESS;
+    }
+
+    Stopwatch writeTime;
+    if (!saveImage(outFile, img, ascii)) {
+        return EXIT_FAILURE;
+    }
+    reportThroughput(isPNGFile(outFile) ? "escrita PNG" : (ascii ? "escrita P3" : "escrita P6"), img.bytes(), writeTime.seconds());
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,163 @@
+// Modo lote: aplica a mesma cadeia de filtros a um diretório de quadros.
+//
+// Três estágios em paralelo, ligados por filas limitadas:
+//     leitura (thread própria) -> filtro (thread principal + pool)
+//         -> escrita (thread própria)
+// Enquanto um quadro é filtrado, o próximo já está sendo lido e o anterior
+// gravado. As filas seguram no máximo BATCH_QUEUE quadros cada, o que
+// limita a memória. No fim, cada estágio informa quanto do tempo total
+// passou trabalhando: o que estiver perto de 100% é o gargalo.
+#ifndef _PPM_BATCH_H_
+#define _PPM_BATCH_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+#include "ppm_io.h"
+#include "ppm_stream.h"
+#include "ppm_png.h"
+
+using namespace std;
+
+const size_t BATCH_QUEUE = 2;
+
+// '*' e '?' no estilo do shell, só no nome do arquivo
+inline bool wildcardMatch(const char *pattern, const char *name) {
+    if (*pattern == '\0') return *name == '\0';
+    if (*pattern == '*') {
+        return wildcardMatch(pattern + 1, name) || (*name && wildcardMatch(pattern, name + 1));
+    }
+    if (*name == '\0') return false;
+    return (*pattern == '?' || *pattern == *name) && wildcardMatch(pattern + 1, name + 1);
+}
+
+// 'input' é um diretório (todos os .ppm dele) ou um padrão como
+// "quadros/*.ppm". A lista sai em ordem alfabética.
+inline bool listBatchInputs(const string &input, vector<string> &files) {
+    namespace fs = std::filesystem;
+    error_code ec;
+    fs::path dir(input);
+    string pattern = "*.ppm";
+    if (!fs::is_directory(dir, ec)) {
+        pattern = dir.filename().string();
+        dir = dir.parent_path();
+        if (dir.empty()) dir = ".";
+    }
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        string name = it->path().filename().string();
+        if (wildcardMatch(pattern.c_str(), name.c_str())) files.push_back(it->path().string());
+    }
+    if (ec) {
+        fprintf(stderr, "Erro ao listar %s: %s\n", dir.string().c_str(), ec.message().c_str());
+        return false;
+    }
+    sort(files.begin(), files.end());
+    return true;
+}
+
+struct BatchFrame {
+    string name;    // nome do arquivo, sem diretório
+    Image img;
+};
+
+// Tempo ocupado de um estágio (sem contar a espera nas filas).
+struct StageClock {
+    double busy;
+    int frames;
+    size_t bytes;
+
+    StageClock() : busy(0), frames(0), bytes(0) {}
+
+    void report(const char *stage, double wall) const {
+        printf("%-8s %4d quadros, ocupado %8.1f ms (%5.1f%%), %8.1f MB/s enquanto ocupado\n",
+               stage, frames, busy * 1000.0, wall > 0 ? 100.0 * busy / wall : 0.0,
+               busy > 0 ? bytes / (1024.0 * 1024.0) / busy : 0.0);
+    }
+};
+
+// Lê cada arquivo de 'files', aplica filter(pixels, largura, altura) e grava
+// com o mesmo nome em 'outDir', trocando a extensão por 'ext' (".ppm" ou
+// ".png"). Um quadro com erro é pulado e avisado. Não grava por cima das
+// entradas: elas ainda podem estar mapeadas (ou na fila) quando a saída de
+// mesmo nome seria escrita.
+template <class F>
+bool batchPPM(const vector<string> &files, const string &outDir, const string &ext, bool ascii, F filter) {
+    namespace fs = std::filesystem;
+    error_code ec;
+    fs::create_directories(outDir, ec);
+    for (size_t i = 0; i < files.size(); i++) {
+        fs::path out = fs::path(outDir) / fs::path(files[i]).filename().replace_extension(ext);
+        if (fs::equivalent(out, files[i], ec)) {
+            fprintf(stderr, "A saída %s sobrescreveria a entrada; use outro diretório de saída\n",
+                    out.string().c_str());
+            return false;
+        }
+    }
+
+    BoundedQueue<BatchFrame> toFilter(BATCH_QUEUE), toWrite(BATCH_QUEUE);
+    StageClock readClock, filterClock, writeClock;
+    int failures = 0;
+    Stopwatch wall;
+
+    thread reader([&] {
+        for (size_t i = 0; i < files.size(); i++) {
+            Stopwatch t;
+            BatchFrame f;
+            f.name = fs::path(files[i]).filename().string();
+            bool ok = openPPM(files[i], f.img);
+            if (ok) f.img.prefetch();
+            readClock.busy += t.seconds();
+            if (!ok) {
+                failures++;
+                continue;
+            }
+            readClock.frames++;
+            readClock.bytes += f.img.bytes();
+            toFilter.push(std::move(f));
+        }
+        toFilter.close();
+    });
+
+    thread writer([&] {
+        BatchFrame f;
+        while (toWrite.pop(f)) {
+            Stopwatch t;
+            string out = (fs::path(outDir) / fs::path(f.name).replace_extension(ext)).string();
+            if (saveImage(out, f.img, ascii)) {
+                writeClock.frames++;
+                writeClock.bytes += f.img.bytes();
+            }
+            // libera o quadro (e o mapeamento) ainda dentro do estágio
+            f.img.release();
+            writeClock.busy += t.seconds();
+        }
+    });
+
+    BatchFrame f;
+    while (toFilter.pop(f)) {
+        Stopwatch t;
+        filter(f.img.data, f.img.width, f.img.height);
+        filterClock.busy += t.seconds();
+        filterClock.frames++;
+        filterClock.bytes += f.img.bytes();
+        toWrite.push(std::move(f));
+    }
+    toWrite.close();
+    reader.join();
+    writer.join();
+
+    double seconds = wall.seconds();
+    readClock.report("leitura", seconds);
+    filterClock.report("filtro", seconds);
+    writeClock.report("escrita", seconds);
+    reportThroughput("lote", filterClock.bytes, seconds);
+    failures += readClock.frames - writeClock.frames;
+    if (failures > 0) fprintf(stderr, "%d quadro(s) com erro\n", failures);
+    return failures == 0;
+}
+
+#endif
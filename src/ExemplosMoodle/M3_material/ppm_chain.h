@@ -0,0 +1,373 @@
+// Cadeias de filtros descritas em texto, ex.:
+//
+//     gray:weighted,colorize:30,40,50,negative
+//
+// A cadeia é compilada em uma lista de PixelOp (ppm_simd.h) e aplicada em
+// uma única passada sobre a imagem: um filtro a mais custa um pouco de
+// conta por pixel, não mais uma leitura e escrita da imagem inteira.
+// Antes de rodar, compileChain() junta os passos pontuais por canal em
+// uma tabela só (ppm_lut.h).
+//
+// Filtros de vizinhança (ppm_convolve.h) precisam dos pixels vizinhos já
+// prontos, então dividem a cadeia: os passos pontuais antes e depois de
+// cada um rodam em passadas separadas. Filtros por histograma
+// (ppm_histogram.h) também dividem: contam a imagem como ela está naquele
+// ponto, e a tabela resultante entra no começo do trecho seguinte. A
+// redução a uma paleta (ppm_palette.h) e o recorte (ppm_cutout.h) dividem
+// do mesmo jeito que os de vizinhança.
+//
+// Filtros e argumentos:
+//     chroma:R,G,B,T     (ou chroma-key) cor-chave e tolerância 0..1
+//     gray[:weighted]    (ou gray-scale) média ponderada; gray:mean = aritmética
+//     colorize:R,G,B     cor de base
+//     negative
+//     blur:R             média em janela de (2R+1)x(2R+1)
+//     gauss:S            (ou gaussian) gaussiano de desvio S
+//     sharpen:S[,A]      máscara de nitidez, desvio S e intensidade A (1)
+//     sobel              bordas (magnitude do gradiente, em cinza)
+//     erode:R            mínimo em janela de (2R+1)x(2R+1), por canal
+//     dilate:R           máximo na mesma janela
+//     open:R             erode e depois dilate
+//     close:R            dilate e depois erode
+//     median:R           mediana na mesma janela (R até 127)
+//     levels[:C]         auto-levels por canal, ignorando C% em cada ponta (0,5)
+//     stretch[:C]        contrast stretch, mesmo intervalo nos 3 canais (0)
+//     equalize           equalização do histograma
+//     mediancut:N[,D]    paleta de N cores (2..256) por median cut; D = 1 pontilha
+//                        com Floyd–Steinberg (0)
+//     octree:N[,D]       o mesmo, com a paleta de uma octree
+//     cutout:R,G,B,T[,A] chroma-key sem pontos soltos: componentes com menos
+//                        de A pixels (64) trocam de lado
+#ifndef _PPM_CHAIN_H_
+#define _PPM_CHAIN_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "ppm_simd.h"
+#include "ppm_lut.h"
+#include "ppm_parallel.h"
+#include "ppm_convolve.h"
+#include "ppm_morphology.h"
+#include "ppm_histogram.h"
+#include "ppm_palette.h"
+#include "ppm_cutout.h"
+
+using namespace std;
+
+enum ImageStepType { STEP_NEIGHBORHOOD, STEP_HISTOGRAM, STEP_PALETTE, STEP_CUTOUT };
+
+// Passo que precisa da imagem inteira (filtro de vizinhança, por
+// histograma, de paleta ou recorte) e sua posição entre os passos pontuais.
+struct ImageStep {
+    ImageStepType type;
+    NeighborhoodOp neighborhood;
+    HistogramOp histogram;
+    PaletteOp palette;
+    CutoutOp cutout;
+    size_t at;          // passos de 'ops' antes dele
+    size_t compiledAt;  // o mesmo em 'compiled'
+};
+
+struct FilterChain {
+    vector<PixelOp> ops;        // passos como foram pedidos
+    vector<ImageStep> steps;
+    vector<PixelOp> compiled;   // o que roda, depois de compileChain()
+    vector<LutStorage> tables;  // tabelas referenciadas por 'compiled'
+    bool isCompiled;
+
+    FilterChain() : isCompiled(false) {}
+
+    bool empty() const {
+        return ops.empty() && steps.empty();
+    }
+
+    // só filtros pontuais: cada pixel depende apenas dele mesmo
+    bool isPointwise() const {
+        return steps.empty();
+    }
+
+    void addNeighborhood(const NeighborhoodOp &op) {
+        ImageStep step = { STEP_NEIGHBORHOOD, op, HistogramOp(), PaletteOp(), CutoutOp(), ops.size(), 0 };
+        steps.push_back(step);
+    }
+
+    void addHistogram(const HistogramOp &op) {
+        ImageStep step = { STEP_HISTOGRAM, NeighborhoodOp(), op, PaletteOp(), CutoutOp(), ops.size(), 0 };
+        steps.push_back(step);
+    }
+
+    void addPalette(const PaletteOp &op) {
+        ImageStep step = { STEP_PALETTE, NeighborhoodOp(), HistogramOp(), op, CutoutOp(), ops.size(), 0 };
+        steps.push_back(step);
+    }
+
+    void addCutout(const CutoutOp &op) {
+        ImageStep step = { STEP_CUTOUT, NeighborhoodOp(), HistogramOp(), PaletteOp(), op, ops.size(), 0 };
+        steps.push_back(step);
+    }
+};
+
+// Compila cada trecho pontual entre passos de imagem separadamente.
+inline void compileChain(FilterChain &chain) {
+    chain.tables.clear();
+    chain.compiled.clear();
+    size_t start = 0;
+    for (size_t i = 0; i <= chain.steps.size(); i++) {
+        size_t end = i < chain.steps.size() ? chain.steps[i].at : chain.ops.size();
+        vector<PixelOp> segment(chain.ops.begin() + start, chain.ops.begin() + end);
+        vector<PixelOp> out = compilePixelOps(segment, chain.tables);
+        chain.compiled.insert(chain.compiled.end(), out.begin(), out.end());
+        if (i < chain.steps.size()) chain.steps[i].compiledAt = chain.compiled.size();
+        start = end;
+    }
+    chain.isCompiled = true;
+}
+
+inline int clampColor(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+inline bool isNumber(const string &s) {
+    if (s.empty()) return false;
+    char *end;
+    strtod(s.c_str(), &end);
+    return *end == '\0';
+}
+
+inline bool compileNeighborhood(const string &name, const vector<string> &args, FilterChain &chain) {
+    NeighborhoodOp op = { NEIGHBOR_SOBEL, 0, 0.0, 1.0 };
+    size_t minArgs = 1, maxArgs = 1;
+    if (name == "blur") {
+        op.type = NEIGHBOR_BLUR;
+    } else if (name == "sharpen") {
+        op.type = NEIGHBOR_SHARPEN;
+        maxArgs = 2;
+    } else if (name == "sobel") {
+        minArgs = maxArgs = 0;
+    } else if (name == "erode") {
+        op.type = NEIGHBOR_ERODE;
+    } else if (name == "dilate") {
+        op.type = NEIGHBOR_DILATE;
+    } else if (name == "open") {
+        op.type = NEIGHBOR_OPEN;
+    } else if (name == "close") {
+        op.type = NEIGHBOR_CLOSE;
+    } else if (name == "median") {
+        op.type = NEIGHBOR_MEDIAN;
+    } else {
+        op.type = NEIGHBOR_GAUSSIAN;
+    }
+    if (args.size() < minArgs || args.size() > maxArgs) {
+        fprintf(stderr, "%s espera %d argumento(s), recebeu %d\n", name.c_str(), (int)minArgs, (int)args.size());
+        return false;
+    }
+    if (!args.empty()) {
+        op.radius = atoi(args[0].c_str());
+        op.sigma = atof(args[0].c_str());
+        if (op.sigma <= 0) {
+            fprintf(stderr, "%s precisa de raio/desvio positivo\n", name.c_str());
+            return false;
+        }
+    }
+    if (args.size() == 2) op.amount = atof(args[1].c_str());
+    chain.addNeighborhood(op);
+    return true;
+}
+
+inline bool compileHistogram(const string &name, const vector<string> &args, FilterChain &chain) {
+    HistogramOp op = { HIST_EQUALIZE, 0.0 };
+    size_t maxArgs = 1;
+    if (name == "levels") {
+        op.type = HIST_LEVELS;
+        op.clip = 0.005;
+    } else if (name == "stretch") {
+        op.type = HIST_STRETCH;
+    } else {
+        maxArgs = 0;
+    }
+    if (args.size() > maxArgs) {
+        fprintf(stderr, "%s espera até %d argumento(s), recebeu %d\n", name.c_str(), (int)maxArgs, (int)args.size());
+        return false;
+    }
+    if (!args.empty()) {
+        op.clip = atof(args[0].c_str()) / 100.0;
+        if (op.clip < 0 || op.clip >= 0.5) {
+            fprintf(stderr, "%s: porcentagem ignorada deve estar em [0, 50)\n", name.c_str());
+            return false;
+        }
+    }
+    chain.addHistogram(op);
+    return true;
+}
+
+inline bool compilePalette(const string &name, const vector<string> &args, FilterChain &chain) {
+    PaletteOp op = { name == "octree" ? PALETTE_OCTREE : PALETTE_MEDIAN_CUT, 0, false };
+    if (args.empty() || args.size() > 2) {
+        fprintf(stderr, "%s espera 1 ou 2 argumento(s), recebeu %d\n", name.c_str(), (int)args.size());
+        return false;
+    }
+    op.colors = atoi(args[0].c_str());
+    if (op.colors < 2 || op.colors > 256) {
+        fprintf(stderr, "%s: número de cores deve estar em [2, 256]\n", name.c_str());
+        return false;
+    }
+    if (args.size() == 2) op.dither = atoi(args[1].c_str()) != 0;
+    chain.addPalette(op);
+    return true;
+}
+
+// R,G,B,T[,A], como o chroma-key mais a área mínima
+inline bool parseCutout(const vector<string> &args, CutoutOp &op) {
+    if (args.size() < 4 || args.size() > 5) {
+        fprintf(stderr, "cutout espera 4 ou 5 argumento(s), recebeu %d\n", (int)args.size());
+        return false;
+    }
+    op.r = clampColor(atoi(args[0].c_str()));
+    op.g = clampColor(atoi(args[1].c_str()));
+    op.b = clampColor(atoi(args[2].c_str()));
+    op.thr = chromaKeyThreshold(atof(args[3].c_str()));
+    op.minArea = args.size() == 5 ? atoi(args[4].c_str()) : CUTOUT_MIN_AREA;
+    return true;
+}
+
+// Fecha o filtro 'name' com os argumentos lidos até aqui.
+inline bool compileFilter(const string &name, const vector<string> &args, FilterChain &chain) {
+    PixelOp op = {};
+    op.type = PIXEL_NEGATIVE;
+    size_t expected = 0;
+    if (name == "chroma" || name == "chroma-key") {
+        expected = 4;
+        op.type = PIXEL_CHROMA_KEY;
+        if (args.size() == 4) {
+            op.r = clampColor(atoi(args[0].c_str()));
+            op.g = clampColor(atoi(args[1].c_str()));
+            op.b = clampColor(atoi(args[2].c_str()));
+            op.thr = chromaKeyThreshold(atof(args[3].c_str()));
+        }
+    } else if (name == "gray" || name == "gray-scale") {
+        op.type = PIXEL_GRAY;
+        if (args.size() == 1 && args[0] == "mean") {
+            op.type = PIXEL_GRAY_MEAN;
+        } else if (!args.empty() && !(args.size() == 1 && args[0] == "weighted")) {
+            fprintf(stderr, "gray aceita 'weighted' ou 'mean'\n");
+            return false;
+        }
+        expected = args.size();
+    } else if (name == "colorize") {
+        expected = 3;
+        op.type = PIXEL_COLORIZE;
+        if (args.size() == 3) {
+            op.r = atoi(args[0].c_str());
+            op.g = atoi(args[1].c_str());
+            op.b = atoi(args[2].c_str());
+        }
+    } else if (name == "negative") {
+        op.type = PIXEL_NEGATIVE;
+    } else if (name == "blur" || name == "gauss" || name == "gaussian" || name == "sharpen" || name == "sobel" ||
+               name == "erode" || name == "dilate" || name == "open" || name == "close" || name == "median") {
+        return compileNeighborhood(name, args, chain);
+    } else if (name == "levels" || name == "stretch" || name == "equalize") {
+        return compileHistogram(name, args, chain);
+    } else if (name == "mediancut" || name == "octree") {
+        return compilePalette(name, args, chain);
+    } else if (name == "cutout") {
+        CutoutOp cut;
+        if (!parseCutout(args, cut)) return false;
+        chain.addCutout(cut);
+        return true;
+    } else {
+        fprintf(stderr, "Filtro desconhecido: '%s'\n", name.c_str());
+        return false;
+    }
+    if (args.size() != expected) {
+        fprintf(stderr, "%s espera %d argumento(s), recebeu %d\n", name.c_str(), (int)expected, (int)args.size());
+        return false;
+    }
+    chain.ops.push_back(op);
+    return true;
+}
+
+// Os itens são separados por vírgula; um item com ':' ou que não é número
+// começa um filtro novo, e números soltos são argumentos do filtro atual.
+inline bool parseFilterChain(const string &spec, FilterChain &chain) {
+    chain.ops.clear();
+    chain.steps.clear();
+    chain.isCompiled = false;
+    string name;
+    vector<string> args;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        if (comma == string::npos) comma = spec.size();
+        string item = spec.substr(start, comma - start);
+        start = comma + 1;
+
+        size_t colon = item.find(':');
+        if (colon == string::npos && isNumber(item)) {
+            if (name.empty()) {
+                fprintf(stderr, "Argumento '%s' sem filtro\n", item.c_str());
+                return false;
+            }
+            args.push_back(item);
+            continue;
+        }
+        if (!name.empty() && !compileFilter(name, args, chain)) return false;
+        args.clear();
+        name = item.substr(0, colon);
+        if (colon != string::npos) args.push_back(item.substr(colon + 1));
+        if (name.empty()) {
+            fprintf(stderr, "Cadeia de filtros inválida: '%s'\n", spec.c_str());
+            return false;
+        }
+    }
+    return compileFilter(name, args, chain);
+}
+
+// Passos pontuais [first, last) de 'ops' em uma passada, em blocos de
+// linhas paralelos.
+inline void runPixelOps(const vector<PixelOp> &ops, size_t first, size_t last, unsigned char *data, int w, int h) {
+    if (first >= last) return;
+    parallelRows(w, h, [&](int y0, int y1) {
+        applyPixelOps(ops.data() + first, (int)(last - first), data + (size_t)y0 * w * 3, (size_t)(y1 - y0) * w);
+    });
+}
+
+// Cada trecho pontual em uma passada, com os passos de imagem entre eles.
+// A tabela de um filtro por histograma só existe depois de contar a imagem;
+// ela é composta com o trecho seguinte e aplicada junto, na mesma passada.
+// Sem compileChain() antes, roda os passos como foram pedidos.
+inline void runChain(const FilterChain &chain, unsigned char *data, int w, int h) {
+    const vector<PixelOp> &ops = chain.isCompiled ? chain.compiled : chain.ops;
+    vector<PixelOp> pending;    // tabela de histograma ainda não aplicada
+    vector<LutStorage> tables;
+    size_t start = 0;
+    for (size_t i = 0; i <= chain.steps.size(); i++) {
+        bool last = i == chain.steps.size();
+        size_t end = last ? ops.size() : (chain.isCompiled ? chain.steps[i].compiledAt : chain.steps[i].at);
+        if (pending.empty()) {
+            runPixelOps(ops, start, end, data, w, h);
+        } else {
+            pending.insert(pending.end(), ops.begin() + start, ops.begin() + end);
+            if (chain.isCompiled) pending = compilePixelOps(pending, tables);
+            runPixelOps(pending, 0, pending.size(), data, w, h);
+            pending.clear();
+        }
+        if (last) break;
+
+        const ImageStep &step = chain.steps[i];
+        if (step.type == STEP_HISTOGRAM) {
+            pending.push_back(histogramPixelOp(step.histogram, data, w, h, tables));
+        } else if (step.type == STEP_PALETTE) {
+            applyPalette(step.palette, data, w, h);
+        } else if (step.type == STEP_CUTOUT) {
+            applyCutout(step.cutout, data, w, h);
+        } else {
+            applyNeighborhood(step.neighborhood, data, w, h);
+        }
+        start = end;
+    }
+}
+
+#endif
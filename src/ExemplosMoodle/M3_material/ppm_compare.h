@@ -0,0 +1,376 @@
+// Comparação de duas imagens do mesmo tamanho, para testes de regressão
+// contra imagens de referência: diferença absoluta máxima e média, PSNR e
+// SSIM de cada canal.
+//
+// As duas imagens vêm de openPlanar (ppm_pam.h), então qualquer PGM, PPM
+// ou PAM de 8 ou 16 bits serve, e cada canal já é um plano de uint16_t.
+//
+// SSIM em janela quadrada de (2*SSIM_RADIUS+1)² pixels, como a janela
+// uniforme do scikit-image, só nos centros com a janela inteira dentro da
+// imagem. As cinco somas da janela (x, y, x², y², xy) são filtros caixa:
+// somas por coluna atualizadas linha a linha (uma linha entra, outra sai)
+// e depois somadas na horizontal. Com amostras de 8 bits tudo cabe em
+// inteiros de 32 bits, inclusive N*Sxx - Sx², e o caminho AVX2 calcula 8
+// centros por vez, com a fórmula final em float; o escalar usa 64 bits e
+// double e serve qualquer maxValue. Os dois diferem só no arredondamento.
+#ifndef _PPM_COMPARE_H_
+#define _PPM_COMPARE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+#include "ppm_pam.h"
+
+using namespace std;
+
+const int SSIM_RADIUS = 3;           // janela 7x7
+const int COMPARE_BAND_ROWS = 256;   // linhas por faixa em paralelo
+
+struct ChannelDiff {
+    uint64_t sumSq, sumAbs;
+    unsigned maxAbs;
+
+    ChannelDiff() : sumSq(0), sumAbs(0), maxAbs(0) {}
+
+    void add(const ChannelDiff &o) {
+        sumSq += o.sumSq;
+        sumAbs += o.sumAbs;
+        maxAbs = max(maxAbs, o.maxAbs);
+    }
+};
+
+struct CompareResult {
+    int channels;               // 3 (RGB) ou 4 (RGBA), cinza replicado em RGB
+    int maxValue;
+    size_t pixels, ssimPixels;
+    ChannelDiff diff[4];
+    double ssim[4];
+
+    double meanAbs(int c) const { return (double)diff[c].sumAbs / pixels; }
+
+    // infinito para canais idênticos
+    double psnr(int c) const {
+        if (diff[c].sumSq == 0) return INFINITY;
+        double mse = (double)diff[c].sumSq / pixels;
+        return 10.0 * log10((double)maxValue * maxValue / mse);
+    }
+
+    // PSNR e SSIM das cores juntas
+    double psnrRGB() const {
+        uint64_t sq = diff[0].sumSq + diff[1].sumSq + diff[2].sumSq;
+        if (sq == 0) return INFINITY;
+        return 10.0 * log10((double)maxValue * maxValue / ((double)sq / (pixels * 3)));
+    }
+    double ssimRGB() const { return (ssim[0] + ssim[1] + ssim[2]) / 3.0; }
+};
+
+/*--------------------------------DIFERENÇAS----------------------------------*/
+inline void diffScalar(const uint16_t *a, const uint16_t *b, size_t n, ChannelDiff &d) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned v = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        d.sumSq += (uint64_t)v * v;
+        d.sumAbs += v;
+        if (v > d.maxAbs) d.maxAbs = v;
+    }
+}
+
+#ifdef PPM_SIMD_X86
+// |a-b| com duas subtrações saturadas; máximo sem pmaxuw (SSE4.1) com
+// max(m, v) = m + sat(v - m). Quadrados de 64 bits com pmuludq nas
+// palavras pares e ímpares de 32 bits, já que 65535² não cabe em int32.
+// A soma dos módulos fica em 32 bits por faixa e é esvaziada no fim.
+SIMD_TARGET("sse2")
+static size_t diff_sse2(const uint16_t *a, const uint16_t *b, size_t n, ChannelDiff &d) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sq = zero, abs32 = zero, mx = zero;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i v = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+        mx = _mm_add_epi16(mx, _mm_subs_epu16(v, mx));
+        __m128i lo = _mm_unpacklo_epi16(v, zero), hi = _mm_unpackhi_epi16(v, zero);
+        abs32 = _mm_add_epi32(abs32, _mm_add_epi32(lo, hi));
+        sq = _mm_add_epi64(sq, _mm_add_epi64(_mm_mul_epu32(lo, lo), _mm_mul_epu32(hi, hi)));
+        lo = _mm_srli_epi64(lo, 32);
+        hi = _mm_srli_epi64(hi, 32);
+        sq = _mm_add_epi64(sq, _mm_add_epi64(_mm_mul_epu32(lo, lo), _mm_mul_epu32(hi, hi)));
+    }
+    uint64_t s64[2];
+    uint32_t s32[4];
+    uint16_t m16[8];
+    _mm_storeu_si128((__m128i *)s64, sq);
+    _mm_storeu_si128((__m128i *)s32, abs32);
+    _mm_storeu_si128((__m128i *)m16, mx);
+    d.sumSq += s64[0] + s64[1];
+    for (int k = 0; k < 4; k++) d.sumAbs += s32[k];
+    for (int k = 0; k < 8; k++) d.maxAbs = max(d.maxAbs, (unsigned)m16[k]);
+    return i;
+}
+
+SIMD_TARGET("avx2")
+static size_t diff_avx2(const uint16_t *a, const uint16_t *b, size_t n, ChannelDiff &d) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sq = zero, abs32 = zero, mx = zero;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i v = _mm256_or_si256(_mm256_subs_epu16(va, vb), _mm256_subs_epu16(vb, va));
+        mx = _mm256_max_epu16(mx, v);
+        __m256i lo = _mm256_unpacklo_epi16(v, zero), hi = _mm256_unpackhi_epi16(v, zero);
+        abs32 = _mm256_add_epi32(abs32, _mm256_add_epi32(lo, hi));
+        sq = _mm256_add_epi64(sq, _mm256_add_epi64(_mm256_mul_epu32(lo, lo), _mm256_mul_epu32(hi, hi)));
+        lo = _mm256_srli_epi64(lo, 32);
+        hi = _mm256_srli_epi64(hi, 32);
+        sq = _mm256_add_epi64(sq, _mm256_add_epi64(_mm256_mul_epu32(lo, lo), _mm256_mul_epu32(hi, hi)));
+    }
+    uint64_t s64[4];
+    uint32_t s32[8];
+    uint16_t m16[16];
+    _mm256_storeu_si256((__m256i *)s64, sq);
+    _mm256_storeu_si256((__m256i *)s32, abs32);
+    _mm256_storeu_si256((__m256i *)m16, mx);
+    for (int k = 0; k < 4; k++) d.sumSq += s64[k];
+    for (int k = 0; k < 8; k++) d.sumAbs += s32[k];
+    for (int k = 0; k < 16; k++) d.maxAbs = max(d.maxAbs, (unsigned)m16[k]);
+    return i;
+}
+#endif
+
+// 'n' amostras; chamado por linha, para a soma de 32 bits por faixa dos
+// vetores não estourar (65535 * n / 8 < 2^32 até meio milhão de colunas)
+inline void diffSamples(const uint16_t *a, const uint16_t *b, size_t n, ChannelDiff &d) {
+    size_t done = 0;
+#ifdef PPM_SIMD_X86
+    switch (simdLevel()) {
+        case SIMD_AVX512VBMI:
+        case SIMD_AVX512:
+        case SIMD_AVX2:   done = diff_avx2(a, b, n, d); break;
+        case SIMD_SSSE3:  done = diff_sse2(a, b, n, d); break;
+        default: break;
+    }
+#endif
+    diffScalar(a + done, b + done, n - done, d);
+}
+
+/*-----------------------------------SSIM-------------------------------------*/
+// Constantes do SSIM já multiplicadas por N² (N pixels na janela), para
+// a fórmula trabalhar direto com as somas:
+// ((2 Sx Sy + c1) (2 (N Sxy - Sx Sy) + c2)) /
+// ((Sx² + Sy² + c1) (N Sxx - Sx² + N Syy - Sy² + c2))
+inline void ssimConstants(int maxValue, double &c1, double &c2) {
+    const double n = (2 * SSIM_RADIUS + 1) * (2 * SSIM_RADIUS + 1);
+    c1 = 0.01 * maxValue * 0.01 * maxValue * n * n;
+    c2 = 0.03 * maxValue * 0.03 * maxValue * n * n;
+}
+
+// Soma do SSIM dos centros das linhas [y0, y1), colunas [R, w-R)
+inline double ssimBandScalar(const uint16_t *a, const uint16_t *b, int w, int y0, int y1, int maxValue) {
+    const int r = SSIM_RADIUS, k = 2 * r + 1, n = k * k;
+    double c1, c2;
+    ssimConstants(maxValue, c1, c2);
+    vector<int64_t> cols((size_t)w * 5, 0);
+    int64_t *cx = cols.data(), *cy = cx + w, *cxx = cy + w, *cyy = cxx + w, *cxy = cyy + w;
+    auto addRow = [&](int y, int sign) {
+        const uint16_t *pa = a + (size_t)y * w, *pb = b + (size_t)y * w;
+        for (int x = 0; x < w; x++) {
+            int64_t u = pa[x], v = pb[x];
+            cx[x] += sign * u;
+            cy[x] += sign * v;
+            cxx[x] += sign * u * u;
+            cyy[x] += sign * v * v;
+            cxy[x] += sign * u * v;
+        }
+    };
+    for (int y = y0 - r; y < y0 + r; y++) addRow(y, 1);
+    double total = 0;
+    for (int y = y0; y < y1; y++) {
+        addRow(y + r, 1);
+        if (y > y0) addRow(y - r - 1, -1);
+        int64_t sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+        for (int x = 0; x < k - 1; x++) {
+            sx += cx[x]; sy += cy[x]; sxx += cxx[x]; syy += cyy[x]; sxy += cxy[x];
+        }
+        for (int x = r; x < w - r; x++) {
+            int j = x + r, o = x - r;
+            sx += cx[j]; sy += cy[j]; sxx += cxx[j]; syy += cyy[j]; sxy += cxy[j];
+            double vx = (double)(n * sxx - sx * sx), vy = (double)(n * syy - sy * sy);
+            double cov = (double)(n * sxy - sx * sy);
+            double num = (2.0 * sx * sy + c1) * (2.0 * cov + c2);
+            double den = ((double)sx * sx + (double)sy * sy + c1) * (vx + vy + c2);
+            total += num / den;
+            sx -= cx[o]; sy -= cy[o]; sxx -= cxx[o]; syy -= cyy[o]; sxy -= cxy[o];
+        }
+    }
+    return total;
+}
+
+#ifdef PPM_SIMD_X86
+// Troca a linha 'out' pela linha 'in' nas somas por coluna (sem 'out',
+// só soma), 16 colunas por vez: com amostras de 8 bits os quadrados e
+// produtos cabem em 16 bits (pmullw) e só as somas vão para 32.
+SIMD_TARGET("avx2")
+static inline void ssimTerms_avx2(__m256i u, __m256i v, __m256i *terms) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i p[5] = { u, v, _mm256_mullo_epi16(u, u), _mm256_mullo_epi16(v, v), _mm256_mullo_epi16(u, v) };
+    // unpack mistura as metades de 128 bits; as colunas voltam à ordem
+    // com permute4x64 antes de unpack
+    for (int f = 0; f < 5; f++) {
+        __m256i q = _mm256_permute4x64_epi64(p[f], 0xd8);
+        terms[2 * f] = _mm256_unpacklo_epi16(q, zero);
+        terms[2 * f + 1] = _mm256_unpackhi_epi16(q, zero);
+    }
+}
+
+SIMD_TARGET("avx2")
+static void ssimColumns_avx2(const uint16_t *ia, const uint16_t *ib, const uint16_t *oa, const uint16_t *ob,
+                             int w, uint32_t *cols) {
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m256i in[10], out[10];
+        ssimTerms_avx2(_mm256_loadu_si256((const __m256i *)(ia + x)), _mm256_loadu_si256((const __m256i *)(ib + x)), in);
+        if (oa) {
+            ssimTerms_avx2(_mm256_loadu_si256((const __m256i *)(oa + x)), _mm256_loadu_si256((const __m256i *)(ob + x)), out);
+        }
+        for (int f = 0; f < 5; f++) {
+            uint32_t *dst = cols + (size_t)f * w + x;
+            for (int h = 0; h < 2; h++) {
+                __m256i s = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(dst + 8 * h)), in[2 * f + h]);
+                if (oa) s = _mm256_sub_epi32(s, out[2 * f + h]);
+                _mm256_storeu_si256((__m256i *)(dst + 8 * h), s);
+            }
+        }
+    }
+    uint32_t *cx = cols, *cy = cx + w, *cxx = cy + w, *cyy = cxx + w, *cxy = cyy + w;
+    for (; x < w; x++) {
+        uint32_t u = ia[x], v = ib[x];
+        cx[x] += u; cy[x] += v; cxx[x] += u * u; cyy[x] += v * v; cxy[x] += u * v;
+        if (oa) {
+            u = oa[x];
+            v = ob[x];
+            cx[x] -= u; cy[x] -= v; cxx[x] -= u * u; cyy[x] -= v * v; cxy[x] -= u * v;
+        }
+    }
+}
+
+// ssimBandScalar para maxValue <= 255: somas da janela com 7 leituras
+// desalinhadas das somas por coluna, variâncias e covariância exatas em
+// int32 e a razão em float, acumulada em double.
+SIMD_TARGET("avx2")
+static double ssimBand_avx2(const uint16_t *a, const uint16_t *b, int w, int y0, int y1, int maxValue) {
+    const int r = SSIM_RADIUS, k = 2 * r + 1, n = k * k;
+    double c1d, c2d;
+    ssimConstants(maxValue, c1d, c2d);
+    const __m256 c1 = _mm256_set1_ps((float)c1d), c2 = _mm256_set1_ps((float)c2d);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256i vn = _mm256_set1_epi32(n);
+    vector<uint32_t> cols((size_t)w * 5, 0);
+    const uint32_t *cx = cols.data(), *cy = cx + w, *cxx = cy + w, *cyy = cxx + w, *cxy = cyy + w;
+    for (int y = y0 - r; y < y0 + r; y++) {
+        ssimColumns_avx2(a + (size_t)y * w, b + (size_t)y * w, NULL, NULL, w, cols.data());
+    }
+    double total = 0;
+    for (int y = y0; y < y1; y++) {
+        size_t in = (size_t)(y + r) * w, out = (size_t)(y - r - 1) * w;
+        if (y > y0) ssimColumns_avx2(a + in, b + in, a + out, b + out, w, cols.data());
+        else ssimColumns_avx2(a + in, b + in, NULL, NULL, w, cols.data());
+        __m256d acc = _mm256_setzero_pd();
+        int centers = w - 2 * r, i = 0;
+        for (; i + 8 <= centers; i += 8) {
+            __m256i s[5];
+            const uint32_t *src[5] = { cx + i, cy + i, cxx + i, cyy + i, cxy + i };
+            for (int f = 0; f < 5; f++) {
+                __m256i t = _mm256_loadu_si256((const __m256i *)src[f]);
+                for (int j = 1; j < k; j++) t = _mm256_add_epi32(t, _mm256_loadu_si256((const __m256i *)(src[f] + j)));
+                s[f] = t;
+            }
+            __m256i vx = _mm256_sub_epi32(_mm256_mullo_epi32(vn, s[2]), _mm256_mullo_epi32(s[0], s[0]));
+            __m256i vy = _mm256_sub_epi32(_mm256_mullo_epi32(vn, s[3]), _mm256_mullo_epi32(s[1], s[1]));
+            __m256i cov = _mm256_sub_epi32(_mm256_mullo_epi32(vn, s[4]), _mm256_mullo_epi32(s[0], s[1]));
+            __m256 fx = _mm256_cvtepi32_ps(s[0]), fy = _mm256_cvtepi32_ps(s[1]);
+            __m256 num = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(two, _mm256_mul_ps(fx, fy)), c1),
+                                       _mm256_add_ps(_mm256_mul_ps(two, _mm256_cvtepi32_ps(cov)), c2));
+            __m256 den = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy)), c1),
+                                       _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(vx, vy)), c2));
+            __m256 q = _mm256_div_ps(num, den);
+            acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(q)));
+            acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(q, 1)));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc);
+        total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (; i < centers; i++) {
+            int64_t sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+            for (int j = 0; j < k; j++) {
+                sx += cx[i + j]; sy += cy[i + j]; sxx += cxx[i + j]; syy += cyy[i + j]; sxy += cxy[i + j];
+            }
+            double vx = (double)(n * sxx - sx * sx), vy = (double)(n * syy - sy * sy);
+            double cov = (double)(n * sxy - sx * sy);
+            total += (2.0 * sx * sy + c1d) * (2.0 * cov + c2d) /
+                     (((double)sx * sx + (double)sy * sy + c1d) * (vx + vy + c2d));
+        }
+    }
+    return total;
+}
+#endif
+
+inline double ssimBand(const uint16_t *a, const uint16_t *b, int w, int y0, int y1, int maxValue) {
+#ifdef PPM_SIMD_X86
+    if (maxValue <= 255 && simdLevel() >= SIMD_AVX2) return ssimBand_avx2(a, b, w, y0, y1, maxValue);
+#endif
+    return ssimBandScalar(a, b, w, y0, y1, maxValue);
+}
+
+/*---------------------------------COMPARAÇÃO---------------------------------*/
+// Faixas de COMPARE_BAND_ROWS linhas; cada uma soma em separado (e o SSIM
+// começa contando as 2R linhas de cima) e as somas são juntadas na ordem
+// das faixas, então o resultado não depende do número de threads.
+inline CompareResult compareImages(const PlanarImage &x, const PlanarImage &y) {
+    CompareResult res;
+    int w = x.width, h = x.height;
+    res.channels = x.hasAlpha() || y.hasAlpha() ? 4 : 3;
+    res.maxValue = x.maxValue;
+    res.pixels = x.pixels();
+    const int r = SSIM_RADIUS;
+    bool window = w > 2 * r && h > 2 * r;
+    res.ssimPixels = window ? (size_t)(w - 2 * r) * (h - 2 * r) : 0;
+
+    int parts = (h + COMPARE_BAND_ROWS - 1) / COMPARE_BAND_ROWS;
+    for (int c = 0; c < res.channels; c++) {
+        const uint16_t *a = x.planes[c].data(), *b = y.planes[c].data();
+        vector<ChannelDiff> diffs(parts);
+        vector<double> ssims(parts, 0.0);
+        threadPool().run(parts, [&](size_t t) {
+            int y0 = (int)t * COMPARE_BAND_ROWS, y1 = min(y0 + COMPARE_BAND_ROWS, h);
+            for (int row = y0; row < y1; row++) diffSamples(a + (size_t)row * w, b + (size_t)row * w, w, diffs[t]);
+            // centros da janela: [R, h-R)
+            int s0 = max(y0, r), s1 = min(y1, h - r);
+            if (window && s0 < s1) ssims[t] = ssimBand(a, b, w, s0, s1, res.maxValue);
+        });
+        double ssimSum = 0;
+        for (int t = 0; t < parts; t++) {
+            res.diff[c].add(diffs[t]);
+            ssimSum += ssims[t];
+        }
+        res.ssim[c] = window ? ssimSum / res.ssimPixels : 1.0;
+    }
+    return res;
+}
+
+inline void printCompare(const CompareResult &res) {
+    static const char *names[4] = { "R", "G", "B", "A" };
+    printf("%-6s %8s %10s %10s %10s\n", "canal", "máx", "média", "PSNR", "SSIM");
+    for (int c = 0; c < res.channels; c++) {
+        printf("%-6s %8u %10.4f %7.2f dB %10.6f\n", names[c], res.diff[c].maxAbs, res.meanAbs(c),
+               res.psnr(c), res.ssim[c]);
+    }
+    printf("%-6s %8s %10s %7.2f dB %10.6f\n", "RGB", "", "", res.psnrRGB(), res.ssimRGB());
+}
+
+#endif
@@ -0,0 +1,353 @@
+// Composição de camadas RGBA com os operadores de Porter-Duff.
+//
+// Tudo em alfa pré-multiplicado (cada cor já multiplicada pelo seu alfa):
+// assim todo operador é o mesmo cálculo por canal, alfa incluído,
+//
+//     resultado = origem * Fa + destino * Fb
+//
+// com Fa e Fb valendo 0, 1, o alfa do outro lado ou 1 menos ele
+// (tabela compositeFactors). Os arquivos PAM e PNG guardam alfa
+// direto; a conversão acontece só na leitura e na gravação.
+//
+// Aritmética de 8 bits em ponto fixo: a*b/255 arredondado exatamente com
+// t = a*b + 128; (t + (t >> 8)) >> 8, sem divisão e cabendo em 16 bits,
+// então os vetores trabalham com 16 pixels (SSE2) ou 32 (AVX2) canais de
+// 16 bits por vez. Escalar e SIMD dão o mesmo resultado, byte a byte.
+//
+// Várias camadas sobre uma imagem grande são compostas em blocos de
+// linhas inteiras com cerca de COMPOSITE_TILE_BYTES: cada thread pega um
+// bloco e aplica todas as camadas nele enquanto ele está na cache, em vez
+// de percorrer a imagem inteira uma vez por camada. Blocos mais estreitos
+// que a linha só encurtam as sequências e atrapalham a pré-busca.
+#ifndef _PPM_COMPOSITE_H_
+#define _PPM_COMPOSITE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+#include "ppm_pam.h"
+
+using namespace std;
+
+enum CompositeMode {
+    COMP_CLEAR, COMP_SRC, COMP_DST,
+    COMP_SRC_OVER, COMP_DST_OVER,
+    COMP_SRC_IN, COMP_DST_IN,
+    COMP_SRC_OUT, COMP_DST_OUT,
+    COMP_SRC_ATOP, COMP_DST_ATOP,
+    COMP_XOR, COMP_PLUS,
+    COMP_MODES
+};
+
+inline const char *compositeModeName(CompositeMode mode) {
+    static const char *names[COMP_MODES] = {
+        "clear", "src", "dst", "src-over", "dst-over", "src-in", "dst-in",
+        "src-out", "dst-out", "src-atop", "dst-atop", "xor", "plus"
+    };
+    return names[mode];
+}
+
+inline bool parseCompositeMode(const string &name, CompositeMode &mode) {
+    for (int m = 0; m < COMP_MODES; m++) {
+        if (name == compositeModeName((CompositeMode)m)) {
+            mode = (CompositeMode)m;
+            return true;
+        }
+    }
+    if (name == "over") {
+        mode = COMP_SRC_OVER;
+        return true;
+    }
+    return false;
+}
+
+// Fator de cada lado: o alfa é sempre o do outro lado
+enum BlendFactor { FACTOR_ZERO, FACTOR_ONE, FACTOR_ALPHA, FACTOR_INV_ALPHA };
+
+struct CompositeFactors {
+    BlendFactor src, dst;
+};
+
+inline CompositeFactors compositeFactors(CompositeMode mode) {
+    static const CompositeFactors table[COMP_MODES] = {
+        { FACTOR_ZERO,      FACTOR_ZERO },          // clear
+        { FACTOR_ONE,       FACTOR_ZERO },          // src
+        { FACTOR_ZERO,      FACTOR_ONE },           // dst
+        { FACTOR_ONE,       FACTOR_INV_ALPHA },     // src-over
+        { FACTOR_INV_ALPHA, FACTOR_ONE },           // dst-over
+        { FACTOR_ALPHA,     FACTOR_ZERO },          // src-in
+        { FACTOR_ZERO,      FACTOR_ALPHA },         // dst-in
+        { FACTOR_INV_ALPHA, FACTOR_ZERO },          // src-out
+        { FACTOR_ZERO,      FACTOR_INV_ALPHA },     // dst-out
+        { FACTOR_ALPHA,     FACTOR_INV_ALPHA },     // src-atop
+        { FACTOR_INV_ALPHA, FACTOR_ALPHA },         // dst-atop
+        { FACTOR_INV_ALPHA, FACTOR_INV_ALPHA },     // xor
+        { FACTOR_ONE,       FACTOR_ONE },           // plus (satura em 255)
+    };
+    return table[mode];
+}
+
+// Fora da camada a origem é transparente, e o destino vira destino * Fb(0):
+// alguns operadores apagam o que a camada não cobre.
+inline bool clearsOutside(CompositeMode mode) {
+    BlendFactor f = compositeFactors(mode).dst;
+    return f == FACTOR_ZERO || f == FACTOR_ALPHA;
+}
+
+const size_t COMPOSITE_TILE_BYTES = 128 * 1024;
+
+/*---------------------------------ESCALAR-----------------------------------*/
+// a*b/255 arredondado, para a e b em 0..255
+inline unsigned mul255(unsigned a, unsigned b) {
+    unsigned t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+template <int F>
+inline unsigned factorTerm(unsigned x, unsigned alpha) {
+    switch (F) {
+        case FACTOR_ZERO:  return 0;
+        case FACTOR_ONE:   return x;
+        case FACTOR_ALPHA: return mul255(x, alpha);
+        default:           return mul255(x, 255 - alpha);
+    }
+}
+
+template <int FA, int FB>
+void blendScalar(const unsigned char *src, unsigned char *dst, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++, src += 4, dst += 4) {
+        unsigned as = src[3], ad = dst[3];
+        for (int c = 0; c < 4; c++) {
+            unsigned v = factorTerm<FA>(src[c], ad) + factorTerm<FB>(dst[c], as);
+            dst[c] = (unsigned char)(v > 255 ? 255 : v);
+        }
+    }
+}
+
+/*-----------------------------------SIMD-------------------------------------*/
+// Pixels expandidos para 16 bits (unpack com zero): dois pixels por 128
+// bits, alfa nas palavras 3 e 7, espalhado pelas quatro com shufflelo/hi.
+// A soma dos dois termos cabe em 16 bits e o packus satura em 255.
+#ifdef PPM_SIMD_X86
+SIMD_TARGET("sse2")
+static inline __m128i mul255_sse2(__m128i a, __m128i b) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+SIMD_TARGET("sse2")
+static inline __m128i alpha_sse2(__m128i px) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xff), 0xff);
+}
+
+template <int F>
+SIMD_TARGET("sse2")
+static inline __m128i factorTerm_sse2(__m128i x, __m128i alpha) {
+    switch (F) {
+        case FACTOR_ZERO:  return _mm_setzero_si128();
+        case FACTOR_ONE:   return x;
+        case FACTOR_ALPHA: return mul255_sse2(x, alpha);
+        default:           return mul255_sse2(x, _mm_sub_epi16(_mm_set1_epi16(255), alpha));
+    }
+}
+
+template <int FA, int FB>
+SIMD_TARGET("sse2")
+static inline __m128i blendWords_sse2(__m128i s, __m128i d) {
+    return _mm_add_epi16(factorTerm_sse2<FA>(s, alpha_sse2(d)), factorTerm_sse2<FB>(d, alpha_sse2(s)));
+}
+
+template <int FA, int FB>
+SIMD_TARGET("sse2")
+static size_t blend_sse2(const unsigned char *src, unsigned char *dst, size_t pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i * 4));
+        __m128i lo = blendWords_sse2<FA, FB>(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+        __m128i hi = blendWords_sse2<FA, FB>(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+SIMD_TARGET("avx2")
+static inline __m256i mul255_avx2(__m256i a, __m256i b) {
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+SIMD_TARGET("avx2")
+static inline __m256i alpha_avx2(__m256i px) {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, 0xff), 0xff);
+}
+
+template <int F>
+SIMD_TARGET("avx2")
+static inline __m256i factorTerm_avx2(__m256i x, __m256i alpha) {
+    switch (F) {
+        case FACTOR_ZERO:  return _mm256_setzero_si256();
+        case FACTOR_ONE:   return x;
+        case FACTOR_ALPHA: return mul255_avx2(x, alpha);
+        default:           return mul255_avx2(x, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha));
+    }
+}
+
+template <int FA, int FB>
+SIMD_TARGET("avx2")
+static inline __m256i blendWords_avx2(__m256i s, __m256i d) {
+    return _mm256_add_epi16(factorTerm_avx2<FA>(s, alpha_avx2(d)), factorTerm_avx2<FB>(d, alpha_avx2(s)));
+}
+
+// unpack e packus trabalham dentro de cada metade de 128 bits, então os
+// 8 pixels voltam na ordem em que foram lidos
+template <int FA, int FB>
+SIMD_TARGET("avx2")
+static size_t blend_avx2(const unsigned char *src, unsigned char *dst, size_t pixels) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i * 4));
+        __m256i lo = blendWords_avx2<FA, FB>(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+        __m256i hi = blendWords_avx2<FA, FB>(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+        _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_packus_epi16(lo, hi));
+    }
+    return i;
+}
+#endif
+
+template <int FA, int FB>
+void blendPixels(const unsigned char *src, unsigned char *dst, size_t pixels) {
+    size_t done = 0;
+#ifdef PPM_SIMD_X86
+    switch (simdLevel()) {
+        case SIMD_AVX512VBMI:
+        case SIMD_AVX512:
+        case SIMD_AVX2:   done = blend_avx2<FA, FB>(src, dst, pixels); break;
+        case SIMD_SSSE3:  done = blend_sse2<FA, FB>(src, dst, pixels); break;
+        default: break;
+    }
+#endif
+    blendScalar<FA, FB>(src + done * 4, dst + done * 4, pixels - done);
+}
+
+// 'src' sobre 'dst', ambos RGBA pré-multiplicado, 'pixels' seguidos
+inline void compositeSpan(CompositeMode mode, const unsigned char *src, unsigned char *dst, size_t pixels) {
+    switch (mode) {
+        case COMP_CLEAR:    memset(dst, 0, pixels * 4); break;
+        case COMP_SRC:      memcpy(dst, src, pixels * 4); break;
+        case COMP_DST:      break;
+        case COMP_SRC_OVER: blendPixels<FACTOR_ONE, FACTOR_INV_ALPHA>(src, dst, pixels); break;
+        case COMP_DST_OVER: blendPixels<FACTOR_INV_ALPHA, FACTOR_ONE>(src, dst, pixels); break;
+        case COMP_SRC_IN:   blendPixels<FACTOR_ALPHA, FACTOR_ZERO>(src, dst, pixels); break;
+        case COMP_DST_IN:   blendPixels<FACTOR_ZERO, FACTOR_ALPHA>(src, dst, pixels); break;
+        case COMP_SRC_OUT:  blendPixels<FACTOR_INV_ALPHA, FACTOR_ZERO>(src, dst, pixels); break;
+        case COMP_DST_OUT:  blendPixels<FACTOR_ZERO, FACTOR_INV_ALPHA>(src, dst, pixels); break;
+        case COMP_SRC_ATOP: blendPixels<FACTOR_ALPHA, FACTOR_INV_ALPHA>(src, dst, pixels); break;
+        case COMP_DST_ATOP: blendPixels<FACTOR_INV_ALPHA, FACTOR_ALPHA>(src, dst, pixels); break;
+        case COMP_XOR:      blendPixels<FACTOR_INV_ALPHA, FACTOR_INV_ALPHA>(src, dst, pixels); break;
+        default:            blendPixels<FACTOR_ONE, FACTOR_ONE>(src, dst, pixels); break;
+    }
+}
+
+/*----------------------------------CAMADAS-----------------------------------*/
+// Imagem RGBA de 8 bits pré-multiplicada, na posição (x, y) da tela
+struct Layer {
+    int width, height;
+    int x, y;
+    CompositeMode mode;
+    vector<unsigned char> rgba;
+
+    Layer() : width(0), height(0), x(0), y(0), mode(COMP_SRC_OVER) {}
+};
+
+// RGBA direto (alfa não multiplicado) para pré-multiplicado, no lugar
+inline void premultiply(unsigned char *rgba, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++, rgba += 4) {
+        unsigned a = rgba[3];
+        rgba[0] = (unsigned char)mul255(rgba[0], a);
+        rgba[1] = (unsigned char)mul255(rgba[1], a);
+        rgba[2] = (unsigned char)mul255(rgba[2], a);
+    }
+}
+
+// Volta para alfa direto, para gravar; alfa 0 fica preto
+inline void unpremultiply(unsigned char *rgba, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++, rgba += 4) {
+        unsigned a = rgba[3];
+        if (a == 255) continue;
+        for (int c = 0; c < 3; c++) {
+            unsigned v = a == 0 ? 0 : (rgba[c] * 255 + a / 2) / a;
+            rgba[c] = (unsigned char)(v > 255 ? 255 : v);
+        }
+    }
+}
+
+// Qualquer PGM/PPM/PAM que openPlanar aceita, reescalado para 8 bits
+inline bool loadLayer(const string &file, Layer &layer) {
+    PlanarImage img;
+    if (!openPlanar(file, img)) return false;
+    layer.width = img.width;
+    layer.height = img.height;
+    layer.rgba.resize(img.pixels() * 4);
+    unsigned maxValue = (unsigned)img.maxValue;
+    parallelRows(img.width, img.height, [&](int y0, int y1) {
+        size_t first = (size_t)y0 * img.width, last = (size_t)y1 * img.width;
+        unsigned char *p = layer.rgba.data() + first * 4;
+        for (size_t i = first; i < last; i++, p += 4) {
+            for (int c = 0; c < 4; c++) {
+                p[c] = (unsigned char)((img.planes[c][i] * 255u + maxValue / 2) / maxValue);
+            }
+        }
+        premultiply(layer.rgba.data() + first * 4, last - first);
+    });
+    return true;
+}
+
+// Camada sobre as linhas [y0, y1) e colunas [x0, x1) da tela
+inline void compositeRect(unsigned char *canvas, int w, const Layer &layer, int x0, int y0, int x1, int y1) {
+    bool clear = clearsOutside(layer.mode);
+    int lx0 = max(x0, layer.x), lx1 = min(x1, layer.x + layer.width);
+    for (int y = y0; y < y1; y++) {
+        unsigned char *row = canvas + (size_t)y * w * 4;
+        bool inside = y >= layer.y && y < layer.y + layer.height && lx0 < lx1;
+        if (!inside) {
+            if (clear) memset(row + (size_t)x0 * 4, 0, (size_t)(x1 - x0) * 4);
+            continue;
+        }
+        if (clear) {
+            memset(row + (size_t)x0 * 4, 0, (size_t)(lx0 - x0) * 4);
+            memset(row + (size_t)lx1 * 4, 0, (size_t)(x1 - lx1) * 4);
+        }
+        const unsigned char *src = layer.rgba.data() + ((size_t)(y - layer.y) * layer.width + (lx0 - layer.x)) * 4;
+        compositeSpan(layer.mode, src, row + (size_t)lx0 * 4, lx1 - lx0);
+    }
+}
+
+// Uma camada de cada vez, cada uma percorrendo a tela inteira
+inline void compositeLayer(unsigned char *canvas, int w, int h, const Layer &layer) {
+    parallelRows(w, h, [&](int y0, int y1) {
+        compositeRect(canvas, w, layer, 0, y0, w, y1);
+    });
+}
+
+// Todas as camadas, em ordem, bloco a bloco
+inline void compositeLayers(unsigned char *canvas, int w, int h, const vector<Layer> &layers) {
+    if (w < 1 || h < 1 || layers.empty()) return;
+    int rows = (int)max(COMPOSITE_TILE_BYTES / ((size_t)w * 4), (size_t)1);
+    int tiles = (h + rows - 1) / rows;
+    threadPool().run(tiles, [&](size_t t) {
+        int y0 = (int)t * rows, y1 = min(y0 + rows, h);
+        for (size_t i = 0; i < layers.size(); i++) compositeRect(canvas, w, layers[i], 0, y0, w, y1);
+    });
+}
+
+#endif
@@ -0,0 +1,340 @@
+// Filtros de vizinhança: blur, gaussiano, sharpen e Sobel.
+//
+// Todos são separáveis: uma passada horizontal e uma vertical. O blur é
+// uma média móvel (box): a soma da janela é atualizada com uma entrada e
+// uma saída por pixel, então o custo não depende do raio. O gaussiano é
+// aproximado por três boxes seguidos.
+//
+// A passada horizontal trabalha linha a linha. A vertical andaria uma
+// coluna inteira por vez, pulando w*3 bytes a cada pixel; em vez disso ela
+// percorre blocos de colunas (até CONV_BLOCK bytes) descendo as linhas,
+// com uma soma por byte do bloco. Blocos largos importam: cada linha do
+// bloco cai em outra página de memória, e blocos estreitos passam mais
+// tempo em faltas de TLB do que somando. Blocos e faixas de linhas são
+// distribuídos entre as threads. Bordas repetem o pixel da borda.
+#ifndef _PPM_CONVOLVE_H_
+#define _PPM_CONVOLVE_H_
+
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+
+using namespace std;
+
+const int CONV_BLOCK = 16384;       // bytes de colunas por bloco (somas de 64 KB, na L2)
+const int CONV_MIN_BAND = 64;       // linhas mínimas por faixa da passada vertical
+
+// Os filtros de ordem (erosão, dilatação, abertura, fechamento e mediana)
+// ficam em ppm_morphology.h, junto com applyNeighborhood().
+enum NeighborhoodType {
+    NEIGHBOR_BLUR, NEIGHBOR_GAUSSIAN, NEIGHBOR_SHARPEN, NEIGHBOR_SOBEL,
+    NEIGHBOR_ERODE, NEIGHBOR_DILATE, NEIGHBOR_OPEN, NEIGHBOR_CLOSE, NEIGHBOR_MEDIAN
+};
+
+struct NeighborhoodOp {
+    NeighborhoodType type;
+    int radius;         // blur e filtros de ordem: raio da janela
+    double sigma;       // gaussiano e sharpen: desvio padrão do desfoque
+    double amount;      // sharpen: intensidade (1 = dobra os detalhes)
+};
+
+// Média da janela arredondada: soma * (1/n) em float. Com n ímpar nunca há
+// empate em .5, e o erro do float fica longe do arredondamento para janelas
+// de até 8191 pixels; o kernel SSE2 faz a mesma conta e dá o mesmo byte.
+struct WindowDivisor {
+    float inv;
+
+    WindowDivisor(int n) : inv(1.0f / n) {}
+
+    unsigned char operator()(int sum) const {
+        return (unsigned char)(int)((float)sum * inv + 0.5f);
+    }
+};
+
+inline int clampIndex(int i, int n) {
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+/*---------------------------------BOX BLUR-----------------------------------*/
+#ifdef PPM_SIMD_X86
+// As três somas (R, G, B) num vetor: um pixel por iteração, gravando 4
+// bytes (o quarto é sobrescrito pelo pixel seguinte, então o último pixel
+// fica para o escalar). Devolve quantos pixels tratou e atualiza as somas.
+SIMD_TARGET("sse2")
+static int boxRow_sse2(unsigned char *row, int w, const unsigned char *in, const unsigned char *out,
+                       int &sr, int &sg, int &sb, float inv) {
+    __m128 vinv = _mm_set1_ps(inv), half = _mm_set1_ps(0.5f);
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setr_epi32(sr, sg, sb, 0);
+    int x = 0;
+    for (; x < w - 1; x++, in += 3, out += 3) {
+        __m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), vinv), half));
+        q = _mm_packus_epi16(_mm_packs_epi32(q, q), zero);
+        int bytes = _mm_cvtsi128_si32(q);
+        memcpy(row + x * 3, &bytes, 4);
+
+        int a, b;
+        memcpy(&a, in, 4);
+        memcpy(&b, out, 4);
+        __m128i va = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(a), zero), zero);
+        __m128i vb = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(b), zero), zero);
+        sum = _mm_add_epi32(sum, _mm_sub_epi32(va, vb));
+    }
+    int s[4];
+    _mm_storeu_si128((__m128i *)s, sum);
+    sr = s[0];
+    sg = s[1];
+    sb = s[2];
+    return x;
+}
+#endif
+
+// Uma linha de 'w' pixels RGB de 'src' para 'row' (podem ser a mesma).
+// 'padded' recebe a linha com radius + 1 cópias do pixel da borda de cada
+// lado, e assim o laço principal não precisa testar os limites.
+inline void boxRow(const unsigned char *src, unsigned char *row, int w, int radius, vector<unsigned char> &padded) {
+    WindowDivisor div(2 * radius + 1);
+    int pad = radius + 1;
+    // um byte a mais no fim: o kernel SSE2 lê 4 bytes por pixel
+    padded.resize(((size_t)w + 2 * pad) * 3 + 1);
+    unsigned char *p = padded.data();
+    memcpy(p + pad * 3, src, (size_t)w * 3);
+    for (int j = 0; j < pad; j++) {
+        memcpy(p + j * 3, src, 3);
+        memcpy(p + (pad + w + j) * 3, src + (w - 1) * 3, 3);
+    }
+    int sr = 0, sg = 0, sb = 0;
+    for (int j = 1; j <= 2 * radius + 1; j++) {
+        sr += p[j * 3];
+        sg += p[j * 3 + 1];
+        sb += p[j * 3 + 2];
+    }
+    const unsigned char *out = p + 3;
+    const unsigned char *in = p + (2 * radius + 2) * 3;
+    int x = 0;
+#ifdef PPM_SIMD_X86
+    if (simdLevel() >= SIMD_SSSE3) {
+        x = boxRow_sse2(row, w, in, out, sr, sg, sb, div.inv);
+        in += x * 3;
+        out += x * 3;
+    }
+#endif
+    for (; x < w; x++, in += 3, out += 3) {
+        row[x * 3] = div(sr);
+        row[x * 3 + 1] = div(sg);
+        row[x * 3 + 2] = div(sb);
+        sr += in[0] - out[0];
+        sg += in[1] - out[1];
+        sb += in[2] - out[2];
+    }
+}
+
+// Passada horizontal de 'src' para 'dst' com os raios de 'radii', em
+// sequência, linha a linha.
+inline void boxHorizontal(const unsigned char *src, unsigned char *dst, int w, int h, const vector<int> &radii) {
+    size_t rowBytes = (size_t)w * 3;
+    parallelRows(w, h, [&](int y0, int y1) {
+        vector<unsigned char> padded;
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *in = src + y * rowBytes;
+            for (size_t i = 0; i < radii.size(); i++) {
+                boxRow(in, dst + y * rowBytes, w, radii[i], padded);
+                in = dst + y * rowBytes;
+            }
+        }
+    });
+}
+
+#ifdef PPM_SIMD_X86
+// Uma linha de um bloco da passada vertical, 16 colunas por vez: grava a
+// média atual e troca a linha que sai da janela pela que entra.
+SIMD_TARGET("sse2")
+static size_t boxStep_sse2(const unsigned char *in, const unsigned char *out, unsigned char *d,
+                           int *sum, size_t width, float inv) {
+    __m128 vinv = _mm_set1_ps(inv), half = _mm_set1_ps(0.5f);
+    __m128i zero = _mm_setzero_si128();
+    size_t c = 0;
+    for (; c + 16 <= width; c += 16) {
+        __m128i s[4], q[4];
+        for (int k = 0; k < 4; k++) {
+            s[k] = _mm_loadu_si128((const __m128i *)(sum + c + k * 4));
+            q[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(s[k]), vinv), half));
+        }
+        __m128i avg = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+        _mm_storeu_si128((__m128i *)(d + c), avg);
+
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + c));
+        __m128i b = _mm_loadu_si128((const __m128i *)(out + c));
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        s[0] = _mm_add_epi32(s[0], _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16));
+        s[1] = _mm_add_epi32(s[1], _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16));
+        s[2] = _mm_add_epi32(s[2], _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16));
+        s[3] = _mm_add_epi32(s[3], _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16));
+        for (int k = 0; k < 4; k++) _mm_storeu_si128((__m128i *)(sum + c + k * 4), s[k]);
+    }
+    return c;
+}
+#endif
+
+inline void boxStep(const unsigned char *in, const unsigned char *out, unsigned char *d,
+                    int *sum, size_t width, const WindowDivisor &div) {
+    size_t c = 0;
+#ifdef PPM_SIMD_X86
+    if (simdLevel() >= SIMD_SSSE3) c = boxStep_sse2(in, out, d, sum, width, div.inv);
+#endif
+    for (; c < width; c++) {
+        d[c] = div(sum[c]);
+        sum[c] += in[c] - out[c];
+    }
+}
+
+// Passada vertical de 'src' para 'dst' nas colunas [c0, c1) (em bytes) e
+// linhas [y0, y1).
+inline void boxColumns(const unsigned char *src, unsigned char *dst, size_t rowBytes, int h,
+                       int radius, size_t c0, size_t c1, int y0, int y1) {
+    WindowDivisor div(2 * radius + 1);
+    size_t width = c1 - c0;
+    int sum[CONV_BLOCK];
+    for (size_t c = 0; c < width; c++) sum[c] = 0;
+    for (int k = y0 - radius; k <= y0 + radius; k++) {
+        const unsigned char *row = src + clampIndex(k, h) * rowBytes + c0;
+        for (size_t c = 0; c < width; c++) sum[c] += row[c];
+    }
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *in = src + clampIndex(y + radius + 1, h) * rowBytes + c0;
+        const unsigned char *out = src + clampIndex(y - radius, h) * rowBytes + c0;
+        boxStep(in, out, dst + y * rowBytes + c0, sum, width, div);
+    }
+}
+
+// Divide a imagem em blocos de colunas e, se forem poucos para as threads,
+// também em faixas de linhas; chama fn(c0, c1, y0, y1) para cada pedaço.
+template <class F>
+void parallelColumnBlocks(size_t rowBytes, int h, F fn) {
+    size_t blocks = (rowBytes + CONV_BLOCK - 1) / CONV_BLOCK;
+    size_t wanted = (size_t)threadPool().size() * 4;
+    int bands = 1;
+    if (blocks < wanted) bands = (int)((wanted + blocks - 1) / blocks);
+    if (bands > h / CONV_MIN_BAND) bands = h / CONV_MIN_BAND;
+    if (bands < 1) bands = 1;
+    int bandRows = (h + bands - 1) / bands;
+    threadPool().run(blocks * bands, [&](size_t t) {
+        size_t block = t % blocks;
+        int band = (int)(t / blocks);
+        size_t c0 = block * CONV_BLOCK;
+        size_t c1 = c0 + CONV_BLOCK < rowBytes ? c0 + CONV_BLOCK : rowBytes;
+        int y0 = band * bandRows;
+        int y1 = y0 + bandRows < h ? y0 + bandRows : h;
+        if (y0 < y1) fn(c0, c1, y0, y1);
+    });
+}
+
+// Boxes em sequência com os raios de 'radii', nas duas direções. As
+// passadas verticais alternam entre 'data' e uma imagem temporária; a
+// horizontal grava já onde a primeira vertical lê, para que a última
+// termine em 'data' sem cópia no fim.
+inline void boxPasses(unsigned char *data, int w, int h, const vector<int> &radii) {
+    if (w < 1 || h < 1 || radii.empty()) return;
+    size_t rowBytes = (size_t)w * 3;
+    unique_ptr<unsigned char[]> tmp(new unsigned char [rowBytes * h]);
+    unsigned char *src = radii.size() % 2 ? tmp.get() : data;
+    unsigned char *dst = radii.size() % 2 ? data : tmp.get();
+    boxHorizontal(data, src, w, h, radii);
+
+    for (size_t i = 0; i < radii.size(); i++) {
+        int radius = radii[i];
+        parallelColumnBlocks(rowBytes, h, [&](size_t c0, size_t c1, int y0, int y1) {
+            boxColumns(src, dst, rowBytes, h, radius, c0, c1, y0, y1);
+        });
+        swap(src, dst);
+    }
+}
+
+inline void boxBlur(unsigned char *data, int w, int h, int radius) {
+    if (radius > 0) boxPasses(data, w, h, vector<int>(1, radius));
+}
+
+/*---------------------------------GAUSSIANO----------------------------------*/
+// Raios de 'n' boxes cuja sequência tem a mesma variância que um gaussiano
+// de desvio 'sigma' (larguras ímpares wl e wl+2, misturadas).
+inline vector<int> gaussianBoxes(double sigma, int n) {
+    double wIdeal = sqrt(12.0 * sigma * sigma / n + 1.0);
+    int wl = (int)floor(wIdeal);
+    if (wl % 2 == 0) wl--;
+    int wu = wl + 2;
+    double mIdeal = (12.0 * sigma * sigma - n * wl * wl - 4.0 * n * wl - 3.0 * n) / (-4.0 * wl - 4.0);
+    int m = (int)floor(mIdeal + 0.5);
+    vector<int> radii;
+    for (int i = 0; i < n; i++) {
+        int width = i < m ? wl : wu;
+        if (width > 1) radii.push_back((width - 1) / 2);
+    }
+    return radii;
+}
+
+inline void gaussianBlur(unsigned char *data, int w, int h, double sigma) {
+    if (sigma > 0) boxPasses(data, w, h, gaussianBoxes(sigma, 3));
+}
+
+/*----------------------------------SHARPEN-----------------------------------*/
+// Máscara de nitidez: realça a diferença entre a imagem e o gaussiano dela.
+inline void sharpen(unsigned char *data, int w, int h, double sigma, double amount) {
+    size_t bytes = (size_t)w * h * 3;
+    vector<unsigned char> blurred(data, data + bytes);
+    gaussianBlur(blurred.data(), w, h, sigma);
+    int a = (int)floor(amount * 256.0 + 0.5);
+    size_t rowBytes = (size_t)w * 3;
+    parallelRows(w, h, [&](int y0, int y1) {
+        unsigned char *d = data + y0 * rowBytes;
+        const unsigned char *b = blurred.data() + y0 * rowBytes;
+        size_t n = (y1 - y0) * rowBytes;
+        for (size_t i = 0; i < n; i++) {
+            int v = d[i] + (d[i] - b[i]) * a / 256;
+            d[i] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    });
+}
+
+/*-----------------------------------SOBEL------------------------------------*/
+// Magnitude do gradiente da luminância, em cinza. Os núcleos 3x3 são
+// separados em [1 2 1] e [-1 0 1]: primeiro nas colunas (três linhas de
+// luminância viram duas linhas de somas), depois ao longo da linha.
+inline void sobel(unsigned char *data, int w, int h) {
+    if (w < 1 || h < 1) return;
+    size_t rowBytes = (size_t)w * 3;
+    vector<unsigned char> luma((size_t)w * h);
+    parallelRows(w, h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *p = data + y * rowBytes;
+            unsigned char *l = luma.data() + (size_t)y * w;
+            for (int x = 0; x < w; x++) l[x] = (unsigned char)grayValue(p[x * 3], p[x * 3 + 1], p[x * 3 + 2], false);
+        }
+    });
+    parallelRows(w, h, [&](int y0, int y1) {
+        vector<int> smooth(w), diff(w);
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *up = luma.data() + (size_t)clampIndex(y - 1, h) * w;
+            const unsigned char *mid = luma.data() + (size_t)y * w;
+            const unsigned char *down = luma.data() + (size_t)clampIndex(y + 1, h) * w;
+            for (int x = 0; x < w; x++) {
+                smooth[x] = up[x] + 2 * mid[x] + down[x];
+                diff[x] = down[x] - up[x];
+            }
+            unsigned char *d = data + y * rowBytes;
+            for (int x = 0; x < w; x++) {
+                int l = clampIndex(x - 1, w), r = clampIndex(x + 1, w);
+                int gx = smooth[r] - smooth[l];
+                int gy = diff[l] + 2 * diff[x] + diff[r];
+                int m = (int)sqrtf((float)(gx * gx + gy * gy));
+                d[x * 3] = d[x * 3 + 1] = d[x * 3 + 2] = (unsigned char)(m > 255 ? 255 : m);
+            }
+        }
+    });
+}
+
+#endif
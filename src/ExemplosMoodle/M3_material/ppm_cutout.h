@@ -0,0 +1,326 @@
+// Recorte por chroma-key com limpeza da máscara.
+//
+// O chroma-key pixel a pixel (ppm_simd.h) deixa pontos soltos: pixels do
+// fundo que fogem da tolerância e pixels do objeto que caem nela. Aqui a
+// chave vira uma máscara (255 = objeto, 0 = fundo), os componentes conexos
+// da máscara são rotulados, e os pequenos demais trocam de lado: ilhas do
+// objeto com menos de 'minArea' pixels viram fundo e buracos do fundo
+// menores que isso viram objeto. O resultado é o recorte RGBA, com a
+// máscara no alfa, ou a imagem com o fundo em preto como no chroma-key.
+//
+// Rotulagem com union-find em paralelo sobre as sequências horizontais
+// de cada linha: cada thread acha e une as sequências de uma faixa de
+// linhas, só com índices da própria faixa; depois as emendas entre faixas
+// são unidas (poucas linhas, serial) e cada faixa resolve a raiz de suas
+// sequências e soma as áreas. A raiz de um componente é sempre a sua
+// primeira sequência, então o resultado não depende das threads.
+// Objeto em vizinhança-8 e fundo em vizinhança-4, para que um não
+// atravesse o outro na diagonal.
+#ifndef _PPM_CUTOUT_H_
+#define _PPM_CUTOUT_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include "ppm_io.h"
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+#include "ppm_png.h"
+
+using namespace std;
+
+struct CutoutOp {
+    int r, g, b;    // cor-chave
+    int thr;        // limiar, de chromaKeyThreshold()
+    int minArea;    // componentes menores que isso trocam de lado
+};
+
+const int CUTOUT_MIN_AREA = 64;
+
+/*-----------------------------------MÁSCARA----------------------------------*/
+// O mesmo teste do chroma-key (keyMask16 de ppm_simd.h), mas gravando um
+// byte de máscara por pixel em vez de zerar o pixel.
+inline void keyMaskScalar(const unsigned char *data, size_t pixels, const CutoutOp &op, unsigned char *mask) {
+    for (size_t i = 0; i < pixels; i++) {
+        const unsigned char *p = data + i * 3;
+        int dr = p[0] - op.r, dg = p[1] - op.g, db = p[2] - op.b;
+        mask[i] = dr * dr + dg * dg + db * db < op.thr ? 0 : 255;
+    }
+}
+
+#ifdef PPM_SIMD_X86
+SIMD_TARGET("ssse3")
+static size_t keyMask_ssse3(const unsigned char *data, size_t pixels, const CutoutOp &op, unsigned char *mask) {
+    const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8((char)0xff);
+    const __m128i vr = _mm_set1_epi16((short)op.r), vg = _mm_set1_epi16((short)op.g), vb = _mm_set1_epi16((short)op.b);
+    const __m128i vt = _mm_set1_epi32(op.thr);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i a, b, c, r, g, bl;
+        load3_ssse3(data + i * 3, a, b, c);
+        deinterleave_ssse3(a, b, c, r, g, bl);
+        __m128i lo = keyMask16_ssse3(_mm_sub_epi16(_mm_unpacklo_epi8(r, zero), vr),
+                                  _mm_sub_epi16(_mm_unpacklo_epi8(g, zero), vg),
+                                  _mm_sub_epi16(_mm_unpacklo_epi8(bl, zero), vb), vt);
+        __m128i hi = keyMask16_ssse3(_mm_sub_epi16(_mm_unpackhi_epi8(r, zero), vr),
+                                  _mm_sub_epi16(_mm_unpackhi_epi8(g, zero), vg),
+                                  _mm_sub_epi16(_mm_unpackhi_epi8(bl, zero), vb), vt);
+        _mm_storeu_si128((__m128i *)(mask + i), _mm_xor_si128(_mm_packs_epi16(lo, hi), ones));
+    }
+    return i;
+}
+
+SIMD_TARGET("avx2")
+static size_t keyMask_avx2(const unsigned char *data, size_t pixels, const CutoutOp &op, unsigned char *mask) {
+    const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi8((char)0xff);
+    const __m256i vr = _mm256_set1_epi16((short)op.r), vg = _mm256_set1_epi16((short)op.g), vb = _mm256_set1_epi16((short)op.b);
+    const __m256i vt = _mm256_set1_epi32(op.thr);
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32) {
+        // cada faixa de 128 bits tem 16 pixels seguidos, então a máscara
+        // empacotada já sai na ordem dos pixels
+        __m256i a, b, c, r, g, bl;
+        load3_avx2(data + i * 3, a, b, c);
+        deinterleave_avx2(a, b, c, r, g, bl);
+        __m256i lo = keyMask16_avx2(_mm256_sub_epi16(_mm256_unpacklo_epi8(r, zero), vr),
+                                  _mm256_sub_epi16(_mm256_unpacklo_epi8(g, zero), vg),
+                                  _mm256_sub_epi16(_mm256_unpacklo_epi8(bl, zero), vb), vt);
+        __m256i hi = keyMask16_avx2(_mm256_sub_epi16(_mm256_unpackhi_epi8(r, zero), vr),
+                                  _mm256_sub_epi16(_mm256_unpackhi_epi8(g, zero), vg),
+                                  _mm256_sub_epi16(_mm256_unpackhi_epi8(bl, zero), vb), vt);
+        _mm256_storeu_si256((__m256i *)(mask + i), _mm256_xor_si256(_mm256_packs_epi16(lo, hi), ones));
+    }
+    return i;
+}
+#endif
+
+inline void keyMaskPixels(const unsigned char *data, size_t pixels, const CutoutOp &op, unsigned char *mask) {
+    size_t done = 0;
+#ifdef PPM_SIMD_X86
+    switch (simdLevel()) {
+        case SIMD_AVX512VBMI:
+        case SIMD_AVX512:
+        case SIMD_AVX2:   done = keyMask_avx2(data, pixels, op, mask); break;
+        case SIMD_SSSE3:  done = keyMask_ssse3(data, pixels, op, mask); break;
+        default: break;
+    }
+#endif
+    keyMaskScalar(data + done * 3, pixels - done, op, mask + done);
+}
+
+inline void keyMask(const unsigned char *data, int w, int h, const CutoutOp &op, unsigned char *mask) {
+    parallelRows(w, h, [&](int y0, int y1) {
+        keyMaskPixels(data + (size_t)y0 * w * 3, (size_t)(y1 - y0) * w, op, mask + (size_t)y0 * w);
+    });
+}
+
+/*----------------------------------ROTULAGEM---------------------------------*/
+// Sequência horizontal de pixels com o mesmo valor na máscara: [x0, x1)
+// na linha y. O union-find trabalha com sequências, não com pixels: num
+// quadro de chroma-key elas são longas, e há poucas por linha.
+struct MaskRun {
+    int x0, x1, y;
+};
+
+inline int32_t findRoot(vector<int32_t> &parent, int32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// a raiz maior aponta para a menor
+inline void unite(vector<int32_t> &parent, int32_t a, int32_t b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+// Une as sequências [first, last) de uma linha às [prevFirst, prevLast)
+// da linha de cima que encostam nelas (na diagonal também, se 'diagonal').
+inline void uniteRows(const vector<MaskRun> &runs, vector<int32_t> &parent, int32_t prevFirst, int32_t prevLast,
+                      int32_t first, int32_t last, bool diagonal) {
+    int reach = diagonal ? 1 : 0;
+    int32_t j = prevFirst;
+    for (int32_t i = first; i < last; i++) {
+        while (j < prevLast && runs[j].x1 + reach <= runs[i].x0) j++;
+        for (int32_t k = j; k < prevLast && runs[k].x0 < runs[i].x1 + reach; k++) unite(parent, i, k);
+    }
+}
+
+// Componentes dos pixels com mask == value menores que minArea passam a
+// 'replacement'.
+inline void removeSmallComponents(unsigned char *mask, int w, int h, unsigned char value, unsigned char replacement,
+                                  bool diagonal, int minArea) {
+    int bands = threadPool().size();
+    if (bands > h) bands = h;
+    if (bands < 1) return;
+    vector<int> bandStart(bands + 1);
+    for (int b = 0; b <= bands; b++) bandStart[b] = (int)((int64_t)h * b / bands);
+
+    // sequências de cada linha, faixa por faixa
+    vector<vector<MaskRun>> bandRuns(bands);
+    vector<int32_t> rowStart(h + 1);
+    threadPool().run(bands, [&](size_t b) {
+        vector<MaskRun> &runs = bandRuns[b];
+        for (int y = bandStart[b]; y < bandStart[b + 1]; y++) {
+            const unsigned char *row = mask + (size_t)y * w;
+            rowStart[y] = (int32_t)runs.size();
+            int x = 0;
+            while (x < w) {
+                while (x < w && row[x] != value) x++;
+                if (x == w) break;
+                MaskRun run = { x, x, y };
+                while (x < w && row[x] == value) x++;
+                run.x1 = x;
+                runs.push_back(run);
+            }
+        }
+    });
+    vector<int32_t> offset(bands + 1, 0);
+    for (int b = 0; b < bands; b++) offset[b + 1] = offset[b] + (int32_t)bandRuns[b].size();
+    int32_t total = offset[bands];
+    if (total == 0) return;
+    vector<MaskRun> runs(total);
+    vector<int32_t> parent(total);
+    unique_ptr<atomic<uint32_t>[]> area(new atomic<uint32_t>[total]);
+
+    // cada faixa une as suas sequências, só com índices da própria faixa
+    threadPool().run(bands, [&](size_t b) {
+        int32_t base = offset[b];
+        copy(bandRuns[b].begin(), bandRuns[b].end(), runs.begin() + base);
+        for (int32_t i = base; i < offset[b + 1]; i++) {
+            parent[i] = i;
+            area[i].store(0, memory_order_relaxed);
+        }
+        int y0 = bandStart[b], y1 = bandStart[b + 1];
+        for (int y = y0; y < y1; y++) rowStart[y] += base;
+        for (int y = y0 + 1; y < y1; y++) {
+            int32_t rowEnd = y + 1 < y1 ? rowStart[y + 1] : offset[b + 1];
+            uniteRows(runs, parent, rowStart[y - 1], rowStart[y], rowStart[y], rowEnd, diagonal);
+        }
+    });
+    rowStart[h] = total;
+
+    // emendas: a primeira linha de cada faixa com a última da anterior
+    for (int b = 1; b < bands; b++) {
+        int y = bandStart[b];
+        uniteRows(runs, parent, rowStart[y - 1], rowStart[y], rowStart[y], rowStart[y + 1], diagonal);
+    }
+
+    // área de cada raiz (só leitura de 'parent') e depois a troca
+    threadPool().run(bands, [&](size_t b) {
+        for (int32_t i = offset[b]; i < offset[b + 1]; i++) {
+            int32_t root = i;
+            while (parent[root] != root) root = parent[root];
+            area[root].fetch_add((uint32_t)(runs[i].x1 - runs[i].x0), memory_order_relaxed);
+        }
+    });
+    threadPool().run(bands, [&](size_t b) {
+        for (int32_t i = offset[b]; i < offset[b + 1]; i++) {
+            int32_t root = i;
+            while (parent[root] != root) root = parent[root];
+            if (area[root].load(memory_order_relaxed) >= (uint32_t)minArea) continue;
+            memset(mask + (size_t)runs[i].y * w + runs[i].x0, replacement, runs[i].x1 - runs[i].x0);
+        }
+    });
+}
+
+// Tira as ilhas do objeto e depois tapa os buracos do fundo.
+inline void cleanMask(unsigned char *mask, int w, int h, int minArea) {
+    if (minArea <= 1 || w < 1 || h < 1) return;
+    removeSmallComponents(mask, w, h, 255, 0, true, minArea);
+    removeSmallComponents(mask, w, h, 0, 255, false, minArea);
+}
+
+inline vector<unsigned char> cutoutMask(const unsigned char *data, int w, int h, const CutoutOp &op) {
+    vector<unsigned char> mask((size_t)w * h);
+    keyMask(data, w, h, op, mask.data());
+    cleanMask(mask.data(), w, h, op.minArea);
+    return mask;
+}
+
+/*-----------------------------------SAÍDA------------------------------------*/
+// Fundo em preto, como o chroma-key, mas com a máscara limpa.
+inline void applyCutout(const CutoutOp &op, unsigned char *data, int w, int h) {
+    vector<unsigned char> mask = cutoutMask(data, w, h, op);
+    parallelRows(w, h, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * w; i < (size_t)y1 * w; i++) {
+            if (mask[i] == 0) data[i * 3] = data[i * 3 + 1] = data[i * 3 + 2] = 0;
+        }
+    });
+}
+
+// RGBA com a máscara no alfa; o fundo também fica com RGB zerado, o que
+// comprime melhor e evita a cor-chave vazando em quem ignora o alfa.
+inline void rgbaScalar(const unsigned char *data, const unsigned char *mask, size_t pixels, unsigned char *rgba) {
+    for (size_t i = 0; i < pixels; i++) {
+        unsigned char a = mask[i];
+        rgba[i * 4] = data[i * 3] & a;
+        rgba[i * 4 + 1] = data[i * 3 + 1] & a;
+        rgba[i * 4 + 2] = data[i * 3 + 2] & a;
+        rgba[i * 4 + 3] = a;
+    }
+}
+
+#ifdef PPM_SIMD_X86
+// 4 pixels por vetor: RGB espalhado em RGB_ (pshufb), alfa ligado e tudo
+// mascarado com o byte da máscara repetido 4 vezes. Cada leitura de 16
+// bytes passa 4 bytes dos 4 pixels, daí a folga no fim.
+SIMD_TARGET("ssse3")
+static size_t rgba_ssse3(const unsigned char *data, const unsigned char *mask, size_t pixels, unsigned char *rgba) {
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i repeat = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    size_t i = 0;
+    for (; i + 18 <= pixels; i += 16) {
+        __m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+        for (int k = 0; k < 4; k++) {
+            __m128i px = _mm_loadu_si128((const __m128i *)(data + (i + 4 * k) * 3));
+            px = _mm_or_si128(_mm_shuffle_epi8(px, spread), alpha);
+            __m128i mk = _mm_shuffle_epi8(m, _mm_add_epi8(repeat, _mm_set1_epi8((char)(4 * k))));
+            _mm_storeu_si128((__m128i *)(rgba + (i + 4 * k) * 4), _mm_and_si128(px, mk));
+        }
+    }
+    return i;
+}
+#endif
+
+inline void cutoutRGBA(const unsigned char *data, int w, int h, const unsigned char *mask, unsigned char *rgba) {
+    parallelRows(w, h, [&](int y0, int y1) {
+        size_t first = (size_t)y0 * w, pixels = (size_t)(y1 - y0) * w, done = 0;
+#ifdef PPM_SIMD_X86
+        if (simdLevel() >= SIMD_SSSE3) done = rgba_ssse3(data + first * 3, mask + first, pixels, rgba + first * 4);
+#endif
+        rgbaScalar(data + (first + done) * 3, mask + first + done, pixels - done, rgba + (first + done) * 4);
+    });
+}
+
+// PNG RGBA se o nome terminar em .png, QOIC RGBA se em .qoic; senão P7
+// RGB_ALPHA.
+inline bool saveRGBA(const string &file, const unsigned char *rgba, int w, int h) {
+    if (isPNGFile(file)) return writePNG(file, rgba, w, h, 4, 8);
+    if (isQOICFile(file)) return writeQOIC(file, rgba, w, h, 4, threadPool());
+    FILE *f = openForReplace(file);
+    bool ok = f != NULL;
+    if (ok) {
+        size_t length = (size_t)w * h * 4;
+        fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", w, h);
+        ok = fwrite(rgba, 1, length, f) == length;
+        ok = finishReplace(f, file, ok);
+    }
+    if (!ok) fprintf(stderr, "Erro ao gravar %s\n", file.c_str());
+    return ok;
+}
+
+#endif
@@ -0,0 +1,190 @@
+// Filtros por histograma: auto-levels, contrast stretch e equalização.
+//
+// Cada um é uma passada de leitura que conta os valores e uma passada que
+// aplica uma tabela por canal (PIXEL_LUT, ppm_lut.h) montada a partir da
+// contagem. A contagem é paralela sem atômicos: a imagem é dividida em uma
+// faixa de linhas por thread, cada thread conta no seu próprio histograma
+// e no fim os histogramas são somados (3 x 256 somas por thread).
+//
+// Dentro de uma thread, pixels seguidos costumam ter o mesmo valor, e
+// incrementar o mesmo contador em seguida faz cada incremento esperar o
+// anterior. Por isso a contagem alterna entre HIST_COPIES cópias do
+// histograma, somadas no fim da faixa.
+#ifndef _PPM_HISTOGRAM_H_
+#define _PPM_HISTOGRAM_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include "ppm_simd.h"
+#include "ppm_lut.h"
+#include "ppm_parallel.h"
+
+using namespace std;
+
+const int HIST_COPIES = 4;
+
+enum HistogramType { HIST_LEVELS, HIST_STRETCH, HIST_EQUALIZE };
+
+struct HistogramOp {
+    HistogramType type;
+    double clip;        // levels/stretch: fração ignorada em cada ponta (0.005 = 0,5%)
+};
+
+struct Histogram {
+    uint32_t counts[3][256];
+    size_t pixels;
+
+    Histogram() {
+        clear();
+    }
+
+    void clear() {
+        memset(counts, 0, sizeof(counts));
+        pixels = 0;
+    }
+
+    void add(const Histogram &other) {
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < 256; v++) counts[c][v] += other.counts[c][v];
+        }
+        pixels += other.pixels;
+    }
+};
+
+// Conta 'pixels' pixels RGB em 'hist' (que não é zerado).
+inline void countPixels(const unsigned char *data, size_t pixels, Histogram &hist) {
+    vector<uint32_t> copies(HIST_COPIES * 768, 0);
+    uint32_t *t = copies.data();
+    size_t i = 0;
+    for (; i + HIST_COPIES <= pixels; i += HIST_COPIES) {
+        const unsigned char *p = data + i * 3;
+        for (int k = 0; k < HIST_COPIES; k++) {
+            uint32_t *copy = t + k * 768;
+            copy[p[k * 3]]++;
+            copy[256 + p[k * 3 + 1]]++;
+            copy[512 + p[k * 3 + 2]]++;
+        }
+    }
+    for (; i < pixels; i++) {
+        t[data[i * 3]]++;
+        t[256 + data[i * 3 + 1]]++;
+        t[512 + data[i * 3 + 2]]++;
+    }
+    for (int k = 0; k < HIST_COPIES; k++) {
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < 256; v++) hist.counts[c][v] += t[k * 768 + c * 256 + v];
+        }
+    }
+    hist.pixels += pixels;
+}
+
+// Histograma da imagem inteira: uma faixa de linhas e um histograma por
+// thread, somados no fim.
+inline Histogram computeHistogram(const unsigned char *data, int w, int h) {
+    int parts = threadPool().size();
+    if (parts > h) parts = h;
+    if (parts < 1) parts = 1;
+    vector<Histogram> partial(parts);
+    threadPool().run(parts, [&](size_t t) {
+        int y0 = (int)((int64_t)h * t / parts);
+        int y1 = (int)((int64_t)h * (t + 1) / parts);
+        countPixels(data + (size_t)y0 * w * 3, (size_t)(y1 - y0) * w, partial[t]);
+    });
+    Histogram total;
+    for (int t = 0; t < parts; t++) total.add(partial[t]);
+    return total;
+}
+
+/*-----------------------------------TABELAS----------------------------------*/
+// As funções abaixo valem para valores de 0 a 'top': 255 aqui e maxValue
+// nos planos de 16 bits (ppm_planar.h).
+
+// Menor e maior valor depois de ignorar 'clip' dos pixels em cada ponta.
+inline void clippedRange(const uint32_t *counts, int top, size_t total, double clip, int &lo, int &hi) {
+    size_t skip = (size_t)(total * clip);
+    size_t seen = 0;
+    for (lo = 0; lo < top; lo++) {
+        seen += counts[lo];
+        if (seen > skip) break;
+    }
+    seen = 0;
+    for (hi = top; hi > 0; hi--) {
+        seen += counts[hi];
+        if (seen > skip) break;
+    }
+}
+
+// Estica [lo, hi] para [0, top].
+template <class T>
+void stretchTable(T *table, int top, int lo, int hi) {
+    for (int v = 0; v <= top; v++) {
+        if (hi <= lo) {
+            table[v] = (T)v;
+        } else {
+            int64_t s = ((int64_t)(v - lo) * top * 2 + (hi - lo)) / (2 * (hi - lo));
+            if (v < lo) s = 0;
+            table[v] = (T)(s > top ? top : s);
+        }
+    }
+}
+
+// cdf(v) do menor valor presente vira 0 e a do maior vira 'top'
+template <class T>
+void equalizeTable(T *table, int top, const uint32_t *all, size_t total) {
+    size_t cdf = 0, first = 0;
+    for (int v = 0; v <= top; v++) {
+        cdf += all[v];
+        if (first == 0) first = cdf;
+        size_t range = total - first;
+        table[v] = range == 0 ? (T)v : (T)(((uint64_t)(cdf - first) * top + range / 2) / range);
+    }
+}
+
+// Tabela por canal (canal c em table[c * 256 + v]).
+//   levels:   cada canal esticado separadamente (corrige também dominantes
+//             de cor);
+//   stretch:  o mesmo intervalo nos três canais, contando todos juntos, o
+//             que preserva o equilíbrio de cor;
+//   equalize: distribuição acumulada dos três canais juntos, a mesma
+//             tabela para todos.
+inline void histogramTable(const HistogramOp &op, const Histogram &hist, unsigned char *table) {
+    uint32_t all[256];
+    for (int v = 0; v < 256; v++) all[v] = hist.counts[0][v] + hist.counts[1][v] + hist.counts[2][v];
+    size_t total = hist.pixels * 3;
+
+    if (op.type == HIST_LEVELS) {
+        for (int c = 0; c < 3; c++) {
+            int lo, hi;
+            clippedRange(hist.counts[c], 255, hist.pixels, op.clip, lo, hi);
+            stretchTable(table + c * 256, 255, lo, hi);
+        }
+        return;
+    }
+    if (op.type == HIST_STRETCH) {
+        int lo, hi;
+        clippedRange(all, 255, total, op.clip, lo, hi);
+        stretchTable(table, 255, lo, hi);
+    } else {
+        equalizeTable(table, 255, all, total);
+    }
+    memcpy(table + 256, table, 256);
+    memcpy(table + 512, table, 256);
+}
+
+// Conta a imagem e devolve o passo PIXEL_LUT que aplica o filtro; a
+// tabela fica em 'tables'.
+inline PixelOp histogramPixelOp(const HistogramOp &op, const unsigned char *data, int w, int h,
+                                vector<LutStorage> &tables) {
+    Histogram hist = computeHistogram(data, w, h);
+    LutStorage t(new vector<unsigned char>(768));
+    histogramTable(op, hist, t->data());
+    tables.push_back(t);
+    PixelOp lut = {};
+    lut.type = PIXEL_LUT;
+    lut.lut = t->data();
+    return lut;
+}
+
+#endif
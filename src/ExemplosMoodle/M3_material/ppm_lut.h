@@ -0,0 +1,120 @@
+// Compilação de operações pontuais em tabelas por canal.
+//
+// Passos que tratam cada canal isoladamente (negative, colorize, tabelas de
+// outros filtros) são compostos em uma única função de 8 bits por canal.
+// Se a composição só usa AND/OR/XOR com constantes, cada bit de saída é
+// uma cópia, uma inversão ou uma constante do bit de entrada, e o passo
+// inteiro vira (v & keep) ^ flip: duas instruções por vetor, na velocidade
+// de um memcpy. Senão vira três tabelas de 256 entradas (PIXEL_LUT).
+//
+// Passos que misturam canais (gray-scale, chroma-key) continuam como
+// conta em registrador dentro da passada fundida: eles são somas
+// separáveis por canal, e uma tabela 3D exata teria 2^24 entradas.
+#ifndef _PPM_LUT_H_
+#define _PPM_LUT_H_
+
+#include <string.h>
+#include <vector>
+#include <memory>
+#include "ppm_simd.h"
+
+using namespace std;
+
+typedef shared_ptr<vector<unsigned char>> LutStorage;
+
+inline bool isChannelOp(PixelOpType type) {
+    return type == PIXEL_COLORIZE || type == PIXEL_NEGATIVE || type == PIXEL_BITWISE || type == PIXEL_LUT;
+}
+
+// Função por canal acumulada durante a compilação.
+struct ChannelMap {
+    bool bitwise;               // ainda é (v & keep) ^ flip
+    unsigned char keep[3], flip[3];
+    unsigned char table[768];   // a mesma função em tabela, sempre em dia
+
+    ChannelMap() {
+        reset();
+    }
+
+    void reset() {
+        bitwise = true;
+        for (int c = 0; c < 3; c++) {
+            keep[c] = 0xff;
+            flip[c] = 0;
+            for (int v = 0; v < 256; v++) table[c * 256 + v] = (unsigned char)v;
+        }
+    }
+
+    bool isIdentity() const {
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < 256; v++) {
+                if (table[c * 256 + v] != v) return false;
+            }
+        }
+        return true;
+    }
+
+    // compõe 'op' depois da função atual
+    void then(const PixelOp &op) {
+        int color[3] = { op.r, op.g, op.b };
+        for (int c = 0; c < 3; c++) {
+            unsigned char k = 0xff, f = 0;
+            if (op.type == PIXEL_NEGATIVE) {
+                f = 0xff;
+            } else if (op.type == PIXEL_COLORIZE) {
+                // v | x == (v & ~x) ^ x
+                k = (unsigned char)~color[c];
+                f = (unsigned char)color[c];
+            } else if (op.type == PIXEL_BITWISE) {
+                k = op.keep[c];
+                f = op.flip[c];
+            }
+            unsigned char *t = table + c * 256;
+            if (op.type == PIXEL_LUT) {
+                bitwise = false;
+                for (int v = 0; v < 256; v++) t[v] = op.lut[c * 256 + t[v]];
+            } else {
+                keep[c] = keep[c] & k;
+                flip[c] = (flip[c] & k) ^ f;
+                for (int v = 0; v < 256; v++) t[v] = (t[v] & k) ^ f;
+            }
+        }
+    }
+
+    // Passo equivalente; as tabelas, se houver, ficam em 'tables'.
+    PixelOp toOp(vector<LutStorage> &tables) const {
+        PixelOp op = {};
+        op.type = PIXEL_BITWISE;
+        memcpy(op.keep, keep, 3);
+        memcpy(op.flip, flip, 3);
+        if (!bitwise) {
+            LutStorage t(new vector<unsigned char>(table, table + 768));
+            tables.push_back(t);
+            op.type = PIXEL_LUT;
+            op.lut = t->data();
+        }
+        return op;
+    }
+};
+
+// Junta cada sequência de passos por canal de 'ops' em um só passo.
+inline vector<PixelOp> compilePixelOps(const vector<PixelOp> &ops, vector<LutStorage> &tables) {
+    vector<PixelOp> out;
+    ChannelMap pending;
+    bool hasPending = false;
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (isChannelOp(ops[i].type)) {
+            pending.then(ops[i]);
+            hasPending = true;
+            continue;
+        }
+        if (hasPending && !pending.isIdentity()) out.push_back(pending.toOp(tables));
+        pending.reset();
+        hasPending = false;
+        out.push_back(ops[i]);
+    }
+    if (hasPending && !pending.isIdentity()) out.push_back(pending.toOp(tables));
+    return out;
+}
+
+#endif
@@ -0,0 +1,316 @@
+// Filtros de ordem: erosão, dilatação, abertura, fechamento e mediana,
+// todos em janelas quadradas de (2R+1)x(2R+1) e com custo por pixel que
+// não depende do raio. Cada canal é tratado como uma imagem em cinza.
+//
+// Erosão (mínimo) e dilatação (máximo) usam o algoritmo de van Herk /
+// Gil-Werman, separável como o blur: a linha (ou coluna) é cortada em
+// blocos de k = 2R+1 amostras; dentro de cada bloco guardam-se o máximo
+// acumulado da esquerda para a direita (g) e da direita para a esquerda
+// (h). Toda janela de k amostras cobre o fim de um bloco e o começo do
+// seguinte, então max(janela em x) = max(h[x], g[x + 2R]): três
+// comparações por amostra. Na vertical, essas contas são entre linhas
+// inteiras (SSE2, 16 bytes por instrução).
+//
+// A mediana é a de tempo constante de Perreault e Hébert: um histograma
+// por coluna, atualizado com uma amostra que entra e uma que sai ao
+// descer uma linha, e um histograma da janela, que anda para a direita
+// somando a coluna que entra e subtraindo a que sai. Os histogramas têm
+// dois níveis, 16 grupos de 16 valores: o nível grosso é atualizado a
+// cada pixel e diz em que grupo está a mediana, e só aquele grupo do
+// nível fino é posto em dia. Só essas somas de 16 contadores de 16 bits
+// são SSE2; a atualização dos histogramas das colunas soma 1 num contador
+// diferente em cada coluna e fica escalar (com gather/scatter do AVX-512
+// não ficou mais rápida). Bordas repetem o pixel da borda, como em
+// ppm_convolve.h.
+#ifndef _PPM_MORPHOLOGY_H_
+#define _PPM_MORPHOLOGY_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+#include "ppm_convolve.h"
+
+using namespace std;
+
+const int MEDIAN_MAX_RADIUS = 127;     // (2R+1)² cabe num contador de 16 bits
+const int MEDIAN_STRIP = 256;          // colunas por faixa da mediana
+
+/*-----------------------------EROSÃO E DILATAÇÃO-----------------------------*/
+#ifdef PPM_SIMD_X86
+SIMD_TARGET("sse2")
+static size_t extremeBytes_sse2(const unsigned char *a, const unsigned char *b, unsigned char *out,
+                                size_t n, bool isMax) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(out + i), isMax ? _mm_max_epu8(x, y) : _mm_min_epu8(x, y));
+    }
+    return i;
+}
+#endif
+
+// out[i] = max(a[i], b[i]) (ou min); 'out' pode ser 'a' ou 'b'
+inline void extremeBytes(const unsigned char *a, const unsigned char *b, unsigned char *out, size_t n, bool isMax) {
+    size_t i = 0;
+#ifdef PPM_SIMD_X86
+    if (simdLevel() >= SIMD_SSSE3) i = extremeBytes_sse2(a, b, out, n, isMax);
+#endif
+    for (; i < n; i++) {
+        unsigned char x = a[i], y = b[i];
+        out[i] = isMax ? (x > y ? x : y) : (x < y ? x : y);
+    }
+}
+
+// Uma linha de 'w' pixels RGB. As posições vão de 0 a n = w + 2R, com R
+// cópias do pixel da borda de cada lado, arredondadas para blocos de k;
+// a janela do pixel x é [x, x + 2R] nessas posições.
+inline void vhgwRow(const unsigned char *src, unsigned char *dst, int w, int radius, bool isMax,
+                    vector<unsigned char> &padded, vector<unsigned char> &g, vector<unsigned char> &h) {
+    int k = 2 * radius + 1;
+    int n = (w + 2 * radius + k - 1) / k * k;
+    padded.resize((size_t)n * 3);
+    g.resize((size_t)n * 3);
+    h.resize((size_t)n * 3);
+    unsigned char *p = padded.data();
+    for (int x = 0; x < n; x++) memcpy(p + x * 3, src + clampIndex(x - radius, w) * 3, 3);
+    for (int b = 0; b < n; b += k) {
+        memcpy(g.data() + b * 3, p + b * 3, 3);
+        for (int j = (b + 1) * 3; j < (b + k) * 3; j++) {
+            unsigned char x = g[j - 3], y = p[j];
+            g[j] = isMax ? (x > y ? x : y) : (x < y ? x : y);
+        }
+        memcpy(h.data() + (b + k - 1) * 3, p + (b + k - 1) * 3, 3);
+        for (int j = (b + k - 1) * 3 - 1; j >= b * 3; j--) {
+            unsigned char x = h[j + 3], y = p[j];
+            h[j] = isMax ? (x > y ? x : y) : (x < y ? x : y);
+        }
+    }
+    extremeBytes(h.data(), g.data() + 2 * radius * 3, dst, (size_t)w * 3, isMax);
+}
+
+// Passada vertical de 'src' para 'dst': as mesmas contas, mas cada
+// amostra é uma linha inteira. 'g' e 'hh' guardam n linhas cada.
+inline void vhgwColumns(const unsigned char *src, unsigned char *dst, int w, int h, int radius, bool isMax) {
+    size_t rowBytes = (size_t)w * 3;
+    int k = 2 * radius + 1;
+    int n = (h + 2 * radius + k - 1) / k * k;
+    unique_ptr<unsigned char[]> g(new unsigned char [rowBytes * n]), hh(new unsigned char [rowBytes * n]);
+    threadPool().run(n / k, [&](size_t block) {
+        int b = (int)block * k;
+        const unsigned char *first = src + clampIndex(b - radius, h) * rowBytes;
+        memcpy(g.get() + b * rowBytes, first, rowBytes);
+        for (int y = b + 1; y < b + k; y++) {
+            extremeBytes(g.get() + (y - 1) * rowBytes, src + clampIndex(y - radius, h) * rowBytes,
+                         g.get() + y * rowBytes, rowBytes, isMax);
+        }
+        const unsigned char *last = src + clampIndex(b + k - 1 - radius, h) * rowBytes;
+        memcpy(hh.get() + (b + k - 1) * rowBytes, last, rowBytes);
+        for (int y = b + k - 2; y >= b; y--) {
+            extremeBytes(hh.get() + (y + 1) * rowBytes, src + clampIndex(y - radius, h) * rowBytes,
+                         hh.get() + y * rowBytes, rowBytes, isMax);
+        }
+    });
+    parallelRows(w, h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            extremeBytes(hh.get() + y * rowBytes, g.get() + (y + 2 * radius) * rowBytes, dst + y * rowBytes,
+                         rowBytes, isMax);
+        }
+    });
+}
+
+// Mínimo (erosão) ou máximo (dilatação) em janela (2R+1)x(2R+1).
+inline void morphology(unsigned char *data, int w, int h, int radius, bool isMax) {
+    if (radius < 1 || w < 1 || h < 1) return;
+    size_t rowBytes = (size_t)w * 3;
+    unique_ptr<unsigned char[]> tmp(new unsigned char [rowBytes * h]);
+    parallelRows(w, h, [&](int y0, int y1) {
+        vector<unsigned char> padded, g, hh;
+        for (int y = y0; y < y1; y++) {
+            vhgwRow(data + y * rowBytes, tmp.get() + y * rowBytes, w, radius, isMax, padded, g, hh);
+        }
+    });
+    vhgwColumns(tmp.get(), data, w, h, radius, isMax);
+}
+
+inline void erode(unsigned char *data, int w, int h, int radius) {
+    morphology(data, w, h, radius, false);
+}
+
+inline void dilate(unsigned char *data, int w, int h, int radius) {
+    morphology(data, w, h, radius, true);
+}
+
+// Abertura: tira detalhes claros menores que a janela
+inline void morphOpen(unsigned char *data, int w, int h, int radius) {
+    erode(data, w, h, radius);
+    dilate(data, w, h, radius);
+}
+
+// Fechamento: tapa detalhes escuros menores que a janela
+inline void morphClose(unsigned char *data, int w, int h, int radius) {
+    dilate(data, w, h, radius);
+    erode(data, w, h, radius);
+}
+
+/*-----------------------------------MEDIANA----------------------------------*/
+// Somas de um grupo de 16 contadores.
+struct ScalarBins {
+    static void add(uint16_t *k, const uint16_t *a) {
+        for (int i = 0; i < 16; i++) k[i] += a[i];
+    }
+    static void addSub(uint16_t *k, const uint16_t *plus, const uint16_t *minus) {
+        for (int i = 0; i < 16; i++) k[i] += plus[i] - minus[i];
+    }
+};
+
+#ifdef PPM_SIMD_X86
+struct Sse2Bins {
+    SIMD_TARGET("sse2")
+    static void add(uint16_t *k, const uint16_t *a) {
+        for (int i = 0; i < 16; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(k + i));
+            v = _mm_add_epi16(v, _mm_loadu_si128((const __m128i *)(a + i)));
+            _mm_storeu_si128((__m128i *)(k + i), v);
+        }
+    }
+    SIMD_TARGET("sse2")
+    static void addSub(uint16_t *k, const uint16_t *plus, const uint16_t *minus) {
+        for (int i = 0; i < 16; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(k + i));
+            v = _mm_add_epi16(v, _mm_loadu_si128((const __m128i *)(plus + i)));
+            v = _mm_sub_epi16(v, _mm_loadu_si128((const __m128i *)(minus + i)));
+            _mm_storeu_si128((__m128i *)(k + i), v);
+        }
+    }
+};
+#endif
+
+// Histogramas de um canal para as colunas [lo, hi): 'fine' com 256
+// contadores e 'coarse' com 16 (um por grupo de 16 valores).
+struct ColumnHistograms {
+    vector<uint16_t> fine, coarse;
+    int lo, hi;
+
+    void reset(int l, int h) {
+        lo = l; hi = h;
+        fine.assign((size_t)(h - l) * 256, 0);
+        coarse.assign((size_t)(h - l) * 16, 0);
+    }
+
+    // soma 'delta' (1 ou -1) às colunas com os valores da linha 'row'
+    void update(const unsigned char *row, int channel, int delta) {
+        uint16_t *f = fine.data(), *c = coarse.data();
+        const unsigned char *p = row + lo * 3 + channel;
+        for (int x = 0; x < hi - lo; x++, p += 3) {
+            int v = *p;
+            f[x * 256 + v] += (uint16_t)delta;
+            c[x * 16 + (v >> 4)] += (uint16_t)delta;
+        }
+    }
+
+    // coluna j da imagem (fora dela, a borda replicada)
+    int column(int j, int w) const { return clampIndex(j, w) - lo; }
+};
+
+// Medianas das colunas [x0, x1) de uma linha do canal 'channel', a partir
+// dos histogramas das colunas já com as linhas da janela. Grupo s do nível
+// fino está em dia na posição valid[s]; pô-lo em dia na posição x custa uma
+// soma e uma subtração por coluna que andou, ou 2R+1 somas recontando a janela.
+template <class Bins>
+void medianRow(const ColumnHistograms &cols, unsigned char *dst, int w, int x0, int x1, int channel, int radius) {
+    const int k = 2 * radius + 1;
+    const int rank = k * k / 2;
+    const uint16_t *cf = cols.fine.data(), *cc = cols.coarse.data();
+    uint16_t coarse[16] = { 0 };
+    uint16_t fine[256];
+    int valid[16];
+    for (int s = 0; s < 16; s++) valid[s] = x0 - k - 1;     // longe o bastante para recontar
+    for (int j = x0 - radius; j <= x0 + radius; j++) Bins::add(coarse, cc + cols.column(j, w) * 16);
+    for (int x = x0; x < x1; x++) {
+        if (x > x0) {
+            Bins::addSub(coarse, cc + cols.column(x + radius, w) * 16, cc + cols.column(x - radius - 1, w) * 16);
+        }
+        int s = 0, seen = 0;
+        while (seen + coarse[s] <= rank) seen += coarse[s++];
+
+        uint16_t *seg = fine + s * 16;
+        int behind = x - valid[s];
+        if (2 * behind > k) {
+            memset(seg, 0, 16 * sizeof(uint16_t));
+            for (int j = x - radius; j <= x + radius; j++) Bins::add(seg, cf + cols.column(j, w) * 256 + s * 16);
+        } else {
+            for (int p = valid[s] + 1; p <= x; p++) {
+                Bins::addSub(seg, cf + cols.column(p + radius, w) * 256 + s * 16,
+                             cf + cols.column(p - radius - 1, w) * 256 + s * 16);
+            }
+        }
+        valid[s] = x;
+
+        int i = 0;
+        while (seen + seg[i] <= rank) seen += seg[i++];
+        dst[x * 3 + channel] = (unsigned char)(s * 16 + i);
+    }
+}
+
+// Linhas [y0, y1) de 'src' para 'dst', em faixas de MEDIAN_STRIP colunas
+// (os histogramas de uma faixa cabem na cache) e um canal por vez.
+template <class Bins>
+void medianBand(const unsigned char *src, unsigned char *dst, int w, int h, int radius, int y0, int y1) {
+    size_t rowBytes = (size_t)w * 3;
+    ColumnHistograms cols;
+    for (int x0 = 0; x0 < w; x0 += MEDIAN_STRIP) {
+        int x1 = min(x0 + MEDIAN_STRIP, w);
+        for (int c = 0; c < 3; c++) {
+            cols.reset(max(x0 - radius, 0), min(x1 + radius, w));
+            for (int j = y0 - radius; j <= y0 + radius; j++) cols.update(src + clampIndex(j, h) * rowBytes, c, 1);
+            for (int y = y0; y < y1; y++) {
+                if (y > y0) {
+                    cols.update(src + clampIndex(y - radius - 1, h) * rowBytes, c, -1);
+                    cols.update(src + clampIndex(y + radius, h) * rowBytes, c, 1);
+                }
+                medianRow<Bins>(cols, dst + y * rowBytes, w, x0, x1, c, radius);
+            }
+        }
+    }
+}
+
+inline void medianFilter(unsigned char *data, int w, int h, int radius) {
+    if (radius < 1 || w < 1 || h < 1) return;
+    if (radius > MEDIAN_MAX_RADIUS) radius = MEDIAN_MAX_RADIUS;
+    size_t rowBytes = (size_t)w * 3;
+    vector<unsigned char> src(data, data + rowBytes * h);
+    // faixas grandes: cada uma começa contando 2R+1 linhas
+    int bands = threadPool().size() * 2;
+    if (bands > h) bands = h;
+    threadPool().run(bands, [&](size_t b) {
+        int y0 = (int)((int64_t)h * b / bands), y1 = (int)((int64_t)h * (b + 1) / bands);
+#ifdef PPM_SIMD_X86
+        if (simdLevel() >= SIMD_SSSE3) {
+            medianBand<Sse2Bins>(src.data(), data, w, h, radius, y0, y1);
+            return;
+        }
+#endif
+        medianBand<ScalarBins>(src.data(), data, w, h, radius, y0, y1);
+    });
+}
+
+/*----------------------------------DESPACHO---------------------------------*/
+inline void applyNeighborhood(const NeighborhoodOp &op, unsigned char *data, int w, int h) {
+    switch (op.type) {
+        case NEIGHBOR_BLUR:     boxBlur(data, w, h, op.radius); break;
+        case NEIGHBOR_GAUSSIAN: gaussianBlur(data, w, h, op.sigma); break;
+        case NEIGHBOR_SHARPEN:  sharpen(data, w, h, op.sigma, op.amount); break;
+        case NEIGHBOR_SOBEL:    sobel(data, w, h); break;
+        case NEIGHBOR_ERODE:    erode(data, w, h, op.radius); break;
+        case NEIGHBOR_DILATE:   dilate(data, w, h, op.radius); break;
+        case NEIGHBOR_OPEN:     morphOpen(data, w, h, op.radius); break;
+        case NEIGHBOR_CLOSE:    morphClose(data, w, h, op.radius); break;
+        case NEIGHBOR_MEDIAN:   medianFilter(data, w, h, op.radius); break;
+    }
+}
+
+#endif
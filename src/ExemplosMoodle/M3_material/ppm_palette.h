@@ -0,0 +1,378 @@
+// Redução a uma paleta de até 256 cores, com ou sem pontilhado
+// Floyd–Steinberg.
+//
+// A paleta sai de um histograma de cores com 5 bits por canal (32768
+// células, com a soma das cores reais de cada uma), contado em paralelo
+// como em ppm_histogram.h: uma faixa e um histograma por thread. Sobre ele:
+//   median cut: divide a caixa mais "pesada" (pixels x maior lado) na
+//               mediana do maior lado até ter N caixas;
+//   octree:     árvore de 5 níveis (um bit de cada canal por nível) com as
+//               células nas folhas; os nós com menos pixels dos níveis mais
+//               fundos são fundidos até sobrar no máximo N folhas.
+// A cor de cada caixa/folha é a média das cores reais dos pixels dela. A
+// cor mais próxima de cada célula vai para uma tabela de 32768 índices,
+// que serve tanto para o mapeamento direto quanto para o pontilhado.
+//
+// O pontilhado é serial por natureza: o erro de um pixel vai para o da
+// direita e para três da linha de baixo. Mas a linha y só precisa que a
+// linha y-1 esteja um pouco à frente, então as linhas rodam em paralelo
+// numa frente diagonal: cada thread pega a próxima linha e processa blocos
+// de DITHER_CHUNK pixels, esperando a linha de cima passar do fim do bloco.
+// Como cada pixel vê exatamente os mesmos erros da versão serial, o
+// resultado não depende do número de threads.
+#ifndef _PPM_PALETTE_H_
+#define _PPM_PALETTE_H_
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include "ppm_parallel.h"
+
+using namespace std;
+
+const int PALETTE_CELLS = 32768;    // 5 bits por canal
+const int DITHER_CHUNK = 32;        // pixels entre duas publicações do progresso da linha
+const int DITHER_RING = 4;          // linhas de erro em uso ao mesmo tempo
+
+enum PaletteMethod { PALETTE_MEDIAN_CUT, PALETTE_OCTREE };
+
+struct PaletteOp {
+    PaletteMethod method;
+    int colors;         // 2..256
+    bool dither;        // Floyd–Steinberg
+};
+
+struct Palette {
+    int size;
+    unsigned char colors[256][3];
+
+    Palette() : size(0) {}
+
+    void add(const uint64_t *sum, uint64_t count) {
+        for (int c = 0; c < 3; c++) colors[size][c] = (unsigned char)((sum[c] + count / 2) / count);
+        size++;
+    }
+};
+
+inline int colorCell(int r, int g, int b) {
+    return (r >> 3) << 10 | (g >> 3) << 5 | (b >> 3);
+}
+
+/*----------------------------------HISTOGRAMA--------------------------------*/
+struct ColorHistogram {
+    vector<uint32_t> counts;    // pixels por célula
+    vector<uint64_t> sums;      // soma de R, G e B por célula
+
+    ColorHistogram() : counts(PALETTE_CELLS, 0), sums(PALETTE_CELLS * 3, 0) {}
+
+    void add(const ColorHistogram &o) {
+        for (int i = 0; i < PALETTE_CELLS; i++) counts[i] += o.counts[i];
+        for (int i = 0; i < PALETTE_CELLS * 3; i++) sums[i] += o.sums[i];
+    }
+};
+
+inline ColorHistogram colorHistogram(const unsigned char *data, int w, int h) {
+    int parts = threadPool().size();
+    if (parts > h) parts = h;
+    if (parts < 1) parts = 1;
+    vector<ColorHistogram> partial(parts);
+    threadPool().run(parts, [&](size_t t) {
+        size_t first = (size_t)w * (size_t)((int64_t)h * t / parts);
+        size_t last = (size_t)w * (size_t)((int64_t)h * (t + 1) / parts);
+        uint32_t *counts = partial[t].counts.data();
+        uint64_t *sums = partial[t].sums.data();
+        for (size_t i = first; i < last; i++) {
+            const unsigned char *p = data + i * 3;
+            int cell = colorCell(p[0], p[1], p[2]);
+            counts[cell]++;
+            sums[cell * 3] += p[0];
+            sums[cell * 3 + 1] += p[1];
+            sums[cell * 3 + 2] += p[2];
+        }
+    });
+    for (int t = 1; t < parts; t++) partial[0].add(partial[t]);
+    return partial[0];
+}
+
+/*---------------------------------MEDIAN CUT---------------------------------*/
+// Caixa de células [lo, hi] (inclusive, 0..31 em cada canal).
+struct ColorBox {
+    int lo[3], hi[3];
+    uint64_t count;
+
+    // percorre as células da caixa: fn(célula)
+    template <class F>
+    void each(F fn) const {
+        for (int r = lo[0]; r <= hi[0]; r++) {
+            for (int g = lo[1]; g <= hi[1]; g++) {
+                for (int b = lo[2]; b <= hi[2]; b++) fn(r << 10 | g << 5 | b);
+            }
+        }
+    }
+
+    // encolhe até as células ocupadas e recalcula 'count'
+    void shrink(const ColorHistogram &hist) {
+        int nlo[3] = { 31, 31, 31 }, nhi[3] = { 0, 0, 0 };
+        count = 0;
+        each([&](int cell) {
+            uint32_t n = hist.counts[cell];
+            if (n == 0) return;
+            int v[3] = { cell >> 10, (cell >> 5) & 31, cell & 31 };
+            for (int c = 0; c < 3; c++) {
+                if (v[c] < nlo[c]) nlo[c] = v[c];
+                if (v[c] > nhi[c]) nhi[c] = v[c];
+            }
+            count += n;
+        });
+        if (count == 0) return;
+        memcpy(lo, nlo, sizeof(lo));
+        memcpy(hi, nhi, sizeof(hi));
+    }
+
+    int longestAxis() const {
+        int axis = 0;
+        for (int c = 1; c < 3; c++) {
+            if (hi[c] - lo[c] > hi[axis] - lo[axis]) axis = c;
+        }
+        return axis;
+    }
+};
+
+inline Palette medianCut(const ColorHistogram &hist, int colors) {
+    vector<ColorBox> boxes(1);
+    for (int c = 0; c < 3; c++) {
+        boxes[0].lo[c] = 0;
+        boxes[0].hi[c] = 31;
+    }
+    boxes[0].shrink(hist);
+    while ((int)boxes.size() < colors) {
+        // a caixa com mais pixels x maior lado, entre as que ainda dividem
+        int best = -1;
+        uint64_t bestScore = 0;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            int axis = boxes[i].longestAxis();
+            uint64_t score = boxes[i].count * (uint64_t)(boxes[i].hi[axis] - boxes[i].lo[axis]);
+            if (score > bestScore) {
+                bestScore = score;
+                best = (int)i;
+            }
+        }
+        if (best < 0) break;
+        ColorBox &box = boxes[best];
+        int axis = box.longestAxis();
+        // pixels em cada plano do eixo, e o corte na mediana
+        uint64_t planes[32] = { 0 };
+        box.each([&](int cell) {
+            int v[3] = { cell >> 10, (cell >> 5) & 31, cell & 31 };
+            planes[v[axis]] += hist.counts[cell];
+        });
+        uint64_t seen = 0;
+        int cut = box.lo[axis];
+        while (cut < box.hi[axis] - 1 && seen + planes[cut] < box.count / 2) seen += planes[cut++];
+        ColorBox upper = box;
+        box.hi[axis] = cut;
+        upper.lo[axis] = cut + 1;
+        box.shrink(hist);
+        upper.shrink(hist);
+        boxes.push_back(upper);
+    }
+
+    Palette pal;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        if (boxes[i].count == 0) continue;
+        uint64_t sum[3] = { 0, 0, 0 };
+        boxes[i].each([&](int cell) {
+            for (int c = 0; c < 3; c++) sum[c] += hist.sums[cell * 3 + c];
+        });
+        pal.add(sum, boxes[i].count);
+    }
+    return pal;
+}
+
+/*-----------------------------------OCTREE-----------------------------------*/
+struct OctreeNode {
+    int children[8];    // -1 = sem filho
+    int level;          // 0 = raiz, 5 = célula
+    bool leaf;
+    uint64_t count, sum[3];
+};
+
+inline Palette octree(const ColorHistogram &hist, int colors) {
+    vector<OctreeNode> nodes;
+    OctreeNode empty = { { -1, -1, -1, -1, -1, -1, -1, -1 }, 0, false, 0, { 0, 0, 0 } };
+    nodes.push_back(empty);
+    int leaves = 0;
+    for (int cell = 0; cell < PALETTE_CELLS; cell++) {
+        uint32_t n = hist.counts[cell];
+        if (n == 0) continue;
+        int v[3] = { cell >> 10, (cell >> 5) & 31, cell & 31 };
+        int node = 0;
+        for (int level = 0; level < 5; level++) {
+            int bit = 4 - level;
+            int k = ((v[0] >> bit) & 1) << 2 | ((v[1] >> bit) & 1) << 1 | ((v[2] >> bit) & 1);
+            if (nodes[node].children[k] < 0) {
+                OctreeNode child = empty;
+                child.level = level + 1;
+                child.leaf = level == 4;
+                nodes.push_back(child);
+                nodes[node].children[k] = (int)nodes.size() - 1;
+                if (child.leaf) leaves++;
+            }
+            node = nodes[node].children[k];
+            nodes[node].count += n;
+            for (int c = 0; c < 3; c++) nodes[node].sum[c] += hist.sums[cell * 3 + c];
+        }
+    }
+
+    // funde, do nível mais fundo para cima, os nós com menos pixels: cada
+    // um vira folha com a soma dos filhos
+    for (int level = 4; level >= 0 && leaves > colors; level--) {
+        vector<int> candidates;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i].level == level && !nodes[i].leaf) candidates.push_back((int)i);
+        }
+        sort(candidates.begin(), candidates.end(), [&](int a, int b) { return nodes[a].count < nodes[b].count; });
+        for (size_t i = 0; i < candidates.size() && leaves > colors; i++) {
+            OctreeNode &node = nodes[candidates[i]];
+            int children = 0;
+            for (int k = 0; k < 8; k++) {
+                if (node.children[k] >= 0) children++;
+                node.children[k] = -1;
+            }
+            node.leaf = true;
+            leaves -= children - 1;
+        }
+    }
+
+    Palette pal;
+    vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        const OctreeNode &node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.leaf) {
+            if (node.count > 0) pal.add(node.sum, node.count);
+            continue;
+        }
+        for (int k = 0; k < 8; k++) {
+            if (node.children[k] >= 0) stack.push_back(node.children[k]);
+        }
+    }
+    return pal;
+}
+
+/*----------------------------------MAPEAMENTO--------------------------------*/
+// Índice da cor da paleta mais próxima do centro de cada célula.
+inline vector<unsigned char> nearestTable(const Palette &pal) {
+    vector<unsigned char> table(PALETTE_CELLS);
+    const int blocks = 64;
+    threadPool().run(blocks, [&](size_t t) {
+        int first = PALETTE_CELLS / blocks * (int)t, last = first + PALETTE_CELLS / blocks;
+        for (int cell = first; cell < last; cell++) {
+            int v[3] = { ((cell >> 10) << 3) + 4, (((cell >> 5) & 31) << 3) + 4, ((cell & 31) << 3) + 4 };
+            int best = 0, bestDist = 1 << 30;
+            for (int i = 0; i < pal.size; i++) {
+                int dr = v[0] - pal.colors[i][0], dg = v[1] - pal.colors[i][1], db = v[2] - pal.colors[i][2];
+                int d = dr * dr + dg * dg + db * db;
+                if (d < bestDist) {
+                    bestDist = d;
+                    best = i;
+                }
+            }
+            table[cell] = (unsigned char)best;
+        }
+    });
+    return table;
+}
+
+inline void mapToPalette(unsigned char *data, int w, int h, const Palette &pal, const unsigned char *table) {
+    parallelRows(w, h, [&](int y0, int y1) {
+        unsigned char *p = data + (size_t)y0 * w * 3;
+        size_t n = (size_t)(y1 - y0) * w;
+        for (size_t i = 0; i < n; i++, p += 3) {
+            const unsigned char *c = pal.colors[table[colorCell(p[0], p[1], p[2])]];
+            p[0] = c[0];
+            p[1] = c[1];
+            p[2] = c[2];
+        }
+    });
+}
+
+/*---------------------------------PONTILHADO---------------------------------*/
+// Progresso de uma linha (pixels prontos), numa linha de cache própria
+// para que as threads vizinhas não disputem a mesma.
+struct alignas(64) RowProgress {
+    atomic<int> done;
+};
+
+// Floyd–Steinberg em frente diagonal. Os erros são guardados x16, então a
+// divisão 7/16, 3/16, 5/16, 1/16 é exata e só arredonda ao somar no pixel.
+// A linha y lê os erros que a linha y-1 deixou em errors[y % DITHER_RING]
+// e escreve os da linha seguinte no próximo; com a frente diagonal, quando
+// a linha y reescreve uma posição, a linha que a leu por último já passou
+// dela.
+inline void ditherFloydSteinberg(unsigned char *data, int w, int h, const Palette &pal, const unsigned char *table) {
+    size_t stride = (size_t)(w + 2) * 3;    // uma coluna de folga em cada lado
+    vector<int> errors(stride * DITHER_RING, 0);
+    unique_ptr<RowProgress[]> progress(new RowProgress[h]);
+    for (int y = 0; y < h; y++) progress[y].done.store(0, memory_order_relaxed);
+
+    threadPool().run(h, [&](size_t t) {
+        int y = (int)t;
+        const int *in = errors.data() + (y % DITHER_RING) * stride + 3;
+        int *out = errors.data() + ((y + 1) % DITHER_RING) * stride + 3;
+        unsigned char *row = data + (size_t)y * w * 3;
+        int carry[3] = { 0, 0, 0 };
+        for (int x0 = 0; x0 < w; x0 += DITHER_CHUNK) {
+            int x1 = x0 + DITHER_CHUNK < w ? x0 + DITHER_CHUNK : w;
+            if (y > 0) {
+                // o pixel x1 da linha de cima ainda manda erro para x1 - 1
+                int need = x1 + 1 < w ? x1 + 1 : w;
+                while (progress[y - 1].done.load(memory_order_acquire) < need) this_thread::yield();
+            }
+            if (x0 == 0) {
+                for (int c = -3; c < 3; c++) out[c] = 0;
+            }
+            for (int x = x0; x < x1; x++) {
+                unsigned char *p = row + x * 3;
+                int v[3], e[3];
+                for (int c = 0; c < 3; c++) {
+                    int s = p[c] + ((in[x * 3 + c] + carry[c] + 8) >> 4);
+                    v[c] = s < 0 ? 0 : (s > 255 ? 255 : s);
+                }
+                const unsigned char *q = pal.colors[table[colorCell(v[0], v[1], v[2])]];
+                for (int c = 0; c < 3; c++) {
+                    p[c] = q[c];
+                    e[c] = v[c] - q[c];
+                    carry[c] = 7 * e[c];
+                    out[(x - 1) * 3 + c] += 3 * e[c];
+                    out[x * 3 + c] += 5 * e[c];
+                    out[(x + 1) * 3 + c] = e[c];
+                }
+            }
+            progress[y].done.store(x1, memory_order_release);
+        }
+    });
+}
+
+/*-----------------------------------ENTRADA----------------------------------*/
+inline Palette buildPalette(const PaletteOp &op, const unsigned char *data, int w, int h) {
+    ColorHistogram hist = colorHistogram(data, w, h);
+    return op.method == PALETTE_OCTREE ? octree(hist, op.colors) : medianCut(hist, op.colors);
+}
+
+inline void applyPalette(const PaletteOp &op, unsigned char *data, int w, int h) {
+    if (w < 1 || h < 1) return;
+    Palette pal = buildPalette(op, data, w, h);
+    vector<unsigned char> table = nearestTable(pal);
+    if (op.dither) {
+        ditherFloydSteinberg(data, w, h, pal, table.data());
+    } else {
+        mapToPalette(data, w, h, pal, table.data());
+    }
+}
+
+#endif
@@ -0,0 +1,317 @@
+// PGM/PPM/PAM de 8 ou 16 bits (P5, P6 e P7) em layout planar.
+//
+// O P6 de 8 bits continua em ppm_io.h, mapeado e intercalado (RGBRGB...),
+// porque os kernels de ppm_simd.h já separam os canais em registrador.
+// Os demais formatos são decodificados para um plano de 16 bits por canal
+// (R, G, B e A): sem intercalação os filtros trabalham com vetores
+// inteiros de um canal só, sem embaralhar bytes, e o mesmo código atende
+// qualquer maxValue até 65535. Os planos só voltam a ser intercalados na
+// gravação.
+//
+// Amostras de 16 bits ficam em big-endian no arquivo, como manda o
+// formato. Cinza é replicado em R, G e B; sem alfa, A = maxValue.
+#ifndef _PPM_PAM_H_
+#define _PPM_PAM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ppm_io.h"
+#include "ppm_parallel.h"
+#include "ppm_png.h"
+
+using namespace std;
+
+struct PlanarImage {
+    int width, height;
+    int maxValue;               // 1..65535
+    int depth;                  // canais no arquivo: 1 cinza, 2 cinza+alfa, 3 RGB, 4 RGBA
+    vector<uint16_t> planes[4]; // R, G, B, A
+
+    PlanarImage() : width(0), height(0), maxValue(0), depth(0) {}
+
+    void allocate(int w, int h) {
+        width = w;
+        height = h;
+        for (int c = 0; c < 4; c++) planes[c].assign((size_t)w * h, 0);
+    }
+
+    size_t pixels() const {
+        return (size_t)width * height;
+    }
+
+    bool hasAlpha() const {
+        return depth == 2 || depth == 4;
+    }
+
+    // bytes por amostra no arquivo
+    int sampleBytes() const {
+        return maxValue > 255 ? 2 : 1;
+    }
+
+    // tamanho dos pixels no formato do arquivo, para os relatórios de vazão
+    size_t fileBytes() const {
+        return pixels() * depth * sampleBytes();
+    }
+};
+
+/*-----------------------------------LEITURA----------------------------------*/
+// Cabeçalho P7: pares "CHAVE valor" até ENDHDR.
+inline bool parsePAMHeader(PPMScanner &s, int &w, int &h, int &depth, int &maxValue) {
+    w = h = depth = maxValue = 0;
+    for (;;) {
+        s.skipSpace();
+        const unsigned char *start = s.p;
+        while (s.p < s.end && *s.p > ' ') s.p++;
+        string key((const char *)start, s.p - start);
+        if (key.empty()) return false;
+        if (key == "ENDHDR") break;
+        if (key == "WIDTH") {
+            if (!s.readInt(w)) return false;
+        } else if (key == "HEIGHT") {
+            if (!s.readInt(h)) return false;
+        } else if (key == "DEPTH") {
+            if (!s.readInt(depth)) return false;
+        } else if (key == "MAXVAL") {
+            if (!s.readInt(maxValue)) return false;
+        } else {
+            // TUPLTYPE e chaves desconhecidas: o resto da linha é ignorado;
+            // o que vale é DEPTH
+            while (s.p < s.end && *s.p != '\n') s.p++;
+        }
+    }
+    while (s.p < s.end && *s.p != '\n') s.p++;
+    if (s.p < s.end) s.p++;
+    return w > 0 && h > 0 && depth >= 1 && depth <= 4;
+}
+
+// Lê magic e cabeçalho de qualquer um dos três formatos.
+inline bool parseAnyHeader(PPMScanner &s, char &type, int &w, int &h, int &depth, int &maxValue) {
+    if (s.end - s.p < 2 || s.p[0] != 'P') return false;
+    type = (char)s.p[1];
+    if (type == '7') {
+        s.p += 2;
+        if (!parsePAMHeader(s, w, h, depth, maxValue)) return false;
+    } else if (type == '5' || type == '6') {
+        if (!parsePPMHeader(s, type, w, h, maxValue)) return false;
+        depth = type == '5' ? 1 : 3;
+    } else {
+        return false;
+    }
+    return maxValue > 0 && maxValue <= 65535;
+}
+
+// Formatos que vão para PlanarImage: P5, P7, P6 com maxval diferente de
+// 255 (16 bits ou menos de 8, que mantêm a escala original) e QOIC RGBA.
+// O resto (P6 de 255, P3 e QOIC RGB) é aberto por openPPM().
+inline bool needsPlanar(const string &file) {
+    FILE *f = fopen(file.c_str(), "rb");
+    if (!f) return false;
+    char type;
+    int w, h, maxValue;
+    bool planar = false;
+    unsigned char magic[13];
+    if (fread(magic, 1, 13, f) == 13 && memcmp(magic, "qoic", 4) == 0) {
+        // QOIC com alfa
+        fclose(f);
+        return magic[12] == 4;
+    }
+    rewind(f);
+    if (fgetc(f) == 'P') {
+        type = (char)fgetc(f);
+        if (type == '5' || type == '7') {
+            planar = true;
+        } else if (type == '6') {
+            rewind(f);
+            planar = readPPMHeader(f, type, w, h, maxValue) && maxValue != 255;
+        }
+    }
+    fclose(f);
+    return planar;
+}
+
+// Separa as linhas [y0, y1) de 'src' (amostras intercaladas do arquivo)
+// nos planos de 'img'.
+inline void splitRows(const unsigned char *src, PlanarImage &img, int y0, int y1) {
+    int depth = img.depth, bytes = img.sampleBytes();
+    unsigned maxValue = (unsigned)img.maxValue;
+    uint16_t *r = img.planes[0].data(), *g = img.planes[1].data();
+    uint16_t *b = img.planes[2].data(), *a = img.planes[3].data();
+    size_t first = (size_t)y0 * img.width, last = (size_t)y1 * img.width;
+    const unsigned char *p = src + first * depth * bytes;
+    if (depth == 3 && maxValue == 255) {
+        // P6 comum: sem troca de bytes nem limite, o laço vira só cópia
+        for (size_t i = first; i < last; i++, p += 3) {
+            r[i] = p[0];
+            g[i] = p[1];
+            b[i] = p[2];
+            a[i] = 255;
+        }
+        return;
+    }
+    for (size_t i = first; i < last; i++) {
+        unsigned v[4] = { 0, 0, 0, 0 };
+        for (int c = 0; c < depth; c++, p += bytes) {
+            unsigned s = bytes == 2 ? (unsigned)(p[0] << 8 | p[1]) : p[0];
+            v[c] = s > maxValue ? maxValue : s;
+        }
+        if (depth <= 2) {
+            r[i] = g[i] = b[i] = (uint16_t)v[0];
+            a[i] = (uint16_t)(depth == 2 ? v[1] : maxValue);
+        } else {
+            r[i] = (uint16_t)v[0];
+            g[i] = (uint16_t)v[1];
+            b[i] = (uint16_t)v[2];
+            a[i] = (uint16_t)(depth == 4 ? v[3] : maxValue);
+        }
+    }
+}
+
+inline bool openPlanar(const string &file, PlanarImage &img) {
+    MappedFile m;
+    unsigned char *heap = nullptr;
+    PPMScanner s;
+    if (m.open(file, false)) {
+        s.p = m.data();
+        s.end = m.data() + m.size();
+    } else {
+        size_t len;
+        if (!readWholeFile(file, heap, len)) {
+            fprintf(stderr, "Erro ao abrir %s\n", file.c_str());
+            return false;
+        }
+        s.p = heap;
+        s.end = heap + len;
+    }
+
+    char type;
+    int w, h, depth, maxValue;
+    QOICInfo qoic;
+    if (readQOICHeader(s.p, s.end - s.p, qoic)) {
+        // QOIC: 8 bits, RGB ou RGBA, já intercalado
+        vector<unsigned char> pixels((size_t)qoic.width * qoic.height * qoic.channels);
+        bool ok = decodeQOICPixels(s.p, qoic, pixels.data(), threadPool());
+        if (ok) {
+            img.maxValue = 255;
+            img.depth = qoic.channels;
+            img.allocate(qoic.width, qoic.height);
+            parallelRows(img.width, img.height, [&](int y0, int y1) {
+                splitRows(pixels.data(), img, y0, y1);
+            });
+        } else {
+            fprintf(stderr, "QOIC inválido: %s\n", file.c_str());
+        }
+        free(heap);
+        return ok;
+    }
+    bool ok = parseAnyHeader(s, type, w, h, depth, maxValue);
+    if (ok) {
+        img.maxValue = maxValue;
+        img.depth = depth;
+        ok = (size_t)(s.end - s.p) >= (size_t)w * h * depth * img.sampleBytes();
+    }
+    if (ok) {
+        img.allocate(w, h);
+        const unsigned char *src = s.p;
+        parallelRows(w, h, [&](int y0, int y1) {
+            splitRows(src, img, y0, y1);
+        });
+    } else {
+        fprintf(stderr, "PGM/PPM/PAM inválido ou não suportado: %s\n", file.c_str());
+    }
+    free(heap);
+    return ok;
+}
+
+/*-----------------------------------ESCRITA----------------------------------*/
+// Uma imagem lida como cinza continua cinza se os filtros não criaram cor.
+inline int outputDepth(const PlanarImage &img) {
+    if (img.depth >= 3) return img.depth;
+    size_t n = img.pixels();
+    const uint16_t *r = img.planes[0].data(), *g = img.planes[1].data(), *b = img.planes[2].data();
+    for (size_t i = 0; i < n; i++) {
+        if (r[i] != g[i] || r[i] != b[i]) return img.depth + 2;
+    }
+    return img.depth;
+}
+
+// Intercala as linhas [y0, y1) dos planos em 'dst', com 'depth' canais.
+// Com 'fullRange' as amostras são reescaladas de 0..maxValue para 0..255
+// ou 0..65535, como o PNG espera.
+inline void mergeRows(const PlanarImage &img, int depth, unsigned char *dst, int y0, int y1, bool fullRange) {
+    int bytes = img.sampleBytes();
+    unsigned maxValue = (unsigned)img.maxValue, full = bytes == 2 ? 65535 : 255;
+    bool scale = fullRange && maxValue != full;
+    const uint16_t *planes[4] = { img.planes[0].data(), img.planes[1].data(),
+                                  img.planes[2].data(), img.planes[3].data() };
+    // cinza usa R e, com alfa, A
+    int channel[4] = { 0, 1, 2, 3 };
+    if (depth == 2) channel[1] = 3;
+    size_t first = (size_t)y0 * img.width, last = (size_t)y1 * img.width;
+    unsigned char *p = dst + first * depth * bytes;
+    for (size_t i = first; i < last; i++) {
+        for (int c = 0; c < depth; c++) {
+            unsigned v = planes[channel[c]][i];
+            if (scale) v = (v * full + maxValue / 2) / maxValue;
+            if (bytes == 2) *p++ = (unsigned char)(v >> 8);
+            *p++ = (unsigned char)v;
+        }
+    }
+}
+
+inline void writePlanarHeader(FILE *f, const PlanarImage &img, int depth) {
+    if (depth == 1 || depth == 3) {
+        fprintf(f, "%s\n#Gerado por exemplo_03.\n%d %d\n%d\n", depth == 1 ? "P5" : "P6",
+                img.width, img.height, img.maxValue);
+    } else {
+        fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
+                img.width, img.height, depth, img.maxValue, depth == 2 ? "GRAYSCALE_ALPHA" : "RGB_ALPHA");
+    }
+}
+
+// P5, P6 ou P7, conforme os canais; amostras de 16 bits se maxValue > 255.
+// Com extensão .png, PNG de 8 ou 16 bits (cinza, cinza+alfa, RGB ou RGBA);
+// com .qoic, QOIC RGB ou RGBA de 8 bits. Como em savePPM(), passa por um
+// temporário (ver openForReplace).
+inline bool savePlanar(const string &file, const PlanarImage &img) {
+    int depth = outputDepth(img);
+    bool png = isPNGFile(file);
+    if (isQOICFile(file)) {
+        // QOIC só tem 8 bits (maxval 255) e RGB ou RGBA
+        if (img.maxValue != 255) {
+            fprintf(stderr, "QOIC grava apenas 8 bits com maxval 255: %s\n", file.c_str());
+            return false;
+        }
+        depth = img.hasAlpha() ? 4 : 3;
+        vector<unsigned char> buf(img.pixels() * depth);
+        parallelRows(img.width, img.height, [&](int y0, int y1) {
+            mergeRows(img, depth, buf.data(), y0, y1, true);
+        });
+        return writeQOIC(file, buf.data(), img.width, img.height, depth, threadPool());
+    }
+    size_t length = img.pixels() * depth * img.sampleBytes();
+    unsigned char *buf = new unsigned char [length];
+    parallelRows(img.width, img.height, [&](int y0, int y1) {
+        mergeRows(img, depth, buf, y0, y1, png);
+    });
+    if (png) {
+        bool ok = writePNG(file, buf, img.width, img.height, depth, img.sampleBytes() * 8);
+        delete [] buf;
+        return ok;
+    }
+    FILE *f = openForReplace(file);
+    bool ok = f != NULL;
+    if (ok) {
+        writePlanarHeader(f, img, depth);
+        ok = fwrite(buf, 1, length, f) == length;
+        ok = finishReplace(f, file, ok);
+    }
+    delete [] buf;
+    if (!ok) fprintf(stderr, "Erro ao gravar %s\n", file.c_str());
+    return ok;
+}
+
+#endif
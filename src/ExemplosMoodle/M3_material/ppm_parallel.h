@@ -0,0 +1,143 @@
+// Execução paralela dos filtros por blocos de linhas.
+//
+// Um pool fixo de threads (a thread que chama também trabalha) distribui
+// os blocos dinamicamente: cada thread pega o próximo bloco livre de um
+// contador atômico, o que equilibra a carga sem fila por tarefa. Os blocos
+// têm ~256 KB, para que leitura e escrita de um bloco fiquem na cache.
+#ifndef _PPM_PARALLEL_H_
+#define _PPM_PARALLEL_H_
+
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+const size_t TILE_BYTES = 256 * 1024;
+
+/*---------------------------------POOL DE THREADS----------------------------*/
+class ThreadPool {
+    vector<thread> workers;
+    mutex m;
+    mutex serial;               // um run() por vez (ex.: filtro e escrita do modo lote)
+    condition_variable wake, finished;
+    const function<void(size_t)> *job;
+    size_t jobCount;
+    atomic<size_t> next;
+    size_t busy;                // workers ainda no job atual
+    unsigned long generation;   // incrementa a cada job
+    bool stopping;
+
+    void drain() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < jobCount) {
+            (*job)(i);
+        }
+    }
+
+    void workerLoop() {
+        unsigned long seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> lock(m);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            drain();
+            lock_guard<mutex> lock(m);
+            if (--busy == 0) finished.notify_one();
+        }
+    }
+
+public:
+    // 'threads' conta a thread que chama run(); 1 = sem workers
+    ThreadPool(int threads) : job(nullptr), jobCount(0), next(0), busy(0), generation(0), stopping(false) {
+        for (int i = 1; i < threads; i++) {
+            workers.push_back(thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const {
+        return (int)workers.size() + 1;
+    }
+
+    // chama fn(i) para i em [0, count) em todas as threads e espera terminar;
+    // chamadas de threads diferentes esperam a vez (fn não pode chamar run())
+    void run(size_t count, const function<void(size_t)> &fn) {
+        if (workers.empty() || count <= 1) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+        lock_guard<mutex> turn(serial);
+        {
+            lock_guard<mutex> lock(m);
+            job = &fn;
+            jobCount = count;
+            next = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        drain();
+        unique_lock<mutex> lock(m);
+        finished.wait(lock, [&] { return busy == 0; });
+    }
+};
+
+inline int defaultThreads() {
+    unsigned n = thread::hardware_concurrency();
+    return n > 0 ? (int)n : 1;
+}
+
+inline unique_ptr<ThreadPool> &poolInstance() {
+    static unique_ptr<ThreadPool> pool;
+    return pool;
+}
+
+// Troca o pool global (ex.: --threads N). Não chamar durante um run().
+inline void setThreads(int threads) {
+    poolInstance().reset(new ThreadPool(threads < 1 ? 1 : threads));
+}
+
+inline ThreadPool &threadPool() {
+    if (!poolInstance()) setThreads(defaultThreads());
+    return *poolInstance();
+}
+
+/*------------------------------BLOCOS DE LINHAS------------------------------*/
+inline int rowsPerTile(int w) {
+    size_t rows = TILE_BYTES / ((size_t)w * 3);
+    return rows > 0 ? (int)rows : 1;
+}
+
+// Chama fn(y0, y1) para blocos de linhas [y0, y1) cobrindo [0, h).
+template <class F>
+void parallelRows(int w, int h, F fn) {
+    int rows = rowsPerTile(w);
+    size_t tiles = (h + rows - 1) / rows;
+    threadPool().run(tiles, [&](size_t t) {
+        int y0 = (int)t * rows;
+        int y1 = (y0 + rows < h) ? y0 + rows : h;
+        fn(y0, y1);
+    });
+}
+
+#endif
@@ -0,0 +1,746 @@
+// Filtros sobre PlanarImage (ppm_pam.h): um plano de 16 bits por canal,
+// qualquer maxValue até 65535.
+//
+// São as mesmas operações de ppm_simd.h, na escala de maxValue (com
+// maxValue = 255 o resultado é igual ao do P6 de 8 bits):
+// - negative: v = maxValue - v;
+// - colorize: v | cor, com a cor levada para 0..maxValue;
+// - gray-scale: mesmos pesos de luma; a média é (r + g + b) / 3;
+// - chroma-key: distância ao quadrado em 64 bits; os pixels da cor-chave
+//   ficam pretos e, se a imagem tem alfa, transparentes.
+//
+// Com os canais em planos, um vetor carrega 8 (SSE2) ou 16 (AVX2) amostras
+// do mesmo canal e não há embaralhamento de bytes. As versões vetoriais
+// dão exatamente o resultado da escalar. Uma cadeia é aplicada em blocos
+// de PLANAR_BLOCK pixels: cada bloco passa por todos os passos enquanto
+// está na cache L1.
+//
+// Os filtros de vizinhança (ppm_convolve.h) e por histograma
+// (ppm_histogram.h) também têm versão planar, nos planos R, G e B (A não
+// muda). Com maxValue = 255 todos dão os mesmos valores que o P6 de 8 bits.
+#ifndef _PPM_PLANAR_H_
+#define _PPM_PLANAR_H_
+
+#include <stdint.h>
+#include <vector>
+#include "ppm_simd.h"
+#include "ppm_pam.h"
+#include "ppm_parallel.h"
+#include "ppm_chain.h"
+
+using namespace std;
+
+const size_t PLANAR_BLOCK = 2048;   // pixels por bloco (4 planos de 4 KB)
+const size_t PLANAR_TILE = 32768;   // pixels por tarefa do pool
+
+// Passo de cadeia já na escala da imagem.
+struct PlanarOp {
+    PixelOpType type;
+    uint16_t color[3];      // cor-chave ou cor de base
+    uint64_t thr;           // chroma-key: d² < thr
+    uint16_t maxValue;
+};
+
+// 'op' vem de uma cadeia não compilada: só os cinco filtros do usuário.
+inline PlanarOp toPlanarOp(const PixelOp &op, int maxValue) {
+    PlanarOp p;
+    p.type = op.type;
+    p.maxValue = (uint16_t)maxValue;
+    int color[3] = { op.r, op.g, op.b };
+    for (int c = 0; c < 3; c++) {
+        int v = color[c] < 0 ? 0 : (color[c] > 255 ? 255 : color[c]);
+        p.color[c] = (uint16_t)((v * maxValue + 127) / 255);
+    }
+    // d² < thr * (maxValue / 255)², arredondado para cima como em
+    // chromaKeyThreshold()
+    uint64_t m2 = (uint64_t)maxValue * maxValue;
+    p.thr = ((uint64_t)op.thr * m2 + 65024) / 65025;
+    return p;
+}
+
+/*-----------------------------------ESCALAR----------------------------------*/
+inline void planarScalar(uint16_t *const *p, size_t n, const PlanarOp &op) {
+    uint16_t *r = p[0], *g = p[1], *b = p[2], *a = p[3];
+    unsigned maxValue = op.maxValue;
+    switch (op.type) {
+        case PIXEL_NEGATIVE:
+            for (int c = 0; c < 3; c++) {
+                for (size_t i = 0; i < n; i++) p[c][i] = (uint16_t)(maxValue - p[c][i]);
+            }
+            break;
+        case PIXEL_COLORIZE:
+            for (int c = 0; c < 3; c++) {
+                for (size_t i = 0; i < n; i++) {
+                    unsigned v = p[c][i] | op.color[c];
+                    p[c][i] = (uint16_t)(v > maxValue ? maxValue : v);
+                }
+            }
+            break;
+        case PIXEL_GRAY:
+            for (size_t i = 0; i < n; i++) {
+                uint32_t y = ((uint32_t)r[i] * LUMA_WR + (uint32_t)g[i] * LUMA_WG + (uint32_t)b[i] * LUMA_WB) >> 15;
+                r[i] = g[i] = b[i] = (uint16_t)y;
+            }
+            break;
+        case PIXEL_GRAY_MEAN:
+            for (size_t i = 0; i < n; i++) {
+                r[i] = g[i] = b[i] = (uint16_t)((r[i] + g[i] + b[i]) / 3);
+            }
+            break;
+        case PIXEL_CHROMA_KEY:
+            for (size_t i = 0; i < n; i++) {
+                int64_t dr = r[i] - op.color[0], dg = g[i] - op.color[1], db = b[i] - op.color[2];
+                if ((uint64_t)(dr * dr + dg * dg + db * db) < op.thr) {
+                    r[i] = g[i] = b[i] = a[i] = 0;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+#ifdef PPM_SIMD_X86
+
+/*------------------------------------SSE2------------------------------------*/
+// 32 bits sem sinal (até 65535) para 16: packs_epi32 satura com sinal,
+// então desloca para a faixa com sinal e volta depois.
+SIMD_TARGET("sse2")
+static inline __m128i pack32to16_sse2(__m128i a, __m128i b) {
+    __m128i bias = _mm_set1_epi32(32768);
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+    return _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000));
+}
+
+// (r + g + b) / 3 em float: a soma (até 196605) e o terço cabem na
+// mantissa com folga, e os 0,1 somados absorvem o erro sem passar do
+// próximo inteiro (a fração exata é 0, 1/3 ou 2/3).
+SIMD_TARGET("sse2")
+static inline __m128i third_sse2(__m128i sum) {
+    __m128 v = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(1.0f / 3.0f)), _mm_set1_ps(0.1f));
+    return _mm_cvttps_epi32(v);
+}
+
+// v * w (v até 65535, w < 32768) em dois vetores de 32 bits
+SIMD_TARGET("sse2")
+static inline void mul32_sse2(__m128i v, __m128i w, __m128i &lo, __m128i &hi) {
+    __m128i l = _mm_mullo_epi16(v, w), h = _mm_mulhi_epu16(v, w);
+    lo = _mm_unpacklo_epi16(l, h);
+    hi = _mm_unpackhi_epi16(l, h);
+}
+
+// máscara (0xffff) das amostras com dr² + dg² + db² < thr; as somas
+// passam de 32 bits, então as pistas pares e ímpares são somadas em 64
+SIMD_TARGET("sse2")
+static inline __m128i keyMask_sse2(__m128i dr, __m128i dg, __m128i db, __m128i thr) {
+    __m128i low = _mm_set1_epi64x(0xffffffff);
+    __m128i half[2];
+    for (int k = 0; k < 2; k++) {
+        __m128i sq[3];
+        __m128i d[3] = { dr, dg, db };
+        for (int c = 0; c < 3; c++) {
+            __m128i lo, hi;
+            mul32_sse2(d[c], d[c], lo, hi);
+            sq[c] = k == 0 ? lo : hi;
+        }
+        __m128i even = _mm_add_epi64(_mm_add_epi64(_mm_and_si128(sq[0], low), _mm_and_si128(sq[1], low)),
+                                     _mm_and_si128(sq[2], low));
+        __m128i odd = _mm_add_epi64(_mm_add_epi64(_mm_srli_epi64(sq[0], 32), _mm_srli_epi64(sq[1], 32)),
+                                    _mm_srli_epi64(sq[2], 32));
+        // soma < thr  <=>  soma - thr negativa (as duas ficam abaixo de 2^35)
+        __m128i ltEven = _mm_shuffle_epi32(_mm_srai_epi32(_mm_sub_epi64(even, thr), 31), _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i ltOdd = _mm_shuffle_epi32(_mm_srai_epi32(_mm_sub_epi64(odd, thr), 31), _MM_SHUFFLE(3, 3, 1, 1));
+        half[k] = _mm_or_si128(_mm_and_si128(ltEven, low), _mm_andnot_si128(low, ltOdd));
+    }
+    return _mm_packs_epi32(half[0], half[1]);
+}
+
+SIMD_TARGET("sse2")
+static inline __m128i absDiff16_sse2(__m128i a, __m128i b) {
+    return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+SIMD_TARGET("sse2")
+static size_t planar_sse2(uint16_t *const *p, size_t n, const PlanarOp &op) {
+    uint16_t *r = p[0], *g = p[1], *b = p[2], *a = p[3];
+    __m128i maxValue = _mm_set1_epi16((short)op.maxValue);
+    size_t i = 0;
+    switch (op.type) {
+        case PIXEL_NEGATIVE:
+        case PIXEL_COLORIZE:
+            for (int c = 0; c < 3; c++) {
+                __m128i color = _mm_set1_epi16((short)op.color[c]);
+                for (i = 0; i + 8 <= n; i += 8) {
+                    __m128i v = _mm_loadu_si128((const __m128i *)(p[c] + i));
+                    if (op.type == PIXEL_NEGATIVE) {
+                        v = _mm_sub_epi16(maxValue, v);
+                    } else {
+                        v = _mm_or_si128(v, color);
+                        v = _mm_sub_epi16(v, _mm_subs_epu16(v, maxValue));
+                    }
+                    _mm_storeu_si128((__m128i *)(p[c] + i), v);
+                }
+            }
+            break;
+        case PIXEL_GRAY:
+        case PIXEL_GRAY_MEAN: {
+            __m128i wr = _mm_set1_epi16(LUMA_WR), wg = _mm_set1_epi16(LUMA_WG), wb = _mm_set1_epi16(LUMA_WB);
+            __m128i zero = _mm_setzero_si128();
+            for (i = 0; i + 8 <= n; i += 8) {
+                __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+                __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+                __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+                __m128i y;
+                if (op.type == PIXEL_GRAY) {
+                    __m128i rl, rh, gl, gh, bl, bh;
+                    mul32_sse2(vr, wr, rl, rh);
+                    mul32_sse2(vg, wg, gl, gh);
+                    mul32_sse2(vb, wb, bl, bh);
+                    __m128i lo = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(rl, gl), bl), 15);
+                    __m128i hi = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(rh, gh), bh), 15);
+                    y = pack32to16_sse2(lo, hi);
+                } else {
+                    __m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(vr, zero), _mm_unpacklo_epi16(vg, zero)),
+                                               _mm_unpacklo_epi16(vb, zero));
+                    __m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(vr, zero), _mm_unpackhi_epi16(vg, zero)),
+                                               _mm_unpackhi_epi16(vb, zero));
+                    y = pack32to16_sse2(third_sse2(lo), third_sse2(hi));
+                }
+                _mm_storeu_si128((__m128i *)(r + i), y);
+                _mm_storeu_si128((__m128i *)(g + i), y);
+                _mm_storeu_si128((__m128i *)(b + i), y);
+            }
+            break;
+        }
+        case PIXEL_CHROMA_KEY: {
+            __m128i kr = _mm_set1_epi16((short)op.color[0]), kg = _mm_set1_epi16((short)op.color[1]);
+            __m128i kb = _mm_set1_epi16((short)op.color[2]);
+            __m128i thr = _mm_set1_epi64x((long long)op.thr);
+            for (i = 0; i + 8 <= n; i += 8) {
+                __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+                __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+                __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+                __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+                __m128i m = keyMask_sse2(absDiff16_sse2(vr, kr), absDiff16_sse2(vg, kg), absDiff16_sse2(vb, kb), thr);
+                _mm_storeu_si128((__m128i *)(r + i), _mm_andnot_si128(m, vr));
+                _mm_storeu_si128((__m128i *)(g + i), _mm_andnot_si128(m, vg));
+                _mm_storeu_si128((__m128i *)(b + i), _mm_andnot_si128(m, vb));
+                _mm_storeu_si128((__m128i *)(a + i), _mm_andnot_si128(m, va));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return i;
+}
+
+/*------------------------------------AVX2------------------------------------*/
+// As mesmas contas em 16 amostras; unpack e pack do AVX2 trabalham por
+// faixa de 128 bits, então a ordem das amostras se desfaz e refaz igual.
+SIMD_TARGET("avx2")
+static inline __m256i pack32to16_avx2(__m256i a, __m256i b) {
+    __m256i bias = _mm256_set1_epi32(32768);
+    __m256i packed = _mm256_packs_epi32(_mm256_sub_epi32(a, bias), _mm256_sub_epi32(b, bias));
+    return _mm256_xor_si256(packed, _mm256_set1_epi16((short)0x8000));
+}
+
+SIMD_TARGET("avx2")
+static inline __m256i third_avx2(__m256i sum) {
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sum), _mm256_set1_ps(1.0f / 3.0f)), _mm256_set1_ps(0.1f));
+    return _mm256_cvttps_epi32(v);
+}
+
+SIMD_TARGET("avx2")
+static inline void mul32_avx2(__m256i v, __m256i w, __m256i &lo, __m256i &hi) {
+    __m256i l = _mm256_mullo_epi16(v, w), h = _mm256_mulhi_epu16(v, w);
+    lo = _mm256_unpacklo_epi16(l, h);
+    hi = _mm256_unpackhi_epi16(l, h);
+}
+
+SIMD_TARGET("avx2")
+static inline __m256i keyMask_avx2(__m256i dr, __m256i dg, __m256i db, __m256i thr) {
+    __m256i low = _mm256_set1_epi64x(0xffffffff);
+    __m256i half[2];
+    for (int k = 0; k < 2; k++) {
+        __m256i sq[3];
+        __m256i d[3] = { dr, dg, db };
+        for (int c = 0; c < 3; c++) {
+            __m256i lo, hi;
+            mul32_avx2(d[c], d[c], lo, hi);
+            sq[c] = k == 0 ? lo : hi;
+        }
+        __m256i even = _mm256_add_epi64(_mm256_add_epi64(_mm256_and_si256(sq[0], low), _mm256_and_si256(sq[1], low)),
+                                        _mm256_and_si256(sq[2], low));
+        __m256i odd = _mm256_add_epi64(_mm256_add_epi64(_mm256_srli_epi64(sq[0], 32), _mm256_srli_epi64(sq[1], 32)),
+                                       _mm256_srli_epi64(sq[2], 32));
+        __m256i ltEven = _mm256_cmpgt_epi64(thr, even);
+        __m256i ltOdd = _mm256_cmpgt_epi64(thr, odd);
+        half[k] = _mm256_or_si256(_mm256_and_si256(ltEven, low), _mm256_andnot_si256(low, ltOdd));
+    }
+    return _mm256_packs_epi32(half[0], half[1]);
+}
+
+SIMD_TARGET("avx2")
+static inline __m256i absDiff16_avx2(__m256i a, __m256i b) {
+    return _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a));
+}
+
+SIMD_TARGET("avx2")
+static size_t planar_avx2(uint16_t *const *p, size_t n, const PlanarOp &op) {
+    uint16_t *r = p[0], *g = p[1], *b = p[2], *a = p[3];
+    __m256i maxValue = _mm256_set1_epi16((short)op.maxValue);
+    size_t i = 0;
+    switch (op.type) {
+        case PIXEL_NEGATIVE:
+        case PIXEL_COLORIZE:
+            for (int c = 0; c < 3; c++) {
+                __m256i color = _mm256_set1_epi16((short)op.color[c]);
+                for (i = 0; i + 16 <= n; i += 16) {
+                    __m256i v = _mm256_loadu_si256((const __m256i *)(p[c] + i));
+                    if (op.type == PIXEL_NEGATIVE) {
+                        v = _mm256_sub_epi16(maxValue, v);
+                    } else {
+                        v = _mm256_min_epu16(_mm256_or_si256(v, color), maxValue);
+                    }
+                    _mm256_storeu_si256((__m256i *)(p[c] + i), v);
+                }
+            }
+            break;
+        case PIXEL_GRAY:
+        case PIXEL_GRAY_MEAN: {
+            __m256i wr = _mm256_set1_epi16(LUMA_WR), wg = _mm256_set1_epi16(LUMA_WG), wb = _mm256_set1_epi16(LUMA_WB);
+            __m256i zero = _mm256_setzero_si256();
+            for (i = 0; i + 16 <= n; i += 16) {
+                __m256i vr = _mm256_loadu_si256((const __m256i *)(r + i));
+                __m256i vg = _mm256_loadu_si256((const __m256i *)(g + i));
+                __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+                __m256i y;
+                if (op.type == PIXEL_GRAY) {
+                    __m256i rl, rh, gl, gh, bl, bh;
+                    mul32_avx2(vr, wr, rl, rh);
+                    mul32_avx2(vg, wg, gl, gh);
+                    mul32_avx2(vb, wb, bl, bh);
+                    __m256i lo = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(rl, gl), bl), 15);
+                    __m256i hi = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(rh, gh), bh), 15);
+                    y = _mm256_packus_epi32(lo, hi);
+                } else {
+                    __m256i lo = _mm256_add_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(vr, zero), _mm256_unpacklo_epi16(vg, zero)),
+                                                  _mm256_unpacklo_epi16(vb, zero));
+                    __m256i hi = _mm256_add_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(vr, zero), _mm256_unpackhi_epi16(vg, zero)),
+                                                  _mm256_unpackhi_epi16(vb, zero));
+                    y = _mm256_packus_epi32(third_avx2(lo), third_avx2(hi));
+                }
+                _mm256_storeu_si256((__m256i *)(r + i), y);
+                _mm256_storeu_si256((__m256i *)(g + i), y);
+                _mm256_storeu_si256((__m256i *)(b + i), y);
+            }
+            break;
+        }
+        case PIXEL_CHROMA_KEY: {
+            __m256i kr = _mm256_set1_epi16((short)op.color[0]), kg = _mm256_set1_epi16((short)op.color[1]);
+            __m256i kb = _mm256_set1_epi16((short)op.color[2]);
+            __m256i thr = _mm256_set1_epi64x((long long)op.thr);
+            for (i = 0; i + 16 <= n; i += 16) {
+                __m256i vr = _mm256_loadu_si256((const __m256i *)(r + i));
+                __m256i vg = _mm256_loadu_si256((const __m256i *)(g + i));
+                __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+                __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+                __m256i m = keyMask_avx2(absDiff16_avx2(vr, kr), absDiff16_avx2(vg, kg), absDiff16_avx2(vb, kb), thr);
+                _mm256_storeu_si256((__m256i *)(r + i), _mm256_andnot_si256(m, vr));
+                _mm256_storeu_si256((__m256i *)(g + i), _mm256_andnot_si256(m, vg));
+                _mm256_storeu_si256((__m256i *)(b + i), _mm256_andnot_si256(m, vb));
+                _mm256_storeu_si256((__m256i *)(a + i), _mm256_andnot_si256(m, va));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return i;
+}
+
+#endif
+
+/*---------------------------------DESPACHO-----------------------------------*/
+// AVX-512 usa o kernel AVX2: com planos de 16 bits a passada já é limitada
+// pela memória.
+inline void planarOp(uint16_t *const *p, size_t n, const PlanarOp &op) {
+    size_t done = 0;
+#ifdef PPM_SIMD_X86
+    if (simdLevel() >= SIMD_AVX2) done = planar_avx2(p, n, op);
+    else if (simdLevel() >= SIMD_SSSE3) done = planar_sse2(p, n, op);
+#endif
+    uint16_t *rest[4] = { p[0] + done, p[1] + done, p[2] + done, p[3] + done };
+    planarScalar(rest, n - done, op);
+}
+
+// Os passos de 'ops' (cadeia não compilada) em todos os pixels de 'img'.
+inline void runPlanarOps(const vector<PixelOp> &ops, PlanarImage &img) {
+    if (ops.empty()) return;
+    vector<PlanarOp> planar;
+    for (size_t i = 0; i < ops.size(); i++) planar.push_back(toPlanarOp(ops[i], img.maxValue));
+    size_t n = img.pixels();
+    size_t tiles = (n + PLANAR_TILE - 1) / PLANAR_TILE;
+    threadPool().run(tiles, [&](size_t t) {
+        size_t end = (t + 1) * PLANAR_TILE < n ? (t + 1) * PLANAR_TILE : n;
+        for (size_t first = t * PLANAR_TILE; first < end; first += PLANAR_BLOCK) {
+            size_t count = end - first < PLANAR_BLOCK ? end - first : PLANAR_BLOCK;
+            uint16_t *p[4];
+            for (int c = 0; c < 4; c++) p[c] = img.planes[c].data() + first;
+            for (size_t k = 0; k < planar.size(); k++) planarOp(p, count, planar[k]);
+        }
+    });
+}
+
+/*--------------------------------VIZINHANÇA----------------------------------*/
+// Média da janela arredondada, como WindowDivisor (ppm_convolve.h), mas em
+// double: a soma chega a 65535 * n e o float não teria precisão para
+// separar o .5. Com n ímpar o resultado é exato.
+struct PlanarDivisor {
+    double inv;
+
+    PlanarDivisor(int n) : inv(1.0 / n) {}
+
+    uint16_t operator()(uint32_t sum) const {
+        return (uint16_t)(uint32_t)(sum * inv + 0.5);
+    }
+};
+
+// Faixas de linhas, uma por thread: a passada vertical recomeça a soma da
+// janela em cada faixa, então faixas grandes custam menos.
+template <class F>
+void planarBands(int h, F fn) {
+    int parts = threadPool().size();
+    if (parts > h) parts = h;
+    if (parts < 1) parts = 1;
+    threadPool().run(parts, [&](size_t t) {
+        fn((int)((int64_t)h * t / parts), (int)((int64_t)h * (t + 1) / parts));
+    });
+}
+
+// Uma linha de 'src' para 'dst' (diferentes), bordas repetidas.
+inline void planarBoxRow(const uint16_t *src, uint16_t *dst, int w, int radius) {
+    PlanarDivisor div(2 * radius + 1);
+    uint32_t sum = 0;
+    for (int k = -radius; k <= radius; k++) sum += src[clampIndex(k, w)];
+    for (int x = 0; x < w; x++) {
+        dst[x] = div(sum);
+        sum += src[clampIndex(x + radius + 1, w)] - src[clampIndex(x - radius, w)];
+    }
+}
+
+// Linhas [y0, y1) da passada vertical de 'src' para 'dst'. Com os planos,
+// uma linha já é um trecho contínuo de colunas: a soma de cada coluna
+// desce a faixa sem os blocos que o P6 intercalado precisa.
+inline void planarBoxColumns(const uint16_t *src, uint16_t *dst, int w, int h, int radius, int y0, int y1) {
+    PlanarDivisor div(2 * radius + 1);
+    vector<uint32_t> sum(w, 0);
+    for (int k = y0 - radius; k <= y0 + radius; k++) {
+        const uint16_t *row = src + (size_t)clampIndex(k, h) * w;
+        for (int x = 0; x < w; x++) sum[x] += row[x];
+    }
+    for (int y = y0; y < y1; y++) {
+        const uint16_t *in = src + (size_t)clampIndex(y + radius + 1, h) * w;
+        const uint16_t *out = src + (size_t)clampIndex(y - radius, h) * w;
+        uint16_t *d = dst + (size_t)y * w;
+        for (int x = 0; x < w; x++) {
+            d[x] = div(sum[x]);
+            sum[x] += in[x] - out[x];
+        }
+    }
+}
+
+// Boxes em sequência com os raios de 'radii' nos planos R, G e B, na mesma
+// ordem de boxPasses(): todas as horizontais, depois todas as verticais.
+inline void planarBoxPasses(PlanarImage &img, const vector<int> &radii) {
+    int w = img.width, h = img.height;
+    if (w < 1 || h < 1 || radii.empty()) return;
+    vector<uint16_t> tmp(img.pixels());
+    for (int c = 0; c < 3; c++) {
+        uint16_t *plane = img.planes[c].data();
+        parallelRows(w, h, [&](int y0, int y1) {
+            vector<uint16_t> a(w), b(w);
+            for (int y = y0; y < y1; y++) {
+                memcpy(a.data(), plane + (size_t)y * w, w * sizeof(uint16_t));
+                for (size_t i = 0; i < radii.size(); i++) {
+                    planarBoxRow(a.data(), b.data(), w, radii[i]);
+                    a.swap(b);
+                }
+                memcpy(tmp.data() + (size_t)y * w, a.data(), w * sizeof(uint16_t));
+            }
+        });
+        for (size_t i = 0; i < radii.size(); i++) {
+            const uint16_t *src = tmp.data();
+            uint16_t *dst = img.planes[c].data();
+            planarBands(h, [&](int y0, int y1) {
+                planarBoxColumns(src, dst, w, h, radii[i], y0, y1);
+            });
+            tmp.swap(img.planes[c]);
+        }
+        // depois da troca o resultado está em 'tmp'
+        tmp.swap(img.planes[c]);
+    }
+}
+
+// Máscara de nitidez, com a mesma conta inteira de sharpen().
+inline void planarSharpen(PlanarImage &img, double sigma, double amount) {
+    PlanarImage blurred = img;
+    planarBoxPasses(blurred, gaussianBoxes(sigma, 3));
+    int64_t a = (int64_t)floor(amount * 256.0 + 0.5);
+    int64_t maxValue = img.maxValue;
+    for (int c = 0; c < 3; c++) {
+        uint16_t *d = img.planes[c].data();
+        const uint16_t *b = blurred.planes[c].data();
+        planarBands(img.height, [&](int y0, int y1) {
+            size_t end = (size_t)y1 * img.width;
+            for (size_t i = (size_t)y0 * img.width; i < end; i++) {
+                int64_t v = d[i] + ((int64_t)d[i] - b[i]) * a / 256;
+                d[i] = (uint16_t)(v < 0 ? 0 : (v > maxValue ? maxValue : v));
+            }
+        });
+    }
+}
+
+// Magnitude do gradiente da luminância, como sobel(); as somas passam de
+// 32 bits ao quadrado, então a raiz é em double.
+inline void planarSobel(PlanarImage &img) {
+    int w = img.width, h = img.height;
+    if (w < 1 || h < 1) return;
+    uint16_t *r = img.planes[0].data(), *g = img.planes[1].data(), *b = img.planes[2].data();
+    vector<uint16_t> luma(img.pixels());
+    planarBands(h, [&](int y0, int y1) {
+        size_t end = (size_t)y1 * w;
+        for (size_t i = (size_t)y0 * w; i < end; i++) {
+            luma[i] = (uint16_t)(((uint32_t)r[i] * LUMA_WR + (uint32_t)g[i] * LUMA_WG + (uint32_t)b[i] * LUMA_WB) >> 15);
+        }
+    });
+    int64_t maxValue = img.maxValue;
+    planarBands(h, [&](int y0, int y1) {
+        vector<int64_t> smooth(w), diff(w);
+        for (int y = y0; y < y1; y++) {
+            const uint16_t *up = luma.data() + (size_t)clampIndex(y - 1, h) * w;
+            const uint16_t *mid = luma.data() + (size_t)y * w;
+            const uint16_t *down = luma.data() + (size_t)clampIndex(y + 1, h) * w;
+            for (int x = 0; x < w; x++) {
+                smooth[x] = up[x] + 2 * mid[x] + down[x];
+                diff[x] = (int64_t)down[x] - up[x];
+            }
+            size_t row = (size_t)y * w;
+            for (int x = 0; x < w; x++) {
+                int l = clampIndex(x - 1, w), rt = clampIndex(x + 1, w);
+                int64_t gx = smooth[rt] - smooth[l];
+                int64_t gy = diff[l] + 2 * diff[x] + diff[rt];
+                int64_t m = (int64_t)sqrt((double)(gx * gx + gy * gy));
+                r[row + x] = g[row + x] = b[row + x] = (uint16_t)(m > maxValue ? maxValue : m);
+            }
+        }
+    });
+}
+
+// Erosão e dilatação de van Herk / Gil-Werman (ppm_morphology.h) sobre
+// um plano: 'src' com 'count' amostras a 'stride' uma da outra, janela de
+// 2R+1 e bordas repetidas. 'g' e 'h' têm espaço para as posições com borda.
+inline void planarExtremeLine(const uint16_t *src, uint16_t *dst, int count, size_t stride, int radius,
+                              bool isMax, vector<uint16_t> &g, vector<uint16_t> &h) {
+    int k = 2 * radius + 1;
+    int n = (count + 2 * radius + k - 1) / k * k;
+    g.resize(n);
+    h.resize(n);
+    for (int b = 0; b < n; b += k) {
+        g[b] = src[clampIndex(b - radius, count) * stride];
+        for (int j = b + 1; j < b + k; j++) {
+            uint16_t v = src[clampIndex(j - radius, count) * stride];
+            g[j] = isMax ? max(g[j - 1], v) : min(g[j - 1], v);
+        }
+        h[b + k - 1] = src[clampIndex(b + k - 1 - radius, count) * stride];
+        for (int j = b + k - 2; j >= b; j--) {
+            uint16_t v = src[clampIndex(j - radius, count) * stride];
+            h[j] = isMax ? max(h[j + 1], v) : min(h[j + 1], v);
+        }
+    }
+    for (int x = 0; x < count; x++) {
+        uint16_t a = h[x], b = g[x + 2 * radius];
+        dst[x * stride] = isMax ? max(a, b) : min(a, b);
+    }
+}
+
+// Mínimo (erosão) ou máximo (dilatação) em janela (2R+1)x(2R+1) nos planos
+// R, G e B: linhas e depois colunas, como morphology().
+inline void planarExtreme(PlanarImage &img, int radius, bool isMax) {
+    int w = img.width, h = img.height;
+    if (radius < 1 || w < 1 || h < 1) return;
+    vector<uint16_t> tmp(img.pixels());
+    for (int c = 0; c < 3; c++) {
+        uint16_t *plane = img.planes[c].data();
+        planarBands(h, [&](int y0, int y1) {
+            vector<uint16_t> g, hh;
+            for (int y = y0; y < y1; y++) {
+                planarExtremeLine(plane + (size_t)y * w, tmp.data() + (size_t)y * w, w, 1, radius, isMax, g, hh);
+            }
+        });
+        int parts = threadPool().size();
+        threadPool().run(parts, [&](size_t t) {
+            vector<uint16_t> g, hh;
+            int x0 = (int)((int64_t)w * t / parts), x1 = (int)((int64_t)w * (t + 1) / parts);
+            for (int x = x0; x < x1; x++) planarExtremeLine(tmp.data() + x, plane + x, h, w, radius, isMax, g, hh);
+        });
+    }
+}
+
+inline void planarNeighborhood(const NeighborhoodOp &op, PlanarImage &img) {
+    switch (op.type) {
+        case NEIGHBOR_BLUR:
+            if (op.radius > 0) planarBoxPasses(img, vector<int>(1, op.radius));
+            break;
+        case NEIGHBOR_GAUSSIAN:
+            if (op.sigma > 0) planarBoxPasses(img, gaussianBoxes(op.sigma, 3));
+            break;
+        case NEIGHBOR_SHARPEN:  planarSharpen(img, op.sigma, op.amount); break;
+        case NEIGHBOR_SOBEL:    planarSobel(img); break;
+        case NEIGHBOR_ERODE:    planarExtreme(img, op.radius, false); break;
+        case NEIGHBOR_DILATE:   planarExtreme(img, op.radius, true); break;
+        case NEIGHBOR_OPEN:
+            planarExtreme(img, op.radius, false);
+            planarExtreme(img, op.radius, true);
+            break;
+        case NEIGHBOR_CLOSE:
+            planarExtreme(img, op.radius, true);
+            planarExtreme(img, op.radius, false);
+            break;
+        case NEIGHBOR_MEDIAN:   break;  // ver planarSupports()
+    }
+}
+
+/*---------------------------------HISTOGRAMA---------------------------------*/
+// Contagem dos planos R, G e B em maxValue + 1 valores por canal (canal c
+// em counts[c * (maxValue + 1) + v]), um histograma por thread.
+inline vector<uint32_t> planarHistogram(const PlanarImage &img) {
+    size_t bins = (size_t)img.maxValue + 1;
+    size_t pixels = img.pixels();
+    int parts = threadPool().size();
+    vector<vector<uint32_t>> partial(parts);
+    threadPool().run(parts, [&](size_t t) {
+        vector<uint32_t> counts(bins * 3, 0);
+        size_t first = pixels * t / parts, last = pixels * (t + 1) / parts;
+        for (int c = 0; c < 3; c++) {
+            const uint16_t *p = img.planes[c].data();
+            uint32_t *n = counts.data() + c * bins;
+            for (size_t i = first; i < last; i++) n[p[i]]++;
+        }
+        partial[t].swap(counts);
+    });
+    vector<uint32_t> total(bins * 3, 0);
+    for (int t = 0; t < parts; t++) {
+        for (size_t i = 0; i < partial[t].size(); i++) total[i] += partial[t][i];
+    }
+    return total;
+}
+
+// Tabela por canal como histogramTable(), com maxValue + 1 entradas.
+inline void planarHistogramTable(const HistogramOp &op, const vector<uint32_t> &counts, size_t pixels,
+                                 int maxValue, vector<uint16_t> table[3]) {
+    size_t bins = (size_t)maxValue + 1;
+    for (int c = 0; c < 3; c++) table[c].resize(bins);
+    if (op.type == HIST_LEVELS) {
+        for (int c = 0; c < 3; c++) {
+            int lo, hi;
+            clippedRange(counts.data() + c * bins, maxValue, pixels, op.clip, lo, hi);
+            stretchTable(table[c].data(), maxValue, lo, hi);
+        }
+        return;
+    }
+    vector<uint32_t> all(bins);
+    for (size_t v = 0; v < bins; v++) all[v] = counts[v] + counts[bins + v] + counts[2 * bins + v];
+    if (op.type == HIST_STRETCH) {
+        int lo, hi;
+        clippedRange(all.data(), maxValue, pixels * 3, op.clip, lo, hi);
+        stretchTable(table[0].data(), maxValue, lo, hi);
+    } else {
+        equalizeTable(table[0].data(), maxValue, all.data(), pixels * 3);
+    }
+    table[1] = table[0];
+    table[2] = table[0];
+}
+
+inline void planarHistogramFilter(const HistogramOp &op, PlanarImage &img) {
+    vector<uint16_t> table[3];
+    planarHistogramTable(op, planarHistogram(img), img.pixels(), img.maxValue, table);
+    planarBands(img.height, [&](int y0, int y1) {
+        size_t first = (size_t)y0 * img.width, last = (size_t)y1 * img.width;
+        for (int c = 0; c < 3; c++) {
+            uint16_t *p = img.planes[c].data();
+            const uint16_t *t = table[c].data();
+            for (size_t i = first; i < last; i++) p[i] = t[p[i]];
+        }
+    });
+}
+
+/*-----------------------------------RECORTE----------------------------------*/
+// O teste do chroma-key planar vira a máscara de ppm_cutout.h, limpa do
+// mesmo jeito; o fundo é zerado como no chroma-key planar, alfa inclusive.
+inline void planarCutout(const CutoutOp &op, PlanarImage &img) {
+    int w = img.width, h = img.height;
+    if (w < 1 || h < 1) return;
+    PixelOp key = {};
+    key.type = PIXEL_CHROMA_KEY;
+    key.r = op.r;
+    key.g = op.g;
+    key.b = op.b;
+    key.thr = op.thr;
+    PlanarOp p = toPlanarOp(key, img.maxValue);
+    uint16_t *planes[4] = { img.planes[0].data(), img.planes[1].data(), img.planes[2].data(), img.planes[3].data() };
+    vector<unsigned char> mask(img.pixels());
+    planarBands(h, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * w; i < (size_t)y1 * w; i++) {
+            int64_t dr = planes[0][i] - p.color[0], dg = planes[1][i] - p.color[1], db = planes[2][i] - p.color[2];
+            mask[i] = (uint64_t)(dr * dr + dg * dg + db * db) < p.thr ? 0 : 255;
+        }
+    });
+    cleanMask(mask.data(), w, h, op.minArea);
+    planarBands(h, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * w; i < (size_t)y1 * w; i++) {
+            if (mask[i] == 0) planes[0][i] = planes[1][i] = planes[2][i] = planes[3][i] = 0;
+        }
+    });
+}
+
+/*-----------------------------------CADEIA-----------------------------------*/
+// Passos de imagem com versão planar. A paleta (ppm_palette.h) não tem:
+// ela conta e mapeia cores de 8 bits (células 5:5:5), o que jogaria fora a
+// profundidade que o caminho planar existe para manter. A mediana também
+// não: os histogramas de 256 valores por coluna de ppm_morphology.h
+// teriam 65536 com amostras de 16 bits.
+inline bool planarSupports(const ImageStep &step) {
+    if (step.type == STEP_NEIGHBORHOOD) return step.neighborhood.type != NEIGHBOR_MEDIAN;
+    return step.type == STEP_HISTOGRAM || step.type == STEP_CUTOUT;
+}
+
+// A cadeia inteira (não compilada) sobre os planos: cada trecho pontual em
+// uma passada por blocos e os passos de imagem entre eles. A tabela de um
+// filtro por histograma é aplicada na hora, sem compor com o trecho
+// seguinte como runChain() faz. Falso, sem tocar na imagem, se algum passo
+// não tem versão planar.
+inline bool runPlanarChain(const FilterChain &chain, PlanarImage &img) {
+    for (size_t i = 0; i < chain.steps.size(); i++) {
+        if (!planarSupports(chain.steps[i])) return false;
+    }
+    size_t start = 0;
+    for (size_t i = 0; i <= chain.steps.size(); i++) {
+        size_t end = i < chain.steps.size() ? chain.steps[i].at : chain.ops.size();
+        runPlanarOps(vector<PixelOp>(chain.ops.begin() + start, chain.ops.begin() + end), img);
+        if (i == chain.steps.size()) break;
+        const ImageStep &step = chain.steps[i];
+        if (step.type == STEP_HISTOGRAM) {
+            planarHistogramFilter(step.histogram, img);
+        } else if (step.type == STEP_CUTOUT) {
+            planarCutout(step.cutout, img);
+        } else {
+            planarNeighborhood(step.neighborhood, img);
+        }
+        start = end;
+    }
+    return true;
+}
+
+#endif
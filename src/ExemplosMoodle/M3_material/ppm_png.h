@@ -0,0 +1,797 @@
+// Gravação em PNG com compressão paralela.
+//
+// A imagem é dividida em faixas de linhas (~PNG_BAND_BYTES cada) que são
+// filtradas e comprimidas em paralelo, cada uma com seu próprio deflate:
+// uma faixa não referencia bytes da anterior, então nenhuma espera outra.
+// As faixas que não são a última terminam com um bloco vazio "stored",
+// que deixa a saída alinhada em byte, e assim os pedaços são simplesmente
+// concatenados num único fluxo zlib, um chunk IDAT por faixa. O adler32
+// de cada faixa é combinado no fim e o CRC de cada chunk também é
+// calculado em paralelo. Perde-se um pouco de compressão na emenda (a
+// janela recomeça vazia), em troca de escalar com as threads.
+//
+// O filtro PNG de cada linha é escolhido pela heurística usual: o que der
+// a menor soma dos valores absolutos (como bytes com sinal). O deflate é
+// LZ77 guloso com cadeias de hash limitadas e blocos Huffman dinâmicos.
+// Imagens com até 256 cores saem como PNG indexado (PLTE + 1 byte/pixel).
+#ifndef _PPM_PNG_H_
+#define _PPM_PNG_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include "ppm_io.h"
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+
+using namespace std;
+
+const size_t PNG_BAND_BYTES = 512 * 1024;   // bytes de pixels por faixa, no máximo
+const size_t PNG_MIN_BAND_BYTES = 128 * 1024;   // e no mínimo, se houver poucas faixas por thread
+const int DEFLATE_WINDOW = 32768;
+const int DEFLATE_HASH_BITS = 15;
+const int DEFLATE_MAX_CHAIN = 8;            // candidatos examinados por posição
+const int DEFLATE_NICE_LENGTH = 32;         // match bom o bastante: para a busca
+const size_t DEFLATE_BLOCK_SYMBOLS = 32768; // símbolos por bloco Huffman
+const int DEFLATE_SKIP_AFTER = 64;          // literais seguidos até começar a pular posições
+
+/*------------------------------------CRC32-----------------------------------*/
+inline const uint32_t *crcTable() {
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+inline uint32_t crc32(uint32_t crc, const unsigned char *p, size_t n) {
+    const uint32_t *t = crcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = t[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/*-----------------------------------ADLER32----------------------------------*/
+const uint32_t ADLER_BASE = 65521;
+
+// 5552 é o maior bloco em que as somas de 32 bits não estouram antes do
+// módulo.
+inline uint32_t adler32(uint32_t adler, const unsigned char *p, size_t n) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n > 0) {
+        size_t block = n < 5552 ? n : 5552;
+        n -= block;
+        for (size_t i = 0; i < block; i++) {
+            a += p[i];
+            b += a;
+        }
+        p += block;
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return a | (b << 16);
+}
+
+// adler32 de A seguido de B, a partir do adler de cada um e do tamanho de B.
+inline uint32_t adler32Combine(uint32_t adlerA, uint32_t adlerB, size_t lengthB) {
+    uint32_t rem = (uint32_t)(lengthB % ADLER_BASE);
+    uint32_t a = adlerA & 0xFFFF;
+    uint32_t b = (uint32_t)((uint64_t)rem * a % ADLER_BASE);
+    a += (adlerB & 0xFFFF) + ADLER_BASE - 1;
+    b += (adlerA >> 16) + (adlerB >> 16) + ADLER_BASE - rem;
+    if (a >= ADLER_BASE) a -= ADLER_BASE;
+    if (a >= ADLER_BASE) a -= ADLER_BASE;
+    if (b >= 2 * ADLER_BASE) b -= 2 * ADLER_BASE;
+    if (b >= ADLER_BASE) b -= ADLER_BASE;
+    return a | (b << 16);
+}
+
+/*-----------------------------------DEFLATE----------------------------------*/
+// Bits saem a partir do menos significativo, como pede o deflate.
+class BitWriter {
+    vector<unsigned char> &out;
+    uint64_t bits;
+    int count;
+
+public:
+    BitWriter(vector<unsigned char> &o) : out(o), bits(0), count(0) {}
+
+    // até 32 bits por vez
+    void put(uint32_t value, int n) {
+        bits |= (uint64_t)value << count;
+        count += n;
+        if (count >= 32) {
+            size_t size = out.size();
+            out.resize(size + 4);
+            unsigned char *p = out.data() + size;
+            p[0] = (unsigned char)bits;
+            p[1] = (unsigned char)(bits >> 8);
+            p[2] = (unsigned char)(bits >> 16);
+            p[3] = (unsigned char)(bits >> 24);
+            bits >>= 32;
+            count -= 32;
+        }
+    }
+
+    // bytes crus, depois de align()
+    void bytes(const unsigned char *p, size_t n) {
+        out.insert(out.end(), p, p + n);
+    }
+
+    // completa o último byte com zeros
+    void align() {
+        while (count > 0) {
+            out.push_back((unsigned char)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+        bits = 0;
+        count = 0;
+    }
+};
+
+// Códigos de comprimento (257..285) e de distância (0..29) do deflate.
+struct DeflateTables {
+    unsigned char lengthCode[259];      // comprimento 3..258 -> código - 257
+    unsigned char distCode[512];        // ver distanceCode()
+    static constexpr int lengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+        67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static constexpr int lengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static constexpr int distBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static constexpr int distExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    DeflateTables() {
+        for (int c = 0; c < 29; c++) {
+            int end = c < 28 ? lengthBase[c + 1] : 259;
+            for (int len = lengthBase[c]; len < end; len++) lengthCode[len] = (unsigned char)c;
+        }
+        lengthCode[258] = 28;
+        // distâncias 1..256 direto; acima disso, em passos de 128
+        for (int c = 0; c < 30; c++) {
+            int end = c < 29 ? distBase[c + 1] : 32769;
+            for (int d = distBase[c]; d < end; d++) {
+                if (d <= 256) distCode[d - 1] = (unsigned char)c;
+                else distCode[256 + ((d - 1) >> 7)] = (unsigned char)c;
+            }
+        }
+    }
+
+    int distanceCode(int d) const {
+        return d <= 256 ? distCode[d - 1] : distCode[256 + ((d - 1) >> 7)];
+    }
+};
+
+inline const DeflateTables &deflateTables() {
+    static const DeflateTables tables;
+    return tables;
+}
+
+// Comprimentos de código Huffman para 'n' símbolos, no máximo 'limit'
+// bits. Se a árvore passar do limite, as frequências são divididas por 2
+// (sem zerar nenhuma) e a árvore refeita, o que a deixa mais rasa.
+inline void huffmanLengths(const uint32_t *freq, int n, int limit, unsigned char *lengths) {
+    vector<uint32_t> f(freq, freq + n);
+    // o deflate quer ao menos dois códigos em cada árvore
+    int used = 0;
+    for (int i = 0; i < n; i++) used += f[i] > 0;
+    for (int i = 0; used < 2 && i < n; i++) {
+        if (f[i] == 0) {
+            f[i] = 1;
+            used++;
+        }
+    }
+    for (;;) {
+        typedef pair<uint32_t, int> Node;
+        vector<Node> heap;
+        vector<int> parent(2 * n, -1);
+        for (int i = 0; i < n; i++) {
+            if (f[i] > 0) heap.push_back(Node(f[i], i));
+        }
+        make_heap(heap.begin(), heap.end(), greater<Node>());
+        int next = n;
+        while (heap.size() > 1) {
+            pop_heap(heap.begin(), heap.end(), greater<Node>());
+            Node a = heap.back();
+            heap.pop_back();
+            pop_heap(heap.begin(), heap.end(), greater<Node>());
+            Node b = heap.back();
+            heap.pop_back();
+            parent[a.second] = parent[b.second] = next;
+            heap.push_back(Node(a.first + b.first, next++));
+            push_heap(heap.begin(), heap.end(), greater<Node>());
+        }
+        // os nós internos nascem em ordem, então o pai sempre tem índice
+        // maior: de cima para baixo basta uma passada
+        vector<int> depth(next, 0);
+        int deepest = 0;
+        for (int i = next - 2; i >= 0; i--) {
+            if (parent[i] >= 0) depth[i] = depth[parent[i]] + 1;
+        }
+        for (int i = 0; i < n; i++) {
+            lengths[i] = (unsigned char)(f[i] > 0 ? depth[i] : 0);
+            if (lengths[i] > deepest) deepest = lengths[i];
+        }
+        if (deepest <= limit) return;
+        for (int i = 0; i < n; i++) {
+            if (f[i] > 0) f[i] = (f[i] + 1) / 2;
+        }
+    }
+}
+
+// Códigos canônicos a partir dos comprimentos, já com os bits invertidos
+// para sair pelo BitWriter.
+inline void huffmanCodes(const unsigned char *lengths, int n, uint16_t *codes) {
+    int count[16] = { 0 }, next[16] = { 0 };
+    for (int i = 0; i < n; i++) count[lengths[i]]++;
+    count[0] = 0;
+    for (int len = 1, code = 0; len < 16; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        int len = lengths[i];
+        if (len == 0) continue;
+        int code = next[len]++, reversed = 0;
+        for (int k = 0; k < len; k++) reversed |= ((code >> k) & 1) << (len - 1 - k);
+        codes[i] = (uint16_t)reversed;
+    }
+}
+
+// Um literal (dist == 0) ou um match (comprimento, distância).
+struct DeflateSymbol {
+    uint16_t length;    // literal: o byte
+    uint16_t dist;
+};
+
+// 'n' bytes sem compressão, em blocos "stored" de até 65535 bytes.
+inline void writeStoredBlocks(BitWriter &bw, const unsigned char *raw, size_t n, bool final) {
+    do {
+        size_t len = n < 65535 ? n : 65535;
+        n -= len;
+        bw.put(final && n == 0 ? 1 : 0, 1);
+        bw.put(0, 2);
+        bw.align();
+        unsigned char header[4] = { (unsigned char)len, (unsigned char)(len >> 8),
+                                    (unsigned char)~len, (unsigned char)(~len >> 8) };
+        bw.bytes(header, 4);
+        bw.bytes(raw, len);
+        raw += len;
+    } while (n > 0);
+}
+
+// Escreve os símbolos 'syms', que codificam os 'rawLength' bytes de 'raw',
+// num bloco Huffman dinâmico; se ele sair maior que os bytes crus (ruído,
+// por exemplo), grava os bytes em blocos stored.
+inline void writeBlock(BitWriter &bw, const vector<DeflateSymbol> &syms, const unsigned char *raw,
+                       size_t rawLength, bool final) {
+    const DeflateTables &t = deflateTables();
+    uint32_t litFreq[286] = { 0 }, distFreq[30] = { 0 };
+    uint64_t bits = 0;
+    for (size_t i = 0; i < syms.size(); i++) {
+        if (syms[i].dist == 0) {
+            litFreq[syms[i].length]++;
+        } else {
+            int lc = t.lengthCode[syms[i].length], dc = t.distanceCode(syms[i].dist);
+            litFreq[257 + lc]++;
+            distFreq[dc]++;
+            bits += DeflateTables::lengthExtra[lc] + DeflateTables::distExtra[dc];
+        }
+    }
+    litFreq[256] = 1;
+
+    unsigned char lengths[286 + 30];
+    unsigned char *litLen = lengths, *distLen = lengths + 286;
+    huffmanLengths(litFreq, 286, 15, litLen);
+    huffmanLengths(distFreq, 30, 15, distLen);
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && litLen[hlit - 1] == 0) hlit--;
+    while (hdist > 1 && distLen[hdist - 1] == 0) hdist--;
+
+    // comprimentos de litLen e distLen seguidos, com repetições em RLE:
+    // 16 repete o anterior 3..6 vezes, 17 e 18 são 3..10 e 11..138 zeros
+    unsigned char all[286 + 30];
+    memcpy(all, litLen, hlit);
+    memcpy(all + hlit, distLen, hdist);
+    int total = hlit + hdist;
+    vector<pair<int, int>> rle;     // (símbolo, extra)
+    uint32_t clFreq[19] = { 0 };
+    for (int i = 0; i < total;) {
+        int v = all[i], run = 1;
+        while (i + run < total && all[i + run] == v) run++;
+        int left = run;
+        if (v == 0) {
+            while (left >= 11) {
+                int r = left < 138 ? left : 138;
+                rle.push_back(make_pair(18, r - 11));
+                left -= r;
+            }
+            if (left >= 3) {
+                rle.push_back(make_pair(17, left - 3));
+                left = 0;
+            }
+        } else {
+            rle.push_back(make_pair(v, 0));
+            left--;
+            while (left >= 3) {
+                int r = left < 6 ? left : 6;
+                rle.push_back(make_pair(16, r - 3));
+                left -= r;
+            }
+        }
+        for (; left > 0; left--) rle.push_back(make_pair(v, 0));
+        i += run;
+    }
+    for (size_t i = 0; i < rle.size(); i++) clFreq[rle[i].first]++;
+
+    static const int order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    unsigned char clLen[19];
+    uint16_t clCode[19] = { 0 }, litCode[286] = { 0 }, distCode[30] = { 0 };
+    huffmanLengths(clFreq, 19, 7, clLen);
+    huffmanCodes(clLen, 19, clCode);
+    huffmanCodes(litLen, 286, litCode);
+    huffmanCodes(distLen, 30, distCode);
+    int hclen = 19;
+    while (hclen > 4 && clLen[order[hclen - 1]] == 0) hclen--;
+
+    static const int rleExtra[3] = { 2, 3, 7 };
+    bits += 17 + hclen * 3;
+    for (size_t i = 0; i < rle.size(); i++) {
+        int s = rle[i].first;
+        bits += clLen[s] + (s >= 16 ? rleExtra[s - 16] : 0);
+    }
+    for (int i = 0; i < 286; i++) bits += (uint64_t)litFreq[i] * litLen[i];
+    for (int i = 0; i < 30; i++) bits += (uint64_t)distFreq[i] * distLen[i];
+    uint64_t storedBits = (rawLength + 5 * (rawLength / 65535 + 1)) * 8 + 7;
+    if (rawLength > 0 && storedBits < bits) {
+        writeStoredBlocks(bw, raw, rawLength, final);
+        return;
+    }
+
+    bw.put(final ? 1 : 0, 1);
+    bw.put(2, 2);
+    bw.put(hlit - 257, 5);
+    bw.put(hdist - 1, 5);
+    bw.put(hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) bw.put(clLen[order[i]], 3);
+    for (size_t i = 0; i < rle.size(); i++) {
+        int s = rle[i].first;
+        bw.put(clCode[s], clLen[s]);
+        if (s >= 16) bw.put(rle[i].second, rleExtra[s - 16]);
+    }
+
+    for (size_t i = 0; i < syms.size(); i++) {
+        const DeflateSymbol &s = syms[i];
+        if (s.dist == 0) {
+            bw.put(litCode[s.length], litLen[s.length]);
+            continue;
+        }
+        int lc = t.lengthCode[s.length], dc = t.distanceCode(s.dist);
+        bw.put(litCode[257 + lc], litLen[257 + lc]);
+        bw.put(s.length - DeflateTables::lengthBase[lc], DeflateTables::lengthExtra[lc]);
+        bw.put(distCode[dc], distLen[dc]);
+        bw.put(s.dist - DeflateTables::distBase[dc], DeflateTables::distExtra[dc]);
+    }
+    bw.put(litCode[256], litLen[256]);
+}
+
+// Quantos bytes iguais a partir de 'a' e 'b', até 'limit', 8 por vez.
+inline int matchLength(const unsigned char *a, const unsigned char *b, int limit) {
+    int n = 0;
+    while (n + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y) break;
+        n += 8;
+    }
+    while (n < limit && a[n] == b[n]) n++;
+    return n;
+}
+
+inline uint32_t deflateHash(const unsigned char *p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Comprime 'data' em blocos deflate, sem referências a nada fora dele.
+// Termina com BFINAL se 'last'; senão com um bloco vazio sem compressão,
+// que alinha a saída em byte para a próxima faixa continuar o fluxo.
+inline void deflateBand(const unsigned char *data, size_t n, bool last, vector<unsigned char> &out) {
+    BitWriter bw(out);
+    vector<int32_t> head((size_t)1 << DEFLATE_HASH_BITS, -1), prev(DEFLATE_WINDOW, -1);
+    vector<DeflateSymbol> syms;
+    syms.reserve(DEFLATE_BLOCK_SYMBOLS);
+
+    size_t pos = 0, blockStart = 0, skipUntil = 0;
+    int misses = 0;
+    while (pos < n) {
+        int best = 0, bestDist = 0;
+        if (pos + 3 <= n && pos >= skipUntil) {
+            uint32_t h = deflateHash(data + pos);
+            int limit = n - pos < 258 ? (int)(n - pos) : 258;
+            int32_t cand = head[h];
+            for (int chain = DEFLATE_MAX_CHAIN; cand >= 0 && chain > 0; chain--) {
+                size_t dist = pos - cand;
+                if (dist > DEFLATE_WINDOW) break;
+                // o byte que estenderia o melhor match e os 3 primeiros
+                // descartam a maioria dos candidatos sem comparar tudo
+                const unsigned char *c = data + cand, *p = data + pos;
+                if (c[best] == p[best] && c[0] == p[0] && c[1] == p[1] && c[2] == p[2]) {
+                    int len = matchLength(data + cand, data + pos, limit);
+                    if (len > best) {
+                        best = len;
+                        bestDist = (int)dist;
+                        if (len >= DEFLATE_NICE_LENGTH || len == limit) break;
+                    }
+                }
+                int32_t older = prev[cand & (DEFLATE_WINDOW - 1)];
+                if (older >= cand) break;   // entrada velha, já sobrescrita
+                cand = older;
+            }
+            prev[pos & (DEFLATE_WINDOW - 1)] = head[h];
+            head[h] = (int32_t)pos;
+        }
+        DeflateSymbol s;
+        if (best >= 3) {
+            s.length = (uint16_t)best;
+            s.dist = (uint16_t)bestDist;
+            // as posições dentro do match também entram no hash
+            size_t end = pos + best;
+            for (pos++; pos < end && pos + 3 <= n; pos++) {
+                uint32_t h = deflateHash(data + pos);
+                prev[pos & (DEFLATE_WINDOW - 1)] = head[h];
+                head[h] = (int32_t)pos;
+            }
+            pos = end;
+            misses = 0;
+        } else {
+            s.length = data[pos++];
+            s.dist = 0;
+            // trecho sem repetições (ruído): procura cada vez mais espaçado
+            if (++misses > DEFLATE_SKIP_AFTER && pos >= skipUntil) {
+                int step = (misses - DEFLATE_SKIP_AFTER) / DEFLATE_SKIP_AFTER;
+                skipUntil = pos + (step < DEFLATE_SKIP_AFTER ? step : DEFLATE_SKIP_AFTER);
+            }
+        }
+        syms.push_back(s);
+        if (syms.size() == DEFLATE_BLOCK_SYMBOLS) {
+            writeBlock(bw, syms, data + blockStart, pos - blockStart, last && pos == n);
+            syms.clear();
+            blockStart = pos;
+        }
+    }
+    if (!syms.empty() || (last && n == 0)) writeBlock(bw, syms, data + blockStart, pos - blockStart, last);
+    if (!last) {
+        // bloco stored vazio: alinha em byte sem encerrar o fluxo
+        writeStoredBlocks(bw, NULL, 0, false);
+    }
+    bw.align();
+}
+
+/*-----------------------------------FILTROS----------------------------------*/
+inline int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+inline unsigned filterCost(unsigned char v) {
+    return v < 128 ? v : 256 - v;
+}
+
+// Sub, Up, Average e Paeth dos bytes [i0, i1) de 'row' em dst[0..3],
+// somando em cost[0..4] o custo deles e o da linha sem filtro.
+inline void filterBytes(const unsigned char *row, const unsigned char *prev, int bpp,
+                        unsigned char *const *dst, uint64_t *cost, size_t i0, size_t i1) {
+    for (size_t i = i0; i < i1; i++) {
+        int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+        unsigned char v[4] = { (unsigned char)(row[i] - a), (unsigned char)(row[i] - b),
+                               (unsigned char)(row[i] - ((a + b) >> 1)), (unsigned char)(row[i] - paeth(a, b, c)) };
+        cost[0] += filterCost(row[i]);
+        for (int k = 0; k < 4; k++) {
+            dst[k][i] = v[k];
+            cost[k + 1] += filterCost(v[k]);
+        }
+    }
+}
+
+#ifdef PPM_SIMD_X86
+// Preditor Paeth em 16 bits: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|.
+SIMD_TARGET("ssse3")
+static inline __m128i paeth_ssse3(__m128i a, __m128i b, __m128i c) {
+    __m128i pa = _mm_abs_epi16(_mm_sub_epi16(b, c));
+    __m128i pb = _mm_abs_epi16(_mm_sub_epi16(a, c));
+    __m128i pc = _mm_abs_epi16(_mm_add_epi16(_mm_sub_epi16(a, c), _mm_sub_epi16(b, c)));
+    __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    __m128i notB = _mm_cmpgt_epi16(pb, pc);
+    __m128i bc = _mm_or_si128(_mm_andnot_si128(notB, b), _mm_and_si128(notB, c));
+    return _mm_or_si128(_mm_andnot_si128(notA, a), _mm_and_si128(notA, bc));
+}
+
+// O mesmo que filterBytes() de 16 em 16 bytes a partir de 'bpp'. O custo
+// de cada filtro sai de pabsb (|byte com sinal|) e psadbw (soma).
+// Devolve até onde foi.
+SIMD_TARGET("ssse3")
+static size_t filterBytes_ssse3(const unsigned char *row, const unsigned char *prev, int bpp,
+                                unsigned char *const *dst, uint64_t *cost, size_t n) {
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+    __m128i sums[5] = { zero, zero, zero, zero, zero };
+    size_t i = bpp;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i a = _mm_loadu_si128((const __m128i *)(row + i - bpp));
+        __m128i b = _mm_loadu_si128((const __m128i *)(prev + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(prev + i - bpp));
+        // média arredondada para baixo: pavgb arredonda para cima
+        __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        __m128i lo = paeth_ssse3(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+        __m128i hi = paeth_ssse3(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+        __m128i v[5] = { x, _mm_sub_epi8(x, a), _mm_sub_epi8(x, b), _mm_sub_epi8(x, avg),
+                         _mm_sub_epi8(x, _mm_packus_epi16(lo, hi)) };
+        for (int k = 0; k < 5; k++) {
+            if (k > 0) _mm_storeu_si128((__m128i *)(dst[k - 1] + i), v[k]);
+            sums[k] = _mm_add_epi64(sums[k], _mm_sad_epu8(_mm_abs_epi8(v[k]), zero));
+        }
+    }
+    for (int k = 0; k < 5; k++) {
+        uint64_t s[2];
+        _mm_storeu_si128((__m128i *)s, sums[k]);
+        cost[k] += s[0] + s[1];
+    }
+    return i;
+}
+#endif
+
+// Filtra uma linha de 'n' bytes ('bpp' bytes por pixel) com o filtro que
+// der a menor soma de |byte com sinal|; grava o tipo e a linha em 'out'.
+// 'prev' é a linha anterior sem filtro (zeros na primeira linha).
+inline void filterRow(const unsigned char *row, const unsigned char *prev, size_t n, int bpp,
+                      unsigned char *out, vector<unsigned char> &scratch) {
+    scratch.resize(n * 4);
+    unsigned char *dst[4] = { scratch.data(), scratch.data() + n, scratch.data() + 2 * n, scratch.data() + 3 * n };
+    uint64_t cost[5] = { 0, 0, 0, 0, 0 };
+    size_t head = n < (size_t)bpp ? n : bpp;
+    filterBytes(row, prev, bpp, dst, cost, 0, head);
+    size_t i = head;
+#ifdef PPM_SIMD_X86
+    if (simdLevel() >= SIMD_SSSE3) i = filterBytes_ssse3(row, prev, bpp, dst, cost, n);
+#endif
+    filterBytes(row, prev, bpp, dst, cost, i, n);
+
+    int best = 0;
+    for (int type = 1; type < 5; type++) {
+        if (cost[type] < cost[best]) best = type;
+    }
+    out[0] = (unsigned char)best;
+    memcpy(out + 1, best == 0 ? row : dst[best - 1], n);
+}
+
+/*-----------------------------------ARQUIVO----------------------------------*/
+inline void appendBE32(vector<unsigned char> &v, uint32_t x) {
+    unsigned char b[4] = { (unsigned char)(x >> 24), (unsigned char)(x >> 16), (unsigned char)(x >> 8), (unsigned char)x };
+    v.insert(v.end(), b, b + 4);
+}
+
+// Chunk completo (tamanho, tipo, dados, CRC) a partir de 'data'.
+inline void makeChunk(const char *type, const unsigned char *data, size_t n, vector<unsigned char> &chunk) {
+    chunk.clear();
+    chunk.reserve(n + 12);
+    appendBE32(chunk, (uint32_t)n);
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data, data + n);
+    appendBE32(chunk, crc32(0, chunk.data() + 4, n + 4));
+}
+
+// 'pixels' são linhas de w * channels amostras de 8 ou 16 bits (16 bits
+// em big-endian, como no PNG). channels: 1 cinza, 2 cinza+alfa, 3 RGB,
+// 4 RGBA.
+// Com 'palette' (paletteSize cores RGB), 'pixels' são índices de 1 byte e
+// o PNG sai indexado (tipo de cor 3) e sem filtros, que em índices só
+// atrapalham o deflate.
+inline bool writePNG(const string &file, const unsigned char *pixels, int w, int h, int channels, int bitDepth,
+                     const unsigned char *palette = NULL, int paletteSize = 0) {
+    static const unsigned char colorTypes[5] = { 0, 0, 4, 2, 6 };
+    int bpp = channels * bitDepth / 8;
+    size_t rowBytes = (size_t)w * bpp;
+    // faixas menores para dar ao menos duas por thread, mas não tão
+    // pequenas que a janela vazia no começo de cada uma pese na compressão
+    size_t bandBytes = rowBytes * h / (2 * threadPool().size());
+    if (bandBytes > PNG_BAND_BYTES) bandBytes = PNG_BAND_BYTES;
+    if (bandBytes < PNG_MIN_BAND_BYTES) bandBytes = PNG_MIN_BAND_BYTES;
+    int bandRows = (int)(bandBytes / (rowBytes > 0 ? rowBytes : 1));
+    if (bandRows < 1) bandRows = 1;
+    int bands = (h + bandRows - 1) / bandRows;
+    if (bands < 1) bands = 1;
+
+    // cada faixa: filtra, calcula o adler e comprime
+    vector<vector<unsigned char>> compressed(bands);
+    vector<uint32_t> adlers(bands);
+    vector<size_t> lengths(bands);
+    threadPool().run(bands, [&](size_t band) {
+        int y0 = (int)band * bandRows;
+        int y1 = y0 + bandRows < h ? y0 + bandRows : h;
+        vector<unsigned char> filtered((size_t)(y1 - y0) * (rowBytes + 1)), scratch;
+        vector<unsigned char> zeros(y0 == 0 ? rowBytes : 0, 0);
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *row = pixels + y * rowBytes;
+            const unsigned char *prev = y > 0 ? row - rowBytes : zeros.data();
+            unsigned char *out = filtered.data() + (size_t)(y - y0) * (rowBytes + 1);
+            if (palette) {
+                out[0] = 0;
+                memcpy(out + 1, row, rowBytes);
+            } else {
+                filterRow(row, prev, rowBytes, bpp, out, scratch);
+            }
+        }
+        adlers[band] = adler32(1, filtered.data(), filtered.size());
+        lengths[band] = filtered.size();
+        compressed[band].reserve(filtered.size() / 2);
+        deflateBand(filtered.data(), filtered.size(), band == (size_t)bands - 1, compressed[band]);
+    });
+
+    // cabeçalho zlib na primeira faixa e adler32 total depois da última
+    uint32_t adler = adlers[0];
+    for (int b = 1; b < bands; b++) adler = adler32Combine(adler, adlers[b], lengths[b]);
+    const unsigned char zlibHeader[2] = { 0x78, 0x01 };
+    compressed[0].insert(compressed[0].begin(), zlibHeader, zlibHeader + 2);
+    appendBE32(compressed[bands - 1], adler);
+
+    vector<vector<unsigned char>> chunks(bands);
+    threadPool().run(bands, [&](size_t band) {
+        makeChunk("IDAT", compressed[band].data(), compressed[band].size(), chunks[band]);
+    });
+
+    unsigned char ihdr[13];
+    uint32_t dims[2] = { (uint32_t)w, (uint32_t)h };
+    for (int k = 0; k < 2; k++) {
+        for (int i = 0; i < 4; i++) ihdr[k * 4 + i] = (unsigned char)(dims[k] >> (24 - 8 * i));
+    }
+    ihdr[8] = (unsigned char)bitDepth;
+    ihdr[9] = palette ? 3 : colorTypes[channels];
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;     // deflate, filtros por linha, sem entrelaçamento
+    vector<unsigned char> head, tail;
+    makeChunk("IHDR", ihdr, 13, head);
+    if (palette) {
+        vector<unsigned char> plte;
+        makeChunk("PLTE", palette, (size_t)paletteSize * 3, plte);
+        head.insert(head.end(), plte.begin(), plte.end());
+    }
+    makeChunk("IEND", NULL, 0, tail);
+
+    FILE *f = openForReplace(file);
+    bool ok = f != NULL;
+    if (ok) {
+        static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        ok = fwrite(signature, 1, 8, f) == 8;
+        ok = ok && fwrite(head.data(), 1, head.size(), f) == head.size();
+        for (int b = 0; b < bands && ok; b++) {
+            ok = fwrite(chunks[b].data(), 1, chunks[b].size(), f) == chunks[b].size();
+        }
+        ok = ok && fwrite(tail.data(), 1, tail.size(), f) == tail.size();
+        ok = finishReplace(f, file, ok);
+    }
+    if (!ok) fprintf(stderr, "Erro ao gravar %s\n", file.c_str());
+    return ok;
+}
+
+/*------------------------------------PALETA----------------------------------*/
+// Conjunto de até 256 cores RGB (chave 0xRRGGBB), endereçamento aberto.
+struct ColorSet {
+    static const int SLOTS = 1024;
+    uint32_t keys[SLOTS];
+    unsigned char index[SLOTS];
+    int size;
+
+    ColorSet() : size(0) {
+        memset(keys, 0xFF, sizeof(keys));
+    }
+
+    // posição da cor, ou da vaga onde ela entraria
+    int find(uint32_t key) const {
+        int slot = (int)((key * 2654435761u) >> 22);
+        while (keys[slot] != key && keys[slot] != 0xFFFFFFFFu) slot = (slot + 1) & (SLOTS - 1);
+        return slot;
+    }
+
+    // false quando já há 256 cores e 'key' seria a 257ª
+    bool insert(uint32_t key) {
+        int slot = find(key);
+        if (keys[slot] == key) return true;
+        if (size == 256) return false;
+        keys[slot] = key;
+        index[slot] = (unsigned char)size++;
+        return true;
+    }
+};
+
+inline uint32_t colorKey(const unsigned char *p) {
+    return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+// Se a imagem tem até 256 cores, preenche a paleta e os índices de cada
+// pixel. Cada faixa junta as suas cores em paralelo e desiste na 257ª,
+// então uma foto é descartada logo nas primeiras linhas.
+inline bool indexColors(const Image &img, vector<unsigned char> &palette, vector<unsigned char> &indices) {
+    int parts = threadPool().size();
+    if (parts > img.height) parts = img.height;
+    if (parts < 1) return false;
+    vector<ColorSet> partial(parts);
+    atomic<bool> tooMany(false);
+    size_t pixels = (size_t)img.width * img.height;
+    threadPool().run(parts, [&](size_t t) {
+        size_t first = pixels * t / parts, last = pixels * (t + 1) / parts;
+        for (size_t i = first; i < last && !tooMany.load(memory_order_relaxed); i++) {
+            if (!partial[t].insert(colorKey(img.data + i * 3))) tooMany = true;
+        }
+    });
+    if (tooMany) return false;
+
+    ColorSet colors;
+    palette.clear();
+    for (int t = 0; t < parts; t++) {
+        for (int slot = 0; slot < ColorSet::SLOTS; slot++) {
+            uint32_t key = partial[t].keys[slot];
+            if (key == 0xFFFFFFFFu) continue;
+            int before = colors.size;
+            if (!colors.insert(key)) return false;
+            if (colors.size > before) {
+                palette.push_back((unsigned char)(key >> 16));
+                palette.push_back((unsigned char)(key >> 8));
+                palette.push_back((unsigned char)key);
+            }
+        }
+    }
+    indices.resize(pixels);
+    parallelRows(img.width, img.height, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * img.width; i < (size_t)y1 * img.width; i++) {
+            indices[i] = colors.index[colors.find(colorKey(img.data + i * 3))];
+        }
+    });
+    return true;
+}
+
+// Imagens com até 256 cores (ex.: depois de reduzir a uma paleta, ver
+// ppm_palette.h) saem indexadas, com um terço dos bytes a comprimir.
+inline bool savePNG(const string &file, const Image &img) {
+    vector<unsigned char> palette, indices;
+    if (indexColors(img, palette, indices)) {
+        return writePNG(file, indices.data(), img.width, img.height, 1, 8, palette.data(), (int)palette.size() / 3);
+    }
+    return writePNG(file, img.data, img.width, img.height, 3, 8);
+}
+
+// Extensão ".png" (sem diferenciar maiúsculas)?
+inline bool isPNGFile(const string &file) {
+    if (file.size() < 4) return false;
+    string ext = file.substr(file.size() - 4);
+    for (size_t i = 0; i < ext.size(); i++) ext[i] = (char)tolower((unsigned char)ext[i]);
+    return ext == ".png";
+}
+
+// PNG se o nome terminar em .png, QOIC se em .qoic; senão P6 (ou P3 com
+// 'ascii').
+inline bool saveImage(const string &file, const Image &img, bool ascii) {
+    if (isQOICFile(file)) return writeQOIC(file, img.data, img.width, img.height, 3, threadPool());
+    return isPNGFile(file) ? savePNG(file, img) : savePPM(file, img, ascii);
+}
+
+#endif
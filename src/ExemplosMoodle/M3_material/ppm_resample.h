@@ -0,0 +1,335 @@
+// Redimensionamento com filtros box, bilinear, bicúbico e Lanczos-3.
+//
+// Separável: uma passada horizontal (muda a largura) e uma vertical (muda
+// a altura), com 8 bits por canal entre as duas. Os pesos de cada pixel de
+// saída são calculados uma vez por coluna e uma vez por linha, em ponto
+// fixo de 16 bits (escala 2^RESAMPLE_BITS), e somam exatamente a escala:
+// uma cor lisa continua a mesma depois do filtro. Ao reduzir, o filtro é
+// alargado na mesma proporção, para que cada saída cubra toda a área de
+// entrada que representa.
+//
+// Os kernels vetoriais multiplicam dois pesos por vez com pmaddwd e somam
+// em 32 bits, a mesma conta inteira da versão escalar, então o resultado
+// é idêntico em todos os níveis de SIMD.
+#ifndef _PPM_RESAMPLE_H_
+#define _PPM_RESAMPLE_H_
+
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "ppm_simd.h"
+#include "ppm_parallel.h"
+
+using namespace std;
+
+const int RESAMPLE_BITS = 14;
+
+enum ResampleFilter { RESAMPLE_BOX, RESAMPLE_BILINEAR, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS3 };
+
+inline const char *resampleFilterName(ResampleFilter f) {
+    switch (f) {
+        case RESAMPLE_BOX:      return "box";
+        case RESAMPLE_BILINEAR: return "bilinear";
+        case RESAMPLE_BICUBIC:  return "bicubic";
+        default:                return "lanczos3";
+    }
+}
+
+// Raio do filtro em pixels de entrada, sem redução.
+inline double resampleSupport(ResampleFilter f) {
+    switch (f) {
+        case RESAMPLE_BOX:      return 0.5;
+        case RESAMPLE_BILINEAR: return 1.0;
+        case RESAMPLE_BICUBIC:  return 2.0;
+        default:                return 3.0;
+    }
+}
+
+inline double sinc(double x) {
+    if (x == 0.0) return 1.0;
+    x *= 3.14159265358979323846;
+    return sin(x) / x;
+}
+
+inline double resampleKernel(ResampleFilter f, double x) {
+    if (x < 0) x = -x;
+    switch (f) {
+        case RESAMPLE_BOX:
+            return x < 0.5 ? 1.0 : (x == 0.5 ? 0.5 : 0.0);
+        case RESAMPLE_BILINEAR:
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case RESAMPLE_BICUBIC: {
+            // Keys com a = -0.5 (Catmull-Rom)
+            const double a = -0.5;
+            if (x < 1.0) return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+            if (x < 2.0) return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+            return 0.0;
+        }
+        default:
+            return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+}
+
+/*------------------------------------PESOS-----------------------------------*/
+// Pesos de 'outSize' saídas sobre 'inSize' entradas: a saída i usa as
+// entradas first[i] .. first[i] + taps - 1 com os pesos
+// coeffs[i * taps ..]. 'taps' é múltiplo de 4 (os kernels tratam 2 ou 4
+// por vez) e as sobras têm peso 0.
+struct ResampleWeights {
+    int taps;
+    vector<int> first;
+    vector<int16_t> coeffs;
+
+    ResampleWeights(ResampleFilter f, int inSize, int outSize) {
+        double scale = (double)inSize / outSize;
+        double stretch = scale > 1.0 ? scale : 1.0;
+        double support = resampleSupport(f) * stretch;
+        taps = ((int)ceil(support) * 2 + 1 + 3) & ~3;
+        first.assign(outSize, 0);
+        coeffs.assign((size_t)outSize * taps, 0);
+
+        vector<double> w(taps);
+        for (int i = 0; i < outSize; i++) {
+            double center = (i + 0.5) * scale;
+            int lo = (int)floor(center - support + 0.5);
+            int hi = (int)floor(center + support + 0.5);
+            if (lo < 0) lo = 0;
+            if (hi > inSize) hi = inSize;
+            if (hi - lo > taps) hi = lo + taps;
+            if (hi <= lo) {
+                // redução tão grande que nenhum centro cai na janela
+                lo = (int)center < inSize ? (int)center : inSize - 1;
+                hi = lo + 1;
+            }
+            double total = 0;
+            for (int k = lo; k < hi; k++) {
+                w[k - lo] = resampleKernel(f, (k + 0.5 - center) / stretch);
+                total += w[k - lo];
+            }
+            if (total == 0) {
+                w[0] = total = 1;
+                hi = lo + 1;
+            }
+            // arredonda e passa a diferença para o maior peso
+            int16_t *c = &coeffs[(size_t)i * taps];
+            int sum = 0, biggest = 0;
+            for (int k = 0; k < hi - lo; k++) {
+                double v = floor(w[k] / total * (1 << RESAMPLE_BITS) + 0.5);
+                c[k] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+                sum += c[k];
+                if (c[k] > c[biggest]) biggest = k;
+            }
+            c[biggest] += (int16_t)((1 << RESAMPLE_BITS) - sum);
+            // encosta a janela no fim da entrada quando não cabe 'taps'
+            // pixels depois de 'lo': os pesos extras são 0
+            if (lo + taps > inSize && inSize >= taps) {
+                int shift = lo + taps - inSize;
+                memmove(c + shift, c, (hi - lo) * sizeof(int16_t));
+                memset(c, 0, shift * sizeof(int16_t));
+                lo -= shift;
+            }
+            first[i] = lo;
+        }
+    }
+};
+
+inline unsigned char resampleRound(int sum) {
+    int v = (sum + (1 << (RESAMPLE_BITS - 1))) >> RESAMPLE_BITS;
+    return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/*-----------------------------PASSADA HORIZONTAL-----------------------------*/
+#ifdef PPM_SIMD_X86
+// Um pixel de saída por iteração, quatro entradas por passo: pshufb põe
+// lado a lado os mesmos canais de dois pixels vizinhos, e pmaddwd os
+// multiplica pelos dois pesos e soma. Lê até 4 bytes além da última
+// entrada usada (a linha vem com folga).
+SIMD_TARGET("ssse3")
+static void resampleRow_ssse3(const unsigned char *src, unsigned char *dst, int outW,
+                              const ResampleWeights &wx) {
+    const __m128i pairA = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+    const __m128i pairB = _mm_setr_epi8(6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1);
+    const __m128i round = _mm_set1_epi32(1 << (RESAMPLE_BITS - 1));
+    int taps = wx.taps;
+    for (int x = 0; x < outW; x++) {
+        const unsigned char *p = src + wx.first[x] * 3;
+        const int16_t *c = &wx.coeffs[(size_t)x * taps];
+        __m128i sum = round;
+        for (int k = 0; k < taps; k += 4, p += 12, c += 4) {
+            __m128i px = _mm_loadu_si128((const __m128i *)p);
+            __m128i w = _mm_loadl_epi64((const __m128i *)c);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_shuffle_epi8(px, pairA), _mm_shuffle_epi32(w, 0x00)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_shuffle_epi8(px, pairB), _mm_shuffle_epi32(w, 0x55)));
+        }
+        sum = _mm_srai_epi32(sum, RESAMPLE_BITS);
+        sum = _mm_packus_epi16(_mm_packs_epi32(sum, sum), sum);
+        int bytes = _mm_cvtsi128_si32(sum);
+        memcpy(dst + x * 3, &bytes, 3);
+    }
+}
+#endif
+
+inline void resampleRow(const unsigned char *src, unsigned char *dst, int outW, const ResampleWeights &wx) {
+#ifdef PPM_SIMD_X86
+    if (simdLevel() >= SIMD_SSSE3) {
+        resampleRow_ssse3(src, dst, outW, wx);
+        return;
+    }
+#endif
+    int taps = wx.taps;
+    for (int x = 0; x < outW; x++) {
+        const unsigned char *p = src + wx.first[x] * 3;
+        const int16_t *c = &wx.coeffs[(size_t)x * taps];
+        int r = 0, g = 0, b = 0;
+        for (int k = 0; k < taps; k++, p += 3) {
+            r += c[k] * p[0];
+            g += c[k] * p[1];
+            b += c[k] * p[2];
+        }
+        dst[x * 3] = resampleRound(r);
+        dst[x * 3 + 1] = resampleRound(g);
+        dst[x * 3 + 2] = resampleRound(b);
+    }
+}
+
+// Largura w -> outW em todas as linhas. Cada linha é copiada antes para
+// um buffer com folga no fim, onde os pesos 0 e as leituras de 16 bytes
+// do kernel podem passar da borda.
+inline void resampleHorizontal(const unsigned char *src, int w, int h, unsigned char *dst, int outW,
+                               const ResampleWeights &wx) {
+    size_t rowBytes = (size_t)w * 3, outBytes = (size_t)outW * 3;
+    parallelRows(outW, h, [&](int y0, int y1) {
+        vector<unsigned char> padded(rowBytes + (size_t)wx.taps * 3 + 16, 0);
+        for (int y = y0; y < y1; y++) {
+            memcpy(padded.data(), src + y * rowBytes, rowBytes);
+            resampleRow(padded.data(), dst + y * outBytes, outW, wx);
+        }
+    });
+}
+
+/*------------------------------PASSADA VERTICAL------------------------------*/
+#ifdef PPM_SIMD_X86
+// 16 bytes de uma linha de saída por iteração, a partir do byte 'x', duas
+// linhas de entrada por passo: os bytes das duas são intercalados e
+// pmaddwd soma os dois produtos de cada coluna. Devolve onde parou.
+SIMD_TARGET("sse2")
+static size_t resampleColumns_sse2(const unsigned char *const *rows, const int16_t *c, int taps,
+                                   unsigned char *dst, size_t x, size_t width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (RESAMPLE_BITS - 1));
+    for (; x + 16 <= width; x += 16) {
+        __m128i s0 = round, s1 = round, s2 = round, s3 = round;
+        for (int k = 0; k < taps; k += 2) {
+            __m128i w = _mm_set1_epi32((int)((uint16_t)c[k] | (uint32_t)(uint16_t)c[k + 1] << 16));
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(rows[k + 1] + x));
+            __m128i lo = _mm_unpacklo_epi8(a, b), hi = _mm_unpackhi_epi8(a, b);
+            s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+            s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+        }
+        s0 = _mm_srai_epi32(s0, RESAMPLE_BITS);
+        s1 = _mm_srai_epi32(s1, RESAMPLE_BITS);
+        s2 = _mm_srai_epi32(s2, RESAMPLE_BITS);
+        s3 = _mm_srai_epi32(s3, RESAMPLE_BITS);
+        __m128i out = _mm_packus_epi16(_mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3));
+        _mm_storeu_si128((__m128i *)(dst + x), out);
+    }
+    return x;
+}
+
+// O mesmo em 32 bytes; unpack e pack trabalham por faixa de 128 bits e
+// um desfaz o outro, então a ordem dos bytes se mantém.
+SIMD_TARGET("avx2")
+static size_t resampleColumns_avx2(const unsigned char *const *rows, const int16_t *c, int taps,
+                                   unsigned char *dst, size_t x, size_t width) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi32(1 << (RESAMPLE_BITS - 1));
+    for (; x + 32 <= width; x += 32) {
+        __m256i s0 = round, s1 = round, s2 = round, s3 = round;
+        for (int k = 0; k < taps; k += 2) {
+            __m256i w = _mm256_set1_epi32((int)((uint16_t)c[k] | (uint32_t)(uint16_t)c[k + 1] << 16));
+            __m256i a = _mm256_loadu_si256((const __m256i *)(rows[k] + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(rows[k + 1] + x));
+            __m256i lo = _mm256_unpacklo_epi8(a, b), hi = _mm256_unpackhi_epi8(a, b);
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), w));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), w));
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), w));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), w));
+        }
+        s0 = _mm256_srai_epi32(s0, RESAMPLE_BITS);
+        s1 = _mm256_srai_epi32(s1, RESAMPLE_BITS);
+        s2 = _mm256_srai_epi32(s2, RESAMPLE_BITS);
+        s3 = _mm256_srai_epi32(s3, RESAMPLE_BITS);
+        __m256i out = _mm256_packus_epi16(_mm256_packs_epi32(s0, s1), _mm256_packs_epi32(s2, s3));
+        _mm256_storeu_si256((__m256i *)(dst + x), out);
+    }
+    return x;
+}
+#endif
+
+// Uma linha de saída a partir das linhas 'rows' (taps ponteiros).
+inline void resampleColumns(const unsigned char *const *rows, const int16_t *c, int taps,
+                            unsigned char *dst, size_t width) {
+    size_t x = 0;
+#ifdef PPM_SIMD_X86
+    if (simdLevel() >= SIMD_AVX2) x = resampleColumns_avx2(rows, c, taps, dst, x, width);
+    if (simdLevel() >= SIMD_SSSE3) x = resampleColumns_sse2(rows, c, taps, dst, x, width);
+#endif
+    for (; x < width; x++) {
+        int sum = 0;
+        for (int k = 0; k < taps; k++) sum += c[k] * rows[k][x];
+        dst[x] = resampleRound(sum);
+    }
+}
+
+// Altura h -> outH, 'w' pixels por linha. Linhas com peso 0 além da borda
+// apontam para a última, só para não ler fora da imagem.
+inline void resampleVertical(const unsigned char *src, int w, int h, unsigned char *dst, int outH,
+                             const ResampleWeights &wy) {
+    size_t rowBytes = (size_t)w * 3;
+    parallelRows(w, outH, [&](int y0, int y1) {
+        vector<const unsigned char *> rows(wy.taps);
+        for (int y = y0; y < y1; y++) {
+            for (int k = 0; k < wy.taps; k++) {
+                int r = wy.first[y] + k;
+                rows[k] = src + (size_t)(r < h ? r : h - 1) * rowBytes;
+            }
+            resampleColumns(rows.data(), &wy.coeffs[(size_t)y * wy.taps], wy.taps, dst + y * rowBytes, rowBytes);
+        }
+    });
+}
+
+/*---------------------------------ENTRADA------------------------------------*/
+// 'src' (w x h) para 'dst' (outW x outH). A ordem das passadas é a que faz
+// menos multiplicações: ao reduzir muito a largura, por exemplo, a
+// horizontal vem primeiro e a vertical já trabalha na imagem estreita.
+inline void resampleImage(const unsigned char *src, int w, int h, unsigned char *dst, int outW, int outH,
+                          ResampleFilter f) {
+    if (w < 1 || h < 1 || outW < 1 || outH < 1) return;
+    if (w == outW && h == outH) {
+        memcpy(dst, src, (size_t)w * h * 3);
+        return;
+    }
+    ResampleWeights wx(f, w, outW), wy(f, h, outH);
+    double horizontalFirst = (double)h * outW * wx.taps + (double)outH * outW * wy.taps;
+    double verticalFirst = (double)outH * w * wy.taps + (double)outH * outW * wx.taps;
+    if (w == outW) {
+        resampleVertical(src, w, h, dst, outH, wy);
+    } else if (h == outH) {
+        resampleHorizontal(src, w, h, dst, outW, wx);
+    } else if (horizontalFirst <= verticalFirst) {
+        unique_ptr<unsigned char[]> tmp(new unsigned char [(size_t)outW * h * 3]);
+        resampleHorizontal(src, w, h, tmp.get(), outW, wx);
+        resampleVertical(tmp.get(), outW, h, dst, outH, wy);
+    } else {
+        unique_ptr<unsigned char[]> tmp(new unsigned char [(size_t)w * outH * 3]);
+        resampleVertical(src, w, h, tmp.get(), outH, wy);
+        resampleHorizontal(tmp.get(), w, outH, dst, outW, wx);
+    }
+}
+
+#endif
@@ -0,0 +1,154 @@
+// Processamento de PPM em faixas de linhas, para imagens maiores que a RAM.
+//
+// Três estágios rodam ao mesmo tempo, cada um em uma faixa diferente:
+// uma thread lê a próxima faixa, a thread principal filtra a atual e outra
+// thread grava a anterior. As faixas circulam por um conjunto fixo de
+// buffers, então a memória usada é 'STREAM_BUFFERS' x faixa, não a imagem.
+#ifndef _PPM_STREAM_H_
+#define _PPM_STREAM_H_
+
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "ppm_io.h"
+
+using namespace std;
+
+/*--------------------------------FILA LIMITADA-------------------------------*/
+// Fila entre estágios. push() bloqueia quando cheia e pop() quando vazia;
+// depois de close(), pop() devolve false assim que a fila esvaziar.
+template <class T>
+class BoundedQueue {
+    deque<T> items;
+    size_t capacity;
+    bool closed;
+    mutex m;
+    condition_variable notEmpty, notFull;
+
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    void push(T item) {
+        unique_lock<mutex> lock(m);
+        notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T &item) {
+        unique_lock<mutex> lock(m);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+/*-----------------------------------FAIXAS-----------------------------------*/
+// leitura da próxima, filtro da atual e escrita da anterior
+const int STREAM_BUFFERS = 3;
+
+struct Strip {
+    unsigned char *data;
+    int rows;
+};
+
+// Lê 'in' (P6 até 8 bits, reescalado para 0..255) em faixas de 'stripRows'
+// linhas, aplica 'filter' em cada uma e grava em 'out'. 'filter' recebe
+// (pixels, largura, linhas).
+template <class F>
+bool streamPPM(const string &in, const string &out, int stripRows, bool ascii, F filter) {
+    FILE *fin = fopen(in.c_str(), "rb");
+    if (!fin) {
+        fprintf(stderr, "Erro ao abrir %s\n", in.c_str());
+        return false;
+    }
+    char type;
+    int w, h, maxValue;
+    if (!readPPMHeader(fin, type, w, h, maxValue) || type != '6' || maxValue > 255) {
+        fprintf(stderr, "Modo em faixas aceita apenas P6 de 8 bits: %s\n", in.c_str());
+        fclose(fin);
+        return false;
+    }
+    FILE *fout = openForReplace(out);
+    if (!fout) {
+        fprintf(stderr, "Erro ao gravar %s\n", out.c_str());
+        fclose(fin);
+        return false;
+    }
+    writePPMHeader(fout, ascii, w, h);
+
+    if (stripRows < 1) stripRows = 1;
+    if (stripRows > h) stripRows = h;
+    size_t rowBytes = (size_t)w * 3;
+
+    BoundedQueue<Strip> freeStrips(STREAM_BUFFERS), toFilter(STREAM_BUFFERS), toWrite(STREAM_BUFFERS);
+    unsigned char *buffers[STREAM_BUFFERS];
+    for (int i = 0; i < STREAM_BUFFERS; i++) {
+        buffers[i] = new unsigned char [rowBytes * stripRows];
+        freeStrips.push(Strip { buffers[i], 0 });
+    }
+
+    bool readOk = true, writeOk = true;
+    Stopwatch total;
+
+    thread reader([&] {
+        for (int y = 0; y < h; y += stripRows) {
+            Strip s;
+            if (!freeStrips.pop(s)) break;
+            s.rows = (h - y < stripRows) ? h - y : stripRows;
+            size_t n = rowBytes * s.rows;
+            if (fread(s.data, 1, n, fin) != n) {
+                readOk = false;
+                break;
+            }
+            if (maxValue != 255) rescaleSamples(s.data, s.data, n, maxValue);
+            toFilter.push(s);
+        }
+        toFilter.close();
+    });
+
+    thread writer([&] {
+        Strip s;
+        while (toWrite.pop(s)) {
+            if (writeOk) writeOk = writePPMPixels(fout, ascii, s.data, rowBytes * s.rows);
+            freeStrips.push(s);
+        }
+    });
+
+    Strip s;
+    while (toFilter.pop(s)) {
+        filter(s.data, w, s.rows);
+        toWrite.push(s);
+    }
+    toWrite.close();
+    reader.join();
+    writer.join();
+
+    fclose(fin);
+    // com leitura truncada o temporário é descartado e o destino fica intacto
+    bool replaced = finishReplace(fout, out, readOk && writeOk);
+    if (readOk) writeOk = replaced;
+    for (int i = 0; i < STREAM_BUFFERS; i++) delete [] buffers[i];
+
+    if (!readOk) fprintf(stderr, "Arquivo truncado: %s\n", in.c_str());
+    if (!writeOk) fprintf(stderr, "Erro ao gravar %s\n", out.c_str());
+    reportThroughput("faixas (ler+filtrar+gravar)", rowBytes * h, total.seconds());
+    printf("memória de pixels: %.2f MB (%d faixas de %d linhas)\n",
+           rowBytes * stripRows * STREAM_BUFFERS / (1024.0 * 1024.0), STREAM_BUFFERS, stripRows);
+    return readOk && writeOk;
+}
+
+#endif
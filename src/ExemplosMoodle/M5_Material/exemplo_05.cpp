@@ -16,6 +16,8 @@
 #define GL_LOG_FILE "gl.log"
 #include <iostream>
 #include <vector>
+#include <string>
+#include "ppm_qoi.h"
 
 #include "Layer.h"
 
@@ -28,7 +30,55 @@ float PARALLAX_RATE = 0.01f;
 
 GLFWwindow *g_window = NULL;
 
-int loadTexture(unsigned int &texture, char *filename)
+// decodifica 'filename' direto em 'out', de 'outSize' bytes (aqui, um pixel
+// buffer mapeado); a memória de trabalho do stb_image vem de 'arena', que é
+// da thread que chama (ver stb_image.h), então depois das primeiras
+// texturas carregar quase não aloca memória
+bool decodeImage(const char *filename, stbi_arena *arena, unsigned char *out, size_t outSize,
+	int &width, int &height, int &nrChannels)
+{
+	stbi_arena *old = stbi_set_arena(arena);
+	int ok = stbi_load_into(filename, out, outSize, &width, &height, &nrChannels, 0);
+	stbi_set_arena(old);
+	return ok != 0;
+}
+
+// dá 'size' bytes ao pixel buffer 'pbo', ligado em GL_PIXEL_UNPACK_BUFFER,
+// e o mapeia; NULL se o driver não conseguiu
+unsigned char *mapPixelBuffer(GLuint pbo, size_t size, GLenum access)
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	return (unsigned char *) glMapBuffer(GL_PIXEL_UNPACK_BUFFER, access);
+}
+
+// conteúdo inteiro de 'file'; falso se não deu para ler
+bool readFileBytes(const string &file, vector<unsigned char> &data)
+{
+	FILE *f = fopen(file.c_str(), "rb");
+	if (!f)
+	{
+		return false;
+	}
+	data.clear();
+	if (fseek(f, 0, SEEK_END) == 0)
+	{
+		long size = ftell(f);
+		if (size > 0)
+		{
+			data.resize((size_t) size);
+			rewind(f);
+			if (fread(data.data(), 1, data.size(), f) != data.size())
+			{
+				data.clear();
+			}
+		}
+	}
+	fclose(f);
+	return !data.empty();
+}
+
+int loadTexture(unsigned int &texture, char *filename, stbi_arena *arena)
 {
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_2D, texture);
@@ -45,18 +95,55 @@ int loadTexture(unsigned int &texture, char *filename)
 
 	int width, height, nrChannels;
 
-	unsigned char *data = stbi_load(filename, &width, &height, &nrChannels, 0);
-	if (data)
+	// os pixels são decodificados direto num pixel buffer mapeado, de onde o
+	// driver os copia para a textura. Cache QOIC em qoic_cache/ (ver
+	// ppm_qoi.h): o PNG/JPEG só é decodificado de novo se for mais novo que
+	// o cache ou se o cache estiver corrompido
+	GLuint pbo;
+	glGenBuffers(1, &pbo);
+	string cacheFile = qoicCacheFile(filename);
+	vector<unsigned char> cached;
+	QOICInfo info;
+	bool ok = false;
+	if (cacheIsFresh(cacheFile, filename) && readFileBytes(cacheFile, cached) &&
+		readQOICHeader(cached.data(), cached.size(), info))
+	{
+		width = info.width;
+		height = info.height;
+		nrChannels = info.channels;
+		unsigned char *pixels = mapPixelBuffer(pbo, (size_t) width * height * nrChannels, GL_WRITE_ONLY);
+		ok = pixels && decodeQOICPixels(cached.data(), info, pixels);
+		if (pixels)
+		{
+			ok = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) && ok;
+		}
+	}
+	if (!ok && stbi_info(filename, &width, &height, &nrChannels))
+	{
+		// sem cache válido: o buffer é lido de volta só para gravar o cache
+		size_t size = (size_t) width * height * nrChannels;
+		unsigned char *pixels = mapPixelBuffer(pbo, size, GL_READ_WRITE);
+		ok = pixels && decodeImage(filename, arena, pixels, size, width, height, nrChannels);
+		if (ok && (nrChannels == 3 || nrChannels == 4))
+		{
+			writeQOIC(cacheFile, pixels, width, height, nrChannels);
+		}
+		if (pixels)
+		{
+			ok = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) && ok;
+		}
+	}
+	if (ok)
 	{
 		if (nrChannels == 4)
 		{
 			cout << "Alpha channel" << endl;
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *) 0);
 		}
 		else
 		{
 			cout << "Without Alpha channel" << endl;
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, (void *) 0);
 		}
 		glGenerateMipmap(GL_TEXTURE_2D);
 	}
@@ -64,7 +151,9 @@ int loadTexture(unsigned int &texture, char *filename)
 	{
 		std::cout << "Failed to load texture" << std::endl;
 	}
-	stbi_image_free(data);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &pbo);
+	return ok;
 }
 
 int main()
@@ -74,6 +163,10 @@ int main()
 
 	// inicia OpenGL e libs auxiliares
 	start_gl();
+
+	// memória de trabalho do stb_image para as texturas carregadas por
+	// esta thread
+	stbi_arena *arena = stbi_arena_create(0);
 	
 	// INIT LAYERS
 	vector<Layer *> layers;
@@ -86,7 +179,7 @@ int main()
 	l0->ratex = 0.0;
 	l0->ratey = 0;
 	layers.push_back(l0);
-	loadTexture(l0->tid, l0->filename);
+	loadTexture(l0->tid, l0->filename, arena);
 
 	Layer *l1 = new Layer;
 	l1->filename = "../src/ExemplosMoodle/M5_Material/w1.png";
@@ -96,7 +189,7 @@ int main()
 	l1->ratex = 0.2;
 	l1->ratey = 0;
 	layers.push_back(l1);
-	loadTexture(l1->tid, l1->filename);
+	loadTexture(l1->tid, l1->filename, arena);
 
 	Layer *l2 = new Layer;
 	l2->filename = "../src/ExemplosMoodle/M5_Material/w2.png";
@@ -107,7 +200,7 @@ int main()
 	l2->ratey = 0;
 
 	layers.push_back(l2);
-	loadTexture(l2->tid, l2->filename);
+	loadTexture(l2->tid, l2->filename, arena);
 
 	Layer *l3 = new Layer;
 	l3->filename = "../src/ExemplosMoodle/M5_Material/w3.png";
@@ -117,7 +210,7 @@ int main()
 	l3->ratex = 0.6;
 	l3->ratey = 0;
 	layers.push_back(l3);
-	loadTexture(l3->tid, l3->filename);
+	loadTexture(l3->tid, l3->filename, arena);
 
 	Layer *l4 = new Layer;
 	l4->filename = "../src/ExemplosMoodle/M5_Material/w4.png";
@@ -127,7 +220,7 @@ int main()
 	l4->ratex = 0.8;
 	l4->ratey = 0;
 	layers.push_back(l4);
-	loadTexture(l4->tid, l4->filename);
+	loadTexture(l4->tid, l4->filename, arena);
 
 	// LOAD TEXTURES
 
@@ -265,5 +358,6 @@ int main()
 
 	// close GL context and any other GLFW resources
 	glfwTerminate();
+	stbi_arena_free(arena);
 	return 0;
 }
@@ -0,0 +1,375 @@
+// QOIC: formato sem perdas e rápido para imagens intermediárias do
+// pipeline e para o cache de texturas já decodificadas dos exemplos GL.
+//
+// Os códigos são os do QOI (https://qoiformat.org): repetição do pixel
+// anterior, índice numa tabela de 64 cores vistas recentemente (hash da
+// cor), diferenças pequenas em relação ao pixel anterior (1 ou 2 bytes) e
+// o pixel inteiro. Sem entropia, codifica e decodifica a centenas de MB/s
+// por núcleo.
+//
+// A diferença é a divisão em blocos de linhas: cada bloco começa do
+// estado inicial do QOI (pixel anterior preto opaco, tabela zerada), e o
+// cabeçalho guarda o tamanho de cada um, então threads diferentes
+// codificam e decodificam blocos diferentes. Layout (inteiros em
+// big-endian, como no QOI):
+//
+//     "qoic"  largura(4)  altura(4)  canais(1)  0(3)  linhas por bloco(4)
+//     blocos(4)  tamanho de cada bloco(4 cada)  dados dos blocos
+//
+// Não depende de nenhum outro cabeçalho do M3 (nem de 'using namespace
+// std'): os exemplos GL (M5_Material e M6_material/exemplo) têm cada um
+// uma cópia idêntica deste arquivo, como têm do stb_image.h. Os blocos
+// rodam em série, a não ser que quem chama passe um executor com
+// run(n, f), como o threadPool() de ppm_parallel.h.
+#ifndef _PPM_QOI_H_
+#define _PPM_QOI_H_
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+const unsigned char QOIC_OP_INDEX = 0x00;   // 00iiiiii
+const unsigned char QOIC_OP_DIFF  = 0x40;   // 01rrggbb, -2..1 em cada canal
+const unsigned char QOIC_OP_LUMA  = 0x80;   // 10gggggg rrrrbbbb, verde -32..31
+const unsigned char QOIC_OP_RUN   = 0xc0;   // 11nnnnnn, 1..62 repetições
+const unsigned char QOIC_OP_RGB   = 0xfe;
+const unsigned char QOIC_OP_RGBA  = 0xff;
+const unsigned char QOIC_MASK     = 0xc0;
+const int QOIC_HEADER = 24;
+// ~256 KB de pixels por bloco, o mesmo TILE_BYTES de ppm_parallel.h
+const size_t QOIC_CHUNK_BYTES = 256 * 1024;
+// teto para largura * altura lidas de um cabeçalho (1 GB em RGBA)
+const uint64_t QOIC_MAX_PIXELS = 1ull << 28;
+// cada byte de dados rende no máximo 62 pixels (uma repetição)
+const int QOIC_MAX_RUN = 62;
+
+// Executor padrão dos blocos: um depois do outro.
+struct QOICSerial {
+    template <class F>
+    void run(size_t count, const F &fn) const {
+        for (size_t c = 0; c < count; c++) fn(c);
+    }
+};
+
+inline int qoicHash(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+    return (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+}
+
+// Extensão ".qoic" (sem diferenciar maiúsculas)?
+inline bool isQOICFile(const std::string &file) {
+    if (file.size() < 5) return false;
+    std::string ext = file.substr(file.size() - 5);
+    for (size_t i = 0; i < ext.size(); i++) ext[i] = (char)tolower((unsigned char)ext[i]);
+    return ext == ".qoic";
+}
+
+// Linhas por bloco: ~QOIC_CHUNK_BYTES de pixels
+inline int qoicRowsPerChunk(int w, int channels) {
+    size_t rows = QOIC_CHUNK_BYTES / ((size_t)w * channels);
+    return rows > 0 ? (int)rows : 1;
+}
+
+inline void putBE32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+inline uint32_t getBE32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/*--------------------------------CODIFICAÇÃO---------------------------------*/
+// Pixel num inteiro (R no byte baixo, A no alto): comparar com o anterior
+// e com a tabela custa uma comparação só.
+template <int CHANNELS>
+inline uint32_t qoicLoad(const unsigned char *p) {
+    uint32_t a = CHANNELS == 4 ? p[3] : 255;
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | a << 24;
+}
+
+inline int qoicHash(uint32_t px) {
+    return qoicHash((unsigned char)px, (unsigned char)(px >> 8), (unsigned char)(px >> 16), (unsigned char)(px >> 24));
+}
+
+// 'n' pixels de CHANNELS canais em 'out', que precisa de n * (CHANNELS + 1)
+// bytes no pior caso. Devolve quantos bytes escreveu.
+template <int CHANNELS>
+size_t qoicEncodeChunk(const unsigned char *px, size_t n, unsigned char *out) {
+    uint32_t index[64] = { 0 };
+    uint32_t prev = 0xff000000u;
+    unsigned char *o = out;
+    int run = 0;
+    for (size_t i = 0; i < n; i++, px += CHANNELS) {
+        uint32_t cur = qoicLoad<CHANNELS>(px);
+        if (cur == prev) {
+            if (++run == 62) {
+                *o++ = (unsigned char)(QOIC_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            *o++ = (unsigned char)(QOIC_OP_RUN | (run - 1));
+            run = 0;
+        }
+        int h = qoicHash(cur);
+        if (index[h] == cur) {
+            *o++ = (unsigned char)(QOIC_OP_INDEX | h);
+        } else {
+            index[h] = cur;
+            if ((cur ^ prev) >> 24 == 0) {
+                signed char dr = (signed char)(cur - prev);
+                signed char dg = (signed char)((cur >> 8) - (prev >> 8));
+                signed char db = (signed char)((cur >> 16) - (prev >> 16));
+                signed char drg = (signed char)(dr - dg), dbg = (signed char)(db - dg);
+                if ((unsigned char)(dr + 2) < 4 && (unsigned char)(dg + 2) < 4 && (unsigned char)(db + 2) < 4) {
+                    *o++ = (unsigned char)(QOIC_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if ((unsigned char)(dg + 32) < 64 && (unsigned char)(drg + 8) < 16 && (unsigned char)(dbg + 8) < 16) {
+                    o[0] = (unsigned char)(QOIC_OP_LUMA | (dg + 32));
+                    o[1] = (unsigned char)((drg + 8) << 4 | (dbg + 8));
+                    o += 2;
+                } else {
+                    o[0] = QOIC_OP_RGB; o[1] = px[0]; o[2] = px[1]; o[3] = px[2];
+                    o += 4;
+                }
+            } else {
+                o[0] = QOIC_OP_RGBA; o[1] = px[0]; o[2] = px[1]; o[3] = px[2]; o[4] = px[3];
+                o += 5;
+            }
+        }
+        prev = cur;
+    }
+    if (run > 0) *o++ = (unsigned char)(QOIC_OP_RUN | (run - 1));
+    return o - out;
+}
+
+// Pixels intercalados com 3 (RGB) ou 4 (RGBA) canais; os blocos são
+// codificados por 'pool'. Grava em 'file'.tmp e renomeia no fim, como o
+// openForReplace() de ppm_io.h: um cache de textura nunca fica pela
+// metade, e a saída pode ser o próprio arquivo de entrada.
+template <class Pool>
+bool writeQOIC(const std::string &file, const unsigned char *pixels, int w, int h, int channels, Pool &pool) {
+    if (w < 1 || h < 1 || (channels != 3 && channels != 4)) {
+        fprintf(stderr, "QOIC: imagem inválida para %s\n", file.c_str());
+        return false;
+    }
+    int rows = qoicRowsPerChunk(w, channels);
+    size_t chunks = (h + rows - 1) / rows;
+    std::vector<std::vector<unsigned char>> data(chunks);
+    pool.run(chunks, [&](size_t c) {
+        int y0 = (int)c * rows, y1 = std::min(y0 + rows, h);
+        size_t n = (size_t)(y1 - y0) * w;
+        data[c].resize(n * (channels + 1));
+        const unsigned char *px = pixels + (size_t)y0 * w * channels;
+        size_t used = channels == 4 ? qoicEncodeChunk<4>(px, n, data[c].data())
+                                    : qoicEncodeChunk<3>(px, n, data[c].data());
+        data[c].resize(used);
+    });
+
+    std::vector<unsigned char> header(QOIC_HEADER + chunks * 4, 0);
+    memcpy(header.data(), "qoic", 4);
+    putBE32(&header[4], (uint32_t)w);
+    putBE32(&header[8], (uint32_t)h);
+    header[12] = (unsigned char)channels;
+    putBE32(&header[16], (uint32_t)rows);
+    putBE32(&header[20], (uint32_t)chunks);
+    for (size_t c = 0; c < chunks; c++) putBE32(&header[QOIC_HEADER + c * 4], (uint32_t)data[c].size());
+
+    std::string tmp = file + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    bool ok = f != NULL;
+    if (ok) {
+        ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+        for (size_t c = 0; ok && c < chunks; c++) ok = fwrite(data[c].data(), 1, data[c].size(), f) == data[c].size();
+        ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+        ok = ok && (remove(file.c_str()) == 0 || errno == ENOENT) && rename(tmp.c_str(), file.c_str()) == 0;
+#else
+        ok = ok && rename(tmp.c_str(), file.c_str()) == 0;
+#endif
+        if (!ok) remove(tmp.c_str());
+    }
+    if (!ok) fprintf(stderr, "Erro ao gravar %s\n", file.c_str());
+    return ok;
+}
+
+inline bool writeQOIC(const std::string &file, const unsigned char *pixels, int w, int h, int channels) {
+    QOICSerial serial;
+    return writeQOIC(file, pixels, w, h, channels, serial);
+}
+
+/*------------------------------DECODIFICAÇÃO---------------------------------*/
+template <int CHANNELS>
+inline void qoicStore(unsigned char *p, uint32_t px) {
+    p[0] = (unsigned char)px;
+    p[1] = (unsigned char)(px >> 8);
+    p[2] = (unsigned char)(px >> 16);
+    if (CHANNELS == 4) p[3] = (unsigned char)(px >> 24);
+}
+
+// Decodifica um bloco de 'len' bytes em exatamente 'n' pixels; falso se os
+// dados acabam antes ou sobram.
+template <int CHANNELS>
+bool qoicDecodeChunk(const unsigned char *in, size_t len, unsigned char *px, size_t n) {
+    uint32_t index[64] = { 0 };
+    uint32_t cur = 0xff000000u;
+    const unsigned char *p = in, *end = in + len;
+    unsigned char *last = px + n * CHANNELS;
+    while (px < last) {
+        if (p >= end) return false;
+        unsigned char op = *p++;
+        if (op < QOIC_OP_DIFF) {
+            cur = index[op];
+        } else if (op < QOIC_OP_LUMA) {
+            // soma por byte sem vai-um entre canais: cada diferença é
+            // somada ao seu byte e o transbordo some com a máscara
+            uint32_t r = (cur + ((op >> 4) & 3) - 2) & 0xff;
+            uint32_t g = ((cur >> 8) + ((op >> 2) & 3) - 2) & 0xff;
+            uint32_t b = ((cur >> 16) + (op & 3) - 2) & 0xff;
+            cur = (cur & 0xff000000u) | r | g << 8 | b << 16;
+        } else if (op < QOIC_OP_RUN) {
+            if (p >= end) return false;
+            int dg = (op & 63) - 32, next = *p++;
+            uint32_t r = (cur + dg + (next >> 4) - 8) & 0xff;
+            uint32_t g = ((cur >> 8) + dg) & 0xff;
+            uint32_t b = ((cur >> 16) + dg + (next & 15) - 8) & 0xff;
+            cur = (cur & 0xff000000u) | r | g << 8 | b << 16;
+        } else if (op == QOIC_OP_RGB) {
+            if (end - p < 3) return false;
+            cur = (cur & 0xff000000u) | p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+            p += 3;
+        } else if (op == QOIC_OP_RGBA) {
+            if (end - p < 4) return false;
+            cur = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+            p += 4;
+        } else {
+            // repetição: o pixel anterior já está na tabela
+            int run = (op & 63) + 1;
+            if ((size_t)(last - px) < (size_t)run * CHANNELS) return false;
+            for (int k = 0; k < run; k++, px += CHANNELS) qoicStore<CHANNELS>(px, cur);
+            continue;
+        }
+        index[qoicHash(cur)] = cur;
+        qoicStore<CHANNELS>(px, cur);
+        px += CHANNELS;
+    }
+    return p == end;
+}
+
+struct QOICInfo {
+    int width, height, channels;
+    uint32_t rows;              // linhas por bloco
+    std::vector<size_t> offset; // início de cada bloco em 'data', mais o fim
+};
+
+// Confere o cabeçalho de um arquivo inteiro na memória ('data', 'len').
+// Largura * altura é limitada antes de qualquer alocação: um cache
+// corrompido é recusado, não vira um bad_alloc.
+inline bool readQOICHeader(const unsigned char *data, size_t len, QOICInfo &info) {
+    if (len < (size_t)QOIC_HEADER || memcmp(data, "qoic", 4) != 0) return false;
+    uint32_t w = getBE32(data + 4), h = getBE32(data + 8), rows = getBE32(data + 16);
+    uint32_t chunks = getBE32(data + 20);
+    int channels = data[12];
+    if (w < 1 || h < 1 || w > 1u << 24 || h > 1u << 24 || rows < 1 || (channels != 3 && channels != 4) ||
+        chunks != (h + rows - 1) / rows || len < QOIC_HEADER + (size_t)chunks * 4) {
+        return false;
+    }
+    info.width = (int)w;
+    info.height = (int)h;
+    info.channels = channels;
+    info.rows = rows;
+    info.offset.resize(chunks + 1);
+    info.offset[0] = QOIC_HEADER + (size_t)chunks * 4;
+    for (uint32_t c = 0; c < chunks; c++) info.offset[c + 1] = info.offset[c] + getBE32(data + QOIC_HEADER + c * 4);
+    if (info.offset[chunks] != len) return false;
+    uint64_t pixels = (uint64_t)w * h;
+    return pixels <= QOIC_MAX_PIXELS && pixels <= (uint64_t)(len - info.offset[0]) * QOIC_MAX_RUN;
+}
+
+// Blocos por 'pool', direto em 'pixels' (largura * altura * canais bytes)
+template <class Pool>
+bool decodeQOICPixels(const unsigned char *data, const QOICInfo &info, unsigned char *pixels, Pool &pool) {
+    int w = info.width, channels = info.channels;
+    std::atomic<bool> ok(true);
+    pool.run(info.offset.size() - 1, [&](size_t c) {
+        int y0 = (int)(c * info.rows), y1 = (int)std::min((size_t)y0 + info.rows, (size_t)info.height);
+        size_t n = (size_t)(y1 - y0) * w;
+        unsigned char *px = pixels + (size_t)y0 * w * channels;
+        const unsigned char *in = data + info.offset[c];
+        size_t size = info.offset[c + 1] - info.offset[c];
+        bool done = channels == 4 ? qoicDecodeChunk<4>(in, size, px, n) : qoicDecodeChunk<3>(in, size, px, n);
+        if (!done) ok = false;
+    });
+    return ok;
+}
+
+inline bool decodeQOICPixels(const unsigned char *data, const QOICInfo &info, unsigned char *pixels) {
+    QOICSerial serial;
+    return decodeQOICPixels(data, info, pixels, serial);
+}
+
+inline bool readQOIC(const std::string &file, std::vector<unsigned char> &pixels, int &w, int &h, int &channels) {
+    FILE *f = fopen(file.c_str(), "rb");
+    if (!f) return false;
+    std::vector<unsigned char> data;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        if (size > 0) {
+            data.resize((size_t)size);
+            rewind(f);
+            if (fread(data.data(), 1, data.size(), f) != data.size()) data.clear();
+        }
+    }
+    fclose(f);
+    QOICInfo info;
+    bool ok = readQOICHeader(data.data(), data.size(), info);
+    if (ok) {
+        w = info.width;
+        h = info.height;
+        channels = info.channels;
+        pixels.resize((size_t)w * h * channels);
+        ok = decodeQOICPixels(data.data(), info, pixels.data());
+    }
+    if (!ok) {
+        fprintf(stderr, "QOIC inválido: %s\n", file.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Arquivo de cache de 'source' dentro de 'dir' (criado se preciso): o
+// caminho vira um nome só, com '/', '\' e ':' trocados por '_'.
+inline std::string qoicCacheFile(const std::string &source, const std::string &dir = "qoic_cache") {
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0777);
+#endif
+    std::string name = source;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (name[i] == '/' || name[i] == '\\' || name[i] == ':') name[i] = '_';
+    }
+    return dir + "/" + name + ".qoic";
+}
+
+// Cache ainda vale: existe e é mais novo que o arquivo de origem
+inline bool cacheIsFresh(const std::string &cache, const std::string &source) {
+    struct stat c, s;
+    if (stat(cache.c_str(), &c) != 0) return false;
+    if (stat(source.c_str(), &s) != 0) return true;
+    return c.st_mtime >= s.st_mtime;
+}
+
+#endif
@@ -25,6 +25,14 @@
    #define stbi_inline __forceinline
 #endif
 
+// for the few loops that are shared by two callers and should be compiled
+// into each of them
+#ifdef __GNUC__
+   #define stbi_force_inline  __attribute__((always_inline)) stbi_inline
+#else
+   #define stbi_force_inline  stbi_inline
+#endif
+
 
 // implementation:
 typedef unsigned char  uint8;
@@ -33,10 +41,18 @@ typedef   signed short  int16;
 typedef unsigned int   uint32;
 typedef   signed int    int32;
 typedef unsigned int   uint;
+typedef unsigned long long uint64;
 
 // should produce compiler error if size is wrong
 typedef unsigned char validate_uint32[sizeof(uint32)==4 ? 1 : -1];
 
+// the inflater loads its input 8 bytes at a time where it knows the byte
+// order matches
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+   #define STBI_LITTLE_ENDIAN
+#endif
+
 #if defined(STBI_NO_STDIO) && !defined(STBI_NO_WRITE)
 #define STBI_NO_WRITE
 #endif
@@ -53,6 +69,60 @@ typedef unsigned char validate_uint32[sizeof(uint32)==4 ? 1 : -1];
    #define stbi_lrot(x,y)  (((x) << (y)) | ((x) >> (32 - (y))))
 #endif
 
+// x86 SSE2/AVX2 kernels for the jpeg decoder, picked at runtime (define
+// STBI_NO_SIMD to leave only the scalar code). SSE2 is part of x86-64; on
+// 32-bit x86 the compiler must already be targeting it.
+#if !defined(STBI_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || \
+    (defined(__i386__) && defined(__SSE2__)) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+   #define STBI_X86
+   #include <immintrin.h>
+   #ifdef _MSC_VER
+   #include <intrin.h>
+   #endif
+#endif
+
+// C++11 gives atomics and one-time initialization for the state shared
+// between decodes, and worker threads for the jpeg decoder (define
+// STBI_NO_THREADS to leave those out)
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+   #define STBI_CPP11
+   #include <atomic>
+   #include <mutex>
+   #ifndef STBI_NO_THREADS
+      #define STBI_THREADS
+      #include <thread>
+      #include <condition_variable>
+      #include <vector>
+      #include <memory>
+   #endif
+#endif
+
+// settings that any thread may change while others decode
+#ifdef STBI_CPP11
+   #define STBI_SHARED(type)  std::atomic<type>
+#else
+   #define STBI_SHARED(type)  type
+#endif
+
+// state that belongs to the decoding thread
+#ifdef STBI_CPP11
+   #define STBI_THREAD_LOCAL  thread_local
+#elif defined(_MSC_VER)
+   #define STBI_THREAD_LOCAL  __declspec(thread)
+#elif defined(__GNUC__)
+   #define STBI_THREAD_LOCAL  __thread
+#else
+   #define STBI_THREAD_LOCAL
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+   #define STBI_TARGET(x)  __attribute__((target(x)))
+   #define STBI_ALIGN16    __attribute__((aligned(16)))
+#else
+   #define STBI_TARGET(x)
+   #define STBI_ALIGN16    __declspec(align(16))
+#endif
+
 ///////////////////////////////////////////////
 //
 //  stbi struct and start_xxx functions
@@ -161,8 +231,8 @@ static stbi_uc *stbi_gif_load(stbi *s, int *x, int *y, int *comp, int req_comp);
 static int      stbi_gif_info(stbi *s, int *x, int *y, int *comp);
 
 
-// this is not threadsafe
-static const char *failure_reason;
+// per thread, so concurrent loads each report their own
+static STBI_THREAD_LOCAL const char *failure_reason;
 
 const char *stbi_failure_reason(void)
 {
@@ -190,9 +260,207 @@ static int e(const char *str)
 #define epf(x,y)   ((float *) (e(x,y)?NULL:NULL))
 #define epuc(x,y)  ((unsigned char *) (e(x,y)?NULL:NULL))
 
+//////////////////////////////////////////////////////////////////////////////
+//
+//  memory
+//
+//  everything the decoders allocate goes through stbi_malloc & co. With an
+//  arena set on the thread the memory comes out of the arena's blocks, and
+//  is given back all at once when the arena is reset; the stbi_load_into
+//  functions also hand the caller's buffer to the decoder as the buffer
+//  for its final image
+
+typedef struct arena_block
+{
+   struct arena_block *next;
+   size_t size, used;
+} arena_block;
+
+struct stbi_arena
+{
+   arena_block *first, *cur;
+};
+
+// allocations are 16-byte aligned, like malloc's, and each one is preceded
+// by its size so realloc knows how much to copy
+#define ARENA_ALIGN     16
+#define ARENA_ROUND(n)  (((n) + ARENA_ALIGN-1) & ~(size_t) (ARENA_ALIGN-1))
+#define ARENA_HEADER    ARENA_ALIGN
+#define ARENA_DEFAULT   (1 << 20)
+
+static STBI_THREAD_LOCAL stbi_arena *cur_arena;
+
+// the caller's buffer while a stbi_load_into call is running
+typedef struct
+{
+   uint8 *data;
+   size_t size;
+   int taken;
+} out_buffer;
+
+static STBI_THREAD_LOCAL out_buffer caller_out;
+
+static uint8 *block_data(arena_block *b)
+{
+   return (uint8 *) b + ARENA_ROUND(sizeof(arena_block));
+}
+
+static arena_block *new_block(size_t size)
+{
+   arena_block *b = (arena_block *) malloc(ARENA_ROUND(sizeof(arena_block)) + size);
+   if (b) { b->next = NULL; b->size = size; b->used = 0; }
+   return b;
+}
+
+static arena_block *arena_owner(stbi_arena *a, void *p)
+{
+   arena_block *b;
+   if (a)
+      for (b = a->first; b; b = b->next)
+         if ((uint8 *) p >= block_data(b) && (uint8 *) p < block_data(b) + b->size)
+            return b;
+   return NULL;
+}
+
+static void *arena_alloc(stbi_arena *a, size_t size)
+{
+   arena_block *b = a->cur;
+   size_t need = ARENA_HEADER + ARENA_ROUND(size);
+   uint8 *p;
+   // blocks after the current one are empty; take the first that fits,
+   // adding a bigger one at the end if none does
+   while (b->size - b->used < need) {
+      if (!b->next) {
+         b->next = new_block(b->size*2 > need ? b->size*2 : need);
+         if (!b->next) return NULL;
+      }
+      b = b->next;
+   }
+   a->cur = b;
+   p = block_data(b) + b->used;
+   *(size_t *) p = size;
+   b->used += need;
+   return p + ARENA_HEADER;
+}
+
+// is p the most recent allocation in the current block?
+static int arena_is_last(stbi_arena *a, arena_block *b, uint8 *p)
+{
+   return b == a->cur && p + ARENA_ROUND(((size_t *) p)[-ARENA_HEADER/sizeof(size_t)]) == block_data(b) + b->used;
+}
+
+static void *arena_realloc(stbi_arena *a, arena_block *b, void *p, size_t size)
+{
+   size_t old = ((size_t *) p)[-ARENA_HEADER/sizeof(size_t)];
+   size_t start = (uint8 *) p - block_data(b);
+   void *q;
+   // growing the last allocation in place is what makes zlib's output
+   // doubling cheap
+   if (arena_is_last(a, b, (uint8 *) p) && start + ARENA_ROUND(size) <= b->size) {
+      ((size_t *) p)[-ARENA_HEADER/sizeof(size_t)] = size;
+      b->used = start + ARENA_ROUND(size);
+      return p;
+   }
+   q = arena_alloc(a, size);
+   if (q) memcpy(q, p, old < size ? old : size);
+   return q;
+}
+
+static void *stbi_malloc(size_t size)
+{
+   return cur_arena ? arena_alloc(cur_arena, size) : malloc(size);
+}
+
+static void *stbi_realloc(void *p, size_t size)
+{
+   arena_block *b = arena_owner(cur_arena, p);
+   if (b) return arena_realloc(cur_arena, b, p, size);
+   if (!p) return stbi_malloc(size);
+   return realloc(p, size);
+}
+
+static void stbi_free(void *p)
+{
+   arena_block *b;
+   if (!p || p == caller_out.data) return;
+   b = arena_owner(cur_arena, p);
+   if (!b)
+      free(p);
+   else if (arena_is_last(cur_arena, b, (uint8 *) p))  // everything else waits for the reset
+      b->used = (uint8 *) p - ARENA_HEADER - block_data(b);
+}
+
+// for the buffer a decoder will return its image in
+static void *stbi_malloc_out(size_t size)
+{
+   if (caller_out.data && !caller_out.taken && size <= caller_out.size) {
+      caller_out.taken = 1;
+      return caller_out.data;
+   }
+   return stbi_malloc(size);
+}
+
+stbi_arena *stbi_arena_create(size_t size)
+{
+   stbi_arena *a = (stbi_arena *) malloc(sizeof(*a));
+   if (!a) return (stbi_arena *) epuc("outofmem", "Out of memory");
+   a->first = a->cur = new_block(size ? ARENA_ROUND(size) : ARENA_DEFAULT);
+   if (!a->first) { free(a); return (stbi_arena *) epuc("outofmem", "Out of memory"); }
+   return a;
+}
+
+static void arena_rewind(stbi_arena *a, arena_block *cur, size_t used)
+{
+   arena_block *b;
+   for (b = cur->next; b; b = b->next)
+      b->used = 0;
+   cur->used = used;
+   a->cur = cur;
+}
+
+void stbi_arena_reset(stbi_arena *a)
+{
+   arena_block *b, *next;
+   size_t total = 0;
+   if (a->first->next) {
+      // it grew: swap the chain for one block as big as all of it, so the
+      // same images fit in one block from now on
+      for (b = a->first; b; b = b->next)
+         total += b->size;
+      b = new_block(total);
+      if (b) {
+         while ((next = a->first) != NULL) {
+            a->first = next->next;
+            free(next);
+         }
+         a->first = b;
+      }
+   }
+   arena_rewind(a, a->first, 0);
+}
+
+void stbi_arena_free(stbi_arena *a)
+{
+   arena_block *b;
+   if (!a) return;
+   if (cur_arena == a) cur_arena = NULL;
+   while ((b = a->first) != NULL) {
+      a->first = b->next;
+      free(b);
+   }
+   free(a);
+}
+
+stbi_arena *stbi_set_arena(stbi_arena *a)
+{
+   stbi_arena *old = cur_arena;
+   cur_arena = a;
+   return old;
+}
+
 void stbi_image_free(void *retval_from_stbi_load)
 {
-   free(retval_from_stbi_load);
+   stbi_free(retval_from_stbi_load);
 }
 
 #ifndef STBI_NO_HDR
@@ -222,6 +490,33 @@ static unsigned char *stbi_load_main(stbi *s, int *x, int *y, int *comp, int req
    return epuc("unknown image type", "Image not of any known type, or corrupt");
 }
 
+// decode with the caller's buffer standing in for the final image, and give
+// back whatever the decode took from the arena
+static int stbi_load_into_main(stbi *s, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_arena *a = cur_arena;
+   arena_block *mark = a ? a->cur : NULL;
+   size_t mark_used = a ? a->cur->used : 0;
+   size_t size = 0;
+   uint8 *data;
+
+   caller_out.data = out;
+   caller_out.size = out_size;
+   caller_out.taken = 0;
+   data = stbi_load_main(s,x,y,comp,req_comp);
+   caller_out.data = NULL;
+   if (data) {
+      size = (size_t) *x * *y * (req_comp ? req_comp : *comp);
+      if (size > out_size)
+         e("buffer too small", "Output buffer too small for image");
+      else if (data != out)
+         memcpy(out, data, size);
+      if (data != out) stbi_free(data);
+   }
+   if (a) arena_rewind(a, mark, mark_used);
+   return data != NULL && size <= out_size;
+}
+
 #ifndef STBI_NO_STDIO
 unsigned char *stbi_load(char const *filename, int *x, int *y, int *comp, int req_comp)
 {
@@ -239,6 +534,25 @@ unsigned char *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_c
    start_file(&s,f);
    return stbi_load_main(&s,x,y,comp,req_comp);
 }
+
+int stbi_load_into(char const *filename, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f = fopen(filename, "rb");
+   char buffer[BUFSIZ];
+   int result;
+   if (!f) return e("can't fopen", "Unable to open file");
+   setvbuf(f, buffer, _IOFBF, sizeof(buffer)); // so stdio doesn't malloc one
+   result = stbi_load_from_file_into(f,out,out_size,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
+int stbi_load_from_file_into(FILE *f, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   start_file(&s,f);
+   return stbi_load_into_main(&s,out,out_size,x,y,comp,req_comp);
+}
 #endif //!STBI_NO_STDIO
 
 unsigned char *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
@@ -255,6 +569,20 @@ unsigned char *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *use
    return stbi_load_main(&s,x,y,comp,req_comp);
 }
 
+int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   start_mem(&s,buffer,len);
+   return stbi_load_into_main(&s,out,out_size,x,y,comp,req_comp);
+}
+
+int stbi_load_from_callbacks_into(stbi_io_callbacks const *clbk, void *user, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi s;
+   start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi_load_into_main(&s,out,out_size,x,y,comp,req_comp);
+}
+
 #ifndef STBI_NO_HDR
 
 float *stbi_loadf_main(stbi *s, int *x, int *y, int *comp, int req_comp)
@@ -358,8 +686,8 @@ extern int      stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void *
 }
 
 #ifndef STBI_NO_HDR
-static float h2l_gamma_i=1.0f/2.2f, h2l_scale_i=1.0f;
-static float l2h_gamma=2.2f, l2h_scale=1.0f;
+static STBI_SHARED(float) h2l_gamma_i(1.0f/2.2f), h2l_scale_i(1.0f);
+static STBI_SHARED(float) l2h_gamma(2.2f), l2h_scale(1.0f);
 
 void   stbi_hdr_to_ldr_gamma(float gamma) { h2l_gamma_i = 1/gamma; }
 void   stbi_hdr_to_ldr_scale(float scale) { h2l_scale_i = 1/scale; }
@@ -378,7 +706,8 @@ enum
 {
    SCAN_load=0,
    SCAN_type,
-   SCAN_header
+   SCAN_header,
+   SCAN_stream   // stop where the pixel data starts (streaming decoder)
 };
 
 static void refill_buffer(stbi *s)
@@ -500,47 +829,50 @@ static uint8 compute_y(int r, int g, int b)
    return (uint8) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
+// one scanline of convert_format, also used by the streaming decoder
+static void convert_row(unsigned char *src, unsigned char *dest, int img_n, int req_comp, uint x)
+{
+   int i;
+   #define COMBO(a,b)  ((a)*8+(b))
+   #define CASE(a,b)   case COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   // convert source image with img_n components to one with req_comp components;
+   // avoid switch per pixel, so use switch per scanline and massive macros
+   switch (COMBO(img_n, req_comp)) {
+      CASE(1,2) dest[0]=src[0], dest[1]=255; break;
+      CASE(1,3) dest[0]=dest[1]=dest[2]=src[0]; break;
+      CASE(1,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=255; break;
+      CASE(2,1) dest[0]=src[0]; break;
+      CASE(2,3) dest[0]=dest[1]=dest[2]=src[0]; break;
+      CASE(2,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=src[1]; break;
+      CASE(3,4) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2],dest[3]=255; break;
+      CASE(3,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
+      CASE(3,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = 255; break;
+      CASE(4,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
+      CASE(4,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = src[3]; break;
+      CASE(4,3) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2]; break;
+      default: assert(0);
+   }
+   #undef CASE
+}
+
 static unsigned char *convert_format(unsigned char *data, int img_n, int req_comp, uint x, uint y)
 {
-   int i,j;
+   int j;
    unsigned char *good;
 
    if (req_comp == img_n) return data;
    assert(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) malloc(req_comp * x * y);
+   good = (unsigned char *) stbi_malloc_out(req_comp * x * y);
    if (good == NULL) {
-      free(data);
+      stbi_free(data);
       return epuc("outofmem", "Out of memory");
    }
 
-   for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
-
-      #define COMBO(a,b)  ((a)*8+(b))
-      #define CASE(a,b)   case COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (COMBO(img_n, req_comp)) {
-         CASE(1,2) dest[0]=src[0], dest[1]=255; break;
-         CASE(1,3) dest[0]=dest[1]=dest[2]=src[0]; break;
-         CASE(1,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=255; break;
-         CASE(2,1) dest[0]=src[0]; break;
-         CASE(2,3) dest[0]=dest[1]=dest[2]=src[0]; break;
-         CASE(2,4) dest[0]=dest[1]=dest[2]=src[0], dest[3]=src[1]; break;
-         CASE(3,4) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2],dest[3]=255; break;
-         CASE(3,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
-         CASE(3,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = 255; break;
-         CASE(4,1) dest[0]=compute_y(src[0],src[1],src[2]); break;
-         CASE(4,2) dest[0]=compute_y(src[0],src[1],src[2]), dest[1] = src[3]; break;
-         CASE(4,3) dest[0]=src[0],dest[1]=src[1],dest[2]=src[2]; break;
-         default: assert(0);
-      }
-      #undef CASE
-   }
+   for (j=0; j < (int) y; ++j)
+      convert_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x);
 
-   free(data);
+   stbi_free(data);
    return good;
 }
 
@@ -548,8 +880,8 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
 static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
-   float *output = (float *) malloc(x * y * comp * sizeof(float));
-   if (output == NULL) { free(data); return epf("outofmem", "Out of memory"); }
+   float *output = (float *) stbi_malloc(x * y * comp * sizeof(float));
+   if (output == NULL) { stbi_free(data); return epf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -558,7 +890,7 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
       }
       if (k < comp) output[i*comp + k] = data[i*comp+k]/255.0f;
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 
@@ -566,8 +898,8 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
-   stbi_uc *output = (stbi_uc *) malloc(x * y * comp);
-   if (output == NULL) { free(data); return epuc("outofmem", "Out of memory"); }
+   stbi_uc *output = (stbi_uc *) stbi_malloc_out(x * y * comp);
+   if (output == NULL) { stbi_free(data); return epuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -584,11 +916,171 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (uint8) float2int(z);
       }
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 #endif
 
+//////////////////////////////////////////////////////////////////////////////
+//
+//  runtime SIMD selection
+//
+
+static int detect_simd_level(void)
+{
+#if defined(STBI_X86) && (defined(__GNUC__) || defined(__clang__))
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) return STBI_SIMD_AVX2;
+   return STBI_SIMD_SSE2;
+#elif defined(STBI_X86) && defined(_MSC_VER)
+   int info[4], osxsave;
+   unsigned long long xcr0;
+   __cpuid(info, 1);
+   osxsave = (info[2] & (1 << 27)) != 0;
+   xcr0 = osxsave ? _xgetbv(0) : 0;
+   __cpuidex(info, 7, 0);
+   if ((info[1] & (1 << 5)) && (xcr0 & 6) == 6) return STBI_SIMD_AVX2;
+   return STBI_SIMD_SSE2;
+#else
+   return STBI_SIMD_NONE;
+#endif
+}
+
+static STBI_SHARED(int) simd_level(-1);
+
+int stbi_simd_level(void)
+{
+   // racing threads all store the same value
+   int level = simd_level;
+   if (level < 0) simd_level = level = detect_simd_level();
+   return level;
+}
+
+void stbi_set_simd_level(int level)
+{
+   int best = detect_simd_level();
+   if (level < STBI_SIMD_NONE) level = STBI_SIMD_NONE;
+   simd_level = level < best ? level : best;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  worker threads
+//
+
+#ifdef STBI_THREADS
+typedef void (*stbi_task_func)(void *ctx, int task);
+
+// Fixed pool; the calling thread works too. run() hands tasks [0,count)
+// out through an atomic counter, so they start in order, and returns when
+// all are done. One run() at a time; tasks must not call run().
+struct stbi_pool
+{
+   std::vector<std::thread> workers;
+   std::mutex lock, serial;
+   std::condition_variable wake, finished;
+   stbi_task_func fn;
+   void *ctx;
+   int count, busy;
+   std::atomic<int> next;
+   unsigned long generation;
+   bool stopping;
+
+   stbi_pool(int threads) : fn(NULL), ctx(NULL), count(0), busy(0), next(0), generation(0), stopping(false)
+   {
+      int i;
+      for (i=1; i < threads; ++i)
+         workers.push_back(std::thread(&stbi_pool::loop, this));
+   }
+
+   ~stbi_pool()
+   {
+      size_t i;
+      {
+         std::lock_guard<std::mutex> g(lock);
+         stopping = true;
+      }
+      wake.notify_all();
+      for (i=0; i < workers.size(); ++i)
+         workers[i].join();
+   }
+
+   int size() const { return (int) workers.size() + 1; }
+
+   void drain()
+   {
+      int i;
+      while ((i = next.fetch_add(1)) < count)
+         fn(ctx, i);
+   }
+
+   void loop()
+   {
+      unsigned long seen = 0;
+      for (;;) {
+         {
+            std::unique_lock<std::mutex> g(lock);
+            while (!stopping && generation == seen) wake.wait(g);
+            if (stopping) return;
+            seen = generation;
+         }
+         drain();
+         std::lock_guard<std::mutex> g(lock);
+         if (--busy == 0) finished.notify_one();
+      }
+   }
+
+   void run(int tasks, stbi_task_func f, void *c)
+   {
+      int i;
+      if (workers.empty() || tasks <= 1) {
+         for (i=0; i < tasks; ++i) f(c, i);
+         return;
+      }
+      std::lock_guard<std::mutex> turn(serial);
+      {
+         std::lock_guard<std::mutex> g(lock);
+         fn = f;
+         ctx = c;
+         count = tasks;
+         next = 0;
+         busy = (int) workers.size();
+         ++generation;
+      }
+      wake.notify_all();
+      drain();
+      std::unique_lock<std::mutex> g(lock);
+      while (busy) finished.wait(g);
+   }
+};
+
+static std::unique_ptr<stbi_pool> thread_pool;
+static std::mutex thread_pool_lock;
+static int thread_count = 0;   // 0: one per core
+
+void stbi_set_thread_count(int count)
+{
+   std::lock_guard<std::mutex> g(thread_pool_lock);
+   thread_count = count < 0 ? 0 : count;
+   thread_pool.reset();
+}
+
+static stbi_pool *get_pool(void)
+{
+   std::lock_guard<std::mutex> g(thread_pool_lock);
+   if (!thread_pool) {
+      int n = thread_count ? thread_count : (int) std::thread::hardware_concurrency();
+      thread_pool.reset(new stbi_pool(n > 1 ? n : 1));
+   }
+   return thread_pool.get();
+}
+#else
+void stbi_set_thread_count(int count)
+{
+   STBI_NOTUSED(count);
+}
+#endif // STBI_THREADS
+
 //////////////////////////////////////////////////////////////////////////////
 //
 //  "baseline" JPEG/JFIF decoder (not actually fully baseline implementation)
@@ -630,12 +1122,27 @@ typedef struct
    int    delta[17];   // old 'firstsymbol' - old 'firstcode'
 } huffman;
 
+#ifdef STBI_SIMD
+typedef unsigned short stbi_dequantize_t;
+#else
+typedef uint8 stbi_dequantize_t;
+#endif
+
+typedef void (*idct_block_func)(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize);
+typedef void (*YCbCr_to_RGB_func)(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step);
+
 typedef struct
 {
    #ifdef STBI_SIMD
    unsigned short dequant2[4][64];
    #endif
    stbi *s;
+
+// kernels picked by jpeg_select_kernels()
+   int simd;
+   idct_block_func idct;
+   YCbCr_to_RGB_func YCbCr_to_RGB;
+
    huffman huff_dc[4];
    huffman huff_ac[4];
    uint8 dequant[4][64];
@@ -657,9 +1164,12 @@ typedef struct
       int x,y,w2,h2;
       uint8 *data;
       void *raw_data;
-      uint8 *linebuf;
+      int data_y;   // component row that data points at (streaming keeps a strip)
    } img_comp[4];
 
+   uint8 *linebuf;   // line buffers for the color conversion
+   uint8 *stream;    // callback input read into memory, if it was
+
    uint32         code_buffer; // jpeg entropy-coded buffer
    int            code_bits;   // number of valid bits
    unsigned char  marker;      // marker seen while filling entropy buffer
@@ -911,12 +1421,6 @@ stbi_inline static uint8 clamp(int x)
    t1 += p2+p4;                                \
    t0 += p1+p3;
 
-#ifdef STBI_SIMD
-typedef unsigned short stbi_dequantize_t;
-#else
-typedef uint8 stbi_dequantize_t;
-#endif
-
 // .344 seconds on 3*anemones.jpg
 static void idct_block(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
 {
@@ -980,7 +1484,7 @@ static void idct_block(uint8 *out, int out_stride, short data[64], stbi_dequanti
 }
 
 #ifdef STBI_SIMD
-static stbi_idct_8x8 stbi_idct_installed = idct_block;
+static STBI_SHARED(stbi_idct_8x8) stbi_idct_installed(NULL);   // NULL: pick by stbi_simd_level()
 
 void stbi_install_idct(stbi_idct_8x8 func)
 {
@@ -988,6 +1492,233 @@ void stbi_install_idct(stbi_idct_8x8 func)
 }
 #endif
 
+#ifdef STBI_X86
+// IDCT_1D with one block column (or row) in each 32-bit lane. The vector
+// ops wrap around just like the int math above, so the results are
+// bit-exact with idct_block.
+#define IDCT_1D_VEC(T,ADD,SUB,MUL,FSH,s0,s1,s2,s3,s4,s5,s6,s7) \
+   T t0,t1,t2,t3,p1,p2,p3,p4,p5,x0,x1,x2,x3;  \
+   p2 = s2;                                   \
+   p3 = s6;                                   \
+   p1 = MUL(ADD(p2,p3), f2f(0.5411961f));     \
+   t2 = ADD(p1, MUL(p3, f2f(-1.847759065f))); \
+   t3 = ADD(p1, MUL(p2, f2f( 0.765366865f))); \
+   p2 = s0;                                   \
+   p3 = s4;                                   \
+   t0 = FSH(ADD(p2,p3));                      \
+   t1 = FSH(SUB(p2,p3));                      \
+   x0 = ADD(t0,t3);                           \
+   x3 = SUB(t0,t3);                           \
+   x1 = ADD(t1,t2);                           \
+   x2 = SUB(t1,t2);                           \
+   t0 = s7;                                   \
+   t1 = s5;                                   \
+   t2 = s3;                                   \
+   t3 = s1;                                   \
+   p3 = ADD(t0,t2);                           \
+   p4 = ADD(t1,t3);                           \
+   p1 = ADD(t0,t3);                           \
+   p2 = ADD(t1,t2);                           \
+   p5 = MUL(ADD(p3,p4), f2f( 1.175875602f));  \
+   t0 = MUL(t0, f2f( 0.298631336f));          \
+   t1 = MUL(t1, f2f( 2.053119869f));          \
+   t2 = MUL(t2, f2f( 3.072711026f));          \
+   t3 = MUL(t3, f2f( 1.501321110f));          \
+   p1 = ADD(p5, MUL(p1, f2f(-0.899976223f))); \
+   p2 = ADD(p5, MUL(p2, f2f(-2.562915447f))); \
+   p3 = MUL(p3, f2f(-1.961570560f));          \
+   p4 = MUL(p4, f2f(-0.390180644f));          \
+   t3 = ADD(t3, ADD(p1,p4));                  \
+   t2 = ADD(t2, ADD(p2,p3));                  \
+   t1 = ADD(t1, ADD(p2,p4));                  \
+   t0 = ADD(t0, ADD(p1,p3));
+
+// final butterfly of each pass: rounding bias, then >> shift into OUT(0..7)
+#define IDCT_OUT_VEC(ADD,SUB,SRA,OUT,bias,shift) \
+   x0 = ADD(x0,bias); x1 = ADD(x1,bias);         \
+   x2 = ADD(x2,bias); x3 = ADD(x3,bias);         \
+   OUT(0) = SRA(ADD(x0,t3), shift);              \
+   OUT(7) = SRA(SUB(x0,t3), shift);              \
+   OUT(1) = SRA(ADD(x1,t2), shift);              \
+   OUT(6) = SRA(SUB(x1,t2), shift);              \
+   OUT(2) = SRA(ADD(x2,t1), shift);              \
+   OUT(5) = SRA(SUB(x2,t1), shift);              \
+   OUT(3) = SRA(ADD(x3,t0), shift);              \
+   OUT(4) = SRA(SUB(x3,t0), shift);
+
+// low 32 bits of a*c in each lane (_mm_mullo_epi32 needs SSE4.1)
+static stbi_inline __m128i mul32_sse2(__m128i a, int c)
+{
+   __m128i k    = _mm_set1_epi32(c);
+   __m128i even = _mm_mul_epu32(a, k);
+   __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), k);
+   return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                             _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0,0,2,0)));
+}
+
+#define SSE2_ADD(a,b)    _mm_add_epi32(a,b)
+#define SSE2_SUB(a,b)    _mm_sub_epi32(a,b)
+#define SSE2_MUL(a,c)    mul32_sse2(a,c)
+#define SSE2_FSH(a)      _mm_slli_epi32(a,12)
+#define SSE2_SRA(a,n)    _mm_srai_epi32(a,n)
+#define SSE2_ROW(k)      r[k][h]
+
+static stbi_inline void transpose4_sse2(__m128i *a, __m128i *b, __m128i *c, __m128i *d)
+{
+   __m128i t0 = _mm_unpacklo_epi32(*a,*b), t1 = _mm_unpacklo_epi32(*c,*d);
+   __m128i t2 = _mm_unpackhi_epi32(*a,*b), t3 = _mm_unpackhi_epi32(*c,*d);
+   *a = _mm_unpacklo_epi64(t0,t1);
+   *b = _mm_unpackhi_epi64(t0,t1);
+   *c = _mm_unpacklo_epi64(t2,t3);
+   *d = _mm_unpackhi_epi64(t2,t3);
+}
+
+// 8x8 block of ints held as r[row][half], 4 lanes per half
+static stbi_inline void transpose8x8_sse2(__m128i r[8][2])
+{
+   int i;
+   transpose4_sse2(&r[0][0], &r[1][0], &r[2][0], &r[3][0]);
+   transpose4_sse2(&r[4][1], &r[5][1], &r[6][1], &r[7][1]);
+   transpose4_sse2(&r[0][1], &r[1][1], &r[2][1], &r[3][1]);
+   transpose4_sse2(&r[4][0], &r[5][0], &r[6][0], &r[7][0]);
+   for (i=0; i < 4; ++i) {
+      __m128i t = r[i][1];
+      r[i][1] = r[i+4][0];
+      r[i+4][0] = t;
+   }
+}
+
+static void idct_block_sse2(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   __m128i r[8][2], zero = _mm_setzero_si128(), ac = zero, bias;
+   int h,k;
+
+   // dequantize; the quantizer values fit in 8 bits, so madd with a zero
+   // high half gives the exact 32-bit products
+   for (k=0; k < 8; ++k) {
+      __m128i d = _mm_loadu_si128((__m128i *) (data + k*8));
+      #ifdef STBI_SIMD
+      __m128i q = _mm_loadu_si128((__m128i *) (dequantize + k*8));
+      #else
+      __m128i q = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (dequantize + k*8)), zero);
+      #endif
+      r[k][0] = _mm_madd_epi16(_mm_unpacklo_epi16(d, zero), _mm_unpacklo_epi16(q, zero));
+      r[k][1] = _mm_madd_epi16(_mm_unpackhi_epi16(d, zero), _mm_unpackhi_epi16(q, zero));
+      if (k) ac = _mm_or_si128(ac, d);
+   }
+   // columns with no AC terms get the dc shortcut, as in idct_block
+   ac = _mm_cmpeq_epi16(ac, zero);
+
+   // columns, 4 at a time
+   bias = _mm_set1_epi32(512);
+   for (h=0; h < 2; ++h) {
+      __m128i dc = _mm_slli_epi32(r[0][h], 2);
+      __m128i m  = h ? _mm_unpackhi_epi16(ac, ac) : _mm_unpacklo_epi16(ac, ac);
+      IDCT_1D_VEC(__m128i, SSE2_ADD, SSE2_SUB, SSE2_MUL, SSE2_FSH,
+                  r[0][h], r[1][h], r[2][h], r[3][h], r[4][h], r[5][h], r[6][h], r[7][h])
+      IDCT_OUT_VEC(SSE2_ADD, SSE2_SUB, SSE2_SRA, SSE2_ROW, bias, 10)
+      for (k=0; k < 8; ++k)
+         r[k][h] = _mm_or_si128(_mm_and_si128(m, dc), _mm_andnot_si128(m, r[k][h]));
+   }
+
+   // rows, 4 at a time, after turning them into columns
+   transpose8x8_sse2(r);
+   bias = _mm_set1_epi32(65536 + (128<<17));
+   for (h=0; h < 2; ++h) {
+      IDCT_1D_VEC(__m128i, SSE2_ADD, SSE2_SUB, SSE2_MUL, SSE2_FSH,
+                  r[0][h], r[1][h], r[2][h], r[3][h], r[4][h], r[5][h], r[6][h], r[7][h])
+      IDCT_OUT_VEC(SSE2_ADD, SSE2_SUB, SSE2_SRA, SSE2_ROW, bias, 17)
+   }
+   transpose8x8_sse2(r);
+
+   // the two saturating packs clamp to 0..255 like clamp()
+   for (k=0; k < 8; ++k) {
+      __m128i p = _mm_packs_epi32(r[k][0], r[k][1]);
+      _mm_storel_epi64((__m128i *) (out + k*out_stride), _mm_packus_epi16(p, p));
+   }
+}
+
+#define AVX2_ADD(a,b)    _mm256_add_epi32(a,b)
+#define AVX2_SUB(a,b)    _mm256_sub_epi32(a,b)
+#define AVX2_MUL(a,c)    _mm256_mullo_epi32(a, _mm256_set1_epi32(c))
+#define AVX2_FSH(a)      _mm256_slli_epi32(a,12)
+#define AVX2_SRA(a,n)    _mm256_srai_epi32(a,n)
+#define AVX2_ROW(k)      r[k]
+
+STBI_TARGET("avx2") static stbi_inline void transpose8x8_avx2(__m256i r[8])
+{
+   __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+   __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+   __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+   __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+   __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+   __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+   __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+   __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+   r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+   r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+   r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+   r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+   r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+   r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+   r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+   r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+STBI_TARGET("avx2") static void idct_block_avx2(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   __m256i r[8], bias, dc, m, a, b;
+   __m128i ac = _mm_setzero_si128(), lo, hi;
+   int k;
+
+   for (k=0; k < 8; ++k) {
+      __m128i d = _mm_loadu_si128((__m128i *) (data + k*8));
+      #ifdef STBI_SIMD
+      __m256i q = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) (dequantize + k*8)));
+      #else
+      __m256i q = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (dequantize + k*8)));
+      #endif
+      r[k] = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(d), q);
+      if (k) ac = _mm_or_si128(ac, d);
+   }
+   m  = _mm256_cvtepi16_epi32(_mm_cmpeq_epi16(ac, _mm_setzero_si128()));
+   dc = _mm256_slli_epi32(r[0], 2);
+
+   {
+      IDCT_1D_VEC(__m256i, AVX2_ADD, AVX2_SUB, AVX2_MUL, AVX2_FSH,
+                  r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7])
+      bias = _mm256_set1_epi32(512);
+      IDCT_OUT_VEC(AVX2_ADD, AVX2_SUB, AVX2_SRA, AVX2_ROW, bias, 10)
+   }
+   for (k=0; k < 8; ++k)
+      r[k] = _mm256_blendv_epi8(r[k], dc, m);
+
+   transpose8x8_avx2(r);
+   {
+      IDCT_1D_VEC(__m256i, AVX2_ADD, AVX2_SUB, AVX2_MUL, AVX2_FSH,
+                  r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7])
+      bias = _mm256_set1_epi32(65536 + (128<<17));
+      IDCT_OUT_VEC(AVX2_ADD, AVX2_SUB, AVX2_SRA, AVX2_ROW, bias, 17)
+   }
+   transpose8x8_avx2(r);
+
+   // packs leave each row split across the two 128-bit lanes; the
+   // permute puts rows 0..3 (and 4..7) back in order, 8 bytes each
+   a = _mm256_packus_epi16(_mm256_packs_epi32(r[0], r[1]), _mm256_packs_epi32(r[2], r[3]));
+   b = _mm256_packus_epi16(_mm256_packs_epi32(r[4], r[5]), _mm256_packs_epi32(r[6], r[7]));
+   a = _mm256_permutevar8x32_epi32(a, _mm256_setr_epi32(0,4,1,5,2,6,3,7));
+   b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(0,4,1,5,2,6,3,7));
+   for (k=0; k < 8; k += 4, a = b) {
+      lo = _mm256_castsi256_si128(a);
+      hi = _mm256_extracti128_si256(a, 1);
+      _mm_storel_epi64((__m128i *) (out + (k+0)*out_stride), lo);
+      _mm_storel_epi64((__m128i *) (out + (k+1)*out_stride), _mm_unpackhi_epi64(lo, lo));
+      _mm_storel_epi64((__m128i *) (out + (k+2)*out_stride), hi);
+      _mm_storel_epi64((__m128i *) (out + (k+3)*out_stride), _mm_unpackhi_epi64(hi, hi));
+   }
+}
+#endif // STBI_X86
+
 #define MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -1021,15 +1752,340 @@ static void reset(jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// where the blocks of one MCU go: block b belongs to component blk[b].comp,
+// at block (i*h + x, j*v + y) for MCU (i,j)
+typedef struct
+{
+   int nblk;
+   int per_row, rows;   // MCUs per row, MCU rows
+   struct { int comp, x, y, h, v; } blk[64];
+} jpeg_layout;
+
+static void jpeg_make_layout(jpeg *z, jpeg_layout *L)
+{
+   int k,x,y;
+   L->nblk = 0;
+   if (z->scan_n == 1) {
+      // non-interleaved, every block is an MCU
+      int n = z->order[0];
+      L->per_row = (z->img_comp[n].x+7) >> 3;
+      L->rows    = (z->img_comp[n].y+7) >> 3;
+      L->blk[0].comp = n;
+      L->blk[0].x = L->blk[0].y = 0;
+      L->blk[0].h = L->blk[0].v = 1;
+      L->nblk = 1;
+      return;
+   }
+   L->per_row = z->img_mcu_x;
+   L->rows    = z->img_mcu_y;
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            L->blk[L->nblk].comp = n;
+            L->blk[L->nblk].x = x;
+            L->blk[L->nblk].y = y;
+            L->blk[L->nblk].h = z->img_comp[n].h;
+            L->blk[L->nblk].v = z->img_comp[n].v;
+            ++L->nblk;
+         }
+      }
+   }
+}
+
+static int jpeg_decode_mcu(jpeg *z, jpeg_layout *L, short *coef)
+{
+   int b;
+   for (b=0; b < L->nblk; ++b, coef += 64) {
+      int n = L->blk[b].comp;
+      if (!decode_block(z, coef, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
+   }
+   return 1;
+}
+
+static void jpeg_idct_mcu(jpeg *z, jpeg_layout *L, int m, short *coef)
+{
+   int b, i = m % L->per_row, j = m / L->per_row;
+   for (b=0; b < L->nblk; ++b, coef += 64) {
+      int n = L->blk[b].comp;
+      int x2 = (i*L->blk[b].h + L->blk[b].x)*8;
+      int y2 = (j*L->blk[b].v + L->blk[b].y)*8;
+      #ifdef STBI_SIMD
+      z->idct(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, coef, z->dequant2[z->img_comp[n].tq]);
+      #else
+      z->idct(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, coef, z->dequant[z->img_comp[n].tq]);
+      #endif
+   }
+}
+
+#ifdef STBI_THREADS
+// Big scans are decoded on the thread pool. When the scan has a restart
+// interval it's cut at its RSTn markers, and the intervals are Huffman
+// decoded and IDCT'd independently; otherwise one thread does the Huffman
+// decoding a MCU row at a time into a ring of coefficient buffers, and
+// the other threads run the IDCT on them.
+#define JPEG_MT_MIN_BLOCKS  4096
+
+// the restart splitter needs the whole scan in memory, so a callback
+// stream is read to the end into z->stream
+static int jpeg_stream_to_memory(jpeg *z)
+{
+   stbi *s = z->s;
+   int len, cap, n;
+   uint8 *p, *q;
+   if (!s->read_from_callbacks) return 1;
+   len = (int) (s->img_buffer_end - s->img_buffer);
+   cap = len + 65536;
+   p = (uint8 *) stbi_malloc(cap);
+   if (!p) return 0;
+   memcpy(p, s->img_buffer, len);
+   for (;;) {
+      if (len == cap) {
+         q = (uint8 *) stbi_realloc(p, cap *= 2);
+         if (!q) { stbi_free(p); return 0; }
+         p = q;
+      }
+      n = (s->io.read)(s->io_user_data, (char *) p + len, cap - len);
+      if (n <= 0) break;
+      len += n;
+   }
+   z->stream = p;
+   start_mem(s, p, len);
+   return 1;
+}
+
+typedef struct
+{
+   uint8 *start, *end;
+} jpeg_interval;
+
+// Cuts the entropy-coded data at p into restart intervals, up to max of
+// them; returns how many there are (max+1 if there are too many). *after
+// and *marker get the position past and the value of the marker that ends
+// the scan (MARKER_none if the data just runs out).
+static int jpeg_split_scan(uint8 *p, uint8 *end, jpeg_interval *iv, int max, uint8 **after, uint8 *marker)
+{
+   int count = 0;
+   uint8 *start = p, *q;
+   *after = end;
+   *marker = MARKER_none;
+   for (;;) {
+      q = (uint8 *) memchr(p, 0xff, end - p);
+      if (q && q+1 < end && q[1] == 0) { p = q+2; continue; }   // stuffed 0xff
+      if (count == max) return max+1;
+      iv[count].start = start;
+      iv[count].end = q ? q : end;
+      ++count;
+      if (!q) return count;
+      while (q < end && *q == 0xff) ++q;   // fill bytes
+      if (q == end) return count;
+      if (!RESTART(*q)) {
+         *marker = *q;
+         *after = q+1;
+         return count;
+      }
+      start = p = q+1;
+   }
+}
+
+typedef struct
+{
+   jpeg *z;
+   jpeg_layout *L;
+   jpeg_interval *iv;
+   int count, tasks;
+   std::atomic<int> failed;
+} jpeg_restart_job;
+
+static void jpeg_restart_task(void *ctx, int t)
+{
+   jpeg_restart_job *job = (jpeg_restart_job *) ctx;
+   jpeg_layout *L = job->L;
+   int total = L->per_row * L->rows, ri = job->z->restart_interval;
+   int per = job->count / job->tasks, extra = job->count % job->tasks;
+   int k = t*per + (t < extra ? t : extra);
+   int last = k + per + (t < extra);
+   STBI_ALIGN16 short coef[64*64];
+   stbi s;
+   jpeg c = *job->z;
+   c.s = &s;
+   for (; k < last && !job->failed; ++k) {
+      int m = k*ri, m_end = m+ri < total ? m+ri : total;
+      start_mem(&s, job->iv[k].start, (int) (job->iv[k].end - job->iv[k].start));
+      reset(&c);
+      for (; m < m_end; ++m) {
+         if (!jpeg_decode_mcu(&c, L, coef)) { job->failed = 1; return; }
+         jpeg_idct_mcu(&c, L, m, coef);
+      }
+   }
+}
+
+// MCU row r lives in slot r % slots until its IDCT is done
+struct jpeg_pipe
+{
+   jpeg *z;
+   jpeg_layout *L;
+   short *coef;
+   int slots, slot_size;
+   int *slot_mcus;   // MCUs decoded into the slot's row
+   int *slot_done;   // last row whose IDCT finished, per slot
+   int decoded;      // rows handed over by the decoder
+   int claimed;      // rows handed out for IDCT
+   int ok;
+   bool finished;
+   std::mutex lock;
+   std::condition_variable ready, freed;
+};
+
+static void jpeg_pipe_idct(jpeg_pipe *p, int row)
+{
+   int slot = row % p->slots, m;
+   short *coef = p->coef + (size_t) slot * p->slot_size;
+   for (m=0; m < p->slot_mcus[slot]; ++m, coef += p->L->nblk*64)
+      jpeg_idct_mcu(p->z, p->L, row * p->L->per_row + m, coef);
+}
+
+// IDCT rows as they come in, until the decoder is finished with all of them
+static void jpeg_pipe_consume(jpeg_pipe *p)
+{
+   int row;
+   std::unique_lock<std::mutex> g(p->lock);
+   for (;;) {
+      while (p->claimed == p->decoded && !p->finished) p->ready.wait(g);
+      if (p->claimed == p->decoded) return;
+      row = p->claimed++;
+      g.unlock();
+      jpeg_pipe_idct(p, row);
+      g.lock();
+      p->slot_done[row % p->slots] = row;
+      p->freed.notify_all();
+   }
+}
+
+// same walk and restart handling as parse_entropy_coded_data, a row at a time
+static void jpeg_pipe_produce(jpeg_pipe *p)
+{
+   jpeg *z = p->z;
+   jpeg_layout *L = p->L;
+   int row, old, m, more = 1;
+   for (row=0; row < L->rows && more; ++row) {
+      int slot = row % p->slots;
+      short *coef = p->coef + (size_t) slot * p->slot_size;
+      if (row >= p->slots) {
+         std::unique_lock<std::mutex> g(p->lock);
+         // do the IDCT of rows nobody picked up yet ourselves, so we never
+         // wait on threads that aren't there
+         while (p->claimed <= row - p->slots) {
+            old = p->claimed++;
+            g.unlock();
+            jpeg_pipe_idct(p, old);
+            g.lock();
+            p->slot_done[old % p->slots] = old;
+         }
+         while (p->slot_done[slot] != row - p->slots) p->freed.wait(g);
+      }
+      p->slot_mcus[slot] = 0;
+      for (m=0; m < L->per_row; ++m, coef += L->nblk*64) {
+         if (!jpeg_decode_mcu(z, L, coef)) { p->ok = more = 0; break; }
+         ++p->slot_mcus[slot];
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) grow_buffer_unsafe(z);
+            // if it's NOT a restart, keep what we have, as the serial path does
+            if (!RESTART(z->marker)) { more = 0; break; }
+            reset(z);
+         }
+      }
+      std::lock_guard<std::mutex> g(p->lock);
+      p->decoded = row+1;
+      p->ready.notify_one();
+   }
+   std::lock_guard<std::mutex> g(p->lock);
+   p->finished = true;
+   p->ready.notify_all();
+}
+
+static void jpeg_pipe_task(void *ctx, int t)
+{
+   jpeg_pipe *p = (jpeg_pipe *) ctx;
+   if (t == 0)
+      jpeg_pipe_produce(p);
+   jpeg_pipe_consume(p);
+}
+
+// returns -1 if the scan should be decoded serially
+static int parse_entropy_coded_data_mt(jpeg *z)
+{
+   jpeg_layout L;
+   stbi_pool *pool;
+   int threads, total, k;
+   uint8 *ring;
+
+   jpeg_make_layout(z, &L);
+   total = L.per_row * L.rows;
+   if (total * L.nblk < JPEG_MT_MIN_BLOCKS) return -1;
+   pool = get_pool();
+   threads = pool->size();
+   if (threads < 2) return -1;
+
+   if (z->restart_interval) {
+      jpeg_restart_job job;
+      uint8 *after, marker;
+      int expected = (total + z->restart_interval-1) / z->restart_interval;
+      if (!jpeg_stream_to_memory(z)) return e("outofmem", "Out of memory");
+      job.iv = (jpeg_interval *) stbi_malloc(expected * sizeof(jpeg_interval));
+      if (!job.iv) return e("outofmem", "Out of memory");
+      job.count = jpeg_split_scan(z->s->img_buffer, z->s->img_buffer_end, job.iv, expected, &after, &marker);
+      if (job.count == expected) {
+         job.z = z;
+         job.L = &L;
+         job.tasks = job.count < 4*threads ? job.count : 4*threads;
+         job.failed = 0;
+         pool->run(job.tasks, jpeg_restart_task, &job);
+         stbi_free(job.iv);
+         if (job.failed) return 0;
+         z->s->img_buffer = after;
+         z->marker = marker;
+         return 1;
+      }
+      // intervals don't add up; let the sequential walk deal with it
+      stbi_free(job.iv);
+   }
+
+   {
+      jpeg_pipe p;
+      p.z = z;
+      p.L = &L;
+      p.slots = threads*2 > 4 ? threads*2 : 4;
+      if (p.slots > L.rows) p.slots = L.rows;
+      p.slot_size = L.per_row * L.nblk * 64;
+      ring = (uint8 *) stbi_malloc((size_t) p.slots * p.slot_size * sizeof(short) + 2*p.slots*sizeof(int) + 15);
+      if (!ring) return -1;
+      p.slot_mcus = (int *) ring;
+      p.slot_done = p.slot_mcus + p.slots;
+      p.coef = (short *) (((size_t) (p.slot_done + p.slots) + 15) & ~(size_t) 15);
+      for (k=0; k < p.slots; ++k) p.slot_done[k] = -1;
+      p.decoded = p.claimed = 0;
+      p.ok = 1;
+      p.finished = false;
+      pool->run(threads, jpeg_pipe_task, &p);
+      stbi_free(ring);
+      return p.ok;
+   }
+}
+#endif // STBI_THREADS
+
 static int parse_entropy_coded_data(jpeg *z)
 {
    reset(z);
+   #ifdef STBI_THREADS
+   {
+      int r = parse_entropy_coded_data_mt(z);
+      if (r >= 0) return r;
+   }
+   #endif
    if (z->scan_n == 1) {
       int i,j;
-      #ifdef STBI_SIMD
-      __declspec(align(16))
-      #endif
-      short data[64];
+      STBI_ALIGN16 short data[64];
       int n = z->order[0];
       // non-interleaved data, we just need to process one block at a time,
       // in trivial scanline order
@@ -1041,9 +2097,9 @@ static int parse_entropy_coded_data(jpeg *z)
          for (i=0; i < w; ++i) {
             if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
             #ifdef STBI_SIMD
-            stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
+            z->idct(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
             #else
-            idct_block(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+            z->idct(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
             #endif
             // every data block is an MCU, so countdown the restart interval
             if (--z->todo <= 0) {
@@ -1057,7 +2113,7 @@ static int parse_entropy_coded_data(jpeg *z)
       }
    } else { // interleaved!
       int i,j,k,x,y;
-      short data[64];
+      STBI_ALIGN16 short data[64];
       for (j=0; j < z->img_mcu_y; ++j) {
          for (i=0; i < z->img_mcu_x; ++i) {
             // scan an interleaved mcu... process scan_n components in order
@@ -1071,9 +2127,9 @@ static int parse_entropy_coded_data(jpeg *z)
                      int y2 = (j*z->img_comp[n].v + y)*8;
                      if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
                      #ifdef STBI_SIMD
-                     stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
+                     z->idct(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
                      #else
-                     idct_block(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+                     z->idct(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
                      #endif
                   }
                }
@@ -1200,7 +2256,6 @@ static int process_frame_header(jpeg *z, int scan)
    s->img_n = c;
    for (i=0; i < c; ++i) {
       z->img_comp[i].data = NULL;
-      z->img_comp[i].linebuf = NULL;
    }
 
    if (Lf != 8+3*s->img_n) return e("bad SOF len","Corrupt JPEG");
@@ -1216,7 +2271,7 @@ static int process_frame_header(jpeg *z, int scan)
       z->img_comp[i].tq = get8(s);  if (z->img_comp[i].tq > 3) return e("bad TQ","Corrupt JPEG");
    }
 
-   if (scan != SCAN_load) return 1;
+   if (scan != SCAN_load && scan != SCAN_stream) return 1;
 
    if ((1 << 30) / s->img_x / s->img_n < s->img_y) return e("too large", "Image too large to decode");
 
@@ -1243,17 +2298,18 @@ static int process_frame_header(jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
       z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
+      z->img_comp[i].data_y = 0;
+      if (scan == SCAN_stream) continue;   // the stream allocates strips
+      z->img_comp[i].raw_data = stbi_malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
-            free(z->img_comp[i].raw_data);
+            stbi_free(z->img_comp[i].raw_data);
             z->img_comp[i].data = NULL;
          }
          return e("outofmem", "Out of memory");
       }
       // align blocks for installable-idct using mmx/sse
       z->img_comp[i].data = (uint8*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
-      z->img_comp[i].linebuf = NULL;
    }
 
    return 1;
@@ -1439,7 +2495,7 @@ static void YCbCr_to_RGB_row(uint8 *out, const uint8 *y, const uint8 *pcb, const
 }
 
 #ifdef STBI_SIMD
-static stbi_YCbCr_to_RGB_run stbi_YCbCr_installed = YCbCr_to_RGB_row;
+static STBI_SHARED(stbi_YCbCr_to_RGB_run) stbi_YCbCr_installed(NULL);   // NULL: pick by stbi_simd_level()
 
 void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func)
 {
@@ -1447,6 +2503,368 @@ void stbi_install_YCbCr_to_RGB(stbi_YCbCr_to_RGB_run func)
 }
 #endif
 
+#ifdef STBI_X86
+// Vector versions of the resamplers and of YCbCr_to_RGB_row. They do the
+// same integer math in 16/32-bit lanes and leave the edges and leftover
+// pixels to the scalar loops, so the output is identical.
+
+#define SSE2_LOAD8(p)   _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (p)), _mm_setzero_si128())
+#define SSE2_TIMES3(x)  _mm_add_epi16(_mm_add_epi16(x, x), x)
+
+static uint8 *resample_row_v_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+   int i;
+   STBI_NOTUSED(hs);
+   for (i=0; i+16 <= w; i += 16) {
+      __m128i n = _mm_loadu_si128((__m128i *) (in_near+i));
+      __m128i f = _mm_loadu_si128((__m128i *) (in_far+i));
+      __m128i lo = _mm_unpacklo_epi8(n, zero), hi = _mm_unpackhi_epi8(n, zero);
+      lo = _mm_add_epi16(_mm_add_epi16(SSE2_TIMES3(lo), _mm_unpacklo_epi8(f, zero)), two);
+      hi = _mm_add_epi16(_mm_add_epi16(SSE2_TIMES3(hi), _mm_unpackhi_epi8(f, zero)), two);
+      _mm_storeu_si128((__m128i *) (out+i), _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2)));
+   }
+   for (; i < w; ++i)
+      out[i] = div4(3*in_near[i] + in_far[i] + 2);
+   return out;
+}
+
+// out[2i] and out[2i+1] go in the low and high byte of one 16-bit lane
+static uint8 *resample_row_h_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   __m128i two = _mm_set1_epi16(2);
+   int i;
+   uint8 *input = in_near;
+
+   if (w == 1) return resample_row_h_2(out, in_near, in_far, w, hs);
+
+   out[0] = input[0];
+   out[1] = div4(input[0]*3 + input[1] + 2);
+   for (i=1; i+8 < w; i += 8) {
+      __m128i n = _mm_add_epi16(SSE2_TIMES3(SSE2_LOAD8(input+i)), two);
+      __m128i e = _mm_srli_epi16(_mm_add_epi16(n, SSE2_LOAD8(input+i-1)), 2);
+      __m128i o = _mm_srli_epi16(_mm_add_epi16(n, SSE2_LOAD8(input+i+1)), 2);
+      _mm_storeu_si128((__m128i *) (out+i*2), _mm_or_si128(e, _mm_slli_epi16(o, 8)));
+   }
+   for (; i < w-1; ++i) {
+      int n = 3*input[i]+2;
+      out[i*2+0] = div4(n+input[i-1]);
+      out[i*2+1] = div4(n+input[i+1]);
+   }
+   out[i*2+0] = div4(input[w-2]*3 + input[w-1] + 2);
+   out[i*2+1] = input[w-1];
+
+   STBI_NOTUSED(in_far);
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+
+static uint8 *resample_row_hv_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   __m128i eight = _mm_set1_epi16(8);
+   int i,t0,t1;
+
+   if (w == 1) return resample_row_hv_2(out, in_near, in_far, w, hs);
+
+   t1 = 3*in_near[0] + in_far[0];
+   out[0] = div4(t1+2);
+   // t0/t1 for 8 columns at once; they give out[2i-1] and out[2i]
+   for (i=1; i+8 <= w; i += 8) {
+      __m128i p = _mm_add_epi16(SSE2_TIMES3(SSE2_LOAD8(in_near+i-1)), SSE2_LOAD8(in_far+i-1));
+      __m128i c = _mm_add_epi16(SSE2_TIMES3(SSE2_LOAD8(in_near+i)),   SSE2_LOAD8(in_far+i));
+      __m128i o = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(SSE2_TIMES3(p), c), eight), 4);
+      __m128i e = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(SSE2_TIMES3(c), p), eight), 4);
+      _mm_storeu_si128((__m128i *) (out+i*2-1), _mm_or_si128(o, _mm_slli_epi16(e, 8)));
+   }
+   t1 = 3*in_near[i-1] + in_far[i-1];
+   for (; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+
+   return out;
+}
+
+// YCbCr_to_RGB_row, rewritten so the multiplies fit madd_epi16:
+//    r = y + cr    + ((cr*(1.402*65536 - 65536) + 32768) >> 16)
+//    g = y - cr    + ((cr*(65536 - 0.71414*65536) - cb*0.34414*65536 + 32768) >> 16)
+//    b = y + 2*cb  + ((cb*(1.772*65536 - 131072) + 32768) >> 16)
+// (the whole multiples of 65536 come out of the shift unchanged)
+#define YCC_CR_R  ((short) (float2fixed(1.40200f) - 65536))
+#define YCC_CR_G  ((short) (65536 - float2fixed(0.71414f)))
+#define YCC_CB_G  ((short) -float2fixed(0.34414f))
+#define YCC_CB_B  ((short) (float2fixed(1.77200f) - 131072))
+// madd operand: (cr, cb) coefficients in one 32-bit lane
+#define YCC_PAIR(kcr,kcb)  ((int) ((uint16) (kcr) | ((uint32) (uint16) (kcb) << 16)))
+
+// 8 pixels in 16-bit lanes; cb and cr already have 128 subtracted
+static stbi_inline void YCbCr_8_sse2(__m128i y, __m128i cb, __m128i cr, __m128i *r, __m128i *g, __m128i *b)
+{
+   const __m128i kr = _mm_set1_epi32(YCC_PAIR(YCC_CR_R, 0));
+   const __m128i kg = _mm_set1_epi32(YCC_PAIR(YCC_CR_G, YCC_CB_G));
+   const __m128i kb = _mm_set1_epi32(YCC_PAIR(0, YCC_CB_B));
+   const __m128i half = _mm_set1_epi32(32768);
+   __m128i lo = _mm_unpacklo_epi16(cr, cb), hi = _mm_unpackhi_epi16(cr, cb);
+   #define YCC_SSE2(k)  _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k), half), 16), \
+                                        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k), half), 16))
+   *r = _mm_add_epi16(_mm_add_epi16(y, cr), YCC_SSE2(kr));
+   *g = _mm_add_epi16(_mm_sub_epi16(y, cr), YCC_SSE2(kg));
+   *b = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(cb, cb)), YCC_SSE2(kb));
+   #undef YCC_SSE2
+}
+
+// 4 RGBA pixels to 3-byte steps; each 4-byte store puts 255 in the next
+// pixel's R, which the next store overwrites, just as the scalar loop does
+static stbi_inline void store_rgb4_sse2(uint8 *out, __m128i px)
+{
+   int k;
+   for (k=0; k < 4; ++k) {
+      uint32 v = (uint32) _mm_cvtsi128_si32(px);
+      memcpy(out + k*3, &v, 4);
+      px = _mm_srli_si128(px, 4);
+   }
+}
+
+static void YCbCr_to_RGB_row_sse2(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   __m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi16(128), alpha = _mm_set1_epi8(-1);
+   int i;
+   for (i=0; i+16 <= count; i += 16) {
+      __m128i yv = _mm_loadu_si128((__m128i *) (y+i));
+      __m128i cb = _mm_loadu_si128((__m128i *) (pcb+i));
+      __m128i cr = _mm_loadu_si128((__m128i *) (pcr+i));
+      __m128i r0,g0,b0,r1,g1,b1,R,G,B,rg,ba,px[4];
+      YCbCr_8_sse2(_mm_unpacklo_epi8(yv, zero), _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), bias),
+                   _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), bias), &r0, &g0, &b0);
+      YCbCr_8_sse2(_mm_unpackhi_epi8(yv, zero), _mm_sub_epi16(_mm_unpackhi_epi8(cb, zero), bias),
+                   _mm_sub_epi16(_mm_unpackhi_epi8(cr, zero), bias), &r1, &g1, &b1);
+      R = _mm_packus_epi16(r0, r1);
+      G = _mm_packus_epi16(g0, g1);
+      B = _mm_packus_epi16(b0, b1);
+      rg = _mm_unpacklo_epi8(R, G);
+      ba = _mm_unpacklo_epi8(B, alpha);
+      px[0] = _mm_unpacklo_epi16(rg, ba);
+      px[1] = _mm_unpackhi_epi16(rg, ba);
+      rg = _mm_unpackhi_epi8(R, G);
+      ba = _mm_unpackhi_epi8(B, alpha);
+      px[2] = _mm_unpacklo_epi16(rg, ba);
+      px[3] = _mm_unpackhi_epi16(rg, ba);
+      if (step == 4) {
+         _mm_storeu_si128((__m128i *) (out+ 0), px[0]);
+         _mm_storeu_si128((__m128i *) (out+16), px[1]);
+         _mm_storeu_si128((__m128i *) (out+32), px[2]);
+         _mm_storeu_si128((__m128i *) (out+48), px[3]);
+      } else {
+         store_rgb4_sse2(out+ 0, px[0]);
+         store_rgb4_sse2(out+12, px[1]);
+         store_rgb4_sse2(out+24, px[2]);
+         store_rgb4_sse2(out+36, px[3]);
+      }
+      out += 16*step;
+   }
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+
+#define AVX2_LOAD16(p)   _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (p)))
+#define AVX2_TIMES3(x)   _mm256_add_epi16(_mm256_add_epi16(x, x), x)
+
+STBI_TARGET("avx2") static uint8 *resample_row_v_2_avx2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   __m256i zero = _mm256_setzero_si256(), two = _mm256_set1_epi16(2);
+   int i;
+   STBI_NOTUSED(hs);
+   // unpack/pack work inside each 128-bit lane, so the bytes end up in order
+   for (i=0; i+32 <= w; i += 32) {
+      __m256i n = _mm256_loadu_si256((__m256i *) (in_near+i));
+      __m256i f = _mm256_loadu_si256((__m256i *) (in_far+i));
+      __m256i lo = _mm256_unpacklo_epi8(n, zero), hi = _mm256_unpackhi_epi8(n, zero);
+      lo = _mm256_add_epi16(_mm256_add_epi16(AVX2_TIMES3(lo), _mm256_unpacklo_epi8(f, zero)), two);
+      hi = _mm256_add_epi16(_mm256_add_epi16(AVX2_TIMES3(hi), _mm256_unpackhi_epi8(f, zero)), two);
+      _mm256_storeu_si256((__m256i *) (out+i), _mm256_packus_epi16(_mm256_srli_epi16(lo, 2), _mm256_srli_epi16(hi, 2)));
+   }
+   for (; i < w; ++i)
+      out[i] = div4(3*in_near[i] + in_far[i] + 2);
+   return out;
+}
+
+STBI_TARGET("avx2") static uint8 *resample_row_h_2_avx2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   __m256i two = _mm256_set1_epi16(2);
+   int i;
+   uint8 *input = in_near;
+
+   if (w == 1) return resample_row_h_2(out, in_near, in_far, w, hs);
+
+   out[0] = input[0];
+   out[1] = div4(input[0]*3 + input[1] + 2);
+   for (i=1; i+16 < w; i += 16) {
+      __m256i n = _mm256_add_epi16(AVX2_TIMES3(AVX2_LOAD16(input+i)), two);
+      __m256i e = _mm256_srli_epi16(_mm256_add_epi16(n, AVX2_LOAD16(input+i-1)), 2);
+      __m256i o = _mm256_srli_epi16(_mm256_add_epi16(n, AVX2_LOAD16(input+i+1)), 2);
+      _mm256_storeu_si256((__m256i *) (out+i*2), _mm256_or_si256(e, _mm256_slli_epi16(o, 8)));
+   }
+   for (; i < w-1; ++i) {
+      int n = 3*input[i]+2;
+      out[i*2+0] = div4(n+input[i-1]);
+      out[i*2+1] = div4(n+input[i+1]);
+   }
+   out[i*2+0] = div4(input[w-2]*3 + input[w-1] + 2);
+   out[i*2+1] = input[w-1];
+
+   STBI_NOTUSED(in_far);
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+
+STBI_TARGET("avx2") static uint8 *resample_row_hv_2_avx2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   __m256i eight = _mm256_set1_epi16(8);
+   int i,t0,t1;
+
+   if (w == 1) return resample_row_hv_2(out, in_near, in_far, w, hs);
+
+   t1 = 3*in_near[0] + in_far[0];
+   out[0] = div4(t1+2);
+   for (i=1; i+16 <= w; i += 16) {
+      __m256i p = _mm256_add_epi16(AVX2_TIMES3(AVX2_LOAD16(in_near+i-1)), AVX2_LOAD16(in_far+i-1));
+      __m256i c = _mm256_add_epi16(AVX2_TIMES3(AVX2_LOAD16(in_near+i)),   AVX2_LOAD16(in_far+i));
+      __m256i o = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(AVX2_TIMES3(p), c), eight), 4);
+      __m256i e = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(AVX2_TIMES3(c), p), eight), 4);
+      _mm256_storeu_si256((__m256i *) (out+i*2-1), _mm256_or_si256(o, _mm256_slli_epi16(e, 8)));
+   }
+   t1 = 3*in_near[i-1] + in_far[i-1];
+   for (; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+
+   return out;
+}
+
+STBI_TARGET("avx2") static stbi_inline void YCbCr_16_avx2(__m256i y, __m256i cb, __m256i cr, __m256i *r, __m256i *g, __m256i *b)
+{
+   const __m256i kr = _mm256_set1_epi32(YCC_PAIR(YCC_CR_R, 0));
+   const __m256i kg = _mm256_set1_epi32(YCC_PAIR(YCC_CR_G, YCC_CB_G));
+   const __m256i kb = _mm256_set1_epi32(YCC_PAIR(0, YCC_CB_B));
+   const __m256i half = _mm256_set1_epi32(32768);
+   __m256i lo = _mm256_unpacklo_epi16(cr, cb), hi = _mm256_unpackhi_epi16(cr, cb);
+   #define YCC_AVX2(k)  _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(lo, k), half), 16), \
+                                           _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(hi, k), half), 16))
+   *r = _mm256_add_epi16(_mm256_add_epi16(y, cr), YCC_AVX2(kr));
+   *g = _mm256_add_epi16(_mm256_sub_epi16(y, cr), YCC_AVX2(kg));
+   *b = _mm256_add_epi16(_mm256_add_epi16(y, _mm256_add_epi16(cb, cb)), YCC_AVX2(kb));
+   #undef YCC_AVX2
+}
+
+// 32 pixels per step. Each 128-bit lane converts its own 16 pixels, so
+// the RGBA groups come out as [0-3|16-19], [4-7|20-23], ... and are put
+// back in order when stored.
+STBI_TARGET("avx2") static void YCbCr_to_RGB_row_avx2(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   const __m256i zero = _mm256_setzero_si256(), bias = _mm256_set1_epi16(128), alpha = _mm256_set1_epi8(-1);
+   const __m256i drop_alpha = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                               0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+   int i,k;
+   for (i=0; i+32 <= count; i += 32) {
+      __m256i yv = _mm256_loadu_si256((__m256i *) (y+i));
+      __m256i cb = _mm256_loadu_si256((__m256i *) (pcb+i));
+      __m256i cr = _mm256_loadu_si256((__m256i *) (pcr+i));
+      __m256i r0,g0,b0,r1,g1,b1,R,G,B,rg,ba,q[4];
+      YCbCr_16_avx2(_mm256_unpacklo_epi8(yv, zero), _mm256_sub_epi16(_mm256_unpacklo_epi8(cb, zero), bias),
+                    _mm256_sub_epi16(_mm256_unpacklo_epi8(cr, zero), bias), &r0, &g0, &b0);
+      YCbCr_16_avx2(_mm256_unpackhi_epi8(yv, zero), _mm256_sub_epi16(_mm256_unpackhi_epi8(cb, zero), bias),
+                    _mm256_sub_epi16(_mm256_unpackhi_epi8(cr, zero), bias), &r1, &g1, &b1);
+      R = _mm256_packus_epi16(r0, r1);
+      G = _mm256_packus_epi16(g0, g1);
+      B = _mm256_packus_epi16(b0, b1);
+      rg = _mm256_unpacklo_epi8(R, G);
+      ba = _mm256_unpacklo_epi8(B, alpha);
+      q[0] = _mm256_unpacklo_epi16(rg, ba);
+      q[1] = _mm256_unpackhi_epi16(rg, ba);
+      rg = _mm256_unpackhi_epi8(R, G);
+      ba = _mm256_unpackhi_epi8(B, alpha);
+      q[2] = _mm256_unpacklo_epi16(rg, ba);
+      q[3] = _mm256_unpackhi_epi16(rg, ba);
+      if (step == 4) {
+         _mm256_storeu_si256((__m256i *) (out+ 0), _mm256_permute2x128_si256(q[0], q[1], 0x20));
+         _mm256_storeu_si256((__m256i *) (out+32), _mm256_permute2x128_si256(q[2], q[3], 0x20));
+         _mm256_storeu_si256((__m256i *) (out+64), _mm256_permute2x128_si256(q[0], q[1], 0x31));
+         _mm256_storeu_si256((__m256i *) (out+96), _mm256_permute2x128_si256(q[2], q[3], 0x31));
+      } else {
+         // 12 bytes per group of 4 pixels: 8 + 4, never past the last pixel
+         for (k=0; k < 4; ++k) {
+            __m256i p = _mm256_shuffle_epi8(q[k], drop_alpha);
+            __m128i lo = _mm256_castsi256_si128(p), hi = _mm256_extracti128_si256(p, 1);
+            uint32 t;
+            _mm_storel_epi64((__m128i *) (out + k*12), lo);
+            t = (uint32) _mm_cvtsi128_si32(_mm_srli_si128(lo, 8));
+            memcpy(out + k*12 + 8, &t, 4);
+            _mm_storel_epi64((__m128i *) (out + 48 + k*12), hi);
+            t = (uint32) _mm_cvtsi128_si32(_mm_srli_si128(hi, 8));
+            memcpy(out + 48 + k*12 + 8, &t, 4);
+         }
+      }
+      out += 32*step;
+   }
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif // STBI_X86
+
+// pick the kernels for one decode: the best ones stbi_simd_level() allows,
+// unless the user installed their own (STBI_SIMD)
+static void jpeg_select_kernels(jpeg *z)
+{
+   z->simd = stbi_simd_level();
+   z->idct = idct_block;
+   z->YCbCr_to_RGB = YCbCr_to_RGB_row;
+   #ifdef STBI_X86
+   if (z->simd >= STBI_SIMD_AVX2) {
+      z->idct = idct_block_avx2;
+      z->YCbCr_to_RGB = YCbCr_to_RGB_row_avx2;
+   } else if (z->simd >= STBI_SIMD_SSE2) {
+      z->idct = idct_block_sse2;
+      z->YCbCr_to_RGB = YCbCr_to_RGB_row_sse2;
+   }
+   #endif
+   #ifdef STBI_SIMD
+   {
+      stbi_idct_8x8 idct = stbi_idct_installed;
+      stbi_YCbCr_to_RGB_run YCbCr = stbi_YCbCr_installed;
+      if (idct) z->idct = idct;
+      if (YCbCr) z->YCbCr_to_RGB = YCbCr;
+   }
+   #endif
+}
+
+static resample_row_func select_resample(jpeg *z, int hs, int vs)
+{
+   if (hs == 1 && vs == 1) return resample_row_1;
+   #ifdef STBI_X86
+   if (z->simd >= STBI_SIMD_AVX2) {
+      if (hs == 1 && vs == 2) return resample_row_v_2_avx2;
+      if (hs == 2 && vs == 1) return resample_row_h_2_avx2;
+      if (hs == 2 && vs == 2) return resample_row_hv_2_avx2;
+   } else if (z->simd >= STBI_SIMD_SSE2) {
+      if (hs == 1 && vs == 2) return resample_row_v_2_sse2;
+      if (hs == 2 && vs == 1) return resample_row_h_2_sse2;
+      if (hs == 2 && vs == 2) return resample_row_hv_2_sse2;
+   }
+   #else
+   STBI_NOTUSED(z);
+   #endif
+   if (hs == 1 && vs == 2) return resample_row_v_2;
+   if (hs == 2 && vs == 1) return resample_row_h_2;
+   if (hs == 2 && vs == 2) return resample_row_hv_2;
+   return resample_row_generic;
+}
 
 // clean up the temporary component buffers
 static void cleanup_jpeg(jpeg *j)
@@ -1454,14 +2872,14 @@ static void cleanup_jpeg(jpeg *j)
    int i;
    for (i=0; i < j->s->img_n; ++i) {
       if (j->img_comp[i].data) {
-         free(j->img_comp[i].raw_data);
+         stbi_free(j->img_comp[i].raw_data);
          j->img_comp[i].data = NULL;
       }
-      if (j->img_comp[i].linebuf) {
-         free(j->img_comp[i].linebuf);
-         j->img_comp[i].linebuf = NULL;
-      }
    }
+   stbi_free(j->linebuf);
+   j->linebuf = NULL;
+   stbi_free(j->stream);
+   j->stream = NULL;
 }
 
 typedef struct
@@ -1474,12 +2892,115 @@ typedef struct
    int ypos;    // which pre-expansion row we're on
 } stbi_resample;
 
+// resample and color-convert output rows [j0,j1) into output, which starts
+// at row j0. linebuf has room for decode_n lines of img_x+3 bytes; the last
+// row is converted into spill and copied out, so the converters' stores
+// past the end of a row can't touch row j1 (which another band may already
+// have done) or run off the end of the output, which may be the caller's
+// buffer
+static void jpeg_convert_rows(jpeg *z, uint8 *output, int n, int decode_n, int j0, int j1, uint8 *linebuf, uint8 *spill)
+{
+   int j,k;
+   uint i;
+   uint8 *coutput[4];
+   stbi_resample res_comp[4];
+
+   for (k=0; k < decode_n; ++k) {
+      stbi_resample *r = &res_comp[k];
+      int t, wraps, last = z->img_comp[k].y - 1;
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+
+      // where the row-by-row stepping below is after j0 rows
+      t          = (r->vs >> 1) + j0;
+      wraps      = t / r->vs;
+      r->ystep   = t % r->vs;
+      r->ypos    = wraps;
+      r->line1   = z->img_comp[k].data + ((wraps < last ? wraps : last) - z->img_comp[k].data_y) * z->img_comp[k].w2;
+      r->line0   = wraps && wraps <= last ? r->line1 - z->img_comp[k].w2 : r->line1;
+
+      r->resample = select_resample(z, r->hs, r->vs);
+   }
+
+   for (j=j0; j < j1; ++j) {
+      uint8 *row = output + n * z->s->img_x * (uint) (j - j0);
+      uint8 *out = j == j1-1 ? spill : row;
+      uint8 *dest = out;
+      for (k=0; k < decode_n; ++k) {
+         stbi_resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf + k * (z->s->img_x + 3),
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
+         }
+      }
+      if (n >= 3) {
+         uint8 *y = coutput[0];
+         if (z->s->img_n == 3) {
+            z->YCbCr_to_RGB(out, y, coutput[1], coutput[2], z->s->img_x, n);
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         uint8 *y = coutput[0];
+         if (n == 1)
+            for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+         else
+            for (i=0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+      }
+      if (dest != row)
+         memcpy(row, dest, n * z->s->img_x);
+   }
+}
+
+#ifdef STBI_THREADS
+// images at least this big are color-converted in parallel bands
+#define JPEG_MT_MIN_PIXELS  (1 << 18)
+
+typedef struct
+{
+   jpeg *z;
+   uint8 *output;
+   int n, decode_n, bands;
+   size_t band_size;
+} jpeg_convert_job;
+
+static void jpeg_convert_task(void *ctx, int t)
+{
+   jpeg_convert_job *job = (jpeg_convert_job *) ctx;
+   uint h = job->z->s->img_y;
+   uint8 *linebuf = job->z->linebuf + job->band_size * t;
+   int j0 = (int) ((size_t) h * t / job->bands);
+   int j1 = (int) ((size_t) h * (t+1) / job->bands);
+   jpeg_convert_rows(job->z, job->output + (size_t) job->n * job->z->s->img_x * j0, job->n, job->decode_n, j0, j1, linebuf,
+                     linebuf + job->decode_n * (job->z->s->img_x + 3));
+}
+#endif
+
 static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
-   int n, decode_n;
+   int n, decode_n, bands = 1;
+   size_t band_size;
+   uint8 *output;
+   #ifdef STBI_THREADS
+   stbi_pool *pool = NULL;
+   #endif
    // validate req_comp
    if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
    z->s->img_n = 0;
+   z->linebuf = z->stream = NULL;
+   jpeg_select_kernels(z);
 
    // load a jpeg image from whichever source
    if (!decode_jpeg_image(z)) { cleanup_jpeg(z); return NULL; }
@@ -1492,86 +3013,46 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
    else
       decode_n = z->s->img_n;
 
-   // resample and color-convert
-   {
-      int k;
-      uint i,j;
-      uint8 *output;
-      uint8 *coutput[4];
-
-      stbi_resample res_comp[4];
-
-      for (k=0; k < decode_n; ++k) {
-         stbi_resample *r = &res_comp[k];
+   #ifdef STBI_THREADS
+   if ((size_t) z->s->img_x * z->s->img_y >= JPEG_MT_MIN_PIXELS) {
+      pool = get_pool();
+      bands = pool->size() > 1 ? 4 * pool->size() : 1;
+      if (bands > (int) z->s->img_y / 16) bands = z->s->img_y / 16;
+      if (bands < 2) bands = 1;
+   }
+   #endif
 
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (uint8 *) malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
-         else                               r->resample = resample_row_generic;
-      }
+   // line buffers big enough for upsampling off the edges with upsample
+   // factor of 4, plus a spare output row, for each band
+   band_size = decode_n * (z->s->img_x + 3) + n * z->s->img_x + 1;
+   z->linebuf = (uint8 *) stbi_malloc(band_size * bands);
+   if (!z->linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+
+   // can't error after this so, this is safe
+   output = (uint8 *) stbi_malloc_out(n * z->s->img_x * z->s->img_y);
+   if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+
+   // now go ahead and resample
+   #ifdef STBI_THREADS
+   if (bands > 1) {
+      jpeg_convert_job job;
+      job.z = z;
+      job.output = output;
+      job.n = n;
+      job.decode_n = decode_n;
+      job.bands = bands;
+      job.band_size = band_size;
+      pool->run(bands, jpeg_convert_task, &job);
+   } else
+   #endif
+      jpeg_convert_rows(z, output, n, decode_n, 0, z->s->img_y, z->linebuf,
+                        z->linebuf + decode_n * (z->s->img_x + 3));
 
-      // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s->img_x * z->s->img_y + 1);
-      if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         uint8 *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi_resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
-         }
-         if (n >= 3) {
-            uint8 *y = coutput[0];
-            if (z->s->img_n == 3) {
-               #ifdef STBI_SIMD
-               stbi_YCbCr_installed(out, y, coutput[1], coutput[2], z->s.img_x, n);
-               #else
-               YCbCr_to_RGB_row(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               #endif
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            uint8 *y = coutput[0];
-            if (n == 1)
-               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-            else
-               for (i=0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
-         }
-      }
-      cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp  = z->s->img_n; // report original components, not output
-      return output;
-   }
+   cleanup_jpeg(z);
+   *out_x = z->s->img_x;
+   *out_y = z->s->img_y;
+   if (comp) *comp  = z->s->img_n; // report original components, not output
+   return output;
 }
 
 static unsigned char *stbi_jpeg_load(stbi *s, int *x, int *y, int *comp, int req_comp)
@@ -1621,6 +3102,20 @@ static int stbi_jpeg_info(stbi *s, int *x, int *y, int *comp)
 #define ZFAST_BITS  9 // accelerate all cases in default tables
 #define ZFAST_MASK  ((1 << ZFAST_BITS) - 1)
 
+// The literal/length and distance codes also get bigger lookup tables
+// whose entries are fully decoded: bits 0..7 hold how many bits the entry
+// consumes (0: code too long for the table), bits 8..15 the kind, and
+// bits 16..31 the payload (literal, two literals, or length/distance base).
+// Lengths and distances keep their extra bit count in the kind.
+#define ZLIT_BITS   11
+#define ZDIST_BITS  9
+
+#define ZK_LIT      0   // one literal
+#define ZK_LIT2     1   // two literals, the first in the low byte
+#define ZK_EOB      2   // end of block
+#define ZK_BAD      3   // symbols 286/287
+#define ZK_LEN      16  // length, ZK_LEN+extra bits
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
@@ -1705,14 +3200,18 @@ typedef struct
 {
    uint8 *zbuffer, *zbuffer_end;
    int num_bits;
-   uint32 code_buffer;
+   int overread;   // zero bytes made up past the end of the input
+   uint64 code_buffer;
 
    char *zout;
    char *zout_start;
    char *zout_end;
    int   z_expandable;
+   int   more_input;   // streaming: the input isn't all there yet
 
    zhuffman z_length, z_distance;
+   uint32 z_litlen_fast[1 << ZLIT_BITS];
+   uint32 z_dist_fast[1 << ZDIST_BITS];
 } zbuf;
 
 stbi_inline static int zget8(zbuf *z)
@@ -1721,20 +3220,35 @@ stbi_inline static int zget8(zbuf *z)
    return *z->zbuffer++;
 }
 
+// tops the bit buffer up to at least 56 bits
 static void fill_bits(zbuf *z)
 {
+   #ifdef STBI_LITTLE_ENDIAN
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      // or in 8 bytes; the ones that don't fit are or'ed in again, at the
+      // same place, by the next refill
+      uint64 v;
+      memcpy(&v, z->zbuffer, 8);
+      z->code_buffer |= v << z->num_bits;
+      z->zbuffer += (63 - z->num_bits) >> 3;
+      z->num_bits |= 56;
+      return;
+   }
+   #endif
    do {
-      assert(z->code_buffer < (1U << z->num_bits));
-      z->code_buffer |= zget8(z) << z->num_bits;
+      if (z->zbuffer < z->zbuffer_end)
+         z->code_buffer |= (uint64) *z->zbuffer++ << z->num_bits;
+      else
+         ++z->overread;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   } while (z->num_bits <= 56);
 }
 
 stbi_inline static unsigned int zreceive(zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) z->code_buffer & ((1 << n) - 1);
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;   
@@ -1754,7 +3268,7 @@ stbi_inline static int zhuffman_decode(zbuf *a, zhuffman *z)
 
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = bit_reverse(a->code_buffer, 16);
+   k = bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -1776,7 +3290,7 @@ static int expand(zbuf *z, int n)  // need to make room for n bytes
    limit = (int) (z->zout_end - z->zout_start);
    while (cur + n > limit)
       limit *= 2;
-   q = (char *) realloc(z->zout_start, limit);
+   q = (char *) stbi_realloc(z->zout_start, limit);
    if (q == NULL) return e("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -1798,34 +3312,150 @@ static int dist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
 static int dist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
-static int parse_huffman_block(zbuf *a)
+// builds the fused table for the codes zbuild_huffman just accepted
+static void zbuild_fast(uint32 *table, int bits, uint8 *sizelist, int num, int is_dist)
+{
+   int i,k,s,code, next_code[16], sizes[16];
+   memset(sizes, 0, sizeof(sizes));
+   memset(table, 0, sizeof(uint32) << bits);
+   for (i=0; i < num; ++i)
+      ++sizes[sizelist[i]];
+   code = 0;
+   for (i=1; i < 16; ++i) {
+      next_code[i] = code;
+      code = (code + sizes[i]) << 1;
+   }
+   for (i=0; i < num; ++i) {
+      uint32 entry;
+      s = sizelist[i];
+      if (!s) continue;
+      code = next_code[s]++;
+      if (s > bits) continue;
+      if (is_dist) {
+         if (i >= 30) continue;   // left to the slow path, which rejects it
+         entry = s | dist_extra[i] << 8 | dist_base[i] << 16;
+      } else if (i < 256)
+         entry = s | ZK_LIT << 8 | i << 16;
+      else if (i == 256)
+         entry = s | ZK_EOB << 8;
+      else if (i < 286)
+         entry = s | (ZK_LEN + length_extra[i-257]) << 8 | length_base[i-257] << 16;
+      else
+         entry = s | ZK_BAD << 8;
+      for (k = bit_reverse(code, s); k < (1 << bits); k += 1 << s)
+         table[k] = entry;
+   }
+   if (is_dist) return;
+   // a literal whose code leaves room for a whole second literal code
+   // gets both; going down, table[k >> s] (<= k) is still a single one
+   for (k=(1 << bits)-1; k >= 0; --k) {
+      uint32 first = table[k], second;
+      s = first & 255;
+      if (!s || (first >> 8 & 255) != ZK_LIT) continue;
+      second = table[k >> s];
+      if ((second & 255) && (second >> 8 & 255) == ZK_LIT && s + (int) (second & 255) <= bits)
+         table[k] = (s + (second & 255)) | ZK_LIT2 << 8 | (first >> 16) << 16 | (second >> 16) << 24;
+   }
+}
+
+// with stream set (a constant, so each version compiles to its own loop),
+// returns 2 before a symbol that might not fit in the fixed output buffer
+// or might need input that hasn't arrived yet; the caller makes room or
+// waits and calls again, as no state is kept outside the zbuf
+stbi_force_inline static int parse_huffman_impl(zbuf *a, int stream)
 {
    for(;;) {
-      int z = zhuffman_decode(a, &a->z_length);
-      if (z < 256) {
-         if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
-         if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
-         *a->zout++ = (char) z;
+      uint32 entry;
+      uint8 *p, *q;
+      int z,len,dist,kind;
+      if (stream)
+         if (a->zout_end - a->zout < 258 || (a->more_input && a->zbuffer_end - a->zbuffer < 8))
+            return 2;
+      // longest case: 15 bit length code + 5 extra + 15 bit distance + 13
+      if (a->num_bits < 48) {
+         fill_bits(a);
+         // the bit buffer holds 8 bytes, so more made-up ones than that
+         // means we're decoding past the end of the input
+         if (a->overread > 8) return e("read past buffer","Corrupt PNG");
+      }
+      entry = a->z_litlen_fast[a->code_buffer & ((1 << ZLIT_BITS) - 1)];
+      kind = entry >> 8 & 255;
+      if (entry & 255) {
+         if (kind <= ZK_LIT2) {
+            len = 1 + kind;
+            if (a->zout_end - a->zout < len) if (!expand(a, len)) return 0;
+            a->code_buffer >>= entry & 255;
+            a->num_bits -= entry & 255;
+            a->zout[0] = (char) (entry >> 16);
+            if (kind == ZK_LIT2) a->zout[1] = (char) (entry >> 24);
+            a->zout += len;
+            continue;
+         }
+         if (kind == ZK_EOB) {
+            a->code_buffer >>= entry & 255;
+            a->num_bits -= entry & 255;
+            return 1;
+         }
+         if (kind == ZK_BAD) return e("bad huffman code","Corrupt PNG");
+         a->code_buffer >>= entry & 255;
+         a->num_bits -= entry & 255;
+         len = (entry >> 16) + zreceive(a, kind - ZK_LEN);
       } else {
-         uint8 *p;
-         int len,dist;
+         // code longer than ZLIT_BITS
+         z = zhuffman_decode(a, &a->z_length);
+         if (z < 0 || z >= 286) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
+         if (z < 256) {
+            if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
+            *a->zout++ = (char) z;
+            continue;
+         }
          if (z == 256) return 1;
          z -= 257;
-         len = length_base[z];
-         if (length_extra[z]) len += zreceive(a, length_extra[z]);
+         len = length_base[z] + zreceive(a, length_extra[z]);
+      }
+
+      entry = a->z_dist_fast[a->code_buffer & ((1 << ZDIST_BITS) - 1)];
+      if (entry & 255) {
+         a->code_buffer >>= entry & 255;
+         a->num_bits -= entry & 255;
+         dist = (entry >> 16) + zreceive(a, entry >> 8 & 255);
+      } else {
          z = zhuffman_decode(a, &a->z_distance);
-         if (z < 0) return e("bad huffman code","Corrupt PNG");
-         dist = dist_base[z];
-         if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
-         if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
-         if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
-         p = (uint8 *) (a->zout - dist);
-         while (len--)
-            *a->zout++ = *p++;
+         if (z < 0 || z >= 30) return e("bad huffman code","Corrupt PNG");
+         dist = dist_base[z] + zreceive(a, dist_extra[z]);
       }
+      if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
+      if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
+      p = (uint8 *) (a->zout - dist);
+      q = (uint8 *) a->zout;
+      a->zout += len;
+      // copy whole words when they can't overlap what they read and there
+      // is room to run past the end of the match
+      if (dist >= 8 && a->zout_end - a->zout >= 8) {
+         do {
+            memcpy(q, p, 8);
+            q += 8;
+            p += 8;
+            len -= 8;
+         } while (len > 0);
+      } else if (dist == 1)
+         memset(q, *p, len);
+      else
+         while (len--)
+            *q++ = *p++;
    }
 }
 
+static int parse_huffman_block(zbuf *a)
+{
+   return parse_huffman_impl(a, 0);
+}
+
+static int parse_huffman_block_stream(zbuf *a)
+{
+   return parse_huffman_impl(a, 1);
+}
+
 static int compute_huffman_codes(zbuf *a)
 {
    static uint8 length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
@@ -1848,10 +3478,11 @@ static int compute_huffman_codes(zbuf *a)
    n = 0;
    while (n < hlit + hdist) {
       int c = zhuffman_decode(a, &z_codelength);
-      assert(c >= 0 && c < 19);
+      if (c < 0 || c >= 19) return e("bad codelengths", "Corrupt PNG");
       if (c < 16)
          lencodes[n++] = (uint8) c;
       else if (c == 16) {
+         if (n == 0) return e("bad codelengths", "Corrupt PNG");
          c = zreceive(a,2)+3;
          memset(lencodes+n, lencodes[n-1], c);
          n += c;
@@ -1869,29 +3500,37 @@ static int compute_huffman_codes(zbuf *a)
    if (n != hlit+hdist) return e("bad codelengths","Corrupt PNG");
    if (!zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   zbuild_fast(a->z_litlen_fast, ZLIT_BITS, lencodes, hlit, 0);
+   zbuild_fast(a->z_dist_fast, ZDIST_BITS, lencodes+hlit, hdist, 1);
    return 1;
 }
 
-static int parse_uncompressed_block(zbuf *a)
+// reads a stored block's header; returns its length, or -1
+static int stored_block_length(zbuf *a)
 {
    uint8 header[4];
    int len,nlen,k;
    if (a->num_bits & 7)
       zreceive(a, a->num_bits & 7); // discard
-   // drain the bit-packed data into header
-   k = 0;
-   while (a->num_bits > 0) {
-      header[k++] = (uint8) (a->code_buffer & 255); // wtf this warns?
-      a->code_buffer >>= 8;
-      a->num_bits -= 8;
-   }
-   assert(a->num_bits == 0);
+   // hand the whole bytes left in the bit buffer back to the input
+   if (a->overread > a->num_bits >> 3) return e("read past buffer","Corrupt PNG") - 1;
+   a->zbuffer -= (a->num_bits >> 3) - a->overread;
+   a->overread = 0;
+   a->num_bits = 0;
+   a->code_buffer = 0;
    // now fill header the normal way
-   while (k < 4)
-      header[k++] = (uint8) zget8(a);
+   for (k=0; k < 4; ++k)
+      header[k] = (uint8) zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
-   if (nlen != (len ^ 0xffff)) return e("zlib corrupt","Corrupt PNG");
+   if (nlen != (len ^ 0xffff)) return e("zlib corrupt","Corrupt PNG") - 1;
+   return len;
+}
+
+static int parse_uncompressed_block(zbuf *a)
+{
+   int len = stored_block_length(a);
+   if (len < 0) return 0;
    if (a->zbuffer + len > a->zbuffer_end) return e("read past buffer","Corrupt PNG");
    if (a->zout + len > a->zout_end)
       if (!expand(a, len)) return 0;
@@ -1914,10 +3553,14 @@ static int parse_zlib_header(zbuf *a)
    return 1;
 }
 
-// @TODO: should statically initialize these for optimal thread safety
-static uint8 default_length[288], default_distance[32];
+// the fixed-code tables are built once and copied into each zbuf that
+// needs them
+static zhuffman default_z_length, default_z_distance;
+static uint32 default_litlen_fast[1 << ZLIT_BITS], default_dist_fast[1 << ZDIST_BITS];
+
 static void init_defaults(void)
 {
+   uint8 default_length[288], default_distance[32];
    int i;   // use <= to match clearly with spec
    for (i=0; i <= 143; ++i)     default_length[i]   = 8;
    for (   ; i <= 255; ++i)     default_length[i]   = 9;
@@ -1925,6 +3568,27 @@ static void init_defaults(void)
    for (   ; i <= 287; ++i)     default_length[i]   = 8;
 
    for (i=0; i <=  31; ++i)     default_distance[i] = 5;
+
+   zbuild_huffman(&default_z_length  , default_length  , 288);
+   zbuild_huffman(&default_z_distance, default_distance,  32);
+   zbuild_fast(default_litlen_fast, ZLIT_BITS, default_length, 288, 0);
+   zbuild_fast(default_dist_fast, ZDIST_BITS, default_distance, 32, 1);
+}
+
+static void use_default_tables(zbuf *a)
+{
+   #ifdef STBI_CPP11
+   static std::once_flag once;
+   std::call_once(once, init_defaults);
+   #else
+   // without C++11 the first build isn't guarded
+   static int built;
+   if (!built) { init_defaults(); built = 1; }
+   #endif
+   a->z_length   = default_z_length;
+   a->z_distance = default_z_distance;
+   memcpy(a->z_litlen_fast, default_litlen_fast, sizeof(default_litlen_fast));
+   memcpy(a->z_dist_fast, default_dist_fast, sizeof(default_dist_fast));
 }
 
 int stbi_png_partial; // a quick hack to only allow decoding some of a PNG... I should implement real streaming support instead
@@ -1934,6 +3598,7 @@ static int parse_zlib(zbuf *a, int parse_header)
    if (parse_header)
       if (!parse_zlib_header(a)) return 0;
    a->num_bits = 0;
+   a->overread = 0;
    a->code_buffer = 0;
    do {
       final = zreceive(a,1);
@@ -1945,9 +3610,7 @@ static int parse_zlib(zbuf *a, int parse_header)
       } else {
          if (type == 1) {
             // use fixed code lengths
-            if (!default_distance[31]) init_defaults();
-            if (!zbuild_huffman(&a->z_length  , default_length  , 288)) return 0;
-            if (!zbuild_huffman(&a->z_distance, default_distance,  32)) return 0;
+            use_default_tables(a);
          } else {
             if (!compute_huffman_codes(a)) return 0;
          }
@@ -1972,7 +3635,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) stbi_malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -1980,7 +3643,7 @@ char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -1993,7 +3656,7 @@ char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
 char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) stbi_malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -2001,7 +3664,7 @@ char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len,
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -2020,7 +3683,7 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(16384);
+   char *p = (char *) stbi_malloc(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer+len;
@@ -2028,7 +3691,7 @@ char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -2084,6 +3747,11 @@ typedef struct
 {
    stbi *s;
    uint8 *idata, *expanded, *out;
+   // header state collected by parse_png_file
+   uint8 palette[1024], pal_img_n;
+   uint8 has_trans, tc[3];
+   uint32 pal_len;
+   int interlace, iphone;
 } png;
 
 
@@ -2108,18 +3776,200 @@ static int paeth(int a, int b, int c)
    return c;
 }
 
+#ifdef STBI_X86
+// SIMD unfiltering of 3 and 4 byte pixels. Sub, Average and Paeth depend
+// on the pixel to the left, so these go a pixel at a time with the whole
+// pixel in one register; Up on a row without added alpha is a plain
+// vector add. Pixels are read and written 4 bytes at a time, except the
+// last 3-byte one of a row, which could be the last bytes of the buffer.
+
+stbi_inline static int png_load32(const uint8 *p)
+{
+   int v;
+   memcpy(&v, p, 4);
+   return v;
+}
+
+stbi_inline static int png_load24(const uint8 *p)
+{
+   return p[0] | p[1] << 8 | p[2] << 16;
+}
+
+static void png_add_row_sse2(uint8 *cur, const uint8 *prior, const uint8 *raw, int n)
+{
+   int i=0;
+   for (; i+16 <= n; i += 16)
+      _mm_storeu_si128((__m128i *) (cur+i), _mm_add_epi8(_mm_loadu_si128((__m128i *) (raw+i)),
+                                                         _mm_loadu_si128((__m128i *) (prior+i))));
+   for (; i < n; ++i)
+      cur[i] = raw[i] + prior[i];
+}
+
+STBI_TARGET("avx2") static void png_add_row_avx2(uint8 *cur, const uint8 *prior, const uint8 *raw, int n)
+{
+   int i=0;
+   for (; i+32 <= n; i += 32)
+      _mm256_storeu_si256((__m256i *) (cur+i), _mm256_add_epi8(_mm256_loadu_si256((__m256i *) (raw+i)),
+                                                               _mm256_loadu_si256((__m256i *) (prior+i))));
+   png_add_row_sse2(cur+i, prior+i, raw+i, n-i);
+}
+
+// one row of x pixels with any filter (the _first ones included); alpha
+// is filled in when out_n is img_n+1
+stbi_force_inline static void png_unfilter_row_sse2(uint8 *cur, const uint8 *prior, const uint8 *raw,
+                                                    int filter, uint32 x, int img_n, int out_n, int simd)
+{
+   __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8(1);
+   __m128i alpha = _mm_cvtsi32_si128(img_n != out_n ? (int) 0xff000000 : 0);
+   __m128i a = zero, b = zero, c = zero, d;
+   __m128i a16, pa, pb, pc, least, take_a, take_b, nearest;
+   uint32 i, last = x-1;
+
+   if (filter == F_none && img_n == out_n) {
+      memcpy(cur, raw, x*img_n);
+      return;
+   }
+   if (filter == F_up && img_n == out_n) {
+      if (simd >= STBI_SIMD_AVX2)
+         png_add_row_avx2(cur, prior, raw, x*img_n);
+      else
+         png_add_row_sse2(cur, prior, raw, x*img_n);
+      return;
+   }
+
+   #define PNG_ROW_SSE2(body)                                                            \
+      for (i=0; i < x; ++i, raw += img_n, cur += out_n, prior += out_n) {                \
+         int px;                                                                         \
+         d = _mm_cvtsi32_si128(img_n == 4 || i < last ? png_load32(raw) : png_load24(raw)); \
+         body                                                                            \
+         px = _mm_cvtsi128_si32(_mm_or_si128(a, alpha));                                 \
+         if (out_n == 4 || i < last)                                                     \
+            memcpy(cur, &px, 4);                                                         \
+         else                                                                            \
+            cur[0] = (uint8) px, cur[1] = (uint8) (px >> 8), cur[2] = (uint8) (px >> 16); \
+      }
+
+   switch (filter) {
+      case F_none:
+         PNG_ROW_SSE2(a = d;)
+         break;
+      case F_sub:
+      case F_paeth_first:   // paeth(a,0,0) is a
+         PNG_ROW_SSE2(a = _mm_add_epi8(d, a);)
+         break;
+      case F_up:
+         PNG_ROW_SSE2(a = _mm_add_epi8(d, _mm_cvtsi32_si128(png_load32(prior)));)
+         break;
+      case F_avg:
+      case F_avg_first:
+         // (a+b)>>1 without the rounding _mm_avg_epu8 does
+         PNG_ROW_SSE2(
+            if (filter == F_avg) b = _mm_cvtsi32_si128(png_load32(prior));
+            a = _mm_add_epi8(d, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), ones)));
+         )
+         break;
+      case F_paeth:
+         // branchless: with p = a+b-c, |p-a| = |b-c|, |p-b| = |a-c| and
+         // |p-c| = |(b-c)+(a-c)|; pick the nearest, ties going a, b, c.
+         // b and c are kept as 16-bit lanes
+         PNG_ROW_SSE2(
+            a16 = _mm_unpacklo_epi8(a, zero);
+            b  = _mm_unpacklo_epi8(_mm_cvtsi32_si128(png_load32(prior)), zero);
+            pa = _mm_sub_epi16(b, c);
+            pb = _mm_sub_epi16(a16, c);
+            pc = _mm_add_epi16(pa, pb);
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            least  = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            take_a = _mm_cmpeq_epi16(least, pa);
+            take_b = _mm_andnot_si128(take_a, _mm_cmpeq_epi16(least, pb));
+            nearest = _mm_or_si128(_mm_and_si128(take_a, a16),
+                      _mm_or_si128(_mm_and_si128(take_b, b), _mm_andnot_si128(_mm_or_si128(take_a, take_b), c)));
+            c = b;
+            a = _mm_packus_epi16(_mm_and_si128(_mm_add_epi16(_mm_unpacklo_epi8(d, zero), nearest), _mm_set1_epi16(255)), zero);
+         )
+         break;
+   }
+   #undef PNG_ROW_SSE2
+}
+#endif // STBI_X86
+
+// undo the filter of one scanline; raw has x*img_n bytes (filter byte
+// already consumed), cur gets x*out_n, prior is the previous output row
+static void png_unfilter_row(uint8 *cur, uint8 *prior, uint8 *raw, int filter, uint32 x, int img_n, int out_n)
+{
+   uint32 i;
+   int k;
+   // handle first pixel explicitly
+   for (k=0; k < img_n; ++k) {
+      switch (filter) {
+         case F_none       : cur[k] = raw[k]; break;
+         case F_sub        : cur[k] = raw[k]; break;
+         case F_up         : cur[k] = raw[k] + prior[k]; break;
+         case F_avg        : cur[k] = raw[k] + (prior[k]>>1); break;
+         case F_paeth      : cur[k] = (uint8) (raw[k] + paeth(0,prior[k],0)); break;
+         case F_avg_first  : cur[k] = raw[k]; break;
+         case F_paeth_first: cur[k] = raw[k]; break;
+      }
+   }
+   if (img_n != out_n) cur[img_n] = 255;
+   raw += img_n;
+   cur += out_n;
+   prior += out_n;
+   // this is a little gross, so that we don't switch per-pixel or per-component
+   if (img_n == out_n) {
+      #define CASE(f) \
+          case f:     \
+             for (i=x-1; i >= 1; --i, raw+=img_n,cur+=img_n,prior+=img_n) \
+                for (k=0; k < img_n; ++k)
+      switch (filter) {
+         CASE(F_none)  cur[k] = raw[k]; break;
+         CASE(F_sub)   cur[k] = raw[k] + cur[k-img_n]; break;
+         CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
+         CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-img_n])>>1); break;
+         CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],prior[k],prior[k-img_n])); break;
+         CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-img_n] >> 1); break;
+         CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],0,0)); break;
+      }
+      #undef CASE
+   } else {
+      assert(img_n+1 == out_n);
+      #define CASE(f) \
+          case f:     \
+             for (i=x-1; i >= 1; --i, cur[img_n]=255,raw+=img_n,cur+=out_n,prior+=out_n) \
+                for (k=0; k < img_n; ++k)
+      switch (filter) {
+         CASE(F_none)  cur[k] = raw[k]; break;
+         CASE(F_sub)   cur[k] = raw[k] + cur[k-out_n]; break;
+         CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
+         CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-out_n])>>1); break;
+         CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],prior[k],prior[k-out_n])); break;
+         CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-out_n] >> 1); break;
+         CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],0,0)); break;
+      }
+      #undef CASE
+   }
+}
+
 // create the png data from post-deflated data
-static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, uint32 x, uint32 y)
+static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, uint32 x, uint32 y, int partial)
 {
    stbi *s = a->s;
-   uint32 i,j,stride = x*out_n;
-   int k;
+   uint32 j,stride = x*out_n;
    int img_n = s->img_n; // copy it into a local for later
+   #ifdef STBI_X86
+   int simd = img_n >= 3 ? stbi_simd_level() : STBI_SIMD_NONE;
+   #endif
    assert(out_n == s->img_n || out_n == s->img_n+1);
-   if (stbi_png_partial) y = 1;
-   a->out = (uint8 *) malloc(x * y * out_n);
+   if (partial) y = 1;
+   // an interlace pass or the partial first row isn't the final image
+   if (!partial && s->img_x == x && s->img_y == y)
+      a->out = (uint8 *) stbi_malloc_out(x * y * out_n);
+   else
+      a->out = (uint8 *) stbi_malloc(x * y * out_n);
    if (!a->out) return e("outofmem", "Out of memory");
-   if (!stbi_png_partial) {
+   if (!partial) {
       if (s->img_x == x && s->img_y == y) {
          if (raw_len != (img_n * x + 1) * y) return e("not enough pixels","Corrupt PNG");
       } else { // interlaced:
@@ -2133,55 +3983,13 @@ static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, u
       if (filter > 4) return e("invalid filter","Corrupt PNG");
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
-      // handle first pixel explicitly
-      for (k=0; k < img_n; ++k) {
-         switch (filter) {
-            case F_none       : cur[k] = raw[k]; break;
-            case F_sub        : cur[k] = raw[k]; break;
-            case F_up         : cur[k] = raw[k] + prior[k]; break;
-            case F_avg        : cur[k] = raw[k] + (prior[k]>>1); break;
-            case F_paeth      : cur[k] = (uint8) (raw[k] + paeth(0,prior[k],0)); break;
-            case F_avg_first  : cur[k] = raw[k]; break;
-            case F_paeth_first: cur[k] = raw[k]; break;
-         }
-      }
-      if (img_n != out_n) cur[img_n] = 255;
-      raw += img_n;
-      cur += out_n;
-      prior += out_n;
-      // this is a little gross, so that we don't switch per-pixel or per-component
-      if (img_n == out_n) {
-         #define CASE(f) \
-             case f:     \
-                for (i=x-1; i >= 1; --i, raw+=img_n,cur+=img_n,prior+=img_n) \
-                   for (k=0; k < img_n; ++k)
-         switch (filter) {
-            CASE(F_none)  cur[k] = raw[k]; break;
-            CASE(F_sub)   cur[k] = raw[k] + cur[k-img_n]; break;
-            CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
-            CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-img_n])>>1); break;
-            CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],prior[k],prior[k-img_n])); break;
-            CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-img_n] >> 1); break;
-            CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],0,0)); break;
-         }
-         #undef CASE
-      } else {
-         assert(img_n+1 == out_n);
-         #define CASE(f) \
-             case f:     \
-                for (i=x-1; i >= 1; --i, cur[img_n]=255,raw+=img_n,cur+=out_n,prior+=out_n) \
-                   for (k=0; k < img_n; ++k)
-         switch (filter) {
-            CASE(F_none)  cur[k] = raw[k]; break;
-            CASE(F_sub)   cur[k] = raw[k] + cur[k-out_n]; break;
-            CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
-            CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-out_n])>>1); break;
-            CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],prior[k],prior[k-out_n])); break;
-            CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-out_n] >> 1); break;
-            CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],0,0)); break;
-         }
-         #undef CASE
-      }
+      #ifdef STBI_X86
+      if (simd)
+         png_unfilter_row_sse2(cur, prior, raw, filter, x, img_n, out_n, simd);
+      else
+      #endif
+      png_unfilter_row(cur, prior, raw, filter, x, img_n, out_n);
+      raw += x*img_n;
    }
    return 1;
 }
@@ -2190,14 +3998,11 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int i
 {
    uint8 *final;
    int p;
-   int save;
    if (!interlaced)
-      return create_png_image_raw(a, raw, raw_len, out_n, a->s->img_x, a->s->img_y);
-   save = stbi_png_partial;
-   stbi_png_partial = 0;
+      return create_png_image_raw(a, raw, raw_len, out_n, a->s->img_x, a->s->img_y, stbi_png_partial);
 
    // de-interlacing
-   final = (uint8 *) malloc(a->s->img_x * a->s->img_y * out_n);
+   final = (uint8 *) stbi_malloc_out(a->s->img_x * a->s->img_y * out_n);
    for (p=0; p < 7; ++p) {
       int xorig[] = { 0,4,0,2,0,1,0 };
       int yorig[] = { 0,0,4,0,2,0,1 };
@@ -2208,30 +4013,27 @@ static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n, int i
       x = (a->s->img_x - xorig[p] + xspc[p]-1) / xspc[p];
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
-         if (!create_png_image_raw(a, raw, raw_len, out_n, x, y)) {
-            free(final);
+         if (!create_png_image_raw(a, raw, raw_len, out_n, x, y, 0)) {
+            stbi_free(final);
             return 0;
          }
          for (j=0; j < y; ++j)
             for (i=0; i < x; ++i)
                memcpy(final + (j*yspc[p]+yorig[p])*a->s->img_x*out_n + (i*xspc[p]+xorig[p])*out_n,
                       a->out + (j*x+i)*out_n, out_n);
-         free(a->out);
+         stbi_free(a->out);
          raw += (x*out_n+1)*y;
          raw_len -= (x*out_n+1)*y;
       }
    }
    a->out = final;
 
-   stbi_png_partial = save;
    return 1;
 }
 
-static int compute_transparency(png *z, uint8 tc[3], int out_n)
+static int compute_transparency(uint8 *p, uint32 pixel_count, uint8 tc[3], int out_n)
 {
-   stbi *s = z->s;
-   uint32 i, pixel_count = s->img_x * s->img_y;
-   uint8 *p = z->out;
+   uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 255 as the alpha value in the output
@@ -2252,17 +4054,9 @@ static int compute_transparency(png *z, uint8 tc[3], int out_n)
    return 1;
 }
 
-static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
+static void expand_palette_pixels(uint8 *p, uint8 *orig, uint32 pixel_count, uint8 *palette, int pal_img_n)
 {
-   uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-   uint8 *p, *temp_out, *orig = a->out;
-
-   p = (uint8 *) malloc(pixel_count * pal_img_n);
-   if (p == NULL) return e("outofmem", "Out of memory");
-
-   // between here and free(out) below, exitting would leak
-   temp_out = p;
-
+   uint32 i;
    if (pal_img_n == 3) {
       for (i=0; i < pixel_count; ++i) {
          int n = orig[i]*4;
@@ -2281,16 +4075,27 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
          p += 4;
       }
    }
-   free(a->out);
-   a->out = temp_out;
+}
+
+static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
+{
+   uint32 pixel_count = a->s->img_x * a->s->img_y;
+   uint8 *p;
+
+   p = (uint8 *) stbi_malloc_out(pixel_count * pal_img_n);
+   if (p == NULL) return e("outofmem", "Out of memory");
+
+   expand_palette_pixels(p, a->out, pixel_count, palette, pal_img_n);
+   stbi_free(a->out);
+   a->out = p;
 
    STBI_NOTUSED(len);
 
    return 1;
 }
 
-static int stbi_unpremultiply_on_load = 0;
-static int stbi_de_iphone_flag = 0;
+static STBI_SHARED(int) stbi_unpremultiply_on_load(0);
+static STBI_SHARED(int) stbi_de_iphone_flag(0);
 
 void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
 {
@@ -2345,15 +4150,18 @@ static void stbi_de_iphone(png *z)
 
 static int parse_png_file(png *z, int scan, int req_comp)
 {
-   uint8 palette[1024], pal_img_n=0;
-   uint8 has_trans=0, tc[3];
-   uint32 ioff=0, idata_limit=0, i, pal_len=0;
-   int first=1,k,interlace=0, iphone=0;
+   uint32 ioff=0, idata_limit=0, i;
+   int first=1,k;
    stbi *s = z->s;
 
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->pal_img_n = 0;
+   z->has_trans = 0;
+   z->pal_len = 0;
+   z->interlace = 0;
+   z->iphone = 0;
 
    if (!check_png_header(s)) return 0;
 
@@ -2363,7 +4171,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
       chunk c = get_chunk_header(s);
       switch (c.type) {
          case PNG_TYPE('C','g','B','I'):
-            iphone = stbi_de_iphone_flag;
+            z->iphone = stbi_de_iphone_flag;
             skip(s, c.length);
             break;
          case PNG_TYPE('I','H','D','R'): {
@@ -2375,12 +4183,12 @@ static int parse_png_file(png *z, int scan, int req_comp)
             s->img_y = get32(s); if (s->img_y > (1 << 24)) return e("too large","Very large image (corrupt?)");
             depth = get8(s);  if (depth != 8)        return e("8bit only","PNG not supported: 8-bit only");
             color = get8(s);  if (color > 6)         return e("bad ctype","Corrupt PNG");
-            if (color == 3) pal_img_n = 3; else if (color & 1) return e("bad ctype","Corrupt PNG");
+            if (color == 3) z->pal_img_n = 3; else if (color & 1) return e("bad ctype","Corrupt PNG");
             comp  = get8(s);  if (comp) return e("bad comp method","Corrupt PNG");
             filter= get8(s);  if (filter) return e("bad filter method","Corrupt PNG");
-            interlace = get8(s); if (interlace>1) return e("bad interlace method","Corrupt PNG");
+            z->interlace = get8(s); if (z->interlace>1) return e("bad interlace method","Corrupt PNG");
             if (!s->img_x || !s->img_y) return e("0-pixel image","Corrupt PNG");
-            if (!pal_img_n) {
+            if (!z->pal_img_n) {
                s->img_n = (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
                if ((1 << 30) / s->img_x / s->img_n < s->img_y) return e("too large", "Image too large to decode");
                if (scan == SCAN_header) return 1;
@@ -2397,13 +4205,13 @@ static int parse_png_file(png *z, int scan, int req_comp)
          case PNG_TYPE('P','L','T','E'):  {
             if (first) return e("first not IHDR", "Corrupt PNG");
             if (c.length > 256*3) return e("invalid PLTE","Corrupt PNG");
-            pal_len = c.length / 3;
-            if (pal_len * 3 != c.length) return e("invalid PLTE","Corrupt PNG");
-            for (i=0; i < pal_len; ++i) {
-               palette[i*4+0] = get8u(s);
-               palette[i*4+1] = get8u(s);
-               palette[i*4+2] = get8u(s);
-               palette[i*4+3] = 255;
+            z->pal_len = c.length / 3;
+            if (z->pal_len * 3 != c.length) return e("invalid PLTE","Corrupt PNG");
+            for (i=0; i < z->pal_len; ++i) {
+               z->palette[i*4+0] = get8u(s);
+               z->palette[i*4+1] = get8u(s);
+               z->palette[i*4+2] = get8u(s);
+               z->palette[i*4+3] = 255;
             }
             break;
          }
@@ -2411,33 +4219,34 @@ static int parse_png_file(png *z, int scan, int req_comp)
          case PNG_TYPE('t','R','N','S'): {
             if (first) return e("first not IHDR", "Corrupt PNG");
             if (z->idata) return e("tRNS after IDAT","Corrupt PNG");
-            if (pal_img_n) {
+            if (z->pal_img_n) {
                if (scan == SCAN_header) { s->img_n = 4; return 1; }
-               if (pal_len == 0) return e("tRNS before PLTE","Corrupt PNG");
-               if (c.length > pal_len) return e("bad tRNS len","Corrupt PNG");
-               pal_img_n = 4;
+               if (z->pal_len == 0) return e("tRNS before PLTE","Corrupt PNG");
+               if (c.length > z->pal_len) return e("bad tRNS len","Corrupt PNG");
+               z->pal_img_n = 4;
                for (i=0; i < c.length; ++i)
-                  palette[i*4+3] = get8u(s);
+                  z->palette[i*4+3] = get8u(s);
             } else {
                if (!(s->img_n & 1)) return e("tRNS with alpha","Corrupt PNG");
                if (c.length != (uint32) s->img_n*2) return e("bad tRNS len","Corrupt PNG");
-               has_trans = 1;
+               z->has_trans = 1;
                for (k=0; k < s->img_n; ++k)
-                  tc[k] = (uint8) get16(s); // non 8-bit images will be larger
+                  z->tc[k] = (uint8) get16(s); // non 8-bit images will be larger
             }
             break;
          }
 
          case PNG_TYPE('I','D','A','T'): {
             if (first) return e("first not IHDR", "Corrupt PNG");
-            if (pal_img_n && !pal_len) return e("no PLTE","Corrupt PNG");
-            if (scan == SCAN_header) { s->img_n = pal_img_n; return 1; }
+            if (z->pal_img_n && !z->pal_len) return e("no PLTE","Corrupt PNG");
+            if (scan == SCAN_stream) return 1; // caller reads the IDAT chunks itself
+            if (scan == SCAN_header) { s->img_n = z->pal_img_n; return 1; }
             if (ioff + c.length > idata_limit) {
                uint8 *p;
                if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
-               p = (uint8 *) realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
+               p = (uint8 *) stbi_realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!getn(s, z->idata+ioff,c.length)) return e("outofdata","Corrupt PNG");
@@ -2450,27 +4259,27 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (first) return e("first not IHDR", "Corrupt PNG");
             if (scan != SCAN_load) return 1;
             if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
-            z->expanded = (uint8 *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, 16384, (int *) &raw_len, !iphone);
+            z->expanded = (uint8 *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, 16384, (int *) &raw_len, !z->iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            free(z->idata); z->idata = NULL;
-            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+            stbi_free(z->idata); z->idata = NULL;
+            if ((req_comp == s->img_n+1 && req_comp != 3 && !z->pal_img_n) || z->has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
-            if (!create_png_image(z, z->expanded, raw_len, s->img_out_n, interlace)) return 0;
-            if (has_trans)
-               if (!compute_transparency(z, tc, s->img_out_n)) return 0;
-            if (iphone && s->img_out_n > 2)
+            if (!create_png_image(z, z->expanded, raw_len, s->img_out_n, z->interlace)) return 0;
+            if (z->has_trans)
+               if (!compute_transparency(z->out, s->img_x * s->img_y, z->tc, s->img_out_n)) return 0;
+            if (z->iphone && s->img_out_n > 2)
                stbi_de_iphone(z);
-            if (pal_img_n) {
+            if (z->pal_img_n) {
                // pal_img_n == 3 or 4
-               s->img_n = pal_img_n; // record the actual colors we had
-               s->img_out_n = pal_img_n;
+               s->img_n = z->pal_img_n; // record the actual colors we had
+               s->img_out_n = z->pal_img_n;
                if (req_comp >= 3) s->img_out_n = req_comp;
-               if (!expand_palette(z, palette, pal_len, s->img_out_n))
+               if (!expand_palette(z, z->palette, z->pal_len, s->img_out_n))
                   return 0;
             }
-            free(z->expanded); z->expanded = NULL;
+            stbi_free(z->expanded); z->expanded = NULL;
             return 1;
          }
 
@@ -2479,8 +4288,8 @@ static int parse_png_file(png *z, int scan, int req_comp)
             if (first) return e("first not IHDR", "Corrupt PNG");
             if ((c.type & (1 << 29)) == 0) {
                #ifndef STBI_NO_FAILURE_STRINGS
-               // not threadsafe
-               static char invalid_chunk[] = "XXXX chunk not known";
+               // one per thread, like failure_reason
+               static STBI_THREAD_LOCAL char invalid_chunk[] = "XXXX chunk not known";
                invalid_chunk[0] = (uint8) (c.type >> 24);
                invalid_chunk[1] = (uint8) (c.type >> 16);
                invalid_chunk[2] = (uint8) (c.type >>  8);
@@ -2512,9 +4321,9 @@ static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   free(p->out);      p->out      = NULL;
-   free(p->expanded); p->expanded = NULL;
-   free(p->idata);    p->idata    = NULL;
+   stbi_free(p->out);      p->out      = NULL;
+   stbi_free(p->expanded); p->expanded = NULL;
+   stbi_free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -2553,6 +4362,606 @@ static int      stbi_png_info(stbi *s, int *x, int *y, int *comp)
    return stbi_png_info_raw(&p, x, y, comp);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+//  streaming decoder
+//
+//    - the caller pushes bytes as they arrive and gets rows back through a
+//      callback as soon as they are decoded, keeping only a few rows
+//    - rows are streamed for non-interlaced PNG (one scanline at a time,
+//      inflating with a 32K window) and for JPEG files whose first scan
+//      has every component (one MCU row at a time); anything else is kept
+//      until stbi_stream_finish and decoded whole
+//    - the JPEG decoder pulls its input, so a MCU row that runs out of
+//      data is decoded again from its start once more has arrived
+
+enum
+{
+   STREAM_header,   // not enough input yet to tell how to decode it
+   STREAM_png,
+   STREAM_jpeg,
+   STREAM_whole,    // decoded at finish
+   STREAM_done,
+   STREAM_error
+};
+
+// where the PNG inflater is in the zlib stream
+enum
+{
+   ZS_header, ZS_block, ZS_stored, ZS_codes, ZS_done
+};
+
+#define STREAM_JPEG_KEEP  4   // component rows kept above each strip for upsampling
+
+struct stbi_stream
+{
+   int req_comp, state, final;
+   stbi_rows_callback rows;
+   void *user;
+
+   uint8 *in;            // input from pos on hasn't been used yet
+   int in_len, in_cap, pos;
+   stbi s;               // memory reader for the decoders
+   int x, y, comp, n;    // image size, stbi_info's comp, output components
+   int row;              // next row to deliver
+
+   // png
+   png p;
+   zbuf z;
+   int png_n;            // components of an unfiltered row
+   int png_pal_n;        // components after palette expansion
+   int png_simd;
+   uint32 chunk_left;    // IDAT bytes not read yet
+   int need_crc, idat_done;
+   int zstate, zfinal, stored_left;
+   uint8 *zin;           // IDAT payload, from zin_pos on not inflated yet
+   int zin_len, zin_cap, zin_pos;
+   uint8 *win;           // inflated data; the next row starts at win_row
+   int win_cap, win_row;
+   uint8 *cur, *prior, *pal_row, *out_row;
+
+   // jpeg
+   jpeg j;
+   int jpeg_started;
+   jpeg_layout L;
+   int mcu_row, decode_n, lines[4];
+   int retry_len;        // input wanted before decoding the next MCU row
+   uint8 *strip;         // converted rows
+};
+
+static int stream_grow(uint8 **buf, int *cap, int need)
+{
+   uint8 *p;
+   int c = *cap ? *cap : 4096;
+   if (need <= *cap) return 1;
+   while (c < need) {
+      if (c > (1 << 29)) return e("too large","Stream too large");
+      c *= 2;
+   }
+   p = (uint8 *) stbi_realloc(*buf, c);
+   if (p == NULL) return e("outofmem", "Out of memory");
+   *buf = p;
+   *cap = c;
+   return 1;
+}
+
+static uint32 stream_get32(uint8 *p)
+{
+   return ((uint32) p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+}
+
+static void png_stream_row(stbi_stream *st)
+{
+   png *p = &st->p;
+   uint8 *px = st->cur, *t;
+   int pn = st->png_n;
+   if (p->has_trans)
+      compute_transparency(st->cur, st->x, p->tc, pn);
+   if (p->pal_img_n) {
+      expand_palette_pixels(st->pal_row, st->cur, st->x, p->palette, st->png_pal_n);
+      px = st->pal_row;
+      pn = st->png_pal_n;
+   }
+   if (st->n != pn) {
+      convert_row(px, st->out_row, pn, st->n, st->x);
+      px = st->out_row;
+   }
+   st->rows(st->user, st->row, 1, px, st->n * st->x);
+   ++st->row;
+   t = st->cur; st->cur = st->prior; st->prior = t;
+}
+
+// unfilters the complete rows in the window, then makes room for the
+// longest match by dropping what's no longer needed, keeping 32K of
+// history and the partial row
+static int png_stream_rows(stbi_stream *st)
+{
+   zbuf *a = &st->z;
+   int img_n = st->s.img_n, used;
+   int rb = img_n * st->x + 1;
+   while (st->row < st->y && (int) (a->zout - (char *) st->win) - st->win_row >= rb) {
+      uint8 *raw = st->win + st->win_row;
+      int filter = *raw++;
+      if (filter > 4) return e("invalid filter","Corrupt PNG");
+      if (st->row == 0) filter = first_row_filter[filter];
+      #ifdef STBI_X86
+      if (st->png_simd)
+         png_unfilter_row_sse2(st->cur, st->prior, raw, filter, st->x, img_n, st->png_n, st->png_simd);
+      else
+      #endif
+      png_unfilter_row(st->cur, st->prior, raw, filter, st->x, img_n, st->png_n);
+      st->win_row += rb;
+      png_stream_row(st);
+   }
+   used = (int) (a->zout - (char *) st->win);
+   if (a->zout_end - a->zout < 258 && used > 32768) {
+      int drop = used - 32768 < st->win_row ? used - 32768 : st->win_row;
+      memmove(st->win, st->win + drop, used - drop);
+      a->zout -= drop;
+      st->win_row -= drop;
+   }
+   return 1;
+}
+
+// inflates as far as the IDAT data received so far goes
+static int png_stream_inflate(stbi_stream *st)
+{
+   zbuf *a = &st->z;
+   while (st->row < st->y) {
+      int avail, r, type;
+      a->zbuffer = st->zin + st->zin_pos;
+      a->zbuffer_end = st->zin + st->zin_len;
+      avail = st->zin_len - st->zin_pos;
+      switch (st->zstate) {
+         case ZS_header:
+            if (avail < 2 && a->more_input) return 1;
+            if (!parse_zlib_header(a)) return 0;
+            a->num_bits = 0;
+            a->overread = 0;
+            a->code_buffer = 0;
+            st->zstate = ZS_block;
+            break;
+         case ZS_block:
+            // a block header with its code lengths fits in 1K
+            if (avail < 1024 && a->more_input) return 1;
+            st->zfinal = zreceive(a,1);
+            type = zreceive(a,2);
+            if (type == 0) {
+               st->stored_left = stored_block_length(a);
+               if (st->stored_left < 0) return 0;
+               st->zstate = ZS_stored;
+            } else if (type == 3) {
+               return e("bad block type","Corrupt PNG");
+            } else {
+               if (type == 1)
+                  use_default_tables(a);
+               else if (!compute_huffman_codes(a))
+                  return 0;
+               st->zstate = ZS_codes;
+            }
+            break;
+         case ZS_stored:
+            r = st->stored_left;
+            if (r > avail) r = avail;
+            if (r > a->zout_end - a->zout) r = (int) (a->zout_end - a->zout);
+            if (r == 0 && st->stored_left && avail == 0) {
+               if (a->more_input) return 1;
+               return e("read past buffer","Corrupt PNG");
+            }
+            memcpy(a->zout, a->zbuffer, r);
+            a->zbuffer += r;
+            a->zout += r;
+            st->stored_left -= r;
+            if (!st->stored_left)
+               st->zstate = st->zfinal ? ZS_done : ZS_block;
+            break;
+         case ZS_codes:
+            r = parse_huffman_block_stream(a);
+            if (!r) return 0;
+            if (r == 1)
+               st->zstate = st->zfinal ? ZS_done : ZS_block;
+            else if (a->zout_end - a->zout >= 258) {
+               st->zin_pos = (int) (a->zbuffer - st->zin);
+               return 1;   // needs more input
+            }
+            break;
+         case ZS_done:
+            return e("not enough pixels","Corrupt PNG");
+      }
+      st->zin_pos = (int) (a->zbuffer - st->zin);
+      if (!png_stream_rows(st)) return 0;
+   }
+   return 1;
+}
+
+// copies IDAT payloads from the input to zin; the first chunk after them
+// ends the zlib stream and the rest of the file isn't needed
+static int png_stream_chunks(stbi_stream *st)
+{
+   // a stored block hands the bytes still in the bit buffer back, so
+   // keep the last 8 that were read
+   if (st->zin_pos > 8) {
+      int drop = st->zin_pos - 8;
+      memmove(st->zin, st->zin + drop, st->zin_len - drop);
+      st->zin_len -= drop;
+      st->zin_pos = 8;
+   }
+   while (!st->idat_done) {
+      int avail = st->in_len - st->pos;
+      if (st->chunk_left) {
+         int take = st->chunk_left < (uint32) avail ? (int) st->chunk_left : avail;
+         if (take == 0) break;
+         if (!stream_grow(&st->zin, &st->zin_cap, st->zin_len + take)) return 0;
+         memcpy(st->zin + st->zin_len, st->in + st->pos, take);
+         st->zin_len += take;
+         st->pos += take;
+         st->chunk_left -= take;
+      } else if (st->need_crc) {
+         if (avail < 4) break;
+         st->pos += 4;
+         st->need_crc = 0;
+      } else {
+         if (avail < 8) break;
+         if (stream_get32(st->in + st->pos + 4) != PNG_TYPE('I','D','A','T')) {
+            st->idat_done = 1;
+            st->z.more_input = 0;
+            break;
+         }
+         st->chunk_left = stream_get32(st->in + st->pos);
+         if (st->chunk_left > (1u << 30)) return e("bad chunk len","Corrupt PNG");
+         st->pos += 8;
+         st->need_crc = 1;
+      }
+   }
+   if (st->final) st->z.more_input = 0;
+   return 1;
+}
+
+// returns 1 when all the chunks before the first IDAT have arrived, and -1
+// when the file won't tell us (a chunk length no PNG has)
+static int png_stream_header_size(stbi_stream *st, uint32 *idat)
+{
+   uint32 off = 8;
+   for (;;) {
+      uint32 len;
+      if ((uint32) st->in_len < off + 8) return 0;
+      if (stream_get32(st->in + off + 4) == PNG_TYPE('I','D','A','T')) {
+         *idat = off;
+         return 1;
+      }
+      len = stream_get32(st->in + off);
+      if (len > (1u << 30)) return -1;
+      off += len + 12;
+   }
+}
+
+static int png_stream_start(stbi_stream *st, uint32 idat)
+{
+   png *p = &st->p;
+   stbi *s = &st->s;
+   int rb;
+   start_mem(s, st->in, idat + 8);
+   p->s = s;
+   if (!parse_png_file(p, SCAN_stream, st->req_comp)) return 0;
+   if (p->interlace || p->iphone) {
+      // Adam7 passes and CgBI's raw deflate stream go the usual way
+      st->state = STREAM_whole;
+      return 1;
+   }
+   st->x = s->img_x;
+   st->y = s->img_y;
+   if ((st->req_comp == s->img_n+1 && st->req_comp != 3 && !p->pal_img_n) || p->has_trans)
+      st->png_n = s->img_n+1;
+   else
+      st->png_n = s->img_n;
+   st->png_pal_n = st->png_n;
+   st->comp = s->img_n;
+   if (p->pal_img_n) {
+      st->png_pal_n = st->req_comp >= 3 ? st->req_comp : p->pal_img_n;
+      st->comp = p->pal_img_n;
+   }
+   st->n = st->req_comp ? st->req_comp : st->png_pal_n;
+   #ifdef STBI_X86
+   st->png_simd = s->img_n >= 3 ? stbi_simd_level() : STBI_SIMD_NONE;
+   #endif
+
+   // room for the 32K window, a partial row and plenty to inflate into
+   rb = s->img_n * st->x + 1;
+   st->win_cap = 32768 + rb + 65536;
+   st->win = (uint8 *) stbi_malloc(st->win_cap);
+   // the SSE2 unfilter reads a byte past the prior row
+   st->cur = (uint8 *) stbi_malloc(st->x * st->png_n + 16);
+   st->prior = (uint8 *) stbi_malloc(st->x * st->png_n + 16);
+   st->pal_row = (uint8 *) stbi_malloc(st->x * 4);
+   st->out_row = (uint8 *) stbi_malloc(st->x * st->n);
+   if (!st->win || !st->cur || !st->prior || !st->pal_row || !st->out_row)
+      return e("outofmem", "Out of memory");
+
+   st->z.zout_start = st->z.zout = (char *) st->win;
+   st->z.zout_end = (char *) st->win + st->win_cap;
+   st->z.z_expandable = 0;
+   st->z.more_input = 1;
+   st->zstate = ZS_header;
+   st->pos = idat;
+   st->state = STREAM_png;
+   return 1;
+}
+
+// returns the offset past the first SOS segment, 0 if it hasn't all
+// arrived, -1 if there isn't one
+static int jpeg_stream_header_size(uint8 *p, int len)
+{
+   int i = 2, m, n;
+   for (;;) {
+      while (i < len && p[i] != 0xff) ++i;   // padding
+      while (i < len && p[i] == 0xff) ++i;
+      if (i >= len) return 0;
+      m = p[i++];
+      if (EOI(m)) return -1;
+      if (m == 0x01 || (m >= 0xd0 && m <= 0xd8)) continue;   // no length
+      if (i + 2 > len) return 0;
+      n = p[i] * 256 + p[i+1];
+      if (i + n > len) return 0;
+      i += n;
+      if (SOS(m)) return i;
+   }
+}
+
+static int jpeg_stream_start(stbi_stream *st, int header_len)
+{
+   jpeg *z = &st->j;
+   stbi *s = &st->s;
+   int k, m;
+   start_mem(s, st->in, header_len);
+   z->s = s;
+   s->img_n = 0;
+   z->linebuf = z->stream = NULL;
+   st->jpeg_started = 1;
+   jpeg_select_kernels(z);
+   z->restart_interval = 0;
+   if (!decode_jpeg_header(z, SCAN_stream)) return 0;
+   m = get_marker(z);
+   while (!SOS(m)) {
+      if (!process_marker(z, m)) return 0;
+      m = get_marker(z);
+   }
+   if (!process_scan_header(z)) return 0;
+
+   // progressive-style component-by-component scans, and sampling factors
+   // that don't divide the largest one, need the whole image
+   if (z->scan_n != s->img_n) {
+      st->state = STREAM_whole;
+      return 1;
+   }
+   for (k=0; k < s->img_n; ++k) {
+      if (z->img_h_max % z->img_comp[k].h || z->img_v_max % z->img_comp[k].v) {
+         st->state = STREAM_whole;
+         return 1;
+      }
+   }
+
+   st->x = s->img_x;
+   st->y = s->img_y;
+   st->comp = s->img_n;
+   st->n = st->req_comp ? st->req_comp : s->img_n;
+   st->decode_n = s->img_n == 3 && st->n < 3 ? 1 : s->img_n;
+   jpeg_make_layout(z, &st->L);
+
+   // each component gets a strip of one MCU row, with the last few rows
+   // of the one before above it
+   for (k=0; k < s->img_n; ++k) {
+      int w2 = z->img_comp[k].w2;
+      st->lines[k] = z->scan_n == 1 ? 8 : z->img_comp[k].v * 8;
+      z->img_comp[k].raw_data = stbi_malloc(w2 * (STREAM_JPEG_KEEP + st->lines[k]) + 15);
+      if (z->img_comp[k].raw_data == NULL) return e("outofmem", "Out of memory");
+      z->img_comp[k].data = (uint8 *) (((size_t) z->img_comp[k].raw_data + 15) & ~15) + STREAM_JPEG_KEEP * w2;
+      z->img_comp[k].data_y = 0;
+   }
+   z->linebuf = (uint8 *) stbi_malloc(st->decode_n * (st->x + 3) + st->n * st->x + 1);
+   st->strip = (uint8 *) stbi_malloc(st->n * st->x * (z->img_v_max * 8 + 4));
+   if (!z->linebuf || !st->strip) return e("outofmem", "Out of memory");
+
+   reset(z);
+   st->pos = (int) (s->img_buffer - st->in);
+   st->state = STREAM_jpeg;
+   return 1;
+}
+
+// converts the rows the decoded MCU rows are enough for, and moves the
+// strips down
+static void jpeg_stream_emit(stbi_stream *st)
+{
+   jpeg *z = &st->j;
+   int k, limit = st->y;
+   if (st->mcu_row < st->L.rows) {
+      for (k=0; k < st->decode_n; ++k) {
+         // the upsampler blends in the component row below
+         int vs = z->img_v_max / z->img_comp[k].v;
+         int l = st->mcu_row * st->lines[k] * vs - (vs >> 1);
+         if (l < limit) limit = l;
+      }
+   }
+   if (limit > st->row) {
+      jpeg_convert_rows(z, st->strip, st->n, st->decode_n, st->row, limit, z->linebuf,
+                        z->linebuf + st->decode_n * (st->x + 3));
+      st->rows(st->user, st->row, limit - st->row, st->strip, st->n * st->x);
+      st->row = limit;
+   }
+   for (k=0; k < st->s.img_n; ++k) {
+      int w2 = z->img_comp[k].w2;
+      uint8 *data = z->img_comp[k].data;
+      memcpy(data - STREAM_JPEG_KEEP * w2, data + (st->lines[k] - STREAM_JPEG_KEEP) * w2, STREAM_JPEG_KEEP * w2);
+      z->img_comp[k].data_y += st->lines[k];
+   }
+}
+
+static int jpeg_stream_rows(stbi_stream *st)
+{
+   jpeg *z = &st->j;
+   stbi *s = &st->s;
+   jpeg_layout *L = &st->L;
+   STBI_ALIGN16 short coef[64*64];
+   while (st->mcu_row < L->rows) {
+      uint32 code_buffer = z->code_buffer;
+      int code_bits = z->code_bits, nomore = z->nomore, todo = z->todo;
+      int dc_pred[4], k, i, ok = 1, avail = st->in_len - st->pos;
+      unsigned char marker = z->marker;
+      if (avail < st->retry_len && !st->final) return 1;
+      for (k=0; k < 4; ++k) dc_pred[k] = z->img_comp[k].dc_pred;
+
+      start_mem(s, st->in + st->pos, avail);
+      for (i=0; i < L->per_row && ok; ++i) {
+         if (!jpeg_decode_mcu(z, L, coef)) { ok = 0; break; }
+         jpeg_idct_mcu(z, L, i, coef);
+         if (--z->todo <= 0 && st->mcu_row * L->per_row + i + 1 < L->rows * L->per_row) {
+            if (z->code_bits < 24) grow_buffer_unsafe(z);
+            if (!RESTART(z->marker)) ok = e("bad restart","Corrupt JPEG");
+            reset(z);
+         }
+         if (s->img_buffer >= s->img_buffer_end && !st->final) break;
+      }
+      if (s->img_buffer >= s->img_buffer_end && !st->final) {
+         // ran out of input: undo the row and try again with twice as much
+         z->code_buffer = code_buffer;
+         z->code_bits = code_bits;
+         z->nomore = nomore;
+         z->todo = todo;
+         z->marker = marker;
+         for (k=0; k < 4; ++k) z->img_comp[k].dc_pred = dc_pred[k];
+         st->retry_len = 2 * avail + 1;
+         return 1;
+      }
+      if (!ok) return 0;
+      // the next row probably needs about as much
+      st->retry_len = (int) (s->img_buffer - (st->in + st->pos));
+      st->pos += st->retry_len;
+      ++st->mcu_row;
+      jpeg_stream_emit(st);
+   }
+   st->state = STREAM_done;
+   return 1;
+}
+
+// works out what the input is once enough of it is there
+static int stream_begin(stbi_stream *st)
+{
+   static uint8 png_sig[8] = { 137,80,78,71,13,10,26,10 };
+   if (st->in_len >= 2 && st->in[0] == 0xff && st->in[1] == 0xd8) {
+      int n = jpeg_stream_header_size(st->in, st->in_len);
+      if (n > 0) return jpeg_stream_start(st, n);
+      if (n < 0 || st->final) st->state = STREAM_whole;
+      return 1;
+   }
+   if (st->in_len >= 8 && memcmp(st->in, png_sig, 8) == 0) {
+      uint32 idat;
+      int r = png_stream_header_size(st, &idat);
+      if (r > 0) return png_stream_start(st, idat);
+      if (r < 0 || st->final) st->state = STREAM_whole;
+      return 1;
+   }
+   if (st->in_len >= 8 || st->final) st->state = STREAM_whole;
+   return 1;
+}
+
+static int stream_run(stbi_stream *st)
+{
+   if (st->state == STREAM_header)
+      if (!stream_begin(st)) return 0;
+   if (st->state == STREAM_png) {
+      if (!png_stream_chunks(st)) return 0;
+      if (!png_stream_inflate(st)) return 0;
+      if (st->row == st->y) st->state = STREAM_done;
+   }
+   if (st->state == STREAM_jpeg)
+      return jpeg_stream_rows(st);
+   return 1;
+}
+
+stbi_stream *stbi_stream_create(int req_comp, stbi_rows_callback rows, void *user)
+{
+   stbi_stream *st;
+   if (req_comp < 0 || req_comp > 4 || !rows) return (stbi_stream *) epuc("bad req_comp", "Internal error");
+   st = (stbi_stream *) stbi_malloc(sizeof(*st));
+   if (st == NULL) return (stbi_stream *) epuc("outofmem", "Out of memory");
+   memset(st, 0, sizeof(*st));
+   st->req_comp = req_comp;
+   st->rows = rows;
+   st->user = user;
+   st->state = STREAM_header;
+   return st;
+}
+
+int stbi_stream_feed(stbi_stream *st, stbi_uc const *data, int len)
+{
+   if (st->state == STREAM_error || st->final) return 0;
+   if (st->state == STREAM_done || len <= 0) return 1;
+   if (st->pos && (st->state == STREAM_png || st->state == STREAM_jpeg)) {
+      memmove(st->in, st->in + st->pos, st->in_len - st->pos);
+      st->in_len -= st->pos;
+      st->pos = 0;
+   }
+   if (len > (1 << 30) - st->in_len) { st->state = STREAM_error; return e("too large","Stream too large"); }
+   if (!stream_grow(&st->in, &st->in_cap, st->in_len + len)) { st->state = STREAM_error; return 0; }
+   memcpy(st->in + st->in_len, data, len);
+   st->in_len += len;
+   if (!stream_run(st)) { st->state = STREAM_error; return 0; }
+   return 1;
+}
+
+int stbi_stream_finish(stbi_stream *st)
+{
+   if (st->state == STREAM_error) return 0;
+   st->final = 1;
+   if (!stream_run(st)) { st->state = STREAM_error; return 0; }
+   if (st->state == STREAM_whole) {
+      int comp;
+      uint8 *data;
+      start_mem(&st->s, st->in, st->in_len);
+      data = stbi_load_main(&st->s, &st->x, &st->y, &comp, st->req_comp);
+      if (data == NULL) { st->state = STREAM_error; return 0; }
+      st->comp = comp;
+      st->n = st->req_comp ? st->req_comp : comp;
+      st->rows(st->user, 0, st->y, data, st->n * st->x);
+      stbi_image_free(data);
+      st->row = st->y;
+      st->state = STREAM_done;
+   }
+   if (st->state != STREAM_done) {
+      st->state = STREAM_error;
+      return e("not enough pixels","Corrupt image");
+   }
+   return 1;
+}
+
+int stbi_stream_info(stbi_stream *st, int *x, int *y, int *comp)
+{
+   if (st->x == 0) {
+      // a format that isn't streamed is asked about what has arrived
+      if (st->state == STREAM_whole)
+         return stbi_info_from_memory(st->in, st->in_len, x, y, comp);
+      return 0;
+   }
+   if (x) *x = st->x;
+   if (y) *y = st->y;
+   if (comp) *comp = st->comp;
+   return 1;
+}
+
+void stbi_stream_free(stbi_stream *st)
+{
+   if (st == NULL) return;
+   if (st->jpeg_started) cleanup_jpeg(&st->j);
+   stbi_free(st->strip);
+   stbi_free(st->out_row);
+   stbi_free(st->pal_row);
+   stbi_free(st->prior);
+   stbi_free(st->cur);
+   stbi_free(st->win);
+   stbi_free(st->zin);
+   stbi_free(st->in);
+   stbi_free(st);
+}
+
 // Microsoft/Windows BMP image
 
 static int bmp_test(stbi *s)
@@ -2705,11 +5114,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       target = req_comp;
    else
       target = s->img_n; // if they want monochrome, we'll post-convert
-   out = (stbi_uc *) malloc(target * s->img_x * s->img_y);
+   out = (stbi_uc *) stbi_malloc_out(target * s->img_x * s->img_y);
    if (!out) return epuc("outofmem", "Out of memory");
    if (bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { free(out); return epuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi_free(out); return epuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = get8u(s);
          pal[i][1] = get8u(s);
@@ -2720,7 +5129,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       skip(s, offset - 14 - hsz - psize * (hsz == 12 ? 3 : 4));
       if (bpp == 4) width = (s->img_x + 1) >> 1;
       else if (bpp == 8) width = s->img_x;
-      else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
+      else { stbi_free(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
          for (i=0; i < (int) s->img_x; i += 2) {
@@ -2758,7 +5167,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { free(out); return epuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi_free(out); return epuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = high_bit(mr)-7; rcount = bitcount(mr);
          gshift = high_bit(mg)-7; gcount = bitcount(mr);
@@ -2955,7 +5364,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       //   force a new number of components
       *comp = tga_bits_per_pixel/8;
    }
-   tga_data = (unsigned char*)malloc( tga_width * tga_height * req_comp );
+   tga_data = (unsigned char*)stbi_malloc_out( tga_width * tga_height * req_comp );
    if (!tga_data) return epuc("outofmem", "Out of memory");
 
    //   skip to the data's starting position (offset usually = 0)
@@ -2966,11 +5375,11 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       //   any data to skip? (offset usually = 0)
       skip(s, tga_palette_start );
       //   load the palette
-      tga_palette = (unsigned char*)malloc( tga_palette_len * tga_palette_bits / 8 );
+      tga_palette = (unsigned char*)stbi_malloc( tga_palette_len * tga_palette_bits / 8 );
       if (!tga_palette) return epuc("outofmem", "Out of memory");
       if (!getn(s, tga_palette, tga_palette_len * tga_palette_bits / 8 )) {
-         free(tga_data);
-         free(tga_palette);
+         stbi_free(tga_data);
+         stbi_free(tga_palette);
          return epuc("bad palette", "Corrupt TGA");
       }
    }
@@ -3106,7 +5515,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    //   clear my palette, if I had one
    if ( tga_palette != NULL )
    {
-      free( tga_palette );
+      stbi_free( tga_palette );
    }
    //   the things I do to get rid of an error message, and yet keep
    //   Microsoft's C compilers happy... [8^(
@@ -3201,7 +5610,7 @@ static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       return epuc("bad compression", "PSD has an unknown compression format");
 
    // Create the destination image.
-   out = (stbi_uc *) malloc(4 * w*h);
+   out = (stbi_uc *) stbi_malloc_out(4 * w*h);
    if (!out) return epuc("outofmem", "Out of memory");
    pixelCount = w*h;
 
@@ -3491,11 +5900,11 @@ static stbi_uc *pic_load(stbi *s,int *px,int *py,int *comp,int req_comp)
    get16(s); //skip `pad'
 
    // intermediate buffer is RGBA
-   result = (stbi_uc *) malloc(x*y*4);
+   result = (stbi_uc *) stbi_malloc_out(x*y*4);
    memset(result, 0xff, x*y*4);
 
    if (!pic_load2(s,x,y,comp, result)) {
-      free(result);
+      stbi_free(result);
       result=0;
    }
    *px = x;
@@ -3746,14 +6155,14 @@ static uint8 *stbi_gif_load_next(stbi *s, stbi_gif *g, int *comp, int req_comp)
 
    if (g->out == 0) {
       if (!stbi_gif_header(s, g, comp,0))     return 0; // failure_reason set by stbi_gif_header
-      g->out = (uint8 *) malloc(4 * g->w * g->h);
+      g->out = (uint8 *) stbi_malloc_out(4 * g->w * g->h);
       if (g->out == 0)                      return epuc("outofmem", "Out of memory");
       stbi_fill_gif_background(g);
    } else {
       // animated-gif-only path
       if (((g->eflags & 0x1C) >> 2) == 3) {
          old_out = g->out;
-         g->out = (uint8 *) malloc(4 * g->w * g->h);
+         g->out = (uint8 *) stbi_malloc(4 * g->w * g->h);
          if (g->out == 0)                   return epuc("outofmem", "Out of memory");
          memcpy(g->out, old_out, g->w*g->h*4);
       }
@@ -3975,7 +6384,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    if (req_comp == 0) req_comp = 3;
 
    // Read data
-   hdr_data = (float *) malloc(height * width * req_comp * sizeof(float));
+   hdr_data = (float *) stbi_malloc(height * width * req_comp * sizeof(float));
 
    // Load image data
    // image data is stored as some number of sca
@@ -4008,13 +6417,13 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            free(scanline);
+            stbi_free(scanline);
             goto main_decode_loop; // yes, this makes no sense
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(hdr_data); free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) scanline = (stbi_uc *) malloc(width * 4);
+         if (len != width) { stbi_free(hdr_data); stbi_free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
+         if (scanline == NULL) scanline = (stbi_uc *) stbi_malloc(width * 4);
             
          for (k = 0; k < 4; ++k) {
             i = 0;
@@ -4036,7 +6445,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          for (i=0; i < width; ++i)
             hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
       }
-      free(scanline);
+      stbi_free(scanline);
    }
 
    return hdr_data;
@@ -4252,6 +6661,97 @@ int stbi_info_from_callbacks(stbi_io_callbacks const *c, void *user, int *x, int
    return stbi_info_main(&s,x,y,comp);
 }
 
+#if defined(STBI_BENCHMARK) && !defined(STBI_NO_STDIO)
+// decode benchmark, one run per SIMD level, each checked against scalar;
+// for a png the inflate of its IDAT data is also timed on its own:
+//    g++ -O2 -DSTBI_BENCHMARK stb_image.cpp -o stbi_bench
+//    ./stbi_bench photo.jpg [runs] [threads]
+#include <chrono>
+
+static double bench_seconds(void)
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void bench_inflate(uint8 *file, long len, int runs)
+{
+   static const uint8 png_sig[8] = { 137,80,78,71,13,10,26,10 };
+   uint8 *idata = (uint8 *) malloc(len), *p = file + 8;
+   int ilen = 0, olen = 0, r;
+   double t0, t;
+   if (!idata || len < 8 || memcmp(file, png_sig, 8)) { free(idata); return; }
+   // gather the IDAT chunks the way the png loader does
+   while (file + len - p >= 12) {
+      uint32 clen = (uint32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+      if (clen > (uint32) (file + len - p) - 12) break;
+      if (!memcmp(p+4, "IDAT", 4)) {
+         memcpy(idata + ilen, p+8, clen);
+         ilen += clen;
+      }
+      p += 12 + clen;
+   }
+   t0 = bench_seconds();
+   for (r=0; r < runs; ++r)
+      free(stbi_zlib_decode_malloc((char *) idata, ilen, &olen));
+   t = (bench_seconds() - t0) / runs;
+   printf("%-7s %8.2f ms %8.1f MB/s in %8.1f MB/s out\n", "inflate", t*1000,
+          ilen / t / 1e6, olen / t / 1e6);
+   free(idata);
+}
+
+int main(int argc, char **argv)
+{
+   static const char *names[] = { "scalar", "sse2", "avx2" };
+   int best = stbi_simd_level(), runs = argc > 2 ? atoi(argv[2]) : 10;
+   int threads = argc > 3 ? atoi(argv[3]) : 0;
+   int level, r, x, y, n, failed = 0;
+   uint8 *file, *ref = NULL;
+   long len;
+   FILE *f;
+
+   if (argc < 2 || runs < 1 || threads < 0) {
+      fprintf(stderr, "usage: %s file.jpg [runs] [threads]\n", argv[0]);
+      return 1;
+   }
+   stbi_set_thread_count(threads);
+   f = fopen(argv[1], "rb");
+   if (!f) { perror(argv[1]); return 1; }
+   fseek(f, 0, SEEK_END);
+   len = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   file = (uint8 *) malloc(len);
+   if (!file || fread(file, 1, len, f) != (size_t) len) { fprintf(stderr, "%s: read error\n", argv[1]); return 1; }
+   fclose(f);
+
+   for (level = STBI_SIMD_NONE; level <= best; ++level) {
+      double t0, t;
+      uint8 *p;
+      int same = 1;
+      stbi_set_simd_level(level);
+      // first decode doubles as warm-up and as the bit-exactness check
+      p = stbi_load_from_memory(file, (int) len, &x, &y, &n, 0);
+      if (!p) { fprintf(stderr, "%s: %s\n", argv[1], stbi_failure_reason()); return 1; }
+      if (!ref) ref = p;
+      else {
+         same = memcmp(ref, p, (size_t) x*y*n) == 0;
+         stbi_image_free(p);
+      }
+      t0 = bench_seconds();
+      for (r=0; r < runs; ++r)
+         stbi_image_free(stbi_load_from_memory(file, (int) len, &x, &y, &n, 0));
+      t = (bench_seconds() - t0) / runs;
+      printf("%-7s %8.2f ms %8.1f MB/s in %8.1f MB/s out%s\n", names[level], t*1000,
+             len / t / 1e6, (double) x*y*n / t / 1e6, same ? "" : "  DIFFERS FROM SCALAR");
+      failed |= !same;
+   }
+   bench_inflate(file, len, runs);
+   printf("%s: %dx%dx%d, %ld bytes, threads %s\n", argv[1], x, y, n, len, threads ? argv[3] : "auto");
+   stbi_image_free(ref);
+   free(file);
+   return failed;
+}
+#endif // STBI_BENCHMARK
+
 #endif // STBI_HEADER_FILE_ONLY
 
 /*
@@ -19,6 +19,7 @@
 
       - decode from memory or through FILE (define STBI_NO_STDIO to remove code)
       - decode from arbitrary I/O callbacks
+      - SSE2/AVX2 jpeg IDCT, upsampling and YCbCr-to-RGB, picked at runtime
       - overridable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD)
 
    Latest revisions:
@@ -111,6 +112,13 @@
 //       3           red, green, blue
 //       4           red, green, blue, alpha
 //
+// Images may be loaded from several threads at once. The settings below
+// (gamma/scale, unpremultiply, iphone conversion, SIMD level, installed
+// kernels) are shared by all threads and may be changed at any time; a
+// load that is already running may see either value. This needs C++11;
+// an older compiler gets plain variables and an unguarded one-time setup
+// of the zlib fixed-code tables.
+//
 // If image loading fails for any reason, the return value will be NULL,
 // and *x, *y, *comp will be unchanged. The function stbi_failure_reason()
 // can be queried for an extremely brief, end-user unfriendly explanation
@@ -192,6 +200,7 @@
 
 #include <stdio.h>
 #endif
+#include <stddef.h> // size_t
 
 #define STBI_VERSION 1
 
@@ -263,11 +272,11 @@ extern int      stbi_is_hdr_from_file(FILE *f);
 #endif // STBI_NO_STDIO
 
 
-// get a VERY brief reason for failure
-// NOT THREADSAFE
+// get a VERY brief reason for failure; it is kept per thread, so it's the
+// reason for this thread's last failed load
 extern const char *stbi_failure_reason  (void); 
 
-// free the loaded image -- this is just free()
+// free the loaded image -- this is just free(), unless an arena is set (below)
 extern void     stbi_image_free      (void *retval_from_stbi_load);
 
 // get image dimensions & components without fully decoding
@@ -281,6 +290,74 @@ extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y,
 #endif
 
 
+// decode into a buffer of your own (out_size bytes, e.g. a mapped pixel
+// unpack buffer) instead of a newly allocated one. These return 1 on
+// success and 0 on failure, which includes a buffer smaller than
+// x*y*channels (stbi_info tells you the size up front); the buffer's
+// contents are undefined after a failure.
+extern int      stbi_load_from_memory_into   (stbi_uc const *buffer, int len, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp);
+extern int      stbi_load_from_callbacks_into(stbi_io_callbacks const *clbk, void *user, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp);
+#ifndef STBI_NO_STDIO
+extern int      stbi_load_into               (char const *filename, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp);
+extern int      stbi_load_from_file_into     (FILE *f,              stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp);
+#endif
+
+// an arena is a few big memory blocks that the decoders allocate from,
+// instead of the heap, while it is set on the calling thread. The _into
+// functions give back what they took from it before returning; otherwise
+// reset it between images. Either way it keeps its blocks for the next
+// image, so after the first few images loading no longer touches the heap
+// (except for the FILE that fopen allocates, when loading by name):
+//
+//    stbi_arena *arena = stbi_arena_create(0);   // 0 = start with 1 MB
+//    stbi_set_arena(arena);
+//    for each texture:
+//       stbi_info(name, &x, &y, &n);             // grow 'pixels' if needed
+//       if (stbi_load_into(name, pixels, size, &x, &y, &n, 0))
+//          ... upload pixels ...
+//    stbi_set_arena(NULL);
+//    stbi_arena_free(arena);
+//
+// Images that stbi_load returns while an arena is set live in the arena
+// until it is reset; call stbi_image_free on them only while it's still
+// set. An arena must only be used by one thread at a time, and not reset
+// while a load is using it.
+typedef struct stbi_arena stbi_arena;
+extern stbi_arena *stbi_arena_create(size_t size);   // size of the first block
+extern void        stbi_arena_reset (stbi_arena *arena);
+extern void        stbi_arena_free  (stbi_arena *arena);
+extern stbi_arena *stbi_set_arena   (stbi_arena *arena); // for this thread; NULL = heap. returns the previous one
+
+// streaming: push the file's bytes in pieces as they arrive (from a socket,
+// an async read...) and get the image back a few rows at a time, without
+// ever holding all of it. Non-interlaced PNGs come out a scanline at a
+// time and JPEGs a MCU row (8 or 16 lines) at a time, as soon as the data
+// for them is in; other files (interlaced PNG, JPEGs with one scan per
+// component, the other formats) are kept until stbi_stream_finish, and
+// then given to the callback whole.
+//
+//    stbi_stream *st = stbi_stream_create(4, on_rows, &texture);
+//    while ((len = read_some(buf)) > 0)
+//       if (!stbi_stream_feed(st, buf, len)) break;
+//    ok = stbi_stream_finish(st);   // 0 if anything failed, see stbi_failure_reason
+//    stbi_stream_free(st);
+//
+// The callback gets 'rows' rows starting at row y, each 'stride' bytes
+// (x * req_comp, or x * comp when req_comp is 0), which are only valid
+// during the call; rows come in order, top to bottom. feed returns 0 once
+// the data is found to be corrupt, finish returns 1 when every row has
+// been delivered. stbi_stream_info returns 1 once the header has been
+// read. A stream's memory comes from the calling thread's arena if one is
+// set, so don't reset that arena while the stream is in use.
+typedef struct stbi_stream stbi_stream;
+typedef void (*stbi_rows_callback)(void *user, int y, int rows, stbi_uc const *pixels, int stride);
+extern stbi_stream *stbi_stream_create(int req_comp, stbi_rows_callback rows, void *user);
+extern int          stbi_stream_feed  (stbi_stream *st, stbi_uc const *data, int len);
+extern int          stbi_stream_finish(stbi_stream *st);
+extern int          stbi_stream_info  (stbi_stream *st, int *x, int *y, int *comp);
+extern void         stbi_stream_free  (stbi_stream *st);
+
+
 
 // for image formats that explicitly notate that they have premultiplied alpha,
 // we just return the colors as stored in the file. set this flag to force
@@ -302,6 +379,23 @@ extern char *stbi_zlib_decode_noheader_malloc(const char *buffer, int len, int *
 extern int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
 
+// The jpeg decoder uses SSE2/AVX2 versions of its IDCT, upsampling and
+// YCbCr-to-RGB kernels when the CPU has them (define STBI_NO_SIMD to build
+// only the scalar ones). They give exactly the same output as the scalar
+// code; lowering the level is meant for testing and benchmarking
+// (stb_image.cpp built with -DSTBI_BENCHMARK is a decode benchmark).
+enum { STBI_SIMD_NONE, STBI_SIMD_SSE2, STBI_SIMD_AVX2 };
+extern int  stbi_simd_level(void);            // level in use (detected on first call)
+extern void stbi_set_simd_level(int level);   // clamped to what the CPU supports
+
+// Large jpegs are decoded on a pool of worker threads: scans with restart
+// markers are split into their intervals, other scans have the Huffman
+// decoding pipelined against the IDCT, and color conversion runs in bands.
+// Sets the number of threads, the caller included (0 = one per core, the
+// default; 1 = no threads). Not while another thread is decoding. Building
+// with STBI_NO_THREADS leaves the pool out.
+extern void stbi_set_thread_count(int count);
+
 // define faster low-level operations (typically SIMD support)
 #ifdef STBI_SIMD
 typedef void (*stbi_idct_8x8)(stbi_uc *out, int out_stride, short data[64], unsigned short *dequantize);